@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "interpreter.h"
+#include "evaluator.h"
+#include "stats.h"
+
+#define MAX_FILE_SIZE 16777216
+#define NUM_RUNS 5
+#define NUM_HOST_CALLS 1000000
+#define SCALING_CASE "fib"
+#define SCALING_RUNS_PER_THREAD 4
+
+typedef struct {
+    const char *bench_name;
+    const char *description;
+    // when set, evaluation is NUM_HOST_CALLS calls of this function through
+    // call_function() after the script ran
+    const char *host_function;
+    // the calls go through one call_function_batch() instead
+    char batch;
+    // file of the cases directory whose source is put before the script
+    const char *prelude;
+} BenchCase;
+
+#define NUM_BENCH_CASES 12
+
+BenchCase BENCH_CASES[NUM_BENCH_CASES] = {
+    {.bench_name="fib", .description="recursive calls, integer arithmetic"},
+    {.bench_name="concat", .description="250k string appends through recursion"},
+    {.bench_name="array", .description="400 aggregations over 1M element arrays"},
+    {.bench_name="loop", .description="while loop counting to 10M, ~95 ms on registers"},
+    {.bench_name="helpers", .description="300 helpers declared, 2 called", .prelude="lib/helpers.shr"},
+    {.bench_name="calls", .description="4M calls of one-line helpers in a loop"},
+    {.bench_name="deep", .description="calls from 2000 frames deep recursion"},
+    {.bench_name="import", .description="helpers imported from a module parsed once"},
+    {.bench_name="host", .description="1M calls of a scoring function from C", .host_function="score"},
+    {.bench_name="batch", .description="the host calls as one batch of columns", .host_function="score", .batch=1},
+    {.bench_name="natives", .description="12M calls of integer builtins in a loop"},
+    {.bench_name="pmap", .description="64 recursive fib calls as tasks, one worker per core"},
+};
+
+// Directory of the cases, which also import their modules from it
+char *get_cases_directory() {
+    char *file_path_copy = strdup(__FILE__);
+    char *directory = malloc(strlen(file_path_copy) + 7);
+    sprintf(directory, "%s/cases", dirname(file_path_copy));
+    free(file_path_copy);
+    return directory;
+}
+
+// Contents of a file of the cases directory, NULL when it cannot be read
+char *read_case_file(const char *file_name) {
+    char *cases_directory = get_cases_directory();
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", cases_directory, file_name);
+    free(cases_directory);
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return NULL;
+    char *code = malloc(MAX_FILE_SIZE);
+    size_t bytes_read = fread(code, 1, MAX_FILE_SIZE - 1, file);
+    code[bytes_read] = '\0';
+    fclose(file);
+    return code;
+}
+
+char *get_bench_code(const char *bench_name) {
+    char file_name[256];
+    snprintf(file_name, sizeof(file_name), "%s.shr", bench_name);
+    return read_case_file(file_name);
+}
+
+// Script of a case, after its prelude. The helpers case declares the
+// helpers of the module that the import case imports
+char *get_case_code(BenchCase *bench_case) {
+    char *code = get_bench_code(bench_case->bench_name);
+    if (code == NULL || bench_case->prelude == NULL) return code;
+    char *prelude = read_case_file(bench_case->prelude);
+    if (prelude != NULL) {
+        size_t length = strlen(prelude);
+        snprintf(prelude + length, MAX_FILE_SIZE - length, "%s", code);
+    }
+    free(code);
+    return prelude;
+}
+
+int compare_doubles(const void *left, const void *right) {
+    double l = *(const double *)left, r = *(const double *)right;
+    return (l > r) - (l < r);
+}
+
+// The arguments of run_host_calls() as columns of a single batch
+char run_host_batch(BenchCase *bench_case, EvaluatorContext *context, FlatFunction const *function, double *evaluate_ms) {
+    int32_t *a = malloc(NUM_HOST_CALLS * sizeof(int32_t)), *b = malloc(NUM_HOST_CALLS * sizeof(int32_t));
+    int32_t *results = malloc(NUM_HOST_CALLS * sizeof(int32_t));
+    for (int32_t i = 0; i < NUM_HOST_CALLS; ++i) {
+        a[i] = i % 500;
+        b[i] = i % 7;
+    }
+
+    PhaseTiming timer = start_phase_timer();
+    char error = call_function_batch(context, function, (int32_t const *[]){a, b}, 2, NUM_HOST_CALLS, results);
+    *evaluate_ms += stop_phase_timer(&timer).wall_ms;
+    if (error) printf("%-10s error message: %s\n", bench_case->bench_name, context->error_message);
+    free(a);
+    free(b);
+    free(results);
+    return error;
+}
+
+// Calls the host function of the case with varying arguments, adding the
+// time taken to *evaluate_ms
+char run_host_calls(BenchCase *bench_case, EvaluatorContext *context, double *evaluate_ms) {
+    FlatFunction const *function = find_function(context, bench_case->host_function);
+    if (function == NULL) {
+        printf("%-10s no function %s\n", bench_case->bench_name, bench_case->host_function);
+        return 1;
+    }
+
+    if (bench_case->batch) return run_host_batch(bench_case, context, function, evaluate_ms);
+
+    PhaseTiming timer = start_phase_timer();
+    for (int32_t i = 0; i < NUM_HOST_CALLS; ++i) {
+        int32_t result;
+        if (call_function(context, function, (int32_t[]){i % 500, i % 7}, 2, &result)) {
+            printf("%-10s error message: %s\n", bench_case->bench_name, context->error_message);
+            return 1;
+        }
+    }
+    *evaluate_ms += stop_phase_timer(&timer).wall_ms;
+    return 0;
+}
+
+// Runs the case NUM_RUNS times and reports the median of each phase
+char run_bench_case(BenchCase *bench_case) {
+    char *code = get_case_code(bench_case);
+    if (code == NULL) {
+        printf("%-10s could not read the script\n", bench_case->bench_name);
+        return 1;
+    }
+
+    char *cases_directory = get_cases_directory();
+    double front_end_ms[NUM_RUNS], evaluate_ms[NUM_RUNS];
+    InterpreterStats stats;
+    for (size_t run = 0; run < NUM_RUNS; ++run) {
+        char *error_message;
+        EvaluatorContext context = init_evaluator_context(1);
+        context.module_dir = cases_directory;
+        context.keep_functions = bench_case->host_function != NULL;
+        if (interpret(code, &error_message, &context, &stats)) {
+            printf("%-10s error message: %s\n", bench_case->bench_name, error_message);
+            free(error_message);
+            delete_evaluator_context(&context);
+            free(cases_directory);
+            free(code);
+            return 1;
+        }
+        front_end_ms[run] = stats.tokenize.wall_ms + stats.parse.wall_ms + stats.optimize.wall_ms;
+        evaluate_ms[run] = stats.evaluate.wall_ms;
+        if (bench_case->host_function && run_host_calls(bench_case, &context, evaluate_ms+run)) {
+            delete_evaluator_context(&context);
+            free(cases_directory);
+            free(code);
+            return 1;
+        }
+        delete_evaluator_context(&context);
+    }
+    free(cases_directory);
+    free(code);
+
+    qsort(front_end_ms, NUM_RUNS, sizeof(double), compare_doubles);
+    qsort(evaluate_ms, NUM_RUNS, sizeof(double), compare_doubles);
+    printf(
+        "%-10s %14.3f %14.3f %10ld   %s\n",
+        bench_case->bench_name, 
+        front_end_ms[NUM_RUNS / 2], 
+        evaluate_ms[NUM_RUNS / 2], 
+        stats.peak_rss_kb,
+        bench_case->description
+    );
+    return 0;
+}
+
+typedef struct {
+    Program const *program;
+    char failed;
+} ScalingWorker;
+
+static void *run_scaling_worker(void *argument) {
+    ScalingWorker *worker = argument;
+    for (size_t run = 0; run < SCALING_RUNS_PER_THREAD; ++run) {
+        char *error_message;
+        EvaluatorContext context = init_evaluator_context(1);
+        if (run_program(worker->program, &error_message, &context, NULL)) {
+            worker->failed = 1;
+            free(error_message);
+        }
+        delete_evaluator_context(&context);
+    }
+    return NULL;
+}
+
+// Compiles one case and runs it from 1 up to as many threads as there are
+// cores, each thread with its own context. Reports runs per second and the
+// speedup over a single thread
+char run_scaling_bench() {
+    char *code = get_bench_code(SCALING_CASE);
+    if (code == NULL) return 1;
+    char *error_message;
+    EvaluatorContext settings = init_evaluator_context(1);
+    Program program;
+    char failed = compile_program(code, &error_message, &settings, &program);
+    delete_evaluator_context(&settings);
+    free(code);
+    if (failed) {
+        printf("scaling    error message: %s\n", error_message);
+        free(error_message);
+        return 1;
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) cores = 1;
+    printf("\n%-10s %14s %14s %10s   shared compiled %s, %d runs per thread\n", "threads", "wall ms", "runs/s", "speedup", SCALING_CASE, SCALING_RUNS_PER_THREAD);
+    double single_rate = 0;
+    // powers of two, then all cores
+    for (long threads = 1; !failed; threads = threads * 2 < cores ? threads * 2 : cores) {
+        ScalingWorker *workers = calloc(threads, sizeof(ScalingWorker));
+        pthread_t *handles = calloc(threads, sizeof(pthread_t));
+        PhaseTiming timer = start_phase_timer();
+        for (long i = 0; i < threads; ++i) {
+            workers[i].program = &program;
+            pthread_create(handles+i, NULL, run_scaling_worker, workers+i);
+        }
+        for (long i = 0; i < threads; ++i) {
+            pthread_join(handles[i], NULL);
+            failed |= workers[i].failed;
+        }
+        double wall_ms = stop_phase_timer(&timer).wall_ms;
+        double rate = threads * SCALING_RUNS_PER_THREAD * 1e3 / wall_ms;
+        if (threads == 1) single_rate = rate;
+        printf("%-10ld %14.3f %14.2f %9.2fx\n", threads, wall_ms, rate, rate / single_rate);
+        free(workers);
+        free(handles);
+        if (threads == cores) break;
+    }
+    delete_program(&program);
+    return failed;
+}
+
+#define FRONT_END_BENCH_BLOCKS 40000
+
+// About 8 MB of generated helpers and calls
+static char *generate_large_source() {
+    char *code;
+    size_t size;
+    FILE *stream = open_memstream(&code, &size);
+    fprintf(stream, "suppose total = 0;\n");
+    for (size_t i = 0; i < FRONT_END_BENCH_BLOCKS; ++i) {
+        fprintf(stream, "fn helper%zu(a, b) {\n", i);
+        fprintf(stream, "    suppose scaled = [a, b, a * %zu + b];\n", i);
+        fprintf(stream, "    imagine a > %zu && a != b { checkit sum(scaled) - %zu; }\n", i % 100, i);
+        fprintf(stream, "    bummer { suppose name = \"helper;}%zu\" + a; checkit a * b + %zu; }\n}\n", i, i);
+        fprintf(stream, "imagine total < 0 { total = 0; } bummer { total = total + helper%zu(1, 2); }\n", i);
+    }
+    fprintf(stream, "vomit total;\n");
+    fclose(stream);
+    return code;
+}
+
+// Tokenizes, parses and optimizes a large source on 1 up to as many threads
+// as there are cores. Reports the median front end time of NUM_RUNS runs
+char run_front_end_bench() {
+    char *code = generate_large_source();
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) cores = 1;
+    printf("\n%-10s %14s %14s %10s   front end of %zu kB generated source\n", "threads", "front end ms", "chunks", "speedup", strlen(code) / 1024);
+
+    char failed = 0;
+    double single_ms = 0;
+    for (long threads = 1; !failed; threads = threads * 2 < cores ? threads * 2 : cores) {
+        double front_end_ms[NUM_RUNS];
+        InterpreterStats stats;
+        for (size_t run = 0; run < NUM_RUNS && !failed; ++run) {
+            char *error_message;
+            EvaluatorContext context = init_evaluator_context(1);
+            context.front_end_threads = threads;
+            if (interpret(code, &error_message, &context, &stats)) {
+                printf("front_end  error message: %s\n", error_message);
+                free(error_message);
+                failed = 1;
+            }
+            front_end_ms[run] = stats.tokenize.wall_ms + stats.parse.wall_ms + stats.optimize.wall_ms;
+            delete_evaluator_context(&context);
+        }
+        if (failed) break;
+        qsort(front_end_ms, NUM_RUNS, sizeof(double), compare_doubles);
+        if (threads == 1) single_ms = front_end_ms[NUM_RUNS / 2];
+        printf("%-10ld %14.3f %14zu %9.2fx\n", threads, front_end_ms[NUM_RUNS / 2], stats.front_end_chunks, single_ms / front_end_ms[NUM_RUNS / 2]);
+        if (threads == cores) break;
+    }
+    free(code);
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    printf("%-10s %14s %14s %10s\n", "bench", "front end ms", "evaluate ms", "rss kB");
+    char failed = 0;
+    for (size_t i = 0; i < NUM_BENCH_CASES; ++i) {
+        // optional filter: bin/bench <name>...
+        char selected = argc < 2;
+        for (int j = 1; j < argc; ++j) selected |= strcmp(argv[j], BENCH_CASES[i].bench_name) == 0;
+        if (selected) failed |= run_bench_case(BENCH_CASES + i);
+    }
+    char scaling = argc < 2;
+    for (int j = 1; j < argc; ++j) scaling |= strcmp(argv[j], "scaling") == 0;
+    if (scaling) failed |= run_scaling_bench();
+    char front_end = argc < 2;
+    for (int j = 1; j < argc; ++j) front_end |= strcmp(argv[j], "front_end") == 0;
+    if (front_end) failed |= run_front_end_bench();
+    return failed;
+}
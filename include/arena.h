@@ -0,0 +1,28 @@
+#ifndef __ARENA__
+#define __ARENA__
+
+#include <stdlib.h>
+#include "stack.h"
+
+#define _ARENA_BLOCK_SIZE 65536
+
+// Bump allocator for runtime objects (strings, ...) owned by an evaluator
+// context. Objects are never freed one by one, the whole arena goes away
+// with the context. Arrays are the exception: each gets a block of its own,
+// freed once nothing refers to it any more, see sweep_arrays()
+typedef struct {
+    Stack blocks; // char * of every block
+    char *cursor;
+    size_t remaining;
+    Stack arrays;               // Array * allocated by new_array()
+    size_t array_bytes;         // of the arrays
+    size_t array_bytes_swept;   // array_bytes right after the last sweep
+} ObjectArena;
+
+ObjectArena init_object_arena(void);
+void delete_object_arena(ObjectArena *arena);
+
+// Returns 8 byte aligned memory or NULL
+void *arena_alloc(ObjectArena *arena, size_t size);
+
+#endif
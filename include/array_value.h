@@ -0,0 +1,82 @@
+#ifndef __ARRAY_VALUE__
+#define __ARRAY_VALUE__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "value.h"
+#include "arena.h"
+
+// Arrays hold int32_t elements in one contiguous buffer so the bulk builtins
+// (sum, dot, map_add, ...) run as tight vector loops. They are mutable and
+// shared by reference: assigning an array to another variable does not copy it
+typedef struct {
+    size_t length;
+    int32_t *items;
+    char marked;    // reached by the sweep in progress, see sweep_arrays()
+} Array;
+
+static inline char value_is_array(Value value) {
+    return value_tag(value) == ARRAY_TAG;
+}
+
+static inline Array *value_as_array(Value value) {
+    return value_as_pointer(value);
+}
+
+// Allocates an array of length zeroed elements in the arena. Returns 1 when
+// out of memory
+char new_array(size_t length, ObjectArena *arena, Value *result);
+
+// Arrays are swept once the bytes allocated since the last sweep reach both
+// _ARRAY_SWEEP_BYTES and the bytes that survived it, so a sweep costs time
+// in proportion to the allocations that led to it
+#define _ARRAY_SWEEP_BYTES (1 << 20)
+
+static inline char arrays_need_sweep(ObjectArena const *arena) {
+    size_t allocated = arena->array_bytes - arena->array_bytes_swept;
+    return allocated >= _ARRAY_SWEEP_BYTES && allocated >= arena->array_bytes_swept;
+}
+
+// Frees the arrays of the arena that are not marked, and clears the mark of
+// the others. The caller marks every array still referred to beforehand
+void sweep_arrays(ObjectArena *arena);
+
+// Instruction sets the bulk kernels may use. Picked at runtime from what the
+// CPU supports, every level computes bit identical results
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE41,
+    SIMD_AVX2,
+};
+
+enum SimdLevel detect_simd_level(void);
+enum SimdLevel simd_level(void);
+// Caps the level used by the kernels (clamped to detect_simd_level()).
+// Meant for tests and benchmarks comparing the implementations
+void set_simd_level(enum SimdLevel level);
+
+// Bulk kernels. Sums and products wrap around like integer arithmetic does.
+// min/max need length > 0. In the map kernels `right` may be NULL, in which
+// case `scalar` is applied to every element; dst may alias left
+int32_t sum_int32(int32_t const *items, size_t length);
+int32_t min_int32(int32_t const *items, size_t length);
+int32_t max_int32(int32_t const *items, size_t length);
+int32_t dot_int32(int32_t const *left, int32_t const *right, size_t length);
+void add_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length);
+void mul_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length);
+
+// Column kernels of call_function_batch(), with the arguments of the map
+// kernels. Comparisons write masks, -1 where they hold and 0 elsewhere, which
+// the bitwise kernels combine. select_int32() takes values where the mask is
+// set and keeps dst elsewhere, any_int32() tells whether a mask is set at all
+void sub_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length);
+void and_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length);
+void or_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length);
+void xor_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length);
+void eq_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length);
+void gt_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length);
+void lt_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length);
+void select_int32(int32_t *dst, int32_t const *mask, int32_t const *values, size_t length);
+char any_int32(int32_t const *items, size_t length);
+
+#endif
@@ -2,13 +2,40 @@
 #define __EVALUATOR__
 
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 #include "stack.h"
 #include "hash_table.h"
 #include "parser.h"
+#include "flat_tree.h"
+#include "value.h"
+#include "arena.h"
+#include "task_pool.h"
 
 #define _INITIAL_STACK_FRAMES_CAPACITY 64
 #define _INITIAL_IDENTIFIER_TABLE_CAPACITY 32
+#define _MAX_SPARE_FRAMES 64
+#define _DEADLINE_CHECK_INTERVAL 256
+// Guards the C stack of the tree walker against runaway recursion
+#define _DEFAULT_MAX_CALL_DEPTH 10000
+// C stack of a generator body, reserved but only backed as far as it is used
+#define _GENERATOR_STACK_BYTES (8 * 1024 * 1024)
+// Body size in AST nodes up to which calls are inlined, see optimizer.h
+#define _DEFAULT_INLINE_THRESHOLD 16
+// Arguments of a native, passed in an array on the C stack
+#define _MAX_NATIVE_ARGS 8
+#define _INITIAL_NATIVES_CAPACITY 16
+// Rows call_function_batch() evaluates column-at-a-time, so that the columns
+// of a chunk stay in the L1 cache, and the largest body it does so for
+#define _BATCH_ROWS 512
+#define _MAX_BATCH_NODES 256
+// Tasks a pmap splits its calls into per worker, so that a worker done early
+// steals the rest of a slow range
+#define _PMAP_TASKS_PER_WORKER 4
+// Calls after which a function runs an optimized copy of its body, see
+// tier_up() in the evaluator
+#define _DEFAULT_TIER_UP_THRESHOLD 1000
 
 enum ErrorCode {
     PASS,
@@ -19,41 +46,250 @@ enum ErrorCode {
     UNEXPECTED_ARGUMENTS,
     NOT_CALLABLE,
     DIVISION_BY_ZERO,
+    INDEX_OUT_OF_RANGE,
+    SYNTAX_ERROR, // in a function body, which is parsed on first call
+    STEP_LIMIT_EXCEEDED,
+    DEADLINE_EXCEEDED,
+    CALL_DEPTH_EXCEEDED,
+    HEAP_LIMIT_EXCEEDED,
+    CANCELLED,
+    IMPORT_ERROR,
+    SNAPSHOT_ERROR, // a snapshot could not be taken or restored
+    YIELD_OUTSIDE_GENERATOR,
     INTERNAL
 };
 
+// Resource limits of a single run. 0 means unlimited
 typedef struct {
-    enum {
-        INT32_T_ENTRY, 
-        ASTNODE_POINTER_ENTRY,
-    } type; 
+    size_t max_steps;       // evaluation steps, one per function call or loop iteration
+    size_t timeout_ms;      // wall clock time measured from the start of the run
+    size_t max_call_depth;  // number of live stack frames
+    size_t max_heap_bytes;  // bytes held by frames and evaluator buffers
+} EvaluatorLimits;
 
-    union {
-        int32_t number;
-        const ASTNode *function_node;
-    } value;
-} StackFrameEntry;
+// Callbacks of the host following a run, see hooks.h
+typedef struct EvaluatorHooks_s EvaluatorHooks;
 
+// Program kept alive by a context, see retain_program()
 typedef struct {
+    FlatTree *tree;
+    Token *tokens;
+    size_t num_tokens;
+} RetainedProgram;
+
+typedef struct EvaluatorContext_s {
     Stack stack_frames;
+    // emptied frames of returned calls, reused by the next calls
+    Stack spare_frames;
     enum ErrorCode error_code;
     char *error_message;
+    Value result;
+    // set by a return statement, stops the enclosing sequences and loops
+    // until the function call (or the program) it belongs to ends
+    char returning;
 
-    enum {
-        NUMBER_TYPE, 
-        STRING_TYPE 
-    } result_type;
-
-    union {
-        int32_t number;
-        char *string;
-    } result;
+    Stack side_effects; // printed values
+    FILE *output;       // where printed values are written unless dry_run, stdout by default
 
-    Stack side_effects; // only type of side effect is int32_t currently 
+    // runtime strings and arrays; they live as long as the context
+    ObjectArena objects;
+    // RetainedProgram of evaluated programs that defined functions. Function
+    // values point into them, so they live as long as the context too
+    Stack programs;
+    // Module const * imported into the main frame, see evaluate_import()
+    Stack modules;
+    // relative import paths start here (the working directory when NULL)
+    char const *module_dir;
     char dry_run;
+    // whole program dead code elimination by interpret(), on by default. A
+    // context that runs several programs (a REPL) turns it off, as later
+    // programs may call functions that earlier ones define and never use
+    char eliminate_dead_code;
+    // keeps every function through dead code elimination, for hosts that
+    // call them by name, see call_function()
+    char keep_functions;
+    // threads interpret() tokenizes and parses large sources with, 0 takes
+    // one per core and 1 keeps the front end serial
+    size_t front_end_threads;
+    // largest body, in AST nodes, that interpret() substitutes at call
+    // sites, 0 turns inlining off. The same caveat applies
+    size_t inline_threshold;
+    // tree of the code being evaluated, which holds the names, strings and
+    // call sites its nodes refer to
+    FlatTree const *tree;
+    FlatName const *names;  // names of tree, read on every lookup
+    // arguments of the innermost inlined call being evaluated
+    Value const *inline_args;
+    // generator whose body is running, the one a yield hands its value to
+    struct Generator_s *generator;
+    size_t generators;  // started and not yet deleted
+    // name -> Native const * registered by the host, see register_natives().
+    // Allocated by the first registration
+    HashTable natives;
+
+    // spawned tasks, see evaluate_spawn(). The first spawn or pmap starts the
+    // pool, with task_threads workers (0 takes one per core); the tasks of a
+    // run spawn into the same pool
+    TaskPool *pool;
+    char owns_pool;
+    size_t task_threads;
+    Stack tasks;    // Task * spawned by this context, in spawn order
+    // cancelled flag of the context the task running in this one comes from
+    _Atomic char *cancel_source;
+    // interpret() shares every tree it runs (see share_tree()), not only
+    // those that spawn tasks. Set by the first run that spawns tasks, as
+    // they may call the functions of any program of the context. A REPL
+    // sets it up front
+    char share_trees;
+
+    // calls of a function after which it tiers up, 0 keeps every function in
+    // its first form. Each tier up writes a line to tier_log when it is set
+    size_t tier_up_threshold;
+    FILE *tier_log;
+
+    // call site caches (CallSiteCache) hold while binding_epoch stays the
+    // same. Binding a name whose hash_bit() is in cached_callee_bits, or
+    // popping the frame of a cached callee, starts a new epoch
+    uint64_t binding_epoch;
+    uint64_t cached_callee_bits;
+    size_t highest_cached_frame;
+
+    // resource governor, see limits_exceeded()
+    EvaluatorLimits limits;
+    size_t steps;
+    double deadline_ms;
+    long heap_bytes_base;
+    _Atomic char cancelled;
+
+    // callbacks following the run, NULL when the host sets none. Not passed
+    // on to tasks
+    EvaluatorHooks const *hooks;
+
+    // instrumentation counters, read by interpret() when stats are requested
+    size_t function_calls;
+    size_t frames_allocated;
+    size_t tier_ups;
 
 } EvaluatorContext;
 
-EvaluatorContext evaluate(ASTNode *node, char dry_run);
+// A C function that scripts call by name like one of their own. Its
+// arguments are evaluated into an array on the C stack and no frame is
+// allocated. It leaves its result in context->result or sets the error of
+// the context. The builtins (len, sum, abs, pow, ...) are natives too
+typedef struct Native_s Native;
+typedef void (*NativeFunction)(Native const *native, Value const *args, EvaluatorContext *context);
+
+struct Native_s {
+    char const *name;
+    size_t args_length;     // at most _MAX_NATIVE_ARGS, checked on every call
+    NativeFunction function;
+    void *data;             // for the host, e.g. state shared by its calls
+};
+
+EvaluatorContext init_evaluator_context(char dry_run);
+void delete_evaluator_context(EvaluatorContext *context);
+
+// Runs the program of a tree, a STMT_SEQUENCE, in the context. Limits are
+// read from context->limits
+void evaluate_program(FlatTree const *tree, EvaluatorContext *context);
+// Runs only the top-level statements [first, last) of the program, e.g. the
+// rest of a program that a snapshot was taken of. Limits are measured from
+// the start of this call
+void evaluate_statements(FlatTree const *tree, size_t first, size_t last, EvaluatorContext *context);
+
+// Hands the tree and tokens of an evaluated program over to the context,
+// which deletes them in delete_evaluator_context(). Returns 1 when out of
+// memory
+char retain_program(EvaluatorContext *context, FlatTree *tree, Token *tokens, size_t num_tokens);
+
+// Forgets the error of the last evaluation so the context (and its global
+// frame) can run the next program, e.g. the next REPL input
+void clear_evaluation_error(EvaluatorContext *context);
+
+// Asks a running evaluation to stop at its next call boundary. Safe to call
+// from any thread, e.g. a watchdog
+void cancel_evaluation(EvaluatorContext *context);
+
+// Host API. find_function() returns the function a program run in the
+// context bound to name at the top level, NULL when there is none. It lives
+// as long as the context
+FlatFunction const *find_function(EvaluatorContext const *context, char const *name);
+
+// Calls function with integer arguments, reusing the frames and buffers of
+// the context; its limits apply to each call. Returns 1 and sets the error of
+// the context when the call fails or its result is not an integer. The error
+// of a previous call is cleared first
+char call_function(
+    EvaluatorContext *context, 
+    FlatFunction const *function, 
+    int32_t const *args, 
+    size_t args_length, 
+    int32_t *result
+);
+
+// Makes natives callable by the programs run in the context. They must stay
+// alive as long as the context. Functions and variables of a script take
+// precedence over a native of the same name, a native takes precedence over
+// the builtins and replaces one registered before under its name. Returns 1
+// when out of memory or a native takes more than _MAX_NATIVE_ARGS arguments
+char register_natives(EvaluatorContext *context, Native const *natives, size_t natives_length);
+
+// Calls function once per row: the arguments of row i are columns[0][i], ...,
+// columns[args_length - 1][i] and its result goes to results[i]. A body made
+// of checkit and imagine / bummer over integer arithmetic, comparisons and
+// && / || of the arguments (inlined helpers included) is run column-at-a-time
+// on the SIMD kernels, with masks selecting the rows each branch runs for.
+// Any other body, and a chunk of rows where a row fails, runs row by row.
+// The limits of the context apply to the whole batch, a row counting as one
+// step. Returns 1 and sets the error of the context when a row fails; the
+// rows before it have their results
+char call_function_batch(
+    EvaluatorContext *context, 
+    FlatFunction const *function, 
+    int32_t const * const *columns, 
+    size_t args_length, 
+    size_t rows, 
+    int32_t *results
+);
+
+// A function run as a coroutine: each generator_next() runs its body up to
+// the next yield statement and hands the yielded value to the host. The body
+// runs on a C stack of its own and its frames leave the context while it is
+// suspended, so the host may call functions and other generators in between
+// and a generator takes the same memory however many values it yields.
+// Generators must be deleted before their context
+typedef struct Generator_s Generator;
+
+enum GeneratorState {
+    GENERATOR_YIELDED,
+    GENERATOR_DONE,     // the body returned
+    GENERATOR_FAILED,   // the body stopped with the error of the context
+};
+
+// Prepares function to run with integer arguments; nothing runs before the
+// first generator_next(). Returns NULL and sets the error of the context when
+// the arguments do not match or the body does not parse
+Generator *start_generator(
+    EvaluatorContext *context, 
+    FlatFunction const *function, 
+    int32_t const *args, 
+    size_t args_length
+);
+
+// Resumes the body until its next yield, whose value goes to *value. The
+// limits of the context apply to each call, the error of a previous call is
+// cleared first. Once the body ended every call returns GENERATOR_DONE. An
+// array yielded stays valid until the context runs a program after the
+// generator was deleted
+enum GeneratorState generator_next(Generator *generator, Value *value);
+
+// A generator deleted while suspended is resumed once to unwind its body, as
+// if it had been cancelled at the yield
+void delete_generator(Generator *generator);
+
+EvaluatorContext evaluate(FlatTree const *tree, char dry_run);
+
+// Writes a value the way the print statement does, without the newline
+void write_value(Value value, FILE *out);
 
 #endif
\ No newline at end of file
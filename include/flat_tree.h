@@ -0,0 +1,108 @@
+#ifndef __FLAT_TREE__
+#define __FLAT_TREE__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "parser.h"
+#include "value.h"
+
+#define _INITIAL_NAME_INDICES_CAPACITY 64
+
+// The form of a parsed and optimized program that the evaluator runs on. All
+// nodes of a tree sit in one array, 16 bytes each, and the children of a node
+// are contiguous. Names, string literals, functions and call site caches live
+// in tables of the tree that node payloads index, so nodes hold no pointers
+typedef struct {
+    uint8_t node_type;          // enum ASTNodeType
+    uint8_t operator;           // enum OperatorType of a COMPARISON or LOGICAL
+    uint8_t joining_operator;   // enum OperatorType between an ARITHMETIC operand and the one before
+    uint8_t negated;            // prefix minus
+    // NUMBER: the int32_t literal, STRING: index into strings, PARAMETER:
+    // argument slot, FUNCTION: index into functions, FUNCTION_CALL: index
+    // into call_sites, VARIABLE, INDEX, INDEX_ASSIGNMENT, DECLARATION,
+    // ASSIGNMENT, IMPORT_STMT and PMAP_CALL: index into names
+    uint32_t payload;
+    // distance from the node to its first child. DECLARATION and ASSIGNMENT
+    // keep only the expression as child, a FUNCTION none
+    uint32_t first_child;
+    uint32_t children_length;
+} FlatNode;
+
+typedef struct {
+    char *name;
+    uint64_t hash;  // hash_key(name)
+} FlatName;
+
+typedef struct {
+    uint32_t name;  // index into names
+    CallSiteCache cache;
+} FlatCallSite;
+
+typedef struct FlatFunction_s {
+    char const *name;
+    uint64_t name_hash;
+    char **args;    // args_length names
+    size_t args_length;
+    uint64_t args_hash_bits;
+
+    // tree holding the body and index of its STMT_SEQUENCE. A body the front
+    // end left unparsed gets a tree of its own on its first call
+    struct FlatTree_s *body_tree;
+    uint32_t body;
+    char owns_body_tree;
+    Token const *body_tokens;
+    int body_tokens_length;
+    char *error_message;    // syntax error of the body
+
+    // calls counted towards tiering up and the optimized copy of the body
+    // they are run with afterwards, see tier_up() in the evaluator
+    size_t calls;
+    FlatNode *tiered_body;
+} FlatFunction;
+
+typedef struct FlatTree_s {
+    FlatNode *nodes;    // the root first
+    size_t nodes_length;
+    FlatName *names;    // every name once
+    size_t names_length;
+    Value *strings;
+    size_t strings_length;
+    FlatFunction *functions;
+    size_t functions_length;
+    FlatCallSite *call_sites;
+    size_t call_sites_length;
+    char **args;        // storage of the argument names of the functions
+    // lowered from a tree marked by share_tree(): evaluating it writes
+    // neither call site caches nor tiering state
+    char shared;
+} FlatTree;
+
+static inline FlatNode const *flat_child(FlatNode const *node, size_t i) {
+    return node + node->first_child + i;
+}
+
+// Lowers root, including every function body parsed so far. Call sites keep
+// the epoch of their AST node, so those of a shared tree (see share_tree())
+// never cache, and the tree is flagged shared. Bodies still unparsed need
+// their tokens alive until they are first called. Returns NULL when out of
+// memory; root is left as it was
+FlatTree *flatten_tree(ASTNode const *root);
+void delete_flat_tree(FlatTree *tree);
+
+// Whether a node of tree (function bodies in it included) spawns tasks, which
+// evaluate the tree on other threads, so its call sites must not cache
+char flat_tree_spawns(FlatTree const *tree);
+
+// Body of a function, parsed and lowered the first time for bodies the front
+// end left unparsed. Returns NULL with error_message set on a syntax error,
+// and NULL alone when out of memory
+FlatNode const *flat_function_body(FlatFunction *function);
+
+// Shares a tree lowered unshared, as if it had been marked by share_tree():
+// parses the bodies left unparsed (keeping the error of those that do not
+// parse) and empties the call site caches. For trees a context kept from
+// before it spawned tasks, which the tasks may then call into. Returns 1
+// when out of memory
+char share_flat_tree(FlatTree *tree);
+
+#endif
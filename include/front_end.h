@@ -0,0 +1,49 @@
+#ifndef __FRONT_END__
+#define __FRONT_END__
+
+#include <stdlib.h>
+#include "tokenizer.h"
+#include "parser.h"
+
+// Sources are only split into chunks of at least this many bytes
+#define _MIN_FRONT_END_CHUNK_BYTES (256 * 1024)
+#define _MAX_FRONT_END_CHUNKS 64
+
+// Bytes [start, end) of a source, holding whole top-level statements
+typedef struct {
+    size_t start;
+    size_t end;
+} SourceChunk;
+
+// Splits code into at most max_chunks chunks of about equal size, each at
+// least min_chunk_bytes long. Chunks end after a ';' or '}' outside of any
+// braces and string literals, unless a bummer follows the '}'. A source
+// whose braces do not balance is not split past the first stray '}'.
+// Returns the number of chunks, 1 when the source stays whole
+size_t split_source(char const *code, size_t max_chunks, size_t min_chunk_bytes, SourceChunk *chunks);
+
+// Tokenizes the chunks on one thread each into a single token array, in
+// source order; chunk_token_starts receives the index of the first token of
+// every chunk. On error everything is freed and *error_message is set to the
+// message tokenize() gives for the whole source
+char tokenize_chunks(
+    char const *code,
+    SourceChunk const *chunks,
+    size_t num_chunks,
+    Token **tokens,
+    size_t *num_tokens,
+    size_t *chunk_token_starts,
+    char **error_message
+);
+
+// Parses the token ranges of the chunks on one thread each and joins their
+// statements into one STMT_SEQUENCE, the tree parse_ast() gives for all the
+// tokens. On a syntax error returns the INVALID node of the first chunk
+// that has one, which is the error parse_ast() reports. The bodies of
+// top-level functions are parsed on the way
+ASTNode parse_chunks(Token const *tokens, size_t num_tokens, size_t const *chunk_token_starts, size_t num_chunks);
+
+// Worker threads the front end uses when asked for 0: one per core
+size_t default_front_end_threads(void);
+
+#endif
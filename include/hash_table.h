@@ -7,6 +7,7 @@
 
 typedef struct {
     char *key;
+    uint64_t hash; // hash_key(key)
     void *value;
 } HashTableRow;
 
@@ -19,8 +20,20 @@ typedef struct {
 
 HashTable init_hash_table(size_t capacity, size_t value_size);
 void clean_hash_table(HashTable *ht);
+// Removes every row but keeps the storage for reuse
+void clear_hash_table(HashTable *ht);
 
 char hash_table_set(HashTable *ht, char const *key, void const *value);
 void const * hash_table_get(HashTable const *ht, char const *key);
 
+// Lookup with a hash computed ahead of time by hash_key(), for callers that
+// look the same key up many times
+uint64_t hash_key(char const *key);
+void const * hash_table_get_hashed(HashTable const *ht, char const *key, uint64_t hash);
+
+// One of 64 bits picked by a hash, for small filters over sets of names
+static inline uint64_t hash_bit(uint64_t hash) {
+    return (uint64_t)1 << (hash >> 58);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,80 @@
+#ifndef __HOOKS__
+#define __HOOKS__
+
+#include <stdlib.h>
+#include "evaluator.h"
+#include "value.h"
+
+// Phases of interpret() and its siblings, in the order they run. Lowering
+// the tree is reported as a second optimize phase, and a snapshot run
+// reports evaluate once for the prelude and once for the rest
+enum InterpreterPhase {
+    TOKENIZE_PHASE,
+    PARSE_PHASE,
+    OPTIMIZE_PHASE,
+    EVALUATE_PHASE,
+    SNAPSHOT_PHASE,
+    _INTERPRETER_PHASES_COUNT
+};
+
+// Used for logging
+extern const char *InterpreterPhaseNames[];
+
+// Callbacks a host sets on context->hooks to follow a run, each given data.
+// Any of them may be NULL. They run on the thread that evaluates, inside
+// the run, and must not use the context. Function events cover calls of
+// script functions that get a frame (not inlined calls or natives), depth
+// being the number of frames above the main one. Output of tasks is printed
+// when they are joined; events of their calls go to the probes only. error
+// is called once per failed run or host call, message may be NULL
+struct EvaluatorHooks_s {
+    void (*function_entry)(void *data, char const *name, size_t depth);
+    void (*function_exit)(void *data, char const *name, size_t depth);
+    void (*print)(void *data, Value value);
+    void (*error)(void *data, enum ErrorCode error_code, char const *message);
+    void (*phase_start)(void *data, enum InterpreterPhase phase);
+    void (*phase_end)(void *data, enum InterpreterPhase phase);
+    void *data;
+};
+
+// Takes the arguments of a compiled out hook or probe, which the compiler
+// then drops, so that they still count as used
+static inline void ignore_event(void const *unused, ...) {
+    (void)unused;
+}
+
+// Building with -D_DISABLE_HOOKS compiles every hook and probe out.
+// Otherwise a run without hooks pays one well predicted branch per event
+#ifdef _DISABLE_HOOKS
+#define _HOOK(context, event, ...) ignore_event(context, __VA_ARGS__)
+#else
+#define _HOOK(context, event, ...) do { \
+    EvaluatorHooks const *hooks_ = (context)->hooks; \
+    if (_UNLIKELY(hooks_ != NULL) && hooks_->event != NULL) hooks_->event(hooks_->data, __VA_ARGS__); \
+} while (0)
+#endif
+
+// USDT probes of provider mshon, built in when systemtap's <sys/sdt.h> is
+// available. They are nops until a tracer attaches to the running process:
+//
+//   bpftrace -e 'usdt:bin/mshon:mshon:function__entry { @[str(arg0)] = count(); }'
+//
+// function__entry and function__exit (name, depth), print (value), error
+// (error code, message), phase__start and phase__end (phase name). Unlike
+// hooks they also fire in tasks
+#if !defined(_DISABLE_HOOKS) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define _HAS_PROBES
+#endif
+#endif
+
+#ifdef _HAS_PROBES
+#define _PROBE1(name, a) DTRACE_PROBE1(mshon, name, a)
+#define _PROBE2(name, a, b) DTRACE_PROBE2(mshon, name, a, b)
+#else
+#define _PROBE1(name, a) ignore_event(NULL, a)
+#define _PROBE2(name, a, b) ignore_event(NULL, a, b)
+#endif
+
+#endif
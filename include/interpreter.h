@@ -2,8 +2,77 @@
 #define __INTERPRETER__
 
 #include "evaluator.h"
+#include "snapshot.h"
+#include "stats.h"
 
-char interpret(char const *code, char **error_message, EvaluatorContext *context, char dry_run);
+// Runs code end to end in a context created by init_evaluator_context(), which
+// also carries the resource limits of the run. When stats is not NULL it is
+// filled with phase timings, node/call counters and per subsystem allocation
+// counters of this run
+char interpret(
+    char const *code, 
+    char **error_message, 
+    EvaluatorContext *context, 
+    InterpreterStats *stats
+);
+
+// A program compiled once and run by any number of contexts, also at the same
+// time from different threads with one context each. The tree is never
+// written to after compilation: the body of every function left after dead
+// code elimination is parsed up front (a syntax error in one fails the
+// compilation, called or not) and call sites do not cache their callees.
+// Contexts that ran it must be deleted before it
+typedef struct {
+    FlatTree *tree;
+} Program;
+
+// Compiles code with the optimization settings of context, as interpret()
+// would. Returns 1 with *error_message set on a syntax error
+char compile_program(
+    char const *code, 
+    char **error_message, 
+    EvaluatorContext const *context, 
+    Program *program
+);
+
+// Evaluates a compiled program in the context, like interpret() does after
+// parsing. Needs no locks: everything written belongs to the context
+char run_program(
+    Program const *program, 
+    char **error_message, 
+    EvaluatorContext *context, 
+    InterpreterStats *stats
+);
+
+void delete_program(Program *program);
+
+// Runs code like interpret() and, once its prelude (the leading function
+// definitions and declarations, see prelude_length()) has run, writes the
+// program and the global frame to a snapshot at snapshot_path. Every
+// function body is parsed up front. A prelude that prints cannot be
+// snapshot; that and a failed write stop the run with SNAPSHOT_ERROR
+char interpret_and_snapshot(
+    char const *code, 
+    char const *snapshot_path, 
+    char **error_message, 
+    EvaluatorContext *context, 
+    InterpreterStats *stats
+);
+
+// Warm start: maps the snapshot at snapshot_path, binds its globals in
+// context (a fresh one) and runs the statements after the prelude, without
+// parsing or running the prelude again. When code is not NULL the snapshot
+// must have been taken of it. Imports resolve against the directory of the
+// snapshot script unless context->module_dir is set. snapshot receives the
+// restored program, which must outlive the context
+char resume_snapshot(
+    char const *snapshot_path, 
+    char const *code, 
+    Snapshot *snapshot, 
+    char **error_message, 
+    EvaluatorContext *context, 
+    InterpreterStats *stats
+);
 
 #endif
 
@@ -0,0 +1,25 @@
+#ifndef __MODULE__
+#define __MODULE__
+
+#include <stdint.h>
+#include "flat_tree.h"
+
+// A parsed and optimized source file, shared read-only by every context (and
+// thread) that imports it. Function bodies are parsed up front and call
+// sites never cache their callee, so evaluating a module writes nothing to
+// its tree
+typedef struct Module_s {
+    char *path;             // canonical path
+    char *directory;        // relative imports inside the module start here
+    uint64_t content_hash;  // hash_key() of the source the tree was parsed from
+    FlatTree *tree;
+} Module;
+
+// Finds the module at path (relative paths start at directory, or at the
+// working directory when it is NULL). Each content a module has is parsed
+// once per process, so a file changed back to an earlier content gets that
+// version again. On error *error_message is set, allocated from
+// EVALUATOR_ALLOC
+char load_module(char const *directory, char const *path, Module const **module, char **error_message);
+
+#endif
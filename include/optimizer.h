@@ -0,0 +1,35 @@
+#ifndef __OPTIMIZER__
+#define __OPTIMIZER__
+
+#include <stdlib.h>
+#include "parser.h"
+
+// Whole program dead code elimination, run on a parsed program before it is
+// evaluated. Functions whose name is never reached from the top-level
+// statements (following the calls made by reachable function bodies) are
+// dropped, so are branches and loops behind constant conditions and
+// statements after a return. Names are matched without regard to scope,
+// which keeps every definition a dynamically scoped lookup could find.
+// Bodies of reachable functions get parsed on the way. With keep_functions
+// every definition stays, for code the program cannot see (a module's
+// importer, or a program importing modules) may call any of them.
+//
+// Returns the number of AST nodes removed
+size_t eliminate_dead_code(ASTNode *root, char keep_functions);
+
+// Arguments an inlined call may have; the evaluator keeps them on the C stack
+#define _MAX_INLINED_ARGS 8
+
+// Replaces calls of small helpers by INLINE_CALL nodes holding a copy of the
+// body. A function qualifies when its body is a single checkit of at most
+// threshold nodes that calls no function of the program, it is defined once,
+// before the first top-level statement that is not a definition, and its
+// name is never declared, assigned or taken by an argument. Every call then
+// resolves to it, and as its frame held nothing but the arguments, the
+// body's other names resolve the same way at the call site. Arguments are
+// bound to the PARAMETER nodes standing in for them in the copy.
+//
+// Returns the number of call sites inlined
+size_t inline_calls(ASTNode *root, size_t threshold);
+
+#endif
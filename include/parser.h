@@ -4,6 +4,7 @@
 #include <stdint.h> 
 #include <stdlib.h>
 #include "tokenizer.h"
+#include "value.h"
 
 
 // Used for logging 
@@ -15,17 +16,30 @@ enum ASTNodeType {
     VARIABLE,
     ARITHMETIC,
     FUNCTION_CALL,
+    STRING,
+    ARRAY,
+    INDEX,
+    COMPARISON, // two children, operator in operators[0]
+    LOGICAL,    // two children, AND_OP or OR_OP in operators[0]
+    INLINE_CALL, // call substituted by the optimizer: the arguments, then the body expression
+    PARAMETER,   // argument slot of the innermost INLINE_CALL, see slot
+    SPAWN_CALL,  // its FUNCTION_CALL child runs as a task, see evaluate_spawn()
+    PMAP_CALL,   // value names the function, the child is the number of calls
 
     // Error Management
     INVALID,
 
     // Statements
     IF_ELSE_STMT,
+    WHILE_STMT,
     FUNCTION,
     DECLARATION,
     ASSIGNMENT,
+    INDEX_ASSIGNMENT,
     RETURN_STMT,
     PRINT_STMT,
+    IMPORT_STMT, // value holds the module path
+    YIELD_STMT,  // hands its expression to the host, see start_generator()
     STMT_SEQUENCE,
 };
 
@@ -33,31 +47,70 @@ enum OperatorType {
     ADD_OP,
     SUB_OP,
     MULT_OP,
-    DIV_OP
+    DIV_OP,
+    EQ_OP,
+    NE_OP,
+    LT_OP,
+    LE_OP,
+    GT_OP,
+    GE_OP,
+    AND_OP,
+    OR_OP
 };
 
+// Callee a FUNCTION_CALL resolved to last time, valid while epoch equals the
+// binding epoch of the evaluating context. See evaluate_function_call()
+typedef struct {
+    Value callee;
+    uint64_t epoch;
+} CallSiteCache;
+
+// epoch of call sites in trees shared between contexts (modules), which no
+// context may write to
+#define _UNCACHED_CALL_SITE UINT64_MAX
+
 struct ASTNode_s { 
     enum ASTNodeType node_type;
 
-    // used when node_type is NUMBER, VARIABLE, FUNCTION_CALL, FUNCTION
+    // used when node_type is NUMBER, VARIABLE, FUNCTION_CALL, FUNCTION, STRING,
+    // INDEX, INDEX_ASSIGNMENT (the name of the indexed variable), INLINE_CALL
+    // (the name of the inlined function), PARAMETER, PMAP_CALL
     char *value;
+    // hash_key(value) of nodes naming an identifier, saves rehashing on lookups
+    uint64_t value_hash;
+
+    // value of a NUMBER node, interned string of a STRING node
+    Value literal;
+    // argument index of a PARAMETER node
+    size_t slot;
 
     // used for function arguments
     char **args; 
     size_t args_length;
+    // hash_bit() of every argument name of a FUNCTION
+    uint64_t args_hash_bits;
+
+    CallSiteCache call_cache;
 
     // used for arithmetic expression operators
     // the length is children_length - 1
     enum OperatorType *operators; 
+    // minus negating the value of the node, NULL when there is none
     enum OperatorType *prefix_operator;
 
     struct ASTNode_s *children;
     size_t children_length;
 
+    // FUNCTION bodies are parsed on first call. Until then children_length
+    // is 0 and these hold the tokens between the curly brackets
+    Token const *body_tokens;
+    int body_tokens_length;
+
     const char *error_message;
 };
 typedef struct ASTNode_s ASTNode;
 
+
 typedef struct {
     Token const *tokens; 
     int num_tokens;
@@ -69,21 +122,48 @@ void delete_node(ASTNode *node);
 // Expression Parsers
 ASTNode parse_number_or_variable(ParserContext *context);
 ASTNode parse_function_call(ParserContext *context);
+ASTNode parse_string(ParserContext *context);
+ASTNode parse_array(ParserContext *context);
+ASTNode parse_index(ParserContext *context);
 ASTNode parse_bracket_expression(ParserContext *context);
+ASTNode parse_spawn(ParserContext *context);
+ASTNode parse_pmap(ParserContext *context);
+ASTNode parse_arithmetic(ParserContext *context);
+ASTNode parse_comparison(ParserContext *context);
+ASTNode parse_logical_and(ParserContext *context);
 ASTNode parse_expression(ParserContext *context);
 
 // Statement Parsers
 ASTNode parse_declaration(ParserContext *context);
 ASTNode parse_assignment(ParserContext *context);
+ASTNode parse_index_assignment(ParserContext *context);
 ASTNode parse_return_stmt(ParserContext *context);
 ASTNode parse_print_stmt(ParserContext *context);
+ASTNode parse_yield_stmt(ParserContext *context);
+ASTNode parse_import_stmt(ParserContext *context);
 ASTNode parse_if_else_stmt(ParserContext *context);
+ASTNode parse_while_stmt(ParserContext *context);
 ASTNode parse_function(ParserContext *context);
 ASTNode parse_stmt_sequence(ParserContext *context);
 
 // Entry points
 ASTNode parse_ast(Token const *tokens, int num_tokens);
+// Statements between the curly brackets of a function, given their tokens
+ASTNode parse_function_body(Token const *tokens, int num_tokens);
+// Body of a FUNCTION node, parsed from its token range the first time it is
+// asked for. The tokens must still be alive then. A syntax error in the body
+// gives an INVALID node
+ASTNode const *function_body(ASTNode *function_node);
+// Parses every function body, nested ones included, and turns call site
+// caching and tiering off, so that evaluating the tree never writes to it
+// and any number of contexts may evaluate it at once. The tokens are not needed afterwards.
+// Returns the first invalid body, NULL when all of them parsed
+ASTNode const *share_tree(ASTNode *root);
+// Deep copy of an expression tree
+ASTNode copy_node(ASTNode const *node);
 char ast_equal(ASTNode *left, ASTNode *right); 
+size_t count_nodes(ASTNode const *node);
+char contains_node_type(ASTNode const *node, enum ASTNodeType node_type);
 void print_node(ASTNode *node, size_t indent_count);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,15 @@
+#ifndef __REPL__
+#define __REPL__
+
+#include <stdio.h>
+#include "evaluator.h"
+
+// Reads programs from in until EOF and runs each in the same context, so
+// variables and functions of earlier inputs stay visible. An input ends at a
+// line break where its curly brackets are balanced. Prompts (when in is a
+// terminal) and error messages go to out. Every input is tokenized and
+// parsed on its own. The printed values of an input are dropped from the
+// side effects of the context once it ran
+void run_repl(FILE *in, FILE *out, EvaluatorContext *context);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef __SNAPSHOT__
+#define __SNAPSHOT__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "flat_tree.h"
+#include "evaluator.h"
+
+#define _SNAPSHOT_MAGIC "MSHNSNAP"
+#define _SNAPSHOT_VERSION 4
+// offset standing for a missing string in the chars of a snapshot
+#define _SNAPSHOT_NONE UINT64_MAX
+
+// A program restored from a snapshot file. The nodes are read straight from
+// the mapped file, only the tables holding pointers (names, functions, ...)
+// are rebuilt. Contexts that ran it must be deleted before it
+typedef struct {
+    void *mapping;
+    size_t mapping_length;
+    FlatTree *tree;
+    uint64_t source_hash;       // hash_key() of the source the tree was parsed from
+    uint32_t resume_statement;  // first top-level statement after the prelude
+    char const *module_dir;     // directory of the script, NULL when unknown
+} Snapshot;
+
+// Number of leading top-level statements that are function definitions or
+// declarations: the prelude a snapshot is taken after
+size_t prelude_length(FlatTree const *tree);
+
+// Writes tree and the main frame of context, as left by running the first
+// resume_statement top-level statements, to path. Every function body must
+// be parsed (see share_tree()). Strings and arrays are saved by content,
+// arrays shared by several names stay shared. The file is replaced at once,
+// never left half written. Returns 1 with *error_message (EVALUATOR_ALLOC)
+// set when the file cannot be written or a value cannot be saved
+char write_snapshot(
+    char const *path,
+    FlatTree const *tree,
+    uint64_t source_hash,
+    uint32_t resume_statement,
+    EvaluatorContext const *context,
+    char **error_message
+);
+
+// Maps a file written by write_snapshot() of the same build and rebuilds its
+// tree. Returns 1 with *error_message (EVALUATOR_ALLOC) set when it cannot be
+// read or is not such a snapshot
+char load_snapshot(char const *path, Snapshot *snapshot, char **error_message);
+
+// Binds the saved globals in the main frame of context, a fresh one. Returns
+// 1 when out of memory
+char restore_globals(Snapshot const *snapshot, EvaluatorContext *context);
+
+void delete_snapshot(Snapshot *snapshot);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef __STATS__
+#define __STATS__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Subsystems that own heap allocations. Used to attribute malloc traffic
+enum AllocSubsystem {
+    TOKENIZER_ALLOC,
+    PARSER_ALLOC,
+    EVALUATOR_ALLOC,
+    HASH_TABLE_ALLOC,
+    STACK_ALLOC,
+    _ALLOC_SUBSYSTEMS_COUNT
+};
+
+// Used for logging
+extern const char *AllocSubsystemNames[];
+
+typedef struct {
+    size_t calls;
+    size_t bytes;
+    // bytes currently held, as reported by the allocator for live blocks
+    long live_bytes;
+} AllocCounter;
+
+// Time spent in a phase, or the clock readings it started at
+typedef struct {
+    double wall_ms;
+    double cpu_ms;
+} PhaseTiming;
+
+typedef struct {
+    PhaseTiming tokenize;
+    PhaseTiming parse;
+    PhaseTiming optimize;
+    PhaseTiming evaluate;
+    PhaseTiming snapshot;   // writing or restoring a snapshot
+
+    size_t tokens;
+    size_t ast_nodes;
+    size_t ast_bytes;       // heap held by the optimized tree, before it is lowered
+    size_t flat_ast_bytes;  // heap held by the flat tree the evaluator runs on
+    size_t front_end_chunks; // source pieces tokenized and parsed in parallel, 1 when serial
+    size_t dead_nodes_removed;
+    size_t inlined_calls;
+    size_t function_calls;
+    size_t frames_allocated;
+    size_t tier_ups;
+
+    AllocCounter allocations[_ALLOC_SUBSYSTEMS_COUNT];
+    long peak_rss_kb;
+} InterpreterStats;
+
+// Allocation wrappers. Counters are thread local, so every thread reports
+// only the traffic it generated itself
+void *stats_malloc(enum AllocSubsystem subsystem, size_t size);
+void *stats_calloc(enum AllocSubsystem subsystem, size_t count, size_t size);
+void *stats_realloc(enum AllocSubsystem subsystem, void *ptr, size_t size);
+char *stats_strdup(enum AllocSubsystem subsystem, char const *str);
+void stats_free(enum AllocSubsystem subsystem, void *ptr);
+
+void reset_alloc_counters(void);
+void read_alloc_counters(AllocCounter *counters);
+// Adds counters read on another thread, e.g. a worker, to those of this thread
+void add_alloc_counters(AllocCounter const *counters);
+long read_live_bytes(enum AllocSubsystem subsystem);
+
+// start_phase_timer() reads the wall and CPU clocks, stop_phase_timer() gives
+// the time elapsed on both since those readings
+PhaseTiming start_phase_timer(void);
+PhaseTiming stop_phase_timer(PhaseTiming const *start);
+
+long read_peak_rss_kb(void);
+
+void print_interpreter_stats(InterpreterStats const *stats, FILE *out);
+
+#endif
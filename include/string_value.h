@@ -0,0 +1,50 @@
+#ifndef __STRING_VALUE__
+#define __STRING_VALUE__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "value.h"
+#include "arena.h"
+
+// Strings of up to _SMALL_STRING_CAPACITY bytes live inside the Value itself
+// (SMALL_STRING_TAG, length in bits 3..7, bytes in the upper 7 bytes).
+// Longer ones are String objects (STRING_TAG): either flat, or a rope node
+// joining two string Values, so concatenation never copies long strings
+#define _SMALL_STRING_CAPACITY 7
+
+// Concatenations up to this length are copied into a flat string instead of
+// creating a rope node
+#define _FLAT_CONCAT_THRESHOLD 32
+
+typedef struct {
+    size_t length;
+    Value left;          // rope halves, both 0 for flat strings
+    Value right;
+    char const *chars;   // flat strings only, NUL terminated
+} String;
+
+static inline char value_is_string(Value value) {
+    return value_tag(value) == SMALL_STRING_TAG || value_tag(value) == STRING_TAG;
+}
+
+size_t string_length(Value value);
+
+// Value of a string literal. Short literals are stored inline, longer ones are
+// interned in a process wide table and live until exit
+Value intern_string(char const *chars);
+
+// All three return 1 when out of memory. new_string() copies length bytes of
+// chars into a flat string
+char new_string(char const *chars, size_t length, ObjectArena *arena, Value *result);
+char concat_strings(Value left, Value right, ObjectArena *arena, Value *result);
+char int_to_string(int32_t number, ObjectArena *arena, Value *result);
+
+// Copies the bytes of the string (no terminating NUL) into buffer, which must
+// hold string_length(value) bytes
+void copy_string_chars(Value value, char *buffer);
+void write_string(Value value, FILE *out);
+
+// Compares contents, whatever the representation of either side
+char strings_equal(Value left, Value right);
+
+#endif
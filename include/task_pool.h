@@ -0,0 +1,40 @@
+#ifndef __TASK_POOL__
+#define __TASK_POOL__
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+// C stack of a worker, reserved but only backed as far as it is used. Tasks
+// waiting for other tasks run them on top of their own frames meanwhile
+#define _TASK_STACK_BYTES (32 * 1024 * 1024)
+#define _INITIAL_JOB_DEQUE_CAPACITY 64
+
+// A unit of work run once by some thread of a pool. Embedded as the first
+// member of the caller's own struct, which run() casts back to
+typedef struct PoolJob_s {
+    void (*run)(struct PoolJob_s *job);
+    _Atomic char done;
+} PoolJob;
+
+// Work-stealing pool: every worker has a deque of jobs that it pushes to and
+// pops from at the bottom (newest first), and steals the oldest job of
+// another deque when its own is empty. Threads outside of the pool submit to
+// a deque of their own that the workers steal from
+typedef struct TaskPool_s TaskPool;
+
+// Starts threads workers. Returns NULL when the pool or its first worker
+// cannot be started
+TaskPool *start_task_pool(size_t threads);
+size_t task_pool_threads(TaskPool const *pool);
+
+// Queues job on the deque of the calling thread. Returns 1 when out of memory
+char submit_job(TaskPool *pool, PoolJob *job);
+
+// Returns once job has run, running queued jobs of the pool meanwhile, so a
+// job may wait for jobs it submitted without tying up a worker
+void wait_job(TaskPool *pool, PoolJob *job);
+
+// Runs the jobs still queued and stops the workers
+void stop_task_pool(TaskPool *pool);
+
+#endif
@@ -6,7 +6,8 @@ extern const char *TokeTypeNames[];
 
 enum TokenizerError {
     TOKENIZER_PASS = 0,
-    TOKENIZER_INVALID_CHARACTER
+    TOKENIZER_INVALID_CHARACTER,
+    TOKENIZER_UNTERMINATED_STRING
 };
 
 enum TokenType {
@@ -24,7 +25,13 @@ enum TokenType {
     COMMA,
     EQUAL,
     DOUBLE_EQUAL,
-    //DOUBLE_QUOTES, TODO: adding string support
+    NOT_EQUAL,
+    LESS,
+    LESS_EQUAL,
+    GREATER,
+    GREATER_EQUAL,
+    AND,
+    OR,
 
     IF,
     ELSE,
@@ -32,8 +39,14 @@ enum TokenType {
     LET,
     RETURN,
     PRINT,
+    WHILE,
+    IMPORT,
+    YIELD,
+    SPAWN,
+    PMAP,
 
     NUMERIC_LITERAL,
+    STRING_LITERAL, // token_value holds the unescaped contents
     IDENTIFIER,
 };
 
@@ -48,6 +61,7 @@ typedef struct {
     size_t parsed_tokens_capacity;
     char const *code;
     char const *code_start;
+    char const *code_end; // tokenizing stops here, or at the NUL when NULL
     char *error_message; 
     enum TokenizerError error_code;
 } TokenizerState;
@@ -55,6 +69,9 @@ typedef struct {
 void delete_token(Token *token);
 
 TokenizerState init_tokenizer_state(char const *code);
+// State for the bytes [start, end) of code, which must not split a token.
+// Error positions still count from the start of code
+TokenizerState init_tokenizer_range(char const *code, size_t start, size_t end);
 
 char tokenize(TokenizerState *tokenizer_state);
 
@@ -0,0 +1,67 @@
+#ifndef __VALUE__
+#define __VALUE__
+
+#include <stdint.h>
+
+// Every runtime value (frame entries, evaluation results and side effects) is
+// a single 64 bit word. The low _VALUE_TAG_BITS bits hold the type tag:
+//
+//   INT_TAG           int32_t payload in the high 32 bits, low 32 bits zero
+//   FUNCTION_TAG      pointer to a FlatFunction, see flat_tree.h
+//   SMALL_STRING_TAG  string of up to 7 bytes stored inline, see string_value.h
+//   STRING_TAG        pointer to a String
+//   ARRAY_TAG         pointer to an Array, see array_value.h
+//   NATIVE_TAG        pointer to a Native, only held by call site caches
+//   TASK_TAG          pointer to a spawned Task, see evaluate_spawn()
+//
+// Heap payloads are at least 8 byte aligned, so their low bits are free for
+// the tag. INT_TAG is 0, which makes a zeroed Value the integer 0 and lets
+// integer code check two operands with a single OR.
+typedef uint64_t Value;
+
+enum ValueTag {
+    INT_TAG = 0,
+    FUNCTION_TAG = 1,
+    SMALL_STRING_TAG = 2,
+    STRING_TAG = 3,
+    ARRAY_TAG = 4,
+    NATIVE_TAG = 5,
+    TASK_TAG = 6,
+};
+
+#define _VALUE_TAG_BITS 3
+#define _VALUE_TAG_MASK ((uint64_t)(1 << _VALUE_TAG_BITS) - 1)
+
+#define _LIKELY(x) __builtin_expect(!!(x), 1)
+#define _UNLIKELY(x) __builtin_expect(!!(x), 0)
+#define _NOINLINE __attribute__((noinline))
+
+static inline enum ValueTag value_tag(Value value) {
+    return (enum ValueTag)(value & _VALUE_TAG_MASK);
+}
+
+static inline Value int_value(int32_t number) {
+    return (uint64_t)(uint32_t)number << 32;
+}
+
+static inline int32_t value_as_int(Value value) {
+    return (int32_t)(uint32_t)(value >> 32);
+}
+
+static inline char value_is_int(Value value) {
+    return (value & _VALUE_TAG_MASK) == INT_TAG;
+}
+
+static inline char values_are_ints(Value left, Value right) {
+    return ((left | right) & _VALUE_TAG_MASK) == INT_TAG;
+}
+
+static inline Value pointer_value(void const *pointer, enum ValueTag tag) {
+    return (uint64_t)(uintptr_t)pointer | tag;
+}
+
+static inline void *value_as_pointer(Value value) {
+    return (void *)(uintptr_t)(value & ~_VALUE_TAG_MASK);
+}
+
+#endif
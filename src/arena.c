@@ -0,0 +1,56 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "stack.h"
+#include "stats.h"
+
+ObjectArena init_object_arena(void) {
+    ObjectArena arena = {
+        .blocks = init_stack(8, sizeof(char *)),
+        .cursor = NULL,
+        .remaining = 0,
+        .arrays = init_stack(8, sizeof(void *))
+    };
+    return arena;
+}
+
+void delete_object_arena(ObjectArena *arena) {
+    for (size_t i = 0; i < arena->blocks.length; ++i) {
+        stats_free(EVALUATOR_ALLOC, *(char **)stack_at(&arena->blocks, i));
+    }
+    delete_stack(&arena->blocks);
+    arena->cursor = NULL;
+    arena->remaining = 0;
+    for (size_t i = 0; i < arena->arrays.length; ++i) {
+        stats_free(EVALUATOR_ALLOC, *(void **)stack_at(&arena->arrays, i));
+    }
+    delete_stack(&arena->arrays);
+    arena->array_bytes = 0;
+    arena->array_bytes_swept = 0;
+}
+
+void *arena_alloc(ObjectArena *arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    if (size <= arena->remaining) {
+        void *result = arena->cursor;
+        arena->cursor += size;
+        arena->remaining -= size;
+        return result;
+    }
+
+    // objects bigger than a quarter block get a block of their own, so the
+    // tail of the current block is not wasted
+    size_t block_size = size > _ARENA_BLOCK_SIZE / 4 ? size : _ARENA_BLOCK_SIZE;
+    char *block = stats_malloc(EVALUATOR_ALLOC, block_size);
+    if (block == NULL) return NULL;
+    if (!stack_push(&arena->blocks, &block)) {
+        stats_free(EVALUATOR_ALLOC, block);
+        return NULL;
+    }
+
+    if (block_size == size) return block;
+    arena->cursor = block + size;
+    arena->remaining = block_size - size;
+    return block;
+}
@@ -0,0 +1,414 @@
+#include "array_value.h"
+
+#include <string.h>
+#include <stdatomic.h>
+#include "stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define _X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+char new_array(size_t length, ObjectArena *arena, Value *result) {
+    Array *array = stats_malloc(EVALUATOR_ALLOC, sizeof(Array) + length * sizeof(int32_t));
+    if (array == NULL) return 1;
+    if (!stack_push(&arena->arrays, &array)) {
+        stats_free(EVALUATOR_ALLOC, array);
+        return 1;
+    }
+    arena->array_bytes += sizeof(Array) + length * sizeof(int32_t);
+    array->length = length;
+    array->items = (int32_t *)(array + 1);
+    array->marked = 0;
+    memset(array->items, 0, length * sizeof(int32_t));
+    *result = pointer_value(array, ARRAY_TAG);
+    return 0;
+}
+
+void sweep_arrays(ObjectArena *arena) {
+    Array **arrays = arena->arrays.buffer;
+    size_t kept = 0;
+    for (size_t i = 0; i < arena->arrays.length; ++i) {
+        if (!arrays[i]->marked) {
+            arena->array_bytes -= sizeof(Array) + arrays[i]->length * sizeof(int32_t);
+            stats_free(EVALUATOR_ALLOC, arrays[i]);
+            continue;
+        }
+        arrays[i]->marked = 0;
+        arrays[kept++] = arrays[i];
+    }
+    arena->arrays.length = kept;
+    arena->array_bytes_swept = arena->array_bytes;
+}
+
+enum SimdLevel detect_simd_level(void) {
+#ifdef _X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return SIMD_SSE41;
+#endif
+    return SIMD_SCALAR;
+}
+
+// -1 until the first kernel call detects the level
+static _Atomic int current_simd_level = -1;
+
+enum SimdLevel simd_level(void) {
+    int level = atomic_load_explicit(&current_simd_level, memory_order_relaxed);
+    if (_UNLIKELY(level < 0)) {
+        level = detect_simd_level();
+        atomic_store_explicit(&current_simd_level, level, memory_order_relaxed);
+    }
+    return (enum SimdLevel)level;
+}
+
+void set_simd_level(enum SimdLevel level) {
+    enum SimdLevel detected = detect_simd_level();
+    atomic_store_explicit(&current_simd_level, level < detected ? level : detected, memory_order_relaxed);
+}
+
+
+//////////////////////
+/// Scalar kernels ///
+//////////////////////
+
+// Integer math goes through uint32_t so overflow wraps instead of being UB
+
+static int32_t sum_scalar(int32_t const *items, size_t length) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < length; ++i) sum += (uint32_t)items[i];
+    return (int32_t)sum;
+}
+
+static int32_t min_scalar(int32_t const *items, size_t length) {
+    int32_t min = items[0];
+    for (size_t i = 1; i < length; ++i) min = items[i] < min ? items[i] : min;
+    return min;
+}
+
+static int32_t max_scalar(int32_t const *items, size_t length) {
+    int32_t max = items[0];
+    for (size_t i = 1; i < length; ++i) max = items[i] > max ? items[i] : max;
+    return max;
+}
+
+static int32_t dot_scalar(int32_t const *left, int32_t const *right, size_t length) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < length; ++i) sum += (uint32_t)left[i] * (uint32_t)right[i];
+    return (int32_t)sum;
+}
+
+static void add_scalar(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        dst[i] = (uint32_t)left[i] + (uint32_t)(right ? right[i] : scalar);
+    }
+}
+
+static void mul_scalar(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        dst[i] = (uint32_t)left[i] * (uint32_t)(right ? right[i] : scalar);
+    }
+}
+
+// The column kernels of call_function_batch() are stamped out per operator.
+// Comparisons give masks: -1 where they hold, 0 elsewhere
+#define _DEFINE_SCALAR_KERNEL(name, EXPRESSION) \
+    static void name##_scalar( \
+        int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length \
+    ) { \
+        for (size_t i = 0; i < length; ++i) { \
+            int32_t l = left[i], r = right ? right[i] : scalar; \
+            dst[i] = (EXPRESSION); \
+        } \
+    }
+
+_DEFINE_SCALAR_KERNEL(sub, (uint32_t)l - (uint32_t)r)
+_DEFINE_SCALAR_KERNEL(and, l & r)
+_DEFINE_SCALAR_KERNEL(or, l | r)
+_DEFINE_SCALAR_KERNEL(xor, l ^ r)
+_DEFINE_SCALAR_KERNEL(eq, -(l == r))
+_DEFINE_SCALAR_KERNEL(gt, -(l > r))
+_DEFINE_SCALAR_KERNEL(lt, -(l < r))
+
+static void select_scalar(int32_t *dst, int32_t const *mask, int32_t const *values, size_t length) {
+    for (size_t i = 0; i < length; ++i) dst[i] = mask[i] ? values[i] : dst[i];
+}
+
+static char any_scalar(int32_t const *items, size_t length) {
+    int32_t any = 0;
+    for (size_t i = 0; i < length; ++i) any |= items[i];
+    return any != 0;
+}
+
+
+////////////////////
+/// SIMD kernels ///
+////////////////////
+
+// Each kernel handles whole vectors and leaves the tail to its scalar twin.
+// Loads and stores are unaligned: array items are only 8 byte aligned
+
+#ifdef _X86_KERNELS
+
+#define _SSE41 __attribute__((target("sse4.1")))
+#define _AVX2 __attribute__((target("avx2")))
+
+_SSE41 static int32_t reduce_add_128(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+
+_SSE41 static int32_t reduce_min_128(__m128i v) {
+    v = _mm_min_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_min_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+
+_SSE41 static int32_t reduce_max_128(__m128i v) {
+    v = _mm_max_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_max_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+
+_SSE41 static __m128i load_128(int32_t const *items) {
+    return _mm_loadu_si128((__m128i const *)items);
+}
+
+_AVX2 static __m256i load_256(int32_t const *items) {
+    return _mm256_loadu_si256((__m256i const *)items);
+}
+
+_SSE41 static int32_t sum_sse41(int32_t const *items, size_t length) {
+    __m128i sum = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) sum = _mm_add_epi32(sum, load_128(items + i));
+    return (uint32_t)reduce_add_128(sum) + (uint32_t)sum_scalar(items + i, length - i);
+}
+
+_AVX2 static int32_t sum_avx2(int32_t const *items, size_t length) {
+    // two accumulators keep two loads in flight per iteration
+    __m256i sum0 = _mm256_setzero_si256(), sum1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        sum0 = _mm256_add_epi32(sum0, load_256(items + i));
+        sum1 = _mm256_add_epi32(sum1, load_256(items + i + 8));
+    }
+    __m256i sum = _mm256_add_epi32(sum0, sum1);
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    return (uint32_t)reduce_add_128(half) + (uint32_t)sum_sse41(items + i, length - i);
+}
+
+_SSE41 static int32_t min_sse41(int32_t const *items, size_t length) {
+    if (length < 4) return min_scalar(items, length);
+    __m128i min = load_128(items);
+    size_t i = 4;
+    for (; i + 4 <= length; i += 4) min = _mm_min_epi32(min, load_128(items + i));
+    // the last vector overlaps elements already seen, which min tolerates
+    min = _mm_min_epi32(min, load_128(items + length - 4));
+    return reduce_min_128(min);
+}
+
+_AVX2 static int32_t min_avx2(int32_t const *items, size_t length) {
+    if (length < 8) return min_sse41(items, length);
+    __m256i min = load_256(items);
+    size_t i = 8;
+    for (; i + 8 <= length; i += 8) min = _mm256_min_epi32(min, load_256(items + i));
+    min = _mm256_min_epi32(min, load_256(items + length - 8));
+    return reduce_min_128(_mm_min_epi32(_mm256_castsi256_si128(min), _mm256_extracti128_si256(min, 1)));
+}
+
+_SSE41 static int32_t max_sse41(int32_t const *items, size_t length) {
+    if (length < 4) return max_scalar(items, length);
+    __m128i max = load_128(items);
+    size_t i = 4;
+    for (; i + 4 <= length; i += 4) max = _mm_max_epi32(max, load_128(items + i));
+    max = _mm_max_epi32(max, load_128(items + length - 4));
+    return reduce_max_128(max);
+}
+
+_AVX2 static int32_t max_avx2(int32_t const *items, size_t length) {
+    if (length < 8) return max_sse41(items, length);
+    __m256i max = load_256(items);
+    size_t i = 8;
+    for (; i + 8 <= length; i += 8) max = _mm256_max_epi32(max, load_256(items + i));
+    max = _mm256_max_epi32(max, load_256(items + length - 8));
+    return reduce_max_128(_mm_max_epi32(_mm256_castsi256_si128(max), _mm256_extracti128_si256(max, 1)));
+}
+
+_SSE41 static int32_t dot_sse41(int32_t const *left, int32_t const *right, size_t length) {
+    __m128i sum = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        sum = _mm_add_epi32(sum, _mm_mullo_epi32(load_128(left + i), load_128(right + i)));
+    }
+    return (uint32_t)reduce_add_128(sum) + (uint32_t)dot_scalar(left + i, right + i, length - i);
+}
+
+_AVX2 static int32_t dot_avx2(int32_t const *left, int32_t const *right, size_t length) {
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(load_256(left + i), load_256(right + i)));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    return (uint32_t)reduce_add_128(half) + (uint32_t)dot_sse41(left + i, right + i, length - i);
+}
+
+// The map kernels are stamped out per operator: OP_128 / OP_256 combine two
+// vectors, scalar_kernel finishes the tail
+#define _DEFINE_MAP_KERNELS(name, OP_128, OP_256, scalar_kernel) \
+    _SSE41 static void name##_sse41( \
+        int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length \
+    ) { \
+        __m128i broadcast = _mm_set1_epi32(scalar); \
+        size_t i = 0; \
+        for (; i + 4 <= length; i += 4) { \
+            __m128i operand = right ? load_128(right + i) : broadcast; \
+            _mm_storeu_si128((__m128i *)(dst + i), OP_128(load_128(left + i), operand)); \
+        } \
+        scalar_kernel(dst + i, left + i, right ? right + i : NULL, scalar, length - i); \
+    } \
+    _AVX2 static void name##_avx2( \
+        int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length \
+    ) { \
+        __m256i broadcast = _mm256_set1_epi32(scalar); \
+        size_t i = 0; \
+        for (; i + 8 <= length; i += 8) { \
+            __m256i operand = right ? load_256(right + i) : broadcast; \
+            _mm256_storeu_si256((__m256i *)(dst + i), OP_256(load_256(left + i), operand)); \
+        } \
+        scalar_kernel(dst + i, left + i, right ? right + i : NULL, scalar, length - i); \
+    }
+
+_DEFINE_MAP_KERNELS(add, _mm_add_epi32, _mm256_add_epi32, add_scalar)
+_DEFINE_MAP_KERNELS(mul, _mm_mullo_epi32, _mm256_mullo_epi32, mul_scalar)
+
+// AVX2 only compares for greater than
+_AVX2 static __m256i cmplt_256(__m256i left, __m256i right) {
+    return _mm256_cmpgt_epi32(right, left);
+}
+
+_DEFINE_MAP_KERNELS(sub, _mm_sub_epi32, _mm256_sub_epi32, sub_scalar)
+_DEFINE_MAP_KERNELS(and, _mm_and_si128, _mm256_and_si256, and_scalar)
+_DEFINE_MAP_KERNELS(or, _mm_or_si128, _mm256_or_si256, or_scalar)
+_DEFINE_MAP_KERNELS(xor, _mm_xor_si128, _mm256_xor_si256, xor_scalar)
+_DEFINE_MAP_KERNELS(eq, _mm_cmpeq_epi32, _mm256_cmpeq_epi32, eq_scalar)
+_DEFINE_MAP_KERNELS(gt, _mm_cmpgt_epi32, _mm256_cmpgt_epi32, gt_scalar)
+_DEFINE_MAP_KERNELS(lt, _mm_cmplt_epi32, cmplt_256, lt_scalar)
+
+_SSE41 static void select_sse41(int32_t *dst, int32_t const *mask, int32_t const *values, size_t length) {
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        __m128i blended = _mm_blendv_epi8(load_128(dst + i), load_128(values + i), load_128(mask + i));
+        _mm_storeu_si128((__m128i *)(dst + i), blended);
+    }
+    select_scalar(dst + i, mask + i, values + i, length - i);
+}
+
+_AVX2 static void select_avx2(int32_t *dst, int32_t const *mask, int32_t const *values, size_t length) {
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        __m256i blended = _mm256_blendv_epi8(load_256(dst + i), load_256(values + i), load_256(mask + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), blended);
+    }
+    select_sse41(dst + i, mask + i, values + i, length - i);
+}
+
+_SSE41 static char any_sse41(int32_t const *items, size_t length) {
+    __m128i any = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) any = _mm_or_si128(any, load_128(items + i));
+    return !_mm_testz_si128(any, any) || any_scalar(items + i, length - i);
+}
+
+_AVX2 static char any_avx2(int32_t const *items, size_t length) {
+    __m256i any = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) any = _mm256_or_si256(any, load_256(items + i));
+    return !_mm256_testz_si256(any, any) || any_sse41(items + i, length - i);
+}
+
+#endif
+
+
+////////////////
+/// Dispatch ///
+////////////////
+
+#ifdef _X86_KERNELS
+#define _DISPATCH(kernel, ...) \
+    switch (simd_level()) { \
+        case SIMD_AVX2: return kernel##_avx2(__VA_ARGS__); \
+        case SIMD_SSE41: return kernel##_sse41(__VA_ARGS__); \
+        default: return kernel##_scalar(__VA_ARGS__); \
+    }
+#define _DISPATCH_VOID(kernel, ...) \
+    switch (simd_level()) { \
+        case SIMD_AVX2: kernel##_avx2(__VA_ARGS__); break; \
+        case SIMD_SSE41: kernel##_sse41(__VA_ARGS__); break; \
+        default: kernel##_scalar(__VA_ARGS__); \
+    }
+#else
+#define _DISPATCH(kernel, ...) return kernel##_scalar(__VA_ARGS__);
+#define _DISPATCH_VOID(kernel, ...) kernel##_scalar(__VA_ARGS__);
+#endif
+
+int32_t sum_int32(int32_t const *items, size_t length) {
+    _DISPATCH(sum, items, length)
+}
+
+int32_t min_int32(int32_t const *items, size_t length) {
+    _DISPATCH(min, items, length)
+}
+
+int32_t max_int32(int32_t const *items, size_t length) {
+    _DISPATCH(max, items, length)
+}
+
+int32_t dot_int32(int32_t const *left, int32_t const *right, size_t length) {
+    _DISPATCH(dot, left, right, length)
+}
+
+void add_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length) {
+    _DISPATCH_VOID(add, dst, left, right, scalar, length)
+}
+
+void mul_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length) {
+    _DISPATCH_VOID(mul, dst, left, right, scalar, length)
+}
+
+void sub_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length) {
+    _DISPATCH_VOID(sub, dst, left, right, scalar, length)
+}
+
+void and_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length) {
+    _DISPATCH_VOID(and, dst, left, right, scalar, length)
+}
+
+void or_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length) {
+    _DISPATCH_VOID(or, dst, left, right, scalar, length)
+}
+
+void xor_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length) {
+    _DISPATCH_VOID(xor, dst, left, right, scalar, length)
+}
+
+void eq_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length) {
+    _DISPATCH_VOID(eq, dst, left, right, scalar, length)
+}
+
+void gt_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length) {
+    _DISPATCH_VOID(gt, dst, left, right, scalar, length)
+}
+
+void lt_int32(int32_t *dst, int32_t const *left, int32_t const *right, int32_t scalar, size_t length) {
+    _DISPATCH_VOID(lt, dst, left, right, scalar, length)
+}
+
+void select_int32(int32_t *dst, int32_t const *mask, int32_t const *values, size_t length) {
+    _DISPATCH_VOID(select, dst, mask, values, length)
+}
+
+char any_int32(int32_t const *items, size_t length) {
+    _DISPATCH(any, items, length)
+}
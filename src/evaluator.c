@@ -3,394 +3,2796 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "stack.h"
 #include "hash_table.h"
 #include "parser.h"
+#include "stats.h"
+#include "string_value.h"
+#include "array_value.h"
+#include "optimizer.h"
+#include "module.h"
+#include "flat_tree.h"
+#include "hooks.h"
 
 char *undefined_identifier_message(char const *identifier) {
-    char *error_message = malloc(25+strlen(identifier)+1);
+    char *error_message = stats_malloc(EVALUATOR_ALLOC, 25+strlen(identifier)+1);
     if (error_message != NULL)
         sprintf(error_message, "Undeclared Identifier: %s", identifier);
     return error_message;
 }
 
 char *callable_identifier_not_called_message(char const *identifier) {
-    char *error_message = malloc(54+strlen(identifier)+1);
+    char *error_message = stats_malloc(EVALUATOR_ALLOC, 54+strlen(identifier)+1);
     if (error_message != NULL)
         sprintf(error_message, "Callable identifier needs to be called in expression: %s", identifier);
     return error_message;
 }
 
 char *not_callable_message(char const *identifier) {
-    char *error_message = malloc(25+strlen(identifier)+1);
+    char *error_message = stats_malloc(EVALUATOR_ALLOC, 26+strlen(identifier)+1);
     if (error_message != NULL)
         sprintf(error_message, "Variable is not callable: %s", identifier);
     return error_message;
 }
 
 char *unexpected_arguments_message(char const *identifier) {
-    char *error_message = malloc(42+strlen(identifier)+1);
+    char *error_message = stats_malloc(EVALUATOR_ALLOC, 42+strlen(identifier)+1);
     if (error_message != NULL)
         sprintf(error_message, "Incorrect arguments supplied to function: %s", identifier);
     return error_message;
 }
 
 char *variable_exists_message(char const *identifier) {
-    char *error_message = malloc(25+strlen(identifier)+1);
+    char *error_message = stats_malloc(EVALUATOR_ALLOC, 25+strlen(identifier)+1);
     if (error_message != NULL)
         sprintf(error_message, "Variable Already Exists: %s", identifier);
     return error_message;
 }
 
-int32_t char_to_int(char const *num) {
-    int result = 0;
-    for(char const *p=num; *p; ++p) {
-        result = result * 10 + (*p) - '0';
-    }
-    return result;
+char *unexpected_type_message(char const *operation) {
+    char *error_message = stats_malloc(EVALUATOR_ALLOC, 32+strlen(operation)+1);
+    if (error_message != NULL)
+        sprintf(error_message, "Unexpected operand type for: %s", operation);
+    return error_message;
+}
+
+char *limit_exceeded_message(char const *limit_name, size_t limit) {
+    char *error_message = stats_malloc(EVALUATOR_ALLOC, 27+strlen(limit_name)+20+1);
+    if (error_message != NULL)
+        sprintf(error_message, "Resource limit exceeded: %s (%zu)", limit_name, limit);
+    return error_message;
 }
 
-const StackFrameEntry *search_identifier_value(EvaluatorContext *context, char const *identifer) {
+char *index_out_of_range_message(int32_t index, size_t length) {
+    char *error_message = stats_malloc(EVALUATOR_ALLOC, 32+11+20+1);
+    if (error_message != NULL)
+        sprintf(error_message, "Index out of range: %d (length %zu)", index, length);
+    return error_message;
+}
+
+// Also tells the index, counted from the main frame, of the frame holding the entry
+static const Value *search_identifier_frame(EvaluatorContext *context, char const *identifer, uint64_t hash, size_t *frame_index) {
     for (size_t i=0; i < context->stack_frames.length; ++i) {
         HashTable const *frame = stack_at(&context->stack_frames, i);
-        const StackFrameEntry * const entry = hash_table_get(frame, identifer);
+        const Value * const entry = hash_table_get_hashed(frame, identifer, hash);
 
         if (entry == NULL) continue;
+        *frame_index = context->stack_frames.length - 1 - i;
         return entry;
     }
     return NULL;
 }
 
+const Value *search_identifier_value(EvaluatorContext *context, char const *identifer, uint64_t hash) {
+    size_t frame_index;
+    return search_identifier_frame(context, identifer, hash, &frame_index);
+}
+
+static void invalidate_call_caches(EvaluatorContext *context) {
+    context->binding_epoch += 1;
+    context->cached_callee_bits = 0;
+    context->highest_cached_frame = 0;
+}
+
+// Called for every new or changed binding, with the hash_bit() of its names
+static inline void note_binding(EvaluatorContext *context, uint64_t hash_bits) {
+    if (_UNLIKELY(hash_bits & context->cached_callee_bits)) invalidate_call_caches(context);
+}
+
 char allocate_stack_frame(
     EvaluatorContext *context, 
     char **arg_names, 
-    uint32_t *arg_values, 
+    Value *arg_values, 
     size_t args_length
 ) { 
-    HashTable frame = init_hash_table(_INITIAL_IDENTIFIER_TABLE_CAPACITY, sizeof(StackFrameEntry));
-    HashTable *new_frame = malloc(sizeof(HashTable));
-    if (frame.rows == NULL || new_frame == NULL) return 0;
-    memcpy(new_frame, &frame, sizeof(HashTable));
+    HashTable new_frame;
+    if (context->spare_frames.length > 0) {
+        new_frame = *(HashTable *)stack_top(&context->spare_frames);
+        stack_pop(&context->spare_frames);
+    }
+    else {
+        new_frame = init_hash_table(_INITIAL_IDENTIFIER_TABLE_CAPACITY, sizeof(Value));
+        if (new_frame.rows == NULL) return 1;
+    }
 
     for (size_t i=0; i < args_length; ++i) {
-        StackFrameEntry entry = {.type=INT32_T_ENTRY, .value.number=arg_values[i]};
-
-        char error = hash_table_set(new_frame, arg_names[i], &entry);
+        char error = hash_table_set(&new_frame, arg_names[i], arg_values+i);
 
         if (error) {
-            clean_hash_table(new_frame);
-            free(new_frame);
+            clean_hash_table(&new_frame);
             return error;
         }
     }
 
-    char error = !stack_push(&context->stack_frames, new_frame);
+    char error = !stack_push(&context->stack_frames, &new_frame);
+    if (error) clean_hash_table(&new_frame);
+    else context->frames_allocated += 1;
     return error;
 }
 
+void pop_stack_frame(EvaluatorContext *context) {
+    // cached callees of the main frame stay, it is only popped with the context
+    if (context->highest_cached_frame >= context->stack_frames.length - 1) invalidate_call_caches(context);
+    HashTable *frame = stack_top(&context->stack_frames);
+    Stack *spares = &context->spare_frames;
+    if (context->stack_frames.length > 1 && spares->buffer != NULL && spares->length < _MAX_SPARE_FRAMES) {
+        clear_hash_table(frame);
+        if (!stack_push(spares, frame)) clean_hash_table(frame);
+    }
+    else clean_hash_table(frame);
+    stack_pop(&context->stack_frames);
+}
+
+static double monotonic_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+// Bytes held by frames, the evaluation stacks and evaluator buffers
+static long evaluator_heap_bytes() {
+    return (
+        read_live_bytes(EVALUATOR_ALLOC) + 
+        read_live_bytes(HASH_TABLE_ALLOC) + 
+        read_live_bytes(STACK_ALLOC)
+    );
+}
+
+// Called at call (and loop) boundaries. Counts one step and returns 1 and sets
+// the error when any limit is breached. Deadline is polled every
+// _DEADLINE_CHECK_INTERVAL steps to keep clock reads off the hot path
+char limits_exceeded(EvaluatorContext *context) {
+    EvaluatorLimits const *limits = &context->limits;
+    context->steps += 1;
+
+    char cancelled = atomic_load_explicit(&context->cancelled, memory_order_relaxed);
+    if (context->cancel_source != NULL) cancelled |= atomic_load_explicit(context->cancel_source, memory_order_relaxed);
+    if (cancelled) {
+        context->error_code = CANCELLED;
+        context->error_message = stats_strdup(EVALUATOR_ALLOC, "Evaluation cancelled");
+        return 1;
+    }
+    if (limits->max_steps && context->steps > limits->max_steps) {
+        context->error_code = STEP_LIMIT_EXCEEDED;
+        context->error_message = limit_exceeded_message("steps", limits->max_steps);
+        return 1;
+    }
+    if (limits->max_call_depth && context->stack_frames.length > limits->max_call_depth) {
+        context->error_code = CALL_DEPTH_EXCEEDED;
+        context->error_message = limit_exceeded_message("call depth", limits->max_call_depth);
+        return 1;
+    }
+    if (limits->max_heap_bytes && 
+        evaluator_heap_bytes() - context->heap_bytes_base > (long)limits->max_heap_bytes) {
+        context->error_code = HEAP_LIMIT_EXCEEDED;
+        context->error_message = limit_exceeded_message("heap bytes", limits->max_heap_bytes);
+        return 1;
+    }
+    if (limits->timeout_ms && 
+        context->steps % _DEADLINE_CHECK_INTERVAL == 0 && 
+        monotonic_ms() > context->deadline_ms) {
+        context->error_code = DEADLINE_EXCEEDED;
+        context->error_message = limit_exceeded_message("timeout ms", limits->timeout_ms);
+        return 1;
+    }
+    return 0;
+}
+
+
+
+
+char value_is_truthy(Value value) {
+    if (value_is_int(value)) return value_as_int(value) != 0;
+    if (value_is_string(value)) return string_length(value) != 0;
+    if (value_is_array(value)) return value_as_array(value)->length != 0;
+    return 1;
+}
+
+static void write_array(Array const *array, FILE *out) {
+    fputc('[', out);
+    for (size_t i = 0; i < array->length; ++i) {
+        if (i > 0) fputs(", ", out);
+        fprintf(out, "%d", array->items[i]);
+    }
+    fputc(']', out);
+}
+
+void write_value(Value value, FILE *out) {
+    if (value_is_int(value)) fprintf(out, "%d", value_as_int(value));
+    else if (value_is_string(value)) write_string(value, out);
+    else if (value_is_array(value)) write_array(value_as_array(value), out);
+    else if (value_tag(value) == TASK_TAG) fputs("<task>", out);
+    else fprintf(out, "<function %s>", ((FlatFunction const *)value_as_pointer(value))->name);
+}
+
+void evaluate_number(FlatNode const *node, EvaluatorContext *context);
+void evaluate_variable(FlatNode const *node, EvaluatorContext *context);
+void evaluate_arithmetic(FlatNode const *node, EvaluatorContext *context);
+void evaluate_function_call(FlatNode const *node, EvaluatorContext *context);
+void evaluate_inline_call(FlatNode const *node, EvaluatorContext *context);
+void evaluate_parameter(FlatNode const *node, EvaluatorContext *context);
+void evaluate_string(FlatNode const *node, EvaluatorContext *context);
+void evaluate_array(FlatNode const *node, EvaluatorContext *context);
+void evaluate_index(FlatNode const *node, EvaluatorContext *context);
+void evaluate_comparison(FlatNode const *node, EvaluatorContext *context);
+static char evaluate_condition(FlatNode const *node, EvaluatorContext *context);
+void evaluate_spawn(FlatNode const *node, EvaluatorContext *context);
+void evaluate_pmap(FlatNode const *node, EvaluatorContext *context);
+void evaluate_expression_node(FlatNode const *node, EvaluatorContext *context);
+
+void evaluate_declaration(FlatNode const *node, EvaluatorContext *context);
+void evaluate_assignment(FlatNode const *node, EvaluatorContext *context);
+void evaluate_index_assignment(FlatNode const *node, EvaluatorContext *context);
+void evaluate_print(FlatNode const *node, EvaluatorContext *context);
+void evaluate_yield(FlatNode const *node, EvaluatorContext *context);
+void evaluate_return(FlatNode const *node, EvaluatorContext *context);
+void evaluate_if_else(FlatNode const *node, EvaluatorContext *context);
+void evaluate_while(FlatNode const *node, EvaluatorContext *context);
+void evaluate_function(FlatNode const *node, EvaluatorContext *context);
+void evaluate_statement_sequence(FlatNode const *node, EvaluatorContext *context);
+
+typedef struct Task_s Task;
+static void builtin_join(Native const *native, Value const *args, EvaluatorContext *context);
+static void join_pending_tasks(EvaluatorContext *context);
+static void delete_tasks(EvaluatorContext *context);
+static void collect_arrays(EvaluatorContext *context);
+
+
+/////////////
+/// Tiers ///
+/////////////
+
+// A function called tier_up_threshold times is recompiled into a copy of its
+// body that invoke_function() runs from then on. The copy reads arguments
+// the body never rebinds from their slot instead of looking them up by name,
+// has negated literals decoded and constant expressions folded. Functions of
+// shared trees keep their first form, as tiering writes to the function
+
+typedef struct {
+    FlatFunction const *function;
+    FlatTree const *tree;   // holding the body
+    char *assigned;         // per argument, whether the body rebinds its name
+    FlatNode *nodes;
+    size_t nodes_length;
+    size_t resolved;
+    size_t folded;
+    EvaluatorContext *context;
+} TierBuilder;
+
+static size_t count_subtree(FlatNode const *node) {
+    size_t count = 1;
+    for (size_t i = 0; i < node->children_length; ++i) count += count_subtree(flat_child(node, i));
+    return count;
+}
+
+// Slot of the argument named name, args_length when there is none. The last
+// of repeated names is the one the frame binds
+static size_t argument_slot(FlatFunction const *function, char const *name) {
+    for (size_t i = function->args_length; i-- > 0;) {
+        if (strcmp(function->args[i], name) == 0) return i;
+    }
+    return function->args_length;
+}
+
+static void mark_assigned(TierBuilder *builder, FlatNode const *node) {
+    FlatFunction const *function = builder->function;
+    char const *name = NULL;
+    if (node->node_type == ASSIGNMENT || node->node_type == DECLARATION) name = builder->tree->names[node->payload].name;
+    else if (node->node_type == FUNCTION) name = builder->tree->functions[node->payload].name;
+    else if (node->node_type == IMPORT_STMT) memset(builder->assigned, 1, function->args_length);
+    if (name != NULL) {
+        size_t slot = argument_slot(function, name);
+        if (slot < function->args_length) builder->assigned[slot] = 1;
+    }
+    for (size_t i = 0; i < node->children_length; ++i) mark_assigned(builder, flat_child(node, i));
+}
+
+// Replaces nodes[index], an operator whose operands are all literals, with
+// the literal it evaluates to. Operators that fail (a division by zero) stay
+static void fold_constant(TierBuilder *builder, size_t index) {
+    FlatNode const *node = builder->nodes + index;
+    if (node->node_type != ARITHMETIC && node->node_type != COMPARISON && node->node_type != LOGICAL) return;
+    for (size_t i = 0; i < node->children_length; ++i) {
+        if (flat_child(node, i)->node_type != NUMBER) return;
+    }
+
+    EvaluatorContext *context = builder->context;
+    Value result = context->result;
+    evaluate_expression_node(node, context);
+    char folds = !context->error_code && value_is_int(context->result);
+    if (folds) {
+        builder->nodes[index] = (FlatNode){
+            .node_type = NUMBER,
+            .joining_operator = node->joining_operator,
+            .payload = (uint32_t)value_as_int(context->result)
+        };
+        builder->folded += 1;
+    }
+    if (context->error_code) clear_evaluation_error(context);
+    context->result = result;
+}
+
+// Copies node to nodes[index] and its children, one after the other, to the
+// end of the nodes in use. Arguments are resolved unless within an inlined
+// body, whose PARAMETER slots are those of the inlined call
+static void tier_node(TierBuilder *builder, FlatNode const *node, size_t index, char resolve) {
+    FlatNode *tiered = builder->nodes + index;
+    *tiered = *node;
+    if (node->node_type == VARIABLE && resolve) {
+        size_t slot = argument_slot(builder->function, builder->tree->names[node->payload].name);
+        if (slot < builder->function->args_length && !builder->assigned[slot]) {
+            tiered->node_type = PARAMETER;
+            tiered->payload = slot;
+            builder->resolved += 1;
+        }
+    }
+    else if (node->node_type == NUMBER && node->negated) {
+        tiered->payload = 0u - node->payload;
+        tiered->negated = 0;
+    }
+
+    size_t first_child = builder->nodes_length;
+    builder->nodes_length += node->children_length;
+    tiered->first_child = first_child - index;
+    for (size_t i = 0; i < node->children_length; ++i) {
+        char inlined_body = node->node_type == INLINE_CALL && i + 1 == node->children_length;
+        tier_node(builder, flat_child(node, i), first_child + i, resolve && !inlined_body);
+    }
+    fold_constant(builder, index);
+}
 
+// Builds the tiered body of function. Returns NULL when out of memory
+static FlatNode const *tier_up(FlatFunction *function, EvaluatorContext *context) {
+    FlatNode const *body = function->body_tree->nodes + function->body;
+    TierBuilder builder = {
+        .function = function,
+        .tree = function->body_tree,
+        .assigned = stats_calloc(EVALUATOR_ALLOC, function->args_length + 1, 1),
+        .nodes = stats_malloc(PARSER_ALLOC, count_subtree(body) * sizeof(FlatNode)),
+        .nodes_length = 1,
+        .context = context
+    };
+    if (builder.assigned == NULL || builder.nodes == NULL) {
+        stats_free(EVALUATOR_ALLOC, builder.assigned);
+        stats_free(PARSER_ALLOC, builder.nodes);
+        return NULL;
+    }
 
+    mark_assigned(&builder, body);
+    tier_node(&builder, body, 0, 1);
+    stats_free(EVALUATOR_ALLOC, builder.assigned);
 
-void evaluate_number(ASTNode const *node, EvaluatorContext *context);
-void evaluate_variable(ASTNode const *node, EvaluatorContext *context);
-void evaluate_arithmetic(ASTNode const *node, EvaluatorContext *context);
-void evaluate_function_call(ASTNode const *node, EvaluatorContext *context);
-void evaluate_expression_node(ASTNode const *node, EvaluatorContext *context);
+    function->tiered_body = builder.nodes;
+    context->tier_ups += 1;
+    if (context->tier_log != NULL) {
+        fprintf(
+            context->tier_log, "tier up: %s after %zu calls, %zu arguments resolved, %zu expressions folded\n",
+            function->name, function->calls, builder.resolved, builder.folded
+        );
+    }
+    return function->tiered_body;
+}
 
-void evaluate_declaration(ASTNode const *node, EvaluatorContext *context);
-void evaluate_assignment(ASTNode const *node, EvaluatorContext *context);
-void evaluate_print(ASTNode const *node, EvaluatorContext *context);
-void evaluate_return(ASTNode const *node, EvaluatorContext *context);
-void evaluate_if_else(ASTNode const *node, EvaluatorContext *context);
-void evaluate_function(ASTNode const *node, EvaluatorContext *context);
-void evaluate_statement_sequence(ASTNode const *node, EvaluatorContext *context);
+// Body a call of function runs: the tiered one once it is hot. body is the
+// first form, which a failed tier up falls back to
+static FlatNode const *hot_body(FlatFunction *function, FlatNode const *body, EvaluatorContext *context) {
+    if (function->tiered_body != NULL) return function->tiered_body;
+    if (context->tier_up_threshold == 0 || function->body_tree->shared) return body;
+    if (++function->calls < context->tier_up_threshold) return body;
 
+    FlatNode const *tiered = tier_up(function, context);
+    if (tiered != NULL) return tiered;
+    function->calls = 0;
+    return body;
+}
 
 /////////////////////////////
 /// Expression evaluators ///
 /////////////////////////////
 
-void evaluate_number(ASTNode const *node, EvaluatorContext *context) {
-    int32_t result_number = char_to_int(node->value);
-    if (node->prefix_operator != NULL && *node->prefix_operator == SUB_OP) {
-        result_number *= -1;
+// Makes tree the one whose nodes are evaluated. Returns the previous one
+static FlatTree const *enter_tree(FlatTree const *tree, EvaluatorContext *context) {
+    FlatTree const *previous = context->tree;
+    context->tree = tree;
+    context->names = tree ? tree->names : NULL;
+    return previous;
+}
+
+// Name held by the payload of a node of the tree being evaluated
+static inline FlatName const *node_name(FlatNode const *node, EvaluatorContext const *context) {
+    return context->names + node->payload;
+}
+
+// Applies a prefix operator of node to context->result
+static void apply_prefix_operator(FlatNode const *node, EvaluatorContext *context) {
+    if (!node->negated) return;
+    if (_UNLIKELY(!value_is_int(context->result))) {
+        context->error_code = UNEXPECTED_TYPE;
+        context->error_message = unexpected_type_message("-");
+        return;
     }
-    context->result_type = NUMBER_TYPE;
-    context->result.number = result_number;
+    context->result = int_value(-(uint32_t)value_as_int(context->result));
 }
 
-void evaluate_variable(ASTNode const *node, EvaluatorContext *context) {
-    const StackFrameEntry * const entry = search_identifier_value(context, node->value);
+void evaluate_number(FlatNode const *node, EvaluatorContext *context) {
+    context->result = int_value((int32_t)node->payload);
+    apply_prefix_operator(node, context);
+}
+
+void evaluate_variable(FlatNode const *node, EvaluatorContext *context) {
+    FlatName const *name = node_name(node, context);
+    const Value * const entry = search_identifier_value(context, name->name, name->hash);
 
     if (entry == NULL) {
         context->error_code = UNDECLARED_IDENTIFIER;
-        context->error_message = undefined_identifier_message(node->value);
+        context->error_message = undefined_identifier_message(name->name);
         return;
     }
 
-    if (entry->type == ASTNODE_POINTER_ENTRY) {
+    if (value_tag(*entry) == FUNCTION_TAG) {
         context->error_code = CALLABLE_IDENTIFIER_NOT_CALLED;
-        context->error_message = callable_identifier_not_called_message(node->value);
+        context->error_message = callable_identifier_not_called_message(name->name);
         return;
     }
 
-    int32_t result_number = entry->value.number;
-    if (node->prefix_operator != NULL && *node->prefix_operator == SUB_OP) {
-        result_number *= -1;
+    context->result = *entry;
+    apply_prefix_operator(node, context);
+}
+
+// Integer fast path of a binary operator. Arithmetic wraps around like the
+// underlying uint32_t operations
+static inline char apply_int_operator(enum OperatorType operator, int32_t left, int32_t right, int32_t *result) {
+    switch (operator) {
+        case ADD_OP: *result = (uint32_t)left + (uint32_t)right; return 1;
+        case SUB_OP: *result = (uint32_t)left - (uint32_t)right; return 1;
+        case MULT_OP: *result = (uint32_t)left * (uint32_t)right; return 1;
+        case DIV_OP: 
+            if (right == 0) return 0;
+            *result = (right == -1) ? (int32_t)(-(uint32_t)left) : left / right; 
+            return 1;
+        default: break;
     }
-    context->result_type = NUMBER_TYPE;
-    context->result.number = result_number;
+    return 0;
 }
 
-void evaluate_arithmetic(ASTNode const *node, EvaluatorContext *context) {
-    uint32_t *child_evaluations = malloc(node->children_length * 4);
-    if (child_evaluations == NULL) {
+// String concatenation, the only operator defined on strings. An integer
+// operand is converted to its decimal form
+static void concat_values(Value left, Value right, EvaluatorContext *context) {
+    char error = 0;
+    if (value_is_int(left)) error = int_to_string(value_as_int(left), &context->objects, &left);
+    if (value_is_int(right)) error = error || int_to_string(value_as_int(right), &context->objects, &right);
+    if (!error) error = concat_strings(left, right, &context->objects, &context->result);
+    if (error) {
         context->error_code = INTERNAL;
-        return;
+        context->error_message = stats_strdup(EVALUATOR_ALLOC, "Internal Error: Could not allocate memory for string");
     }
+}
 
-    for (size_t i = 0; i < node->children_length; ++i) {
-        evaluate_expression_node(node->children+i, context);
+// Operands are combined as soon as they are evaluated, left to right, so
+// no buffer holds them. The prefix operator negates the result
+void evaluate_arithmetic(FlatNode const *node, EvaluatorContext *context) {
+    evaluate_expression_node(flat_child(node, 0), context);
+    for (size_t i = 1; i < node->children_length && !context->error_code; ++i) {
+        Value left = context->result;
+        FlatNode const *operand = flat_child(node, i);
+        evaluate_expression_node(operand, context);
         if (context->error_code) return;
-        child_evaluations[i] = context->result.number;
-    }
+        Value right = context->result;
+        enum OperatorType operator = operand->joining_operator;
+        if (_UNLIKELY(!values_are_ints(left, right))) {
+            char is_concat = (
+                operator == ADD_OP &&
+                (value_is_string(left) || value_is_string(right)) &&
+                (value_is_string(left) || value_is_int(left)) &&
+                (value_is_string(right) || value_is_int(right))
+            );
+            if (is_concat) {
+                concat_values(left, right, context);
+                continue;
+            }
+            context->error_code = UNEXPECTED_TYPE;
+            context->error_message = unexpected_type_message("arithmetic");
+            return;
+        }
 
-    int32_t result_number = child_evaluations[0];
-    if (node->prefix_operator != NULL && *node->prefix_operator == SUB_OP) {
-        result_number *= -1;
-    }
-    for (size_t i = 1; i < node->children_length; ++i) {
-        if (node->operators[i-1] == ADD_OP) result_number += child_evaluations[i];
-        else if (node->operators[i-1] == SUB_OP) result_number -= child_evaluations[i];
-        else if (node->operators[i-1] == MULT_OP) result_number *= child_evaluations[i];
-        else if (node->operators[i-1] == DIV_OP) result_number /= child_evaluations[i];
+        int32_t result_number;
+        if (!apply_int_operator(operator, value_as_int(left), value_as_int(right), &result_number)) {
+            context->error_code = DIVISION_BY_ZERO;
+            context->error_message = stats_strdup(EVALUATOR_ALLOC, "Division by zero");
+            return;
+        }
+        context->result = int_value(result_number);
     }
-    context->result_type = NUMBER_TYPE;
-    context->result.number = result_number;
+    if (context->error_code) return;
+    apply_prefix_operator(node, context);
 }
 
-void evaluate_function_call(ASTNode const *node, EvaluatorContext *context) {
-    const StackFrameEntry * const entry = search_identifier_value(context, node->value);
+///////////////
+/// Natives ///
+///////////////
 
-    if (entry == NULL) {
-        context->error_code = UNDECLARED_IDENTIFIER;
-        context->error_message = undefined_identifier_message(node->value);
+// The builtins are found only when neither a frame nor the natives of the
+// host bind the name, so scripts may shadow them. min and max take an array
+// or two integers, the only names listed for two arities
+
+static char expect_array(Value value, char const *name, EvaluatorContext *context) {
+    if (_LIKELY(value_is_array(value))) return 0;
+    context->error_code = UNEXPECTED_TYPE;
+    context->error_message = unexpected_type_message(name);
+    return 1;
+}
+
+static char expect_ints(Value left, Value right, char const *name, EvaluatorContext *context) {
+    if (_LIKELY(values_are_ints(left, right))) return 0;
+    context->error_code = UNEXPECTED_TYPE;
+    context->error_message = unexpected_type_message(name);
+    return 1;
+}
+
+static void fail_arguments(char const *name, EvaluatorContext *context) {
+    context->error_code = UNEXPECTED_ARGUMENTS;
+    context->error_message = unexpected_arguments_message(name);
+}
+
+static void builtin_len(Native const *native, Value const *args, EvaluatorContext *context) {
+    if (expect_array(args[0], native->name, context)) return;
+    context->result = int_value(value_as_array(args[0])->length);
+}
+
+static void builtin_range(Native const *native, Value const *args, EvaluatorContext *context) {
+    if (!value_is_int(args[0]) || value_as_int(args[0]) < 0) {
+        fail_arguments(native->name, context);
+        return;
+    }
+    if (new_array(value_as_int(args[0]), &context->objects, &context->result)) {
+        context->error_code = INTERNAL;
         return;
     }
+    Array *array = value_as_array(context->result);
+    for (size_t i = 0; i < array->length; ++i) array->items[i] = i;
+}
 
-    if (entry->type != ASTNODE_POINTER_ENTRY) {
-        context->error_code = NOT_CALLABLE,
-        context->error_message = not_callable_message(node->value);
+static void builtin_sum(Native const *native, Value const *args, EvaluatorContext *context) {
+    if (expect_array(args[0], native->name, context)) return;
+    Array const *array = value_as_array(args[0]);
+    context->result = int_value(sum_int32(array->items, array->length));
+}
+
+static void builtin_min(Native const *native, Value const *args, EvaluatorContext *context) {
+    if (expect_array(args[0], native->name, context)) return;
+    Array const *array = value_as_array(args[0]);
+    if (array->length == 0) {
+        fail_arguments(native->name, context);
         return;
     }
+    context->result = int_value(min_int32(array->items, array->length));
+}
 
-    if (node->children_length != entry->value.function_node->args_length) {
-        context->error_code = UNEXPECTED_ARGUMENTS;
-        context->error_message = unexpected_arguments_message(node->value);
+static void builtin_max(Native const *native, Value const *args, EvaluatorContext *context) {
+    if (expect_array(args[0], native->name, context)) return;
+    Array const *array = value_as_array(args[0]);
+    if (array->length == 0) {
+        fail_arguments(native->name, context);
         return;
     }
+    context->result = int_value(max_int32(array->items, array->length));
+}
 
-    uint32_t *arg_values = malloc(node->children_length * 4);
-    if (arg_values == NULL) {
-        context->error_code = INTERNAL;
+static void builtin_dot(Native const *native, Value const *args, EvaluatorContext *context) {
+    if (expect_array(args[0], native->name, context) || expect_array(args[1], native->name, context)) return;
+    Array const *left = value_as_array(args[0]), *right = value_as_array(args[1]);
+    if (left->length != right->length) {
+        fail_arguments(native->name, context);
         return;
     }
+    context->result = int_value(dot_int32(left->items, right->items, left->length));
+}
 
-    for (size_t i = 0; i < node->children_length; ++i) {
-        evaluate_expression_node(node->children+i, context);
-        if (context->error_code) return;
-        arg_values[i] = context->result.number;
+// map_add / map_mul: element wise with an array of the same length, or with
+// an integer applied to every element. Always returns a new array
+static void map_builtin(
+    Native const *native, 
+    Value const *args, 
+    EvaluatorContext *context,
+    void (*kernel)(int32_t *, int32_t const *, int32_t const *, int32_t, size_t)
+) {
+    if (expect_array(args[0], native->name, context)) return;
+    Array const *left = value_as_array(args[0]);
+    Array const *right = value_is_array(args[1]) ? value_as_array(args[1]) : NULL;
+    if ((right == NULL && !value_is_int(args[1])) || (right != NULL && right->length != left->length)) {
+        fail_arguments(native->name, context);
+        return;
     }
 
-    char error = allocate_stack_frame(
-        context,
-        entry->value.function_node->args, 
-        arg_values, 
-        entry->value.function_node->args_length
-    );
-    
-    if(error) {
+    Value result;
+    if (new_array(left->length, &context->objects, &result)) {
         context->error_code = INTERNAL;
         return;
     }
+    kernel(
+        value_as_array(result)->items, 
+        left->items, 
+        right ? right->items : NULL, 
+        right ? 0 : value_as_int(args[1]), 
+        left->length
+    );
+    context->result = result;
+}
 
-    evaluate_statement_sequence(entry->value.function_node->children+0, context);
-    
-    stack_pop(&context->stack_frames);
-    
-    if (node->prefix_operator != NULL && *node->prefix_operator == SUB_OP) {
-        context->result.number *= -1;
-    }
+static void builtin_map_add(Native const *native, Value const *args, EvaluatorContext *context) {
+    map_builtin(native, args, context, add_int32);
 }
 
-void evaluate_expression_node(ASTNode const *node, EvaluatorContext *context) {
-     if (node->node_type == NUMBER) evaluate_number(node, context);
-     else if (node->node_type == VARIABLE) evaluate_variable(node, context);
-     else if (node->node_type == ARITHMETIC) evaluate_arithmetic(node, context);
-     else if (node->node_type == FUNCTION_CALL) evaluate_function_call(node, context);
-     else context->error_code = INTERNAL; 
+static void builtin_map_mul(Native const *native, Value const *args, EvaluatorContext *context) {
+    map_builtin(native, args, context, mul_int32);
 }
 
+// The integer builtins wrap around like the arithmetic operators
+static void builtin_abs(Native const *native, Value const *args, EvaluatorContext *context) {
+    if (expect_ints(args[0], args[0], native->name, context)) return;
+    uint32_t number = (uint32_t)value_as_int(args[0]);
+    context->result = int_value((int32_t)(value_as_int(args[0]) < 0 ? 0u - number : number));
+}
 
-////////////////////////////
-/// Statement evaluators ///
-////////////////////////////
+static void builtin_min_of_two(Native const *native, Value const *args, EvaluatorContext *context) {
+    if (expect_ints(args[0], args[1], native->name, context)) return;
+    context->result = value_as_int(args[0]) <= value_as_int(args[1]) ? args[0] : args[1];
+}
 
-void evaluate_declaration(ASTNode const *node, EvaluatorContext *context) { 
-    HashTable *current_frame = stack_top(&context->stack_frames);
-    char const *name = node->children[0].value;
-    
-    if (hash_table_get(current_frame, name) != NULL) {
-        context->error_code = VARIABLE_EXISTS;
-        context->error_message = variable_exists_message(name);
-        context->result.number = 0;
+static void builtin_max_of_two(Native const *native, Value const *args, EvaluatorContext *context) {
+    if (expect_ints(args[0], args[1], native->name, context)) return;
+    context->result = value_as_int(args[0]) >= value_as_int(args[1]) ? args[0] : args[1];
+}
+
+// pow(base, exponent) by squaring, a negative exponent fails
+static void builtin_pow(Native const *native, Value const *args, EvaluatorContext *context) {
+    if (expect_ints(args[0], args[1], native->name, context)) return;
+    if (value_as_int(args[1]) < 0) {
+        fail_arguments(native->name, context);
+        return;
+    }
+    uint32_t base = (uint32_t)value_as_int(args[0]), result = 1;
+    for (uint32_t exponent = value_as_int(args[1]); exponent > 0; exponent >>= 1) {
+        if (exponent & 1) result *= base;
+        base *= base;
+    }
+    context->result = int_value((int32_t)result);
+}
+
+// mod(a, b) rounds the quotient down, so the result has the sign of b
+static void builtin_mod(Native const *native, Value const *args, EvaluatorContext *context) {
+    if (expect_ints(args[0], args[1], native->name, context)) return;
+    int32_t left = value_as_int(args[0]), right = value_as_int(args[1]);
+    if (right == 0) {
+        context->error_code = DIVISION_BY_ZERO;
+        context->error_message = stats_strdup(EVALUATOR_ALLOC, "Division by zero");
         return;
     }
+    // INT32_MIN % -1 overflows in C
+    int32_t remainder = right == -1 ? 0 : left % right;
+    if (remainder != 0 && (remainder < 0) != (right < 0)) remainder += right;
+    context->result = int_value(remainder);
+}
 
-    evaluate_expression_node(node->children+1, context);
+static Native const builtins[] = {
+    {"len", 1, builtin_len, NULL},
+    {"range", 1, builtin_range, NULL},
+    {"sum", 1, builtin_sum, NULL},
+    {"min", 1, builtin_min, NULL},
+    {"min", 2, builtin_min_of_two, NULL},
+    {"max", 1, builtin_max, NULL},
+    {"max", 2, builtin_max_of_two, NULL},
+    {"dot", 2, builtin_dot, NULL},
+    {"map_add", 2, builtin_map_add, NULL},
+    {"map_mul", 2, builtin_map_mul, NULL},
+    {"abs", 1, builtin_abs, NULL},
+    {"pow", 2, builtin_pow, NULL},
+    {"mod", 2, builtin_mod, NULL},
+    {"join", 1, builtin_join, NULL},
+};
 
-    StackFrameEntry entry = {.type=INT32_T_ENTRY, .value.number=context->result.number};
-    char error = hash_table_set(current_frame, name, &entry);
-    if (error) context->error_code = INTERNAL;
-    context->result.number = 0;
+// Native a call of name with args_length arguments goes to: one the host
+// registered, else a builtin of that arity, else any builtin of the name,
+// which then fails the arity check
+static Native const *find_native(EvaluatorContext const *context, FlatName const *name, size_t args_length) {
+    if (context->natives.rows != NULL) {
+        Native const * const *native = hash_table_get_hashed(&context->natives, name->name, name->hash);
+        if (native != NULL) return *native;
+    }
+    Native const *found = NULL;
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i) {
+        if (strcmp(builtins[i].name, name->name) != 0) continue;
+        found = builtins+i;
+        if (found->args_length == args_length) break;
+    }
+    return found;
 }
 
-void evaluate_assignment(ASTNode const *node, EvaluatorContext *context) { 
-    HashTable *current_frame = stack_top(&context->stack_frames);
-    char *name = node->children[0].value;
-    
-    if (hash_table_get(current_frame, name) == NULL) {
-        context->error_code = UNDECLARED_IDENTIFIER;
-        context->error_message = undefined_identifier_message(name);
-        context->result.number = 0;
+char register_natives(EvaluatorContext *context, Native const *natives, size_t natives_length) {
+    if (context->natives.rows == NULL) {
+        context->natives = init_hash_table(_INITIAL_NATIVES_CAPACITY, sizeof(Native const *));
+        if (context->natives.rows == NULL) return 1;
+    }
+    for (size_t i = 0; i < natives_length; ++i) {
+        Native const *native = natives+i;
+        if (native->args_length > _MAX_NATIVE_ARGS || hash_table_set(&context->natives, native->name, &native)) return 1;
+    }
+    // call sites may hold a builtin that a native now replaces
+    invalidate_call_caches(context);
+    return 0;
+}
+
+static void evaluate_native(Native const *native, FlatNode const *node, EvaluatorContext *context) {
+    if (node->children_length != native->args_length) {
+        fail_arguments(native->name, context);
         return;
     }
 
-    evaluate_expression_node(node->children+1, context);
+    Value args[_MAX_NATIVE_ARGS];
+    for (size_t i = 0; i < node->children_length; ++i) {
+        evaluate_expression_node(flat_child(node, i), context);
+        if (context->error_code) return;
+        args[i] = context->result;
+    }
 
-    StackFrameEntry entry = {.type=INT32_T_ENTRY, .value.number=context->result.number};
-    char error = hash_table_set(current_frame, name, &entry);
-    if (error) context->error_code = INTERNAL;
-    context->result.number = 0;
+    if (limits_exceeded(context)) return;
+
+    native->function(native, args, context);
+    if (context->error_code) return;
+    apply_prefix_operator(node, context);
 }
 
-void evaluate_return(ASTNode const *node, EvaluatorContext *context) {
-    evaluate_expression_node(node->children+0, context);
+// Full lookup of a call's callee, which fills the call site cache once the
+// callee is known to fit the call. A native is evaluated right away and
+// gives NULL, as does an error
+static FlatFunction *resolve_callee(FlatNode const *node, FlatCallSite *call_site, EvaluatorContext *context) {
+    FlatName const *name = context->names + call_site->name;
+    size_t frame_index;
+    const Value * const entry = search_identifier_frame(context, name->name, name->hash, &frame_index);
+
+    if (entry == NULL) {
+        Native const *native = find_native(context, name, node->children_length);
+        if (native == NULL) {
+            context->error_code = UNDECLARED_IDENTIFIER;
+            context->error_message = undefined_identifier_message(name->name);
+            return NULL;
+        }
+        // natives sit below every frame, binding the name anywhere shadows them
+        if (native->args_length == node->children_length && call_site->cache.epoch != _UNCACHED_CALL_SITE) {
+            call_site->cache.callee = pointer_value(native, NATIVE_TAG);
+            call_site->cache.epoch = context->binding_epoch;
+            context->cached_callee_bits |= hash_bit(name->hash);
+        }
+        evaluate_native(native, node, context);
+        return NULL;
+    }
+
+    if (value_tag(*entry) != FUNCTION_TAG) {
+        context->error_code = NOT_CALLABLE,
+        context->error_message = not_callable_message(name->name);
+        return NULL;
+    }
+
+    FlatFunction *function = value_as_pointer(*entry);
+    if (node->children_length != function->args_length) {
+        context->error_code = UNEXPECTED_ARGUMENTS;
+        context->error_message = unexpected_arguments_message(name->name);
+        return NULL;
+    }
+
+    if (call_site->cache.epoch == _UNCACHED_CALL_SITE) return function;
+    call_site->cache.callee = *entry;
+    call_site->cache.epoch = context->binding_epoch;
+    context->cached_callee_bits |= hash_bit(name->hash);
+    if (frame_index > context->highest_cached_frame) context->highest_cached_frame = frame_index;
+    return function;
 }
 
-void evaluate_print(ASTNode const *node, EvaluatorContext *context) {
-    evaluate_expression_node(node->children+0, context);
-    if (context->error_code) return;
+// Body of a function, parsing it on the first call. Sets the error when it
+// does not parse
+static FlatNode const *callable_body(FlatFunction *function, EvaluatorContext *context) {
+    FlatNode const *body = flat_function_body(function);
+    if (body != NULL) return body;
+    context->error_code = function->error_message ? SYNTAX_ERROR : INTERNAL;
+    if (function->error_message) context->error_message = stats_strdup(EVALUATOR_ALLOC, function->error_message);
+    return NULL;
+}
 
-    stack_push(&context->side_effects, &context->result.number);
-    if (!context->dry_run) {
-        printf("%d\n", context->result.number);
+// Runs the parsed body of function in a new frame binding its arguments to
+// arg_values, counting one step. The result is left in context->result
+static void invoke_function(FlatFunction const *function, FlatNode const *body, Value *arg_values, EvaluatorContext *context) {
+    if (limits_exceeded(context)) return;
+
+    note_binding(context, function->args_hash_bits);
+    char error = allocate_stack_frame(
+        context,
+        function->args, 
+        arg_values, 
+        function->args_length
+    );
+    if(error) {
+        context->error_code = INTERNAL;
+        return;
     }
 
-    context->result.number = 0;
+    // names and call sites of the body are in the tree holding it. A tiered
+    // body reads the arguments from their slots
+    FlatTree const *caller_tree = enter_tree(function->body_tree, context);
+    Value const *outer_args = context->inline_args;
+    context->inline_args = arg_values;
+    size_t depth = context->stack_frames.length - 1;
+    _PROBE2(function__entry, function->name, depth);
+    _HOOK(context, function_entry, function->name, depth);
+    evaluate_statement_sequence(body, context);
+    _PROBE2(function__exit, function->name, depth);
+    _HOOK(context, function_exit, function->name, depth);
+    context->inline_args = outer_args;
+    enter_tree(caller_tree, context);
+    context->returning = 0;
+    
+    pop_stack_frame(context);
 }
 
-void evaluate_if_else(ASTNode const *node, EvaluatorContext *context) {
-    evaluate_expression_node(node->children+0, context);
-    if (context->result.number != 0) {
-        evaluate_statement_sequence(node->children+1, context);
+void evaluate_function_call(FlatNode const *node, EvaluatorContext *context) {
+    context->function_calls += 1;
+
+    // a hit skips the walk over the frames and the arity check
+    FlatCallSite *call_site = context->tree->call_sites + node->payload;
+    FlatFunction *function;
+    if (_LIKELY(call_site->cache.epoch == context->binding_epoch)) {
+        if (_UNLIKELY(value_tag(call_site->cache.callee) == NATIVE_TAG)) {
+            evaluate_native(value_as_pointer(call_site->cache.callee), node, context);
+            return;
+        }
+        function = value_as_pointer(call_site->cache.callee);
     }
     else {
-        if (node->children_length == 3) {
-            evaluate_statement_sequence(node->children+2, context);
+        function = resolve_callee(node, call_site, context);
+        if (function == NULL) return;
+    }
+
+    FlatNode const *body = function->tiered_body;
+    if (body == NULL) {
+        body = callable_body(function, context);
+        if (body == NULL) return;
+        body = hot_body(function, body, context);
+    }
+
+    // the usual arities fit on the C stack
+    Value stack_values[_MAX_INLINED_ARGS];
+    Value *arg_values = stack_values;
+    if (node->children_length > _MAX_INLINED_ARGS) {
+        arg_values = stats_malloc(EVALUATOR_ALLOC, node->children_length * sizeof(Value));
+        if (arg_values == NULL) {
+            context->error_code = INTERNAL;
+            return;
         }
     }
-}
 
-void evaluate_function(ASTNode const *node, EvaluatorContext *context) {  
-    HashTable *current_frame = stack_top(&context->stack_frames);
-    char *name = node->value;
+    for (size_t i = 0; i < node->children_length && !context->error_code; ++i) {
+        evaluate_expression_node(flat_child(node, i), context);
+        arg_values[i] = context->result;
+    }
+    if (!context->error_code) invoke_function(function, body, arg_values, context);
+    if (arg_values != stack_values) stats_free(EVALUATOR_ALLOC, arg_values);
+    if (context->error_code) return;
     
-    if (hash_table_get(current_frame, name) != NULL) {
-        context->error_code = VARIABLE_EXISTS;
-        context->error_message = variable_exists_message(name);
-        context->result.number = 0;
-        return;
+    apply_prefix_operator(node, context);
+}
+
+// The arguments go to a buffer on the C stack that the PARAMETER nodes of the
+// body read, no frame is allocated and no step counted
+void evaluate_inline_call(FlatNode const *node, EvaluatorContext *context) {
+    size_t args_length = node->children_length - 1;
+    Value arg_values[_MAX_INLINED_ARGS];
+    for (size_t i = 0; i < args_length; ++i) {
+        evaluate_expression_node(flat_child(node, i), context);
+        if (context->error_code) return;
+        arg_values[i] = context->result;
     }
 
-    StackFrameEntry entry = {.type=ASTNODE_POINTER_ENTRY, .value.function_node=node};
-    char error = hash_table_set(current_frame, name, &entry);
-    if (error) context->error_code = INTERNAL;
-    context->result.number = 0;
+    Value const *outer_args = context->inline_args;
+    context->inline_args = arg_values;
+    evaluate_expression_node(flat_child(node, args_length), context);
+    context->inline_args = outer_args;
+    if (context->error_code) return;
+
+    apply_prefix_operator(node, context);
 }
 
-void evaluate_statement_sequence(ASTNode const *node, EvaluatorContext *context) {
+void evaluate_parameter(FlatNode const *node, EvaluatorContext *context) {
+    context->result = context->inline_args[node->payload];
+    apply_prefix_operator(node, context);
+}
+
+void evaluate_string(FlatNode const *node, EvaluatorContext *context) {
+    context->result = context->tree->strings[node->payload];
+    apply_prefix_operator(node, context);
+}
+
+void evaluate_array(FlatNode const *node, EvaluatorContext *context) {
+    Value array;
+    if (new_array(node->children_length, &context->objects, &array)) {
+        context->error_code = INTERNAL;
+        return;
+    }
+
     for (size_t i = 0; i < node->children_length; ++i) {
-        if (node->children[i].node_type == DECLARATION) evaluate_declaration(node->children+i, context);
-        else if (node->children[i].node_type == ASSIGNMENT) evaluate_assignment(node->children+i, context);
-        else if (node->children[i].node_type == PRINT_STMT) evaluate_print(node->children+i, context); 
-        else if (node->children[i].node_type == IF_ELSE_STMT) evaluate_if_else(node->children+i, context);
-        else if (node->children[i].node_type == FUNCTION) evaluate_function(node->children+i, context);
-        else { // node_type == RETURN 
-            evaluate_return(node->children+i, context);
+        evaluate_expression_node(flat_child(node, i), context);
+        if (context->error_code) return;
+        if (!value_is_int(context->result)) {
+            context->error_code = UNEXPECTED_TYPE;
+            context->error_message = unexpected_type_message("array element");
             return;
         }
-        if (context->error_code) return;
+        value_as_array(array)->items[i] = value_as_int(context->result);
     }
+
+    context->result = array;
+    apply_prefix_operator(node, context);
 }
 
-EvaluatorContext evaluate(ASTNode *node, char dry_run) {
-    if (node->node_type != STMT_SEQUENCE) { 
-        EvaluatorContext context = {
-            .error_code = INTERNAL,
-            .error_message = "Internal Error: Invalid AST node type received",
-            .dry_run = dry_run
-        };
-        return context;
+// Looks up the array variable of an INDEX or INDEX_ASSIGNMENT node and
+// evaluates its index. Returns NULL and sets the error on failure
+static Array *evaluate_array_slot(FlatNode const *node, EvaluatorContext *context, size_t *index) {
+    FlatName const *name = node_name(node, context);
+    const Value * const entry = search_identifier_value(context, name->name, name->hash);
+    if (entry == NULL) {
+        context->error_code = UNDECLARED_IDENTIFIER;
+        context->error_message = undefined_identifier_message(name->name);
+        return NULL;
     }
+    if (!value_is_array(*entry)) {
+        context->error_code = UNEXPECTED_TYPE;
+        context->error_message = unexpected_type_message("indexing");
+        return NULL;
+    }
+    Array *array = value_as_array(*entry);
 
-    Stack stack_frames = init_stack(_INITIAL_STACK_FRAMES_CAPACITY, sizeof(HashTable));
-    if (stack_frames.buffer == NULL) {
-        EvaluatorContext context = {
-            .error_code = INTERNAL,
-            .error_message = "Internal Error: Could not allocate memory for stack frames",
-            .dry_run = dry_run
-        };
-        return context;
+    evaluate_expression_node(flat_child(node, 0), context);
+    if (context->error_code) return NULL;
+    if (!value_is_int(context->result)) {
+        context->error_code = UNEXPECTED_TYPE;
+        context->error_message = unexpected_type_message("index");
+        return NULL;
     }
-    
-    HashTable frame = init_hash_table(_INITIAL_IDENTIFIER_TABLE_CAPACITY, sizeof(StackFrameEntry));
-    HashTable *main_frame = malloc(sizeof(HashTable));
-    if (frame.rows == NULL || main_frame == NULL) {
-        EvaluatorContext context = {
-            .error_code = INTERNAL,
-            .error_message = "Internal Error: Could not allocate memory for main frame",
-            .dry_run = dry_run
-        };
-        return context;
+
+    int32_t position = value_as_int(context->result);
+    if (position < 0 || (size_t)position >= array->length) {
+        context->error_code = INDEX_OUT_OF_RANGE;
+        context->error_message = index_out_of_range_message(position, array->length);
+        return NULL;
     }
-    memcpy(main_frame, &frame, sizeof(HashTable));
+    *index = position;
+    return array;
+}
 
-    if (!stack_push(&stack_frames, main_frame)) {
-        EvaluatorContext context = {
-            .error_code = INTERNAL,
-            .error_message = "Internal Error: Could not allocate memory for main frame",
-            .dry_run = dry_run
-        };
-        return context;
+void evaluate_index(FlatNode const *node, EvaluatorContext *context) {
+    size_t index;
+    Array const *array = evaluate_array_slot(node, context, &index);
+    if (array == NULL) return;
+    context->result = int_value(array->items[index]);
+    apply_prefix_operator(node, context);
+}
+
+// Outcome of a comparison operator. Any two values can be tested for
+// equality (strings by content, other objects by identity); ordering is
+// defined on integers only
+static char compare_values(enum OperatorType operator, Value left, Value right, EvaluatorContext *context) {
+    if (_LIKELY(values_are_ints(left, right))) {
+        int32_t l = value_as_int(left), r = value_as_int(right);
+        switch (operator) {
+            case EQ_OP: return l == r;
+            case NE_OP: return l != r;
+            case LT_OP: return l < r;
+            case LE_OP: return l <= r;
+            case GT_OP: return l > r;
+            case GE_OP: return l >= r;
+            default: break;
+        }
+    }
+    else if (operator == EQ_OP || operator == NE_OP) {
+        char equal = (
+            value_is_string(left) && value_is_string(right) ? 
+            strings_equal(left, right) : 
+            left == right
+        );
+        return operator == EQ_OP ? equal : !equal;
     }
 
-    Stack side_effects = init_stack(1024, sizeof(int32_t));
+    context->error_code = UNEXPECTED_TYPE;
+    context->error_message = unexpected_type_message("comparison");
+    return 0;
+}
 
-    EvaluatorContext context = {
-        .stack_frames = stack_frames,
+// Outcome of a COMPARISON or LOGICAL node, ignoring its prefix operator.
+// The right side of && / || is only evaluated when it decides the outcome
+static char evaluate_binary_condition(FlatNode const *node, EvaluatorContext *context) {
+    if (node->node_type == LOGICAL) {
+        char left = evaluate_condition(flat_child(node, 0), context);
+        if (context->error_code) return 0;
+        if (node->operator == AND_OP ? !left : left) return left;
+        return evaluate_condition(flat_child(node, 1), context);
+    }
+
+    evaluate_expression_node(flat_child(node, 0), context);
+    if (context->error_code) return 0;
+    Value left = context->result;
+    evaluate_expression_node(flat_child(node, 1), context);
+    if (context->error_code) return 0;
+    return compare_values(node->operator, left, context->result, context);
+}
+
+// Truth value of a condition. Comparisons and && / || branch on their
+// outcome directly instead of materializing an integer first
+static char evaluate_condition(FlatNode const *node, EvaluatorContext *context) {
+    char is_binary = node->node_type == COMPARISON || node->node_type == LOGICAL;
+    if (is_binary && !node->negated) return evaluate_binary_condition(node, context);
+
+    evaluate_expression_node(node, context);
+    if (context->error_code) return 0;
+    return value_is_truthy(context->result);
+}
+
+// COMPARISON and LOGICAL used as values evaluate to 1 or 0
+void evaluate_comparison(FlatNode const *node, EvaluatorContext *context) {
+    char outcome = evaluate_binary_condition(node, context);
+    if (context->error_code) return;
+    context->result = int_value(outcome);
+    apply_prefix_operator(node, context);
+}
+
+void evaluate_expression_node(FlatNode const *node, EvaluatorContext *context) {
+     if (node->node_type == NUMBER) evaluate_number(node, context);
+     else if (node->node_type == VARIABLE) evaluate_variable(node, context);
+     else if (node->node_type == ARITHMETIC) evaluate_arithmetic(node, context);
+     else if (node->node_type == FUNCTION_CALL) evaluate_function_call(node, context);
+     else if (node->node_type == PARAMETER) evaluate_parameter(node, context);
+     else if (node->node_type == INLINE_CALL) evaluate_inline_call(node, context);
+     else if (node->node_type == STRING) evaluate_string(node, context);
+     else if (node->node_type == ARRAY) evaluate_array(node, context);
+     else if (node->node_type == INDEX) evaluate_index(node, context);
+     else if (node->node_type == COMPARISON || node->node_type == LOGICAL) evaluate_comparison(node, context);
+     else if (node->node_type == SPAWN_CALL) evaluate_spawn(node, context);
+     else if (node->node_type == PMAP_CALL) evaluate_pmap(node, context);
+     else context->error_code = INTERNAL; 
+}
+
+
+////////////////////
+/// Loop kernels ///
+////////////////////
+
+// A while loop whose condition and body only read integer variables and
+// assign integer arithmetic, comparisons and && / || of them is compiled,
+// each time it is entered, to instructions over registers holding those
+// variables. The registers are written back to the frames when the loop
+// ends or fails. Iterations count as steps as on the tree. Any other loop,
+// or one reading a variable that is not an integer on entry, runs on the tree
+
+#define _KERNEL_REGISTERS 32
+#define _KERNEL_INSTRUCTIONS 64
+
+// target = left op right, wrapping around like apply_int_operator(). The
+// comparisons give 1 or 0, && and || combine the truth values of both sides
+enum KernelOp {
+    KERNEL_ADD,
+    KERNEL_SUB,
+    KERNEL_MUL,
+    KERNEL_DIV,
+    KERNEL_EQ,
+    KERNEL_NE,
+    KERNEL_LT,
+    KERNEL_LE,
+    KERNEL_GT,
+    KERNEL_GE,
+    KERNEL_AND,
+    KERNEL_OR,
+    KERNEL_NEGATE,      // target = -left
+    KERNEL_MOVE,        // target = left
+    KERNEL_EXIT         // leaves the loop when left is 0
+};
+
+typedef struct {
+    uint8_t op;         // enum KernelOp
+    uint8_t target;
+    uint8_t left;
+    uint8_t right;
+} KernelInstruction;
+
+// Registers [0, variables_length) hold the variables, the rest constants and
+// temporaries
+typedef struct {
+    // the condition, a KERNEL_EXIT on its value, then the body
+    KernelInstruction instructions[_KERNEL_INSTRUCTIONS];
+    size_t instructions_length;
+    int32_t registers[_KERNEL_REGISTERS];
+    size_t registers_length;
+    Value *slots[_KERNEL_REGISTERS];    // of the variables
+    FlatName const *names[_KERNEL_REGISTERS];
+    char assigned[_KERNEL_REGISTERS];
+    size_t variables_length;
+    char failed;                // the loop cannot be compiled
+} LoopKernel;
+
+static uint8_t kernel_register(LoopKernel *kernel, int32_t value) {
+    if (kernel->registers_length == _KERNEL_REGISTERS) {
+        kernel->failed = 1;
+        return 0;
+    }
+    kernel->registers[kernel->registers_length] = value;
+    return kernel->registers_length++;
+}
+
+// Appends an instruction writing to a new temporary, whose register it returns
+static uint8_t emit_kernel(LoopKernel *kernel, enum KernelOp op, uint8_t left, uint8_t right) {
+    uint8_t target = kernel_register(kernel, 0);
+    if (kernel->instructions_length == _KERNEL_INSTRUCTIONS) kernel->failed = 1;
+    if (kernel->failed) return 0;
+    kernel->instructions[kernel->instructions_length++] = (KernelInstruction){
+        .op = op, .target = target, .left = left, .right = right
+    };
+    return target;
+}
+
+// Appends an instruction writing to no temporary: a move to target or an exit.
+// A move of the temporary just computed retargets its instruction instead
+static void emit_kernel_to(LoopKernel *kernel, enum KernelOp op, uint8_t target, uint8_t left) {
+    if (kernel->instructions_length == _KERNEL_INSTRUCTIONS) kernel->failed = 1;
+    if (kernel->failed) return;
+    size_t length = kernel->instructions_length;
+    if (op == KERNEL_MOVE && length && kernel->instructions[length - 1].target == left && left >= kernel->variables_length) {
+        kernel->instructions[length - 1].target = target;
+        return;
+    }
+    kernel->instructions[kernel->instructions_length++] = (KernelInstruction){.op = op, .target = target, .left = left};
+}
+
+// Register of the variable name, resolved once. Variables come before every
+// other register, so all of them are looked up before the first constant
+static uint8_t kernel_variable(LoopKernel *kernel, FlatName const *name, EvaluatorContext *context) {
+    for (size_t i = 0; i < kernel->variables_length; ++i) {
+        if (kernel->names[i] == name || strcmp(kernel->names[i]->name, name->name) == 0) return i;
+    }
+    Value *slot = (Value *)search_identifier_value(context, name->name, name->hash);
+    if (slot == NULL || !value_is_int(*slot) || kernel->variables_length != kernel->registers_length) {
+        kernel->failed = 1;
+        return 0;
+    }
+    uint8_t index = kernel_register(kernel, value_as_int(*slot));
+    if (kernel->failed) return 0;
+    kernel->slots[index] = slot;
+    kernel->names[index] = name;
+    kernel->variables_length += 1;
+    return index;
+}
+
+// Adds the variables that the subtree of node reads or assigns
+static void collect_kernel_variables(LoopKernel *kernel, FlatNode const *node, EvaluatorContext *context) {
+    if (node->node_type == VARIABLE || node->node_type == ASSIGNMENT) kernel_variable(kernel, node_name(node, context), context);
+    for (size_t i = 0; i < node->children_length && !kernel->failed; ++i) {
+        collect_kernel_variables(kernel, flat_child(node, i), context);
+    }
+}
+
+static char kernel_divides(LoopKernel const *kernel, size_t first) {
+    for (size_t i = first; i < kernel->instructions_length; ++i) {
+        if (kernel->instructions[i].op == KERNEL_DIV) return 1;
+    }
+    return 0;
+}
+
+// Register holding the value of an expression, failing the kernel on a node
+// it cannot run
+static uint8_t compile_kernel_expression(LoopKernel *kernel, FlatNode const *node, EvaluatorContext *context) {
+    uint8_t result = 0;
+    switch (node->node_type) {
+        case NUMBER: {
+            uint32_t number = node->payload;
+            return kernel_register(kernel, node->negated ? -number : number);
+        }
+        case VARIABLE:
+            result = kernel_variable(kernel, node_name(node, context), context);
+            break;
+        case ARITHMETIC:
+            result = compile_kernel_expression(kernel, flat_child(node, 0), context);
+            for (size_t i = 1; i < node->children_length && !kernel->failed; ++i) {
+                FlatNode const *operand = flat_child(node, i);
+                uint8_t right = compile_kernel_expression(kernel, operand, context);
+                result = emit_kernel(kernel, KERNEL_ADD + operand->joining_operator - ADD_OP, result, right);
+            }
+            break;
+        case COMPARISON: {
+            uint8_t left = compile_kernel_expression(kernel, flat_child(node, 0), context);
+            uint8_t right = compile_kernel_expression(kernel, flat_child(node, 1), context);
+            result = emit_kernel(kernel, KERNEL_EQ + node->operator - EQ_OP, left, right);
+            break;
+        }
+        case LOGICAL: {
+            uint8_t left = compile_kernel_expression(kernel, flat_child(node, 0), context);
+            size_t right_start = kernel->instructions_length;
+            uint8_t right = compile_kernel_expression(kernel, flat_child(node, 1), context);
+            // both sides run, which only matches the tree when the right
+            // side cannot fail
+            if (kernel_divides(kernel, right_start)) kernel->failed = 1;
+            result = emit_kernel(kernel, node->operator == AND_OP ? KERNEL_AND : KERNEL_OR, left, right);
+            break;
+        }
+        default:
+            kernel->failed = 1;
+            return 0;
+    }
+    if (node->negated) result = emit_kernel(kernel, KERNEL_NEGATE, result, result);
+    return result;
+}
+
+// Compiles the loop of a WHILE_STMT. Returns 0 when it cannot run as a kernel
+static char compile_loop_kernel(LoopKernel *kernel, FlatNode const *node, EvaluatorContext *context) {
+    FlatNode const *body = flat_child(node, 1);
+    if (body->node_type != STMT_SEQUENCE) return 0;
+    for (size_t i = 0; i < body->children_length; ++i) {
+        if (flat_child(body, i)->node_type != ASSIGNMENT) return 0;
+    }
+
+    collect_kernel_variables(kernel, node, context);
+    if (kernel->failed) return 0;
+    // assignments write to the current frame only
+    HashTable const *current_frame = stack_top(&context->stack_frames);
+    for (size_t i = 0; i < body->children_length; ++i) {
+        FlatName const *name = node_name(flat_child(body, i), context);
+        uint8_t variable = kernel_variable(kernel, name, context);
+        if (hash_table_get_hashed(current_frame, name->name, name->hash) != kernel->slots[variable]) return 0;
+        kernel->assigned[variable] = 1;
+    }
+
+    uint8_t condition = compile_kernel_expression(kernel, flat_child(node, 0), context);
+    emit_kernel_to(kernel, KERNEL_EXIT, 0, condition);
+    for (size_t i = 0; i < body->children_length && !kernel->failed; ++i) {
+        FlatNode const *assignment = flat_child(body, i);
+        uint8_t value = compile_kernel_expression(kernel, flat_child(assignment, 0), context);
+        emit_kernel_to(kernel, KERNEL_MOVE, kernel_variable(kernel, node_name(assignment, context), context), value);
+    }
+    return !kernel->failed;
+}
+
+// Iterations until limits_exceeded() could next fail: up to the step that
+// breaches max_steps or reads the clock. The kernel neither allocates nor
+// calls, so only cancellation is seen later than on the tree, within
+// _DEADLINE_CHECK_INTERVAL iterations
+static size_t kernel_batch(EvaluatorContext const *context) {
+    size_t batch = _DEADLINE_CHECK_INTERVAL - context->steps % _DEADLINE_CHECK_INTERVAL;
+    size_t max_steps = context->limits.max_steps;
+    if (max_steps && context->steps >= max_steps) return 1;
+    if (max_steps && max_steps - context->steps < batch) batch = max_steps - context->steps;
+    return batch;
+}
+
+// Runs the loop until it exits, divides by zero (returning 0) or breaches a
+// limit of context, one step per iteration
+static char run_kernel_loop(LoopKernel *kernel, EvaluatorContext *context) {
+    int32_t *registers = kernel->registers;
+    KernelInstruction const *instructions = kernel->instructions;
+    size_t instructions_length = kernel->instructions_length;
+    size_t batch = kernel_batch(context);
+    while (1) {
+        for (size_t i = 0; i < instructions_length; ++i) {
+            KernelInstruction const instruction = instructions[i];
+            int32_t left = registers[instruction.left], right = registers[instruction.right];
+            int32_t *target = registers + instruction.target;
+            switch (instruction.op) {
+                case KERNEL_ADD: *target = (uint32_t)left + (uint32_t)right; break;
+                case KERNEL_SUB: *target = (uint32_t)left - (uint32_t)right; break;
+                case KERNEL_MUL: *target = (uint32_t)left * (uint32_t)right; break;
+                case KERNEL_DIV: if (!apply_int_operator(DIV_OP, left, right, target)) return 0; break;
+                case KERNEL_EQ: *target = left == right; break;
+                case KERNEL_NE: *target = left != right; break;
+                case KERNEL_LT: *target = left < right; break;
+                case KERNEL_LE: *target = left <= right; break;
+                case KERNEL_GT: *target = left > right; break;
+                case KERNEL_GE: *target = left >= right; break;
+                case KERNEL_AND: *target = left != 0 && right != 0; break;
+                case KERNEL_OR: *target = left != 0 || right != 0; break;
+                case KERNEL_NEGATE: *target = -(uint32_t)left; break;
+                case KERNEL_MOVE: *target = left; break;
+                case KERNEL_EXIT: if (left == 0) return 1; break;
+            }
+        }
+        if (--batch) {
+            context->steps += 1;
+            continue;
+        }
+        if (limits_exceeded(context)) return 1;
+        batch = kernel_batch(context);
+    }
+}
+
+// Runs a WHILE_STMT as a kernel. Returns 0, having run nothing, when it
+// cannot. Kept out of evaluate_while() so that the kernel is not on the C
+// stack of the loops that run on the tree
+static _NOINLINE char run_loop_kernel(FlatNode const *node, EvaluatorContext *context) {
+    LoopKernel kernel;
+    kernel.instructions_length = 0;
+    kernel.registers_length = 0;
+    kernel.variables_length = 0;
+    kernel.failed = 0;
+    memset(kernel.assigned, 0, sizeof(kernel.assigned));
+    if (!compile_loop_kernel(&kernel, node, context)) return 0;
+
+    char divided_by_zero = !run_kernel_loop(&kernel, context);
+
+    uint64_t hash_bits = 0;
+    for (size_t i = 0; i < kernel.variables_length; ++i) {
+        if (!kernel.assigned[i]) continue;
+        *kernel.slots[i] = int_value(kernel.registers[i]);
+        hash_bits |= hash_bit(kernel.names[i]->hash);
+    }
+    note_binding(context, hash_bits);
+    if (divided_by_zero) {
+        context->error_code = DIVISION_BY_ZERO;
+        context->error_message = stats_strdup(EVALUATOR_ALLOC, "Division by zero");
+    }
+    if (!context->error_code) context->result = int_value(0);
+    return 1;
+}
+
+////////////////////////////
+/// Statement evaluators ///
+////////////////////////////
+
+void evaluate_declaration(FlatNode const *node, EvaluatorContext *context) { 
+    HashTable *current_frame = stack_top(&context->stack_frames);
+    FlatName const *name = node_name(node, context);
+    
+    if (hash_table_get_hashed(current_frame, name->name, name->hash) != NULL) {
+        context->error_code = VARIABLE_EXISTS;
+        context->error_message = variable_exists_message(name->name);
+        context->result = int_value(0);
+        return;
+    }
+
+    evaluate_expression_node(flat_child(node, 0), context);
+    if (context->error_code) return;
+
+    // calls in the expression may have grown (and moved) the frame stack
+    current_frame = stack_top(&context->stack_frames);
+    note_binding(context, hash_bit(name->hash));
+    char error = hash_table_set(current_frame, name->name, &context->result);
+    if (error) context->error_code = INTERNAL;
+    context->result = int_value(0);
+}
+
+void evaluate_assignment(FlatNode const *node, EvaluatorContext *context) { 
+    HashTable *current_frame = stack_top(&context->stack_frames);
+    FlatName const *name = node_name(node, context);
+    
+    // every entry's value lives in its own block, so the slot stays put even
+    // when calls in the expression grow the frame stack or this table
+    Value *slot = (Value *)hash_table_get_hashed(current_frame, name->name, name->hash);
+    if (slot == NULL) {
+        context->error_code = UNDECLARED_IDENTIFIER;
+        context->error_message = undefined_identifier_message(name->name);
+        context->result = int_value(0);
+        return;
+    }
+
+    evaluate_expression_node(flat_child(node, 0), context);
+    if (context->error_code) return;
+
+    note_binding(context, hash_bit(name->hash));
+    *slot = context->result;
+    context->result = int_value(0);
+}
+
+void evaluate_index_assignment(FlatNode const *node, EvaluatorContext *context) {
+    size_t index;
+    Array *array = evaluate_array_slot(node, context, &index);
+    if (array == NULL) return;
+
+    evaluate_expression_node(flat_child(node, 1), context);
+    if (context->error_code) return;
+    if (!value_is_int(context->result)) {
+        context->error_code = UNEXPECTED_TYPE;
+        context->error_message = unexpected_type_message("array element");
+        return;
+    }
+    array->items[index] = value_as_int(context->result);
+    context->result = int_value(0);
+}
+
+void evaluate_return(FlatNode const *node, EvaluatorContext *context) {
+    evaluate_expression_node(flat_child(node, 0), context);
+    context->returning = 1;
+}
+
+// Records a printed value and writes it unless dry_run
+static void emit_value(Value value, EvaluatorContext *context) {
+    _PROBE1(print, value);
+    _HOOK(context, print, value);
+    stack_push(&context->side_effects, &value);
+    if (!context->dry_run) {
+        write_value(value, context->output);
+        fputc('\n', context->output);
+    }
+}
+
+void evaluate_print(FlatNode const *node, EvaluatorContext *context) {
+    evaluate_expression_node(flat_child(node, 0), context);
+    if (context->error_code) return;
+
+    emit_value(context->result, context);
+    context->result = int_value(0);
+}
+
+void evaluate_if_else(FlatNode const *node, EvaluatorContext *context) {
+    char outcome = evaluate_condition(flat_child(node, 0), context);
+    if (context->error_code) return;
+    if (outcome) {
+        evaluate_statement_sequence(flat_child(node, 1), context);
+    }
+    else {
+        if (node->children_length == 3) {
+            evaluate_statement_sequence(flat_child(node, 2), context);
+        }
+    }
+}
+
+// The body runs in the current frame, so an iteration allocates nothing
+// beyond what its statements do. Every iteration counts as a step
+void evaluate_while(FlatNode const *node, EvaluatorContext *context) {
+    if (run_loop_kernel(node, context)) return;
+    while (1) {
+        char outcome = evaluate_condition(flat_child(node, 0), context);
+        if (context->error_code) return;
+        if (!outcome) break;
+
+        evaluate_statement_sequence(flat_child(node, 1), context);
+        if (context->error_code || context->returning) return;
+        if (limits_exceeded(context)) return;
+        collect_arrays(context);
+    }
+    context->result = int_value(0);
+}
+
+void evaluate_function(FlatNode const *node, EvaluatorContext *context) {  
+    HashTable *current_frame = stack_top(&context->stack_frames);
+    FlatFunction const *function = context->tree->functions + node->payload;
+    
+    if (hash_table_get_hashed(current_frame, function->name, function->name_hash) != NULL) {
+        context->error_code = VARIABLE_EXISTS;
+        context->error_message = variable_exists_message(function->name);
+        context->result = int_value(0);
+        return;
+    }
+
+    note_binding(context, hash_bit(function->name_hash));
+    Value entry = pointer_value(function, FUNCTION_TAG);
+    char error = hash_table_set(current_frame, function->name, &entry);
+    if (error) context->error_code = INTERNAL;
+    context->result = int_value(0);
+}
+
+// Runs the statements of a module in the main frame, once per context:
+// later imports of the same module, also through a cycle, do nothing
+void evaluate_import(FlatNode const *node, EvaluatorContext *context) {
+    context->result = int_value(0);
+    if (context->stack_frames.length > 1) {
+        context->error_code = IMPORT_ERROR;
+        context->error_message = stats_strdup(EVALUATOR_ALLOC, "Import outside of the top level");
+        return;
+    }
+
+    Module const *module;
+    if (load_module(context->module_dir, node_name(node, context)->name, &module, &context->error_message)) {
+        context->error_code = IMPORT_ERROR;
+        return;
+    }
+    for (size_t i = 0; i < context->modules.length; ++i) {
+        if (((Module const **)context->modules.buffer)[i] == module) return;
+    }
+    if (!stack_push(&context->modules, &module)) {
+        context->error_code = INTERNAL;
+        return;
+    }
+
+    char const *importer_dir = context->module_dir;
+    context->module_dir = module->directory;
+    FlatTree const *importer_tree = enter_tree(module->tree, context);
+    evaluate_statement_sequence(module->tree->nodes, context);
+    context->module_dir = importer_dir;
+    enter_tree(importer_tree, context);
+    context->returning = 0;
+    if (!context->error_code) context->result = int_value(0);
+}
+
+// Runs statements one after the other until an error or a return
+static inline void evaluate_statements_range(FlatNode const *children, size_t length, EvaluatorContext *context) {
+    for (size_t i = 0; i < length; ++i) {
+        if (children[i].node_type == DECLARATION) evaluate_declaration(children+i, context);
+        else if (children[i].node_type == ASSIGNMENT) evaluate_assignment(children+i, context);
+        else if (children[i].node_type == INDEX_ASSIGNMENT) evaluate_index_assignment(children+i, context);
+        else if (children[i].node_type == PRINT_STMT) evaluate_print(children+i, context); 
+        else if (children[i].node_type == YIELD_STMT) evaluate_yield(children+i, context);
+        else if (children[i].node_type == IF_ELSE_STMT) evaluate_if_else(children+i, context);
+        else if (children[i].node_type == WHILE_STMT) evaluate_while(children+i, context);
+        else if (children[i].node_type == FUNCTION) evaluate_function(children+i, context);
+        else if (children[i].node_type == IMPORT_STMT) evaluate_import(children+i, context);
+        else { // node_type == RETURN 
+            evaluate_return(children+i, context);
+            return;
+        }
+        if (context->error_code || context->returning) return;
+    }
+}
+
+void evaluate_statement_sequence(FlatNode const *node, EvaluatorContext *context) {
+    evaluate_statements_range(flat_child(node, 0), node->children_length, context);
+}
+
+EvaluatorContext init_evaluator_context(char dry_run) {
+    EvaluatorContext context = {
         .error_code = PASS,
-        .side_effects = side_effects,
-        .dry_run = dry_run
+        .dry_run = dry_run,
+        .output = stdout,
+        .eliminate_dead_code = 1,
+        .inline_threshold = _DEFAULT_INLINE_THRESHOLD,
+        .tier_up_threshold = _DEFAULT_TIER_UP_THRESHOLD,
+        .binding_epoch = 1,
+        .limits.max_call_depth = _DEFAULT_MAX_CALL_DEPTH
     };
 
-    evaluate_statement_sequence(node, &context);
+    context.stack_frames = init_stack(_INITIAL_STACK_FRAMES_CAPACITY, sizeof(HashTable));
+    if (context.stack_frames.buffer == NULL) {
+        context.error_code = INTERNAL;
+        context.error_message = stats_strdup(EVALUATOR_ALLOC, "Internal Error: Could not allocate memory for stack frames");
+        return context;
+    }
+    
+    HashTable main_frame = init_hash_table(_INITIAL_IDENTIFIER_TABLE_CAPACITY, sizeof(Value));
+    if (main_frame.rows == NULL || !stack_push(&context.stack_frames, &main_frame)) {
+        context.error_code = INTERNAL;
+        context.error_message = stats_strdup(EVALUATOR_ALLOC, "Internal Error: Could not allocate memory for main frame");
+        return context;
+    }
+    context.frames_allocated = 1;
+
+    context.side_effects = init_stack(1024, sizeof(Value));
+    context.objects = init_object_arena();
+    context.programs = init_stack(4, sizeof(RetainedProgram));
+    context.spare_frames = init_stack(_MAX_SPARE_FRAMES, sizeof(HashTable));
+    context.modules = init_stack(4, sizeof(Module const *));
+    context.tasks = init_stack(4, sizeof(Task *));
+    return context;
+}
+
+void delete_evaluator_context(EvaluatorContext *context) {
+    delete_tasks(context);
+    while (context->stack_frames.length > 0) pop_stack_frame(context);
+    delete_stack(&context->stack_frames);
+    while (context->spare_frames.length > 0) {
+        clean_hash_table(stack_top(&context->spare_frames));
+        stack_pop(&context->spare_frames);
+    }
+    delete_stack(&context->spare_frames);
+    delete_stack(&context->side_effects);
+    delete_object_arena(&context->objects);
+    while (context->programs.length > 0) {
+        RetainedProgram *program = stack_top(&context->programs);
+        delete_flat_tree(program->tree);
+        for (size_t i = 0; i < program->num_tokens; ++i) delete_token(program->tokens+i);
+        stats_free(TOKENIZER_ALLOC, program->tokens);
+        stack_pop(&context->programs);
+    }
+    delete_stack(&context->programs);
+    delete_stack(&context->modules);
+    if (context->natives.rows != NULL) clean_hash_table(&context->natives);
+    stats_free(EVALUATOR_ALLOC, context->error_message);
+    context->error_message = NULL;
+}
+
+char retain_program(EvaluatorContext *context, FlatTree *tree, Token *tokens, size_t num_tokens) {
+    RetainedProgram program = {.tree = tree, .tokens = tokens, .num_tokens = num_tokens};
+    return !stack_push(&context->programs, &program);
+}
+
+void clear_evaluation_error(EvaluatorContext *context) {
+    context->error_code = PASS;
+    stats_free(EVALUATOR_ALLOC, context->error_message);
+    context->error_message = NULL;
+    context->result = int_value(0);
+}
+
+void cancel_evaluation(EvaluatorContext *context) {
+    atomic_store_explicit(&context->cancelled, 1, memory_order_relaxed);
+}
+
+// Resets the step count, heap baseline and deadline the limits are measured from
+static void start_run(EvaluatorContext *context) {
+    context->steps = 0;
+    context->heap_bytes_base = evaluator_heap_bytes();
+    if (context->limits.timeout_ms) {
+        context->deadline_ms = monotonic_ms() + context->limits.timeout_ms;
+    }
+}
+
+// Hands the error a run or host call of the host ends with to the probes
+// and hooks
+static void report_error(EvaluatorContext const *context) {
+    _PROBE2(error, context->error_code, context->error_message);
+    _HOOK(context, error, context->error_code, context->error_message);
+}
+
+void evaluate_program(FlatTree const *tree, EvaluatorContext *context) {
+    evaluate_statements(tree, 0, tree->nodes[0].children_length, context);
+}
+
+void evaluate_statements(FlatTree const *tree, size_t first, size_t last, EvaluatorContext *context) {
+    if (context->error_code) return;
+    if (tree->nodes[0].node_type != STMT_SEQUENCE) { 
+        context->error_code = INTERNAL;
+        context->error_message = stats_strdup(EVALUATOR_ALLOC, "Internal Error: Invalid AST node type received");
+        return;
+    }
+
+    start_run(context);
+    enter_tree(tree, context);
+    FlatNode const *statements = flat_child(tree->nodes, first);
+    for (size_t i = 0; i < last - first && !context->error_code && !context->returning; ++i) {
+        evaluate_statements_range(statements + i, 1, context);
+        collect_arrays(context);
+    }
+    enter_tree(NULL, context);
+    context->returning = 0;
+
+    // unwind the frames of calls interrupted by an error
+    while (context->stack_frames.length > 1) pop_stack_frame(context);
+    join_pending_tasks(context);
+    if (context->error_code) report_error(context);
+}
+
+EvaluatorContext evaluate(FlatTree const *tree, char dry_run) {
+    EvaluatorContext context = init_evaluator_context(dry_run);
+    evaluate_program(tree, &context);
     return context;
 }
 
+FlatFunction const *find_function(EvaluatorContext const *context, char const *name) {
+    if (context->stack_frames.length == 0) return NULL;
+    HashTable const *main_frame = context->stack_frames.buffer;
+    Value const *entry = hash_table_get(main_frame, name);
+    if (entry == NULL || value_tag(*entry) != FUNCTION_TAG) return NULL;
+    return value_as_pointer(*entry);
+}
+
+// Runs a call from the host and hands over its integer result. Returns 1
+// when it fails, leaving the error in the context
+static char host_call(
+    EvaluatorContext *context, 
+    FlatFunction const *function, 
+    FlatNode const *body, 
+    Value *arg_values, 
+    int32_t *result
+) {
+    invoke_function(function, body, arg_values, context);
+
+    // unwind the frames of calls interrupted by an error
+    while (context->stack_frames.length > 1) pop_stack_frame(context);
+    join_pending_tasks(context);
+    if (!context->error_code && !value_is_int(context->result)) {
+        context->error_code = UNEXPECTED_TYPE;
+        context->error_message = stats_strdup(EVALUATOR_ALLOC, "Function result is not an integer");
+    }
+    if (context->error_code) return 1;
+    *result = value_as_int(context->result);
+    return 0;
+}
+
+static char call_function_once(
+    EvaluatorContext *context, 
+    FlatFunction const *function, 
+    int32_t const *args, 
+    size_t args_length, 
+    int32_t *result
+) {
+    if (args_length != function->args_length) {
+        context->error_code = UNEXPECTED_ARGUMENTS;
+        context->error_message = unexpected_arguments_message(function->name);
+        return 1;
+    }
+    FlatNode const *body = callable_body((FlatFunction *)function, context);
+    if (body == NULL) return 1;
+    body = hot_body((FlatFunction *)function, body, context);
+
+    // the usual arities fit on the C stack
+    Value stack_values[_MAX_INLINED_ARGS];
+    Value *arg_values = stack_values;
+    if (args_length > _MAX_INLINED_ARGS) {
+        arg_values = stats_malloc(EVALUATOR_ALLOC, args_length * sizeof(Value));
+        if (arg_values == NULL) {
+            context->error_code = INTERNAL;
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < args_length; ++i) arg_values[i] = int_value(args[i]);
+
+    context->function_calls += 1;
+    start_run(context);
+    char error = host_call(context, function, body, arg_values, result);
+    if (arg_values != stack_values) stats_free(EVALUATOR_ALLOC, arg_values);
+    return error;
+}
+
+char call_function(
+    EvaluatorContext *context, 
+    FlatFunction const *function, 
+    int32_t const *args, 
+    size_t args_length, 
+    int32_t *result
+) {
+    if (context->error_code) clear_evaluation_error(context);
+    char error = call_function_once(context, function, args, args_length, result);
+    if (error) report_error(context);
+    return error;
+}
+
+
+///////////////
+/// Batches ///
+///////////////
+
+// State of the rows of a batch evaluated column-at-a-time. Columns hold
+// _BATCH_ROWS values and masks are columns of -1 (row taking part) and 0
+typedef struct {
+    FlatFunction const *function;
+    FlatName const *names;      // of the tree holding the body
+    int32_t const **args;       // argument columns, from the first row of the chunk
+    int32_t const **params;     // argument columns of the innermost INLINE_CALL
+    int32_t *scratch;           // scratch columns, used as a stack
+    size_t scratch_used;
+    size_t rows;                // of the chunk
+    int32_t *results;           // of the chunk
+    char failed;                // a row of the chunk divides by zero
+} Batch;
+
+// Argument a VARIABLE names, args_length when it names none. A name given
+// twice is bound to the later argument
+static size_t batch_argument(Batch const *batch, FlatNode const *node) {
+    char const *name = batch->names[node->payload].name;
+    for (size_t i = batch->function->args_length; i > 0; --i) {
+        if (strcmp(batch->function->args[i-1], name) == 0) return i-1;
+    }
+    return batch->function->args_length;
+}
+
+// Nodes of an expression the column evaluator handles: integer arithmetic,
+// comparisons, && / || and inlined calls over literals and arguments. 0 for
+// any other expression
+static size_t batchable_expression(FlatNode const *node, Batch const *batch) {
+    switch (node->node_type) {
+        case NUMBER:
+        case PARAMETER:
+            return 1;
+        case VARIABLE:
+            return batch_argument(batch, node) < batch->function->args_length;
+        case ARITHMETIC:
+        case COMPARISON:
+        case LOGICAL:
+        case INLINE_CALL: {
+            size_t nodes = 1;
+            for (size_t i = 0; i < node->children_length; ++i) {
+                size_t child_nodes = batchable_expression(flat_child(node, i), batch);
+                if (child_nodes == 0) return 0;
+                nodes += child_nodes;
+            }
+            return nodes;
+        }
+        default:
+            return 0;
+    }
+}
+
+// Nodes of a sequence of checkit and imagine / bummer statements over
+// batchable expressions, 0 for any other sequence. *returns tells whether
+// every path through it ends in a checkit. Statements after a checkit are
+// never reached and not looked at
+static size_t batchable_sequence(FlatNode const *node, Batch const *batch, char *returns) {
+    size_t nodes = 1;
+    *returns = 0;
+    for (size_t i = 0; i < node->children_length && !*returns; ++i) {
+        FlatNode const *statement = flat_child(node, i);
+        size_t statement_nodes = 0;
+        if (statement->node_type == RETURN_STMT) {
+            statement_nodes = batchable_expression(flat_child(statement, 0), batch);
+            *returns = 1;
+        }
+        else if (statement->node_type == IF_ELSE_STMT) {
+            char then_returns, else_returns = 0;
+            size_t condition_nodes = batchable_expression(flat_child(statement, 0), batch);
+            size_t then_nodes = batchable_sequence(flat_child(statement, 1), batch, &then_returns);
+            size_t else_nodes = (
+                statement->children_length == 3 ? 
+                batchable_sequence(flat_child(statement, 2), batch, &else_returns) : 
+                1
+            );
+            if (condition_nodes && then_nodes && else_nodes) {
+                statement_nodes = 1 + condition_nodes + then_nodes + else_nodes;
+            }
+            *returns = then_returns && else_returns;
+        }
+        if (statement_nodes == 0) return 0;
+        nodes += statement_nodes;
+    }
+    return nodes;
+}
+
+static int32_t *batch_column(Batch *batch) {
+    return batch->scratch + batch->scratch_used++ * _BATCH_ROWS;
+}
+
+static int32_t const *batch_expression(FlatNode const *node, int32_t const *mask, Batch *batch);
+static int32_t *batch_condition(FlatNode const *node, int32_t const *mask, Batch *batch);
+
+static int32_t const *batch_prefix(FlatNode const *node, int32_t const *column, Batch *batch) {
+    if (!node->negated) return column;
+    int32_t *negated = batch_column(batch);
+    mul_int32(negated, column, NULL, -1, batch->rows);
+    return negated;
+}
+
+// Rows outside of mask divide too, by 1 where their divisor is 0. A division
+// by zero in a row of mask fails the chunk
+static void batch_divide(int32_t *dst, int32_t const *divisors, int32_t scalar, int32_t const *mask, Batch *batch) {
+    for (size_t i = 0; i < batch->rows; ++i) {
+        int32_t divisor = divisors ? divisors[i] : scalar;
+        if (divisor == 0) {
+            batch->failed |= mask[i] != 0;
+            divisor = 1;
+        }
+        dst[i] = divisor == -1 ? (int32_t)(-(uint32_t)dst[i]) : dst[i] / divisor;
+    }
+}
+
+// Column twin of evaluate_arithmetic(). Literal operands are broadcast by the
+// kernels instead of being filled into a column
+static int32_t const *batch_arithmetic(FlatNode const *node, int32_t const *mask, Batch *batch) {
+    size_t rows = batch->rows;
+    int32_t *result = batch_column(batch);
+    size_t mark = batch->scratch_used;
+    memcpy(result, batch_expression(flat_child(node, 0), mask, batch), rows * sizeof(int32_t));
+
+    for (size_t i = 1; i < node->children_length; ++i) {
+        batch->scratch_used = mark;
+        FlatNode const *operand_node = flat_child(node, i);
+        int32_t const *operand = NULL;
+        int32_t scalar = 0;
+        if (operand_node->node_type == NUMBER) {
+            scalar = operand_node->negated ? (int32_t)(-operand_node->payload) : (int32_t)operand_node->payload;
+        }
+        else operand = batch_expression(operand_node, mask, batch);
+
+        switch (operand_node->joining_operator) {
+            case ADD_OP: add_int32(result, result, operand, scalar, rows); break;
+            case SUB_OP: sub_int32(result, result, operand, scalar, rows); break;
+            case MULT_OP: mul_int32(result, result, operand, scalar, rows); break;
+            default: batch_divide(result, operand, scalar, mask, batch); break;
+        }
+    }
+    if (node->negated) mul_int32(result, result, NULL, -1, rows);
+    batch->scratch_used = mark;
+    return result;
+}
+
+// Mask of a COMPARISON or LOGICAL ignoring its prefix operator, the column
+// twin of evaluate_binary_condition()
+static int32_t *batch_binary_condition(FlatNode const *node, int32_t const *mask, Batch *batch) {
+    size_t rows = batch->rows;
+    if (node->node_type == LOGICAL) {
+        int32_t *outcome = batch_condition(flat_child(node, 0), mask, batch);
+        // the rows where the right side decides, which alone may fail it
+        int32_t *deciding = batch_column(batch);
+        if (node->operator == AND_OP) and_int32(deciding, mask, outcome, 0, rows);
+        else {
+            xor_int32(deciding, outcome, NULL, -1, rows);
+            and_int32(deciding, deciding, mask, 0, rows);
+        }
+        size_t mark = batch->scratch_used;
+        int32_t const *right = batch_condition(flat_child(node, 1), deciding, batch);
+        if (node->operator == AND_OP) and_int32(outcome, outcome, right, 0, rows);
+        else or_int32(outcome, outcome, right, 0, rows);
+        batch->scratch_used = mark;
+        return outcome;
+    }
+
+    int32_t const *left = batch_expression(flat_child(node, 0), mask, batch);
+    int32_t const *right = batch_expression(flat_child(node, 1), mask, batch);
+    int32_t *outcome = batch_column(batch);
+    switch (node->operator) {
+        case EQ_OP: case NE_OP: eq_int32(outcome, left, right, 0, rows); break;
+        case LT_OP: case GE_OP: lt_int32(outcome, left, right, 0, rows); break;
+        default: gt_int32(outcome, left, right, 0, rows); break;
+    }
+    if (node->operator == NE_OP || node->operator == GE_OP || node->operator == LE_OP) {
+        xor_int32(outcome, outcome, NULL, -1, rows);
+    }
+    return outcome;
+}
+
+// Mask of the rows where a condition holds, see evaluate_condition()
+static int32_t *batch_condition(FlatNode const *node, int32_t const *mask, Batch *batch) {
+    char is_binary = node->node_type == COMPARISON || node->node_type == LOGICAL;
+    if (is_binary && !node->negated) return batch_binary_condition(node, mask, batch);
+
+    int32_t const *value = batch_expression(node, mask, batch);
+    int32_t *outcome = batch_column(batch);
+    eq_int32(outcome, value, NULL, 0, batch->rows);
+    xor_int32(outcome, outcome, NULL, -1, batch->rows);
+    return outcome;
+}
+
+// Column of an expression for the rows of mask; other rows hold any value.
+// The result may be an argument column, which must not be written
+static int32_t const *batch_expression(FlatNode const *node, int32_t const *mask, Batch *batch) {
+    switch (node->node_type) {
+        case NUMBER: {
+            int32_t *column = batch_column(batch);
+            int32_t number = node->negated ? (int32_t)(-node->payload) : (int32_t)node->payload;
+            for (size_t i = 0; i < batch->rows; ++i) column[i] = number;
+            return column;
+        }
+        case VARIABLE:
+            return batch_prefix(node, batch->args[batch_argument(batch, node)], batch);
+        case PARAMETER:
+            return batch_prefix(node, batch->params[node->payload], batch);
+        case ARITHMETIC:
+            return batch_arithmetic(node, mask, batch);
+        case INLINE_CALL: {
+            int32_t const *args[_MAX_INLINED_ARGS];
+            size_t args_length = node->children_length - 1;
+            for (size_t i = 0; i < args_length; ++i) args[i] = batch_expression(flat_child(node, i), mask, batch);
+            int32_t const **outer_params = batch->params;
+            batch->params = args;
+            int32_t const *result = batch_expression(flat_child(node, args_length), mask, batch);
+            batch->params = outer_params;
+            return batch_prefix(node, result, batch);
+        }
+        default: {
+            // a mask is -1 where the comparison gives 1, so it is its negation
+            int32_t *outcome = batch_binary_condition(node, mask, batch);
+            if (!node->negated) and_int32(outcome, outcome, NULL, 1, batch->rows);
+            return outcome;
+        }
+    }
+}
+
+// Runs a statement sequence for the rows of mask, the column twin of
+// evaluate_if_else() and evaluate_return(). Rows that return leave the mask
+static void batch_sequence(FlatNode const *node, int32_t *mask, Batch *batch) {
+    size_t rows = batch->rows;
+    for (size_t i = 0; i < node->children_length; ++i) {
+        FlatNode const *statement = flat_child(node, i);
+        size_t mark = batch->scratch_used;
+        if (statement->node_type == RETURN_STMT) {
+            select_int32(batch->results, mask, batch_expression(flat_child(statement, 0), mask, batch), rows);
+            memset(mask, 0, rows * sizeof(int32_t));
+            batch->scratch_used = mark;
+            return;
+        }
+
+        int32_t const *condition = batch_condition(flat_child(statement, 0), mask, batch);
+        int32_t *then_mask = batch_column(batch), *else_mask = batch_column(batch);
+        and_int32(then_mask, mask, condition, 0, rows);
+        xor_int32(else_mask, mask, then_mask, 0, rows);
+        if (any_int32(then_mask, rows)) batch_sequence(flat_child(statement, 1), then_mask, batch);
+        if (statement->children_length == 3 && any_int32(else_mask, rows)) {
+            batch_sequence(flat_child(statement, 2), else_mask, batch);
+        }
+        or_int32(mask, then_mask, else_mask, 0, rows);
+        batch->scratch_used = mark;
+        if (!any_int32(mask, rows)) return;
+    }
+}
+
+// Evaluates rows [first, first + rows) column-at-a-time, counting a step per
+// row. Returns 0 when a row divides by zero or would breach the step limit,
+// leaving the chunk to the row by row path, which fails at that very row
+static char batch_chunk(
+    Batch *batch, 
+    FlatNode const *body, 
+    int32_t const * const *columns, 
+    size_t first, 
+    size_t rows, 
+    int32_t *results, 
+    EvaluatorContext *context
+) {
+    size_t max_steps = context->limits.max_steps;
+    if (max_steps && context->steps + rows > max_steps) return 0;
+
+    for (size_t i = 0; i < batch->function->args_length; ++i) batch->args[i] = columns[i] + first;
+    batch->rows = rows;
+    batch->results = results;
+    batch->failed = 0;
+    batch->scratch_used = 0;
+    int32_t *mask = batch_column(batch);
+    for (size_t i = 0; i < rows; ++i) mask[i] = -1;
+    batch_sequence(body, mask, batch);
+    if (batch->failed) return 0;
+
+    context->function_calls += rows;
+    context->steps += rows - 1;
+    if (limits_exceeded(context)) return 1;
+    // limits_exceeded() polls the clock on multiples of a step count only
+    if (context->limits.timeout_ms && monotonic_ms() > context->deadline_ms) {
+        context->error_code = DEADLINE_EXCEEDED;
+        context->error_message = limit_exceeded_message("timeout ms", context->limits.timeout_ms);
+    }
+    return 1;
+}
+
+static char call_batch(
+    EvaluatorContext *context, 
+    FlatFunction const *function, 
+    int32_t const * const *columns, 
+    size_t args_length, 
+    size_t rows, 
+    int32_t *results
+) {
+    if (args_length != function->args_length) {
+        context->error_code = UNEXPECTED_ARGUMENTS;
+        context->error_message = unexpected_arguments_message(function->name);
+        return 1;
+    }
+    FlatNode const *body = callable_body((FlatFunction *)function, context);
+    if (body == NULL) return 1;
+
+    // scratch columns: at most 3 per node of the body and the mask of a chunk
+    Batch batch = {.function = function, .names = function->body_tree->names};
+    char returns;
+    size_t nodes = batchable_sequence(body, &batch, &returns);
+    if (returns && nodes <= _MAX_BATCH_NODES && rows > 1) {
+        batch.scratch = stats_malloc(EVALUATOR_ALLOC, (3 * nodes + 1) * _BATCH_ROWS * sizeof(int32_t));
+        batch.args = stats_malloc(EVALUATOR_ALLOC, args_length * sizeof(int32_t const *) + 1);
+    }
+    Value *arg_values = stats_malloc(EVALUATOR_ALLOC, args_length * sizeof(Value) + 1);
+    char error = arg_values == NULL || (batch.scratch == NULL) != (batch.args == NULL);
+    if (error) context->error_code = INTERNAL;
+
+    start_run(context);
+    for (size_t first = 0; first < rows && !error; first += _BATCH_ROWS) {
+        size_t chunk_rows = rows - first < _BATCH_ROWS ? rows - first : _BATCH_ROWS;
+        if (batch.scratch && batch_chunk(&batch, body, columns, first, chunk_rows, results + first, context)) {
+            error = context->error_code != PASS;
+            continue;
+        }
+        for (size_t row = first; row < first + chunk_rows && !error; ++row) {
+            for (size_t i = 0; i < args_length; ++i) arg_values[i] = int_value(columns[i][row]);
+            context->function_calls += 1;
+            error = host_call(context, function, body, arg_values, results + row);
+        }
+    }
+
+    stats_free(EVALUATOR_ALLOC, batch.scratch);
+    stats_free(EVALUATOR_ALLOC, batch.args);
+    stats_free(EVALUATOR_ALLOC, arg_values);
+    return error;
+}
+
+char call_function_batch(
+    EvaluatorContext *context, 
+    FlatFunction const *function, 
+    int32_t const * const *columns, 
+    size_t args_length, 
+    size_t rows, 
+    int32_t *results
+) {
+    if (context->error_code) clear_evaluation_error(context);
+    char error = call_batch(context, function, columns, args_length, rows, results);
+    if (error) report_error(context);
+    return error;
+}
+
+
+/////////////
+/// Tasks ///
+/////////////
+
+// A call run by a worker of the pool in a context of its own, which starts
+// with a copy of every binding visible where the call was spawned. So a task
+// never reads the frames of the context that spawned it (its owner), which
+// goes on running meanwhile. Output, error and result reach the owner when
+// the owner joins the task
+struct Task_s {
+    PoolJob job;    // first, run_task() gets the job back
+    EvaluatorContext context;
+    EvaluatorContext *owner;
+    FlatFunction const *function;
+    FlatNode const *body;
+    Value *args;
+    // a range of a pmap calls function for every index of [first, last)
+    // instead, its results going to items
+    int32_t *items;
+    size_t first;
+    size_t last;
+    char joined;    // handed over to the owner, its context is deleted
+    Value result;   // in the arena of the owner once joined
+};
+
+static void run_task(PoolJob *job) {
+    Task *task = (Task *)job;
+    EvaluatorContext *context = &task->context;
+    context->heap_bytes_base = evaluator_heap_bytes();
+    if (task->items == NULL) invoke_function(task->function, task->body, task->args, context);
+    for (size_t i = task->first; i < task->last && !context->error_code; ++i) {
+        Value arg = int_value(i);
+        invoke_function(task->function, task->body, &arg, context);
+        if (context->error_code) break;
+        if (!value_is_int(context->result)) {
+            context->error_code = UNEXPECTED_TYPE;
+            context->error_message = unexpected_type_message("pmap result");
+            break;
+        }
+        task->items[i] = value_as_int(context->result);
+    }
+
+    // unwind the frames of calls interrupted by an error
+    while (context->stack_frames.length > 1) pop_stack_frame(context);
+    task->result = context->result;
+    join_pending_tasks(context);
+}
+
+static char start_pool(EvaluatorContext *context) {
+    long threads = context->task_threads ? (long)context->task_threads : sysconf(_SC_NPROCESSORS_ONLN);
+    context->pool = start_task_pool(threads > 0 ? threads : 1);
+    context->owns_pool = context->pool != NULL;
+    return context->pool == NULL;
+}
+
+// Copy of a string or array in arena, for values entering or leaving a task:
+// the task's context has an arena of its own. Returns 1 when out of memory
+static char copy_value(Value value, ObjectArena *arena, Value *result) {
+    *result = value;
+    if (value_tag(value) == STRING_TAG) {
+        size_t length = string_length(value);
+        char *chars = stats_malloc(EVALUATOR_ALLOC, length);
+        if (chars == NULL) return 1;
+        copy_string_chars(value, chars);
+        char error = new_string(chars, length, arena, result);
+        stats_free(EVALUATOR_ALLOC, chars);
+        return error;
+    }
+    if (value_is_array(value)) {
+        Array const *array = value_as_array(value);
+        if (new_array(array->length, arena, result)) return 1;
+        if (array->length) memcpy(value_as_array(*result)->items, array->items, array->length * sizeof(int32_t));
+    }
+    return 0;
+}
+
+// An array of the owner and its copy in a task
+typedef struct {
+    Array const *array;
+    Value copy;
+} ArrayCopy;
+
+// Copy of value in the arena of the task context, an array copied before
+// being taken from copies, so that names sharing an array share its copy.
+// Returns 1 when out of memory
+static char copy_into_task(Value value, EvaluatorContext *task_context, Stack *copies, Value *result) {
+    if (!value_is_array(value)) return copy_value(value, &task_context->objects, result);
+    ArrayCopy const *copied = copies->buffer;
+    for (size_t i = 0; i < copies->length; ++i) {
+        if (copied[i].array != value_as_array(value)) continue;
+        *result = copied[i].copy;
+        return 0;
+    }
+    ArrayCopy copy = {.array = value_as_array(value)};
+    if (copy_value(value, &task_context->objects, &copy.copy) || !stack_push(copies, &copy)) return 1;
+    *result = copy.copy;
+    return 0;
+}
+
+// Binds in the frame of a task what the names its call can reach resolve
+// to in the owner right now. These are the names in the body of the called
+// function, and in the bodies of the functions those names and the
+// arguments are bound to, and so on. Strings and arrays are copied into the
+// task's arena, so that the task and its owner never write the same array
+typedef struct {
+    EvaluatorContext *owner;
+    EvaluatorContext *task_context;
+    HashTable *frame;
+    Stack copies;       // ArrayCopy
+    Stack functions;    // FlatFunction const * whose bodies are yet to be walked
+    char error;
+} TaskSeeder;
+
+// Copies value into the task, queueing the body of a function
+static void seed_value(TaskSeeder *seeder, Value *value) {
+    seeder->error |= copy_into_task(*value, seeder->task_context, &seeder->copies, value);
+    if (!seeder->error && value_tag(*value) == FUNCTION_TAG) {
+        FlatFunction const *function = value_as_pointer(*value);
+        seeder->error |= !stack_push(&seeder->functions, &function);
+    }
+}
+
+static void seed_name(TaskSeeder *seeder, FlatName const *name) {
+    if (hash_table_get_hashed(seeder->frame, name->name, name->hash) != NULL) return;
+    Value const *entry = search_identifier_value(seeder->owner, name->name, name->hash);
+    if (entry == NULL) return;
+    Value value = *entry;
+    seed_value(seeder, &value);
+    if (!seeder->error) seeder->error |= hash_table_set(seeder->frame, name->name, &value);
+}
+
+static void seed_names(TaskSeeder *seeder, FlatTree const *tree, FlatNode const *node) {
+    switch (node->node_type) {
+        case VARIABLE:
+        case INDEX:
+        case INDEX_ASSIGNMENT:
+        case DECLARATION:
+        case ASSIGNMENT:
+        case PMAP_CALL:
+            seed_name(seeder, tree->names + node->payload);
+            break;
+        case FUNCTION_CALL:
+            seed_name(seeder, tree->names + tree->call_sites[node->payload].name);
+            break;
+        case FUNCTION: {
+            FlatFunction const *function = tree->functions + node->payload;
+            seeder->error |= !stack_push(&seeder->functions, &function);
+            break;
+        }
+        default:
+            break;
+    }
+    for (size_t i = 0; i < node->children_length && !seeder->error; ++i) seed_names(seeder, tree, flat_child(node, i));
+}
+
+// Seeds the frame of task_context for a call of function with args, which
+// are replaced by their copies. Returns 1 when out of memory
+static char copy_visible_bindings(
+    EvaluatorContext *context, 
+    EvaluatorContext *task_context, 
+    FlatFunction const *function, 
+    Value *args, 
+    size_t args_length
+) {
+    TaskSeeder seeder = {
+        .owner = context,
+        .task_context = task_context,
+        .frame = (HashTable *)stack_at(&task_context->stack_frames, 0),
+        .copies = init_stack(4, sizeof(ArrayCopy)),
+        .functions = init_stack(4, sizeof(FlatFunction const *))
+    };
+    seeder.error = seeder.copies.buffer == NULL || !stack_push(&seeder.functions, &function);
+    for (size_t i = 0; i < args_length && !seeder.error; ++i) seed_value(&seeder, args + i);
+    while (seeder.functions.length > 0 && !seeder.error) {
+        FlatFunction const *reached = *(FlatFunction const **)stack_top(&seeder.functions);
+        stack_pop(&seeder.functions);
+        // bodies that do not parse fail the call before reading any name
+        if (reached->body_tree != NULL) seed_names(&seeder, reached->body_tree, reached->body_tree->nodes + reached->body);
+    }
+    delete_stack(&seeder.copies);
+    delete_stack(&seeder.functions);
+    return seeder.error;
+}
+
+// Task calling function with args in a context set up from context, not yet
+// submitted. Strings and arrays among args are replaced by their copies in
+// the task. NULL when out of memory
+static Task *new_task(FlatFunction const *function, FlatNode const *body, Value *args, size_t args_length, EvaluatorContext *context) {
+    if (context->pool == NULL && start_pool(context)) return NULL;
+    Task *task = stats_calloc(EVALUATOR_ALLOC, 1, sizeof(Task));
+    if (task == NULL) return NULL;
+    task->job.run = run_task;
+    task->owner = context;
+    task->function = function;
+    task->body = body;
+
+    EvaluatorContext *task_context = &task->context;
+    *task_context = init_evaluator_context(1);
+    task_context->pool = context->pool;
+    task_context->limits = context->limits;
+    task_context->deadline_ms = context->deadline_ms;
+    task_context->module_dir = context->module_dir;
+    task_context->cancel_source = context->cancel_source ? context->cancel_source : &context->cancelled;
+
+    char error = task_context->error_code != PASS;
+    if (!error) error = copy_visible_bindings(context, task_context, function, args, args_length);
+    for (size_t i = 0; !error && i < context->natives.capacity; ++i) {
+        if (context->natives.rows[i].key == NULL) continue;
+        error = register_natives(task_context, *(Native const **)context->natives.rows[i].value, 1);
+    }
+    if (error) {
+        delete_evaluator_context(task_context);
+        stats_free(EVALUATOR_ALLOC, task);
+        return NULL;
+    }
+    return task;
+}
+
+static void delete_task(Task *task) {
+    if (!task->joined) {
+        delete_evaluator_context(&task->context);
+        stats_free(EVALUATOR_ALLOC, task->args);
+    }
+    stats_free(EVALUATOR_ALLOC, task);
+}
+
+// Copies a value leaving a task into the arena of context. Handles of the
+// task's own tasks cannot leave it. Returns 1 and sets the error otherwise
+static char take_task_value(Value value, EvaluatorContext *context, Value *result) {
+    if (value_tag(value) == TASK_TAG) {
+        context->error_code = UNEXPECTED_TYPE;
+        context->error_message = unexpected_type_message("task result");
+        return 1;
+    }
+    if (copy_value(value, &context->objects, result)) {
+        context->error_code = INTERNAL;
+        return 1;
+    }
+    return 0;
+}
+
+// Hands the output and then the error or result of a finished task over to
+// context, its owner, and deletes the task's context. An owner that failed
+// in the meantime drops them, as it never reaches the join
+static void merge_task(Task *task, EvaluatorContext *context) {
+    EvaluatorContext *task_context = &task->context;
+    Value const *printed = task_context->side_effects.buffer;
+    for (size_t i = 0; i < task_context->side_effects.length && !context->error_code; ++i) {
+        Value value;
+        if (!take_task_value(printed[i], context, &value)) emit_value(value, context);
+    }
+    if (!context->error_code && task_context->error_code) {
+        context->error_code = task_context->error_code;
+        context->error_message = task_context->error_message;
+        task_context->error_message = NULL;
+    }
+    else if (!context->error_code) take_task_value(task->result, context, &task->result);
+    context->function_calls += task_context->function_calls;
+
+    delete_evaluator_context(task_context);
+    stats_free(EVALUATOR_ALLOC, task->args);
+    task->args = NULL;
+    task->joined = 1;
+}
+
+static void join_task(Task *task, EvaluatorContext *context) {
+    if (!task->joined) {
+        wait_job(context->pool, &task->job);
+        merge_task(task, context);
+        if (context->error_code) return;
+    }
+    context->result = task->result;
+}
+
+// join(task): waits for a task spawned by this context and gives its result,
+// or stops with its error. A task joined again gives its result again
+static void builtin_join(Native const *native, Value const *args, EvaluatorContext *context) {
+    (void)native;
+    if (value_tag(args[0]) != TASK_TAG) {
+        context->error_code = UNEXPECTED_TYPE;
+        context->error_message = unexpected_type_message("join");
+        return;
+    }
+    Task *task = value_as_pointer(args[0]);
+    if (task->owner != context) {
+        context->error_code = UNEXPECTED_ARGUMENTS;
+        context->error_message = stats_strdup(EVALUATOR_ALLOC, "Task joined outside of the task that spawned it");
+        return;
+    }
+    join_task(task, context);
+}
+
+// Joins the tasks nobody joined, in spawn order. Called where a run ends, so
+// that no output gets lost
+static void join_pending_tasks(EvaluatorContext *context) {
+    Task **tasks = context->tasks.buffer;
+    for (size_t i = 0; i < context->tasks.length; ++i) {
+        if (tasks[i]->joined) continue;
+        wait_job(context->pool, &tasks[i]->job);
+        merge_task(tasks[i], context);
+    }
+}
+
+// Stops the tasks still running and frees every task of the context, then
+// the pool if the context started it
+static void delete_tasks(EvaluatorContext *context) {
+    Task **tasks = context->tasks.buffer;
+    for (size_t i = 0; i < context->tasks.length; ++i) {
+        if (!tasks[i]->joined) {
+            cancel_evaluation(context);
+            wait_job(context->pool, &tasks[i]->job);
+        }
+        delete_task(tasks[i]);
+    }
+    context->tasks.length = 0;
+    delete_stack(&context->tasks);
+    if (context->owns_pool) stop_task_pool(context->pool);
+    context->pool = NULL;
+}
+
+// Function a spawn or pmap runs, looked up like the callee of a call
+static FlatFunction *spawned_function(FlatName const *name, size_t args_length, EvaluatorContext *context) {
+    Value const *entry = search_identifier_value(context, name->name, name->hash);
+    if (entry == NULL && find_native(context, name, args_length) == NULL) {
+        context->error_code = UNDECLARED_IDENTIFIER;
+        context->error_message = undefined_identifier_message(name->name);
+        return NULL;
+    }
+    // natives run on the thread calling them, they are never spawned
+    if (entry == NULL || value_tag(*entry) != FUNCTION_TAG) {
+        context->error_code = NOT_CALLABLE;
+        context->error_message = not_callable_message(name->name);
+        return NULL;
+    }
+    FlatFunction *function = value_as_pointer(*entry);
+    if (function->args_length != args_length) {
+        context->error_code = UNEXPECTED_ARGUMENTS;
+        context->error_message = unexpected_arguments_message(name->name);
+        return NULL;
+    }
+    return function;
+}
+
+// SPAWN_CALL: the call runs as a task on the pool and its value is the task. The
+// arguments are evaluated before the spawn returns
+void evaluate_spawn(FlatNode const *node, EvaluatorContext *context) {
+    FlatNode const *call = flat_child(node, 0);
+    FlatName const *name = context->names + context->tree->call_sites[call->payload].name;
+    FlatFunction *function = spawned_function(name, call->children_length, context);
+    if (function == NULL) return;
+    FlatNode const *body = callable_body(function, context);
+    if (body == NULL) return;
+
+    Value *arg_values = stats_malloc(EVALUATOR_ALLOC, call->children_length * sizeof(Value));
+    if (arg_values == NULL && call->children_length > 0) {
+        context->error_code = INTERNAL;
+        return;
+    }
+    for (size_t i = 0; i < call->children_length; ++i) {
+        evaluate_expression_node(flat_child(call, i), context);
+        if (context->error_code) {
+            stats_free(EVALUATOR_ALLOC, arg_values);
+            return;
+        }
+        arg_values[i] = context->result;
+    }
+
+    Task *task = new_task(function, body, arg_values, call->children_length, context);
+    if (task == NULL) {
+        stats_free(EVALUATOR_ALLOC, arg_values);
+        context->error_code = INTERNAL;
+        return;
+    }
+    task->args = arg_values;
+    if (submit_job(context->pool, &task->job)) {
+        delete_task(task);
+        context->error_code = INTERNAL;
+        return;
+    }
+    if (!stack_push(&context->tasks, &task)) {
+        wait_job(context->pool, &task->job);
+        delete_task(task);
+        context->error_code = INTERNAL;
+        return;
+    }
+
+    context->result = pointer_value(task, TASK_TAG);
+    apply_prefix_operator(node, context);
+}
+
+// PMAP_CALL: the array of f(0), ..., f(n - 1). The calls are split into ranges of
+// indices run as tasks, _PMAP_TASKS_PER_WORKER per worker, and the output of
+// the ranges is emitted in index order. The first range that fails is the
+// last one whose output is emitted, and its error is the one of the pmap
+void evaluate_pmap(FlatNode const *node, EvaluatorContext *context) {
+    FlatFunction *function = spawned_function(node_name(node, context), 1, context);
+    if (function == NULL) return;
+    FlatNode const *body = callable_body(function, context);
+    if (body == NULL) return;
+
+    evaluate_expression_node(flat_child(node, 0), context);
+    if (context->error_code) return;
+    if (!value_is_int(context->result) || value_as_int(context->result) < 0) {
+        context->error_code = UNEXPECTED_ARGUMENTS;
+        context->error_message = unexpected_arguments_message("pmap");
+        return;
+    }
+    size_t length = value_as_int(context->result);
+
+    Value result;
+    if (new_array(length, &context->objects, &result) || (context->pool == NULL && start_pool(context))) {
+        context->error_code = INTERNAL;
+        return;
+    }
+    size_t tasks_length = task_pool_threads(context->pool) * _PMAP_TASKS_PER_WORKER;
+    if (tasks_length > length) tasks_length = length;
+    Task **tasks = stats_calloc(EVALUATOR_ALLOC, tasks_length + 1, sizeof(Task *));
+    if (tasks == NULL) {
+        context->error_code = INTERNAL;
+        return;
+    }
+
+    size_t submitted = 0;
+    for (; submitted < tasks_length; ++submitted) {
+        Task *task = new_task(function, body, NULL, 0, context);
+        if (task == NULL) break;
+        task->items = value_as_array(result)->items;
+        task->first = length * submitted / tasks_length;
+        task->last = length * (submitted + 1) / tasks_length;
+        if (submit_job(context->pool, &task->job)) {
+            delete_task(task);
+            break;
+        }
+        tasks[submitted] = task;
+    }
+    for (size_t i = 0; i < submitted; ++i) {
+        wait_job(context->pool, &tasks[i]->job);
+        merge_task(tasks[i], context);
+        delete_task(tasks[i]);
+    }
+    stats_free(EVALUATOR_ALLOC, tasks);
+    if (!context->error_code && submitted < tasks_length) context->error_code = INTERNAL;
+    if (context->error_code) return;
+
+    context->result = result;
+    apply_prefix_operator(node, context);
+}
+
+
+////////////////////
+/// Array sweeps ///
+////////////////////
+
+static void mark_array(Value value) {
+    if (value_is_array(value)) value_as_array(value)->marked = 1;
+}
+
+// Frees the arrays of the context that nothing refers to any more, once
+// enough were allocated since the last sweep. Only at a statement of the
+// main frame, where no expression is half evaluated: every array still in
+// use is then bound in the frame, printed, the last result or the result of
+// a joined task. A suspended generator holds frames the context cannot see,
+// so there is no sweep while one is alive
+static void collect_arrays(EvaluatorContext *context) {
+    if (!arrays_need_sweep(&context->objects)) return;
+    if (context->stack_frames.length != 1 || context->generator != NULL || context->generators) return;
+    if (context->inline_args != NULL) return;
+
+    HashTable const *frame = context->stack_frames.buffer;
+    for (size_t i = 0; i < frame->capacity; ++i) {
+        if (frame->rows[i].key != NULL) mark_array(*(Value const *)frame->rows[i].value);
+    }
+    Value const *printed = context->side_effects.buffer;
+    for (size_t i = 0; i < context->side_effects.length; ++i) mark_array(printed[i]);
+    mark_array(context->result);
+    Task **tasks = context->tasks.buffer;
+    for (size_t i = 0; i < context->tasks.length; ++i) {
+        if (tasks[i]->joined) mark_array(tasks[i]->result);
+    }
+    sweep_arrays(&context->objects);
+}
+
+
+//////////////////
+/// Generators ///
+//////////////////
+
+struct Generator_s {
+    EvaluatorContext *context;
+    FlatFunction const *function;
+    FlatNode const *body;
+    Value *args;
+
+    ucontext_t host;        // where generator_next() continues after a yield or the end
+    ucontext_t coroutine;   // where the body continues
+    char *stack;            // guard page first
+    size_t stack_bytes;
+
+    // while suspended: the frames of the body, oldest first, and the tree and
+    // inlined arguments it was evaluating
+    Stack frames;
+    FlatTree const *tree;
+    Value const *inline_args;
+
+    Value value;    // last yielded
+    char started;
+    char finished;
+    char closing;   // resumed by delete_generator() to unwind
+};
+
+// makecontext() passes only int arguments, so the body finds its generator here
+static _Thread_local Generator *starting_generator;
+
+static void run_generator(void) {
+    Generator *generator = starting_generator;
+    invoke_function(generator->function, generator->body, generator->args, generator->context);
+    generator->finished = 1;
+    // returning continues at uc_link, the last generator_next()
+}
+
+void evaluate_yield(FlatNode const *node, EvaluatorContext *context) {
+    Generator *generator = context->generator;
+    if (generator == NULL) {
+        context->error_code = YIELD_OUTSIDE_GENERATOR;
+        context->error_message = stats_strdup(EVALUATOR_ALLOC, "Yield outside of a generator");
+        return;
+    }
+    evaluate_expression_node(flat_child(node, 0), context);
+    if (context->error_code) return;
+
+    generator->value = context->result;
+    swapcontext(&generator->coroutine, &generator->host);
+    context->result = int_value(0);
+    if (generator->closing) {
+        context->error_code = CANCELLED;
+        context->error_message = stats_strdup(EVALUATOR_ALLOC, "Generator deleted");
+    }
+}
+
+Generator *start_generator(
+    EvaluatorContext *context, 
+    FlatFunction const *function, 
+    int32_t const *args, 
+    size_t args_length
+) {
+    if (context->error_code) clear_evaluation_error(context);
+    if (args_length != function->args_length) {
+        context->error_code = UNEXPECTED_ARGUMENTS;
+        context->error_message = unexpected_arguments_message(function->name);
+        return NULL;
+    }
+    FlatNode const *body = callable_body((FlatFunction *)function, context);
+    if (body == NULL) return NULL;
+
+    Generator *generator = stats_calloc(EVALUATOR_ALLOC, 1, sizeof(Generator));
+    char error = generator == NULL;
+    if (!error) {
+        *generator = (Generator){
+            .context = context,
+            .function = function,
+            .body = body,
+            .args = stats_malloc(EVALUATOR_ALLOC, (args_length ? args_length : 1) * sizeof(Value)),
+            .stack_bytes = _GENERATOR_STACK_BYTES,
+            .frames = init_stack(_INITIAL_STACK_FRAMES_CAPACITY, sizeof(HashTable))
+        };
+        void *stack = mmap(NULL, generator->stack_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        generator->stack = stack == MAP_FAILED ? NULL : stack;
+        error = generator->args == NULL || generator->frames.buffer == NULL || generator->stack == NULL;
+    }
+    if (!error) {
+        for (size_t i = 0; i < args_length; ++i) generator->args[i] = int_value(args[i]);
+        // an overflowing body faults on the guard page instead of writing past the stack
+        long page_bytes = sysconf(_SC_PAGESIZE);
+        error = mprotect(generator->stack, page_bytes, PROT_NONE) != 0 || getcontext(&generator->coroutine) != 0;
+        generator->coroutine.uc_stack.ss_sp = generator->stack + page_bytes;
+        generator->coroutine.uc_stack.ss_size = generator->stack_bytes - page_bytes;
+        generator->coroutine.uc_link = &generator->host;
+    }
+    if (error) {
+        if (generator != NULL) {
+            stats_free(EVALUATOR_ALLOC, generator->args);
+            delete_stack(&generator->frames);
+            if (generator->stack != NULL) munmap(generator->stack, generator->stack_bytes);
+            stats_free(EVALUATOR_ALLOC, generator);
+        }
+        context->error_code = INTERNAL;
+        context->error_message = stats_strdup(EVALUATOR_ALLOC, "Internal Error: Could not allocate memory for a generator");
+        return NULL;
+    }
+    makecontext(&generator->coroutine, run_generator, 0);
+    context->generators += 1;
+    return generator;
+}
+
+static enum GeneratorState resume_generator(Generator *generator, Value *value) {
+    EvaluatorContext *context = generator->context;
+    if (context->error_code) clear_evaluation_error(context);
+    if (generator->finished) return GENERATOR_DONE;
+
+    // the frames of the body go back on top of those of the host. Names
+    // they bind may shadow callees cached meanwhile
+    size_t base = context->stack_frames.length;
+    HashTable *frames = generator->frames.buffer;
+    for (size_t i = 0; i < generator->frames.length; ++i) {
+        if (!stack_push(&context->stack_frames, frames+i)) {
+            context->error_code = INTERNAL;
+            context->error_message = stats_strdup(EVALUATOR_ALLOC, "Internal Error: Could not allocate memory for stack frames");
+            return GENERATOR_FAILED;
+        }
+    }
+    generator->frames.length = 0;
+    invalidate_call_caches(context);
+
+    Generator *host_generator = context->generator;
+    FlatTree const *host_tree = enter_tree(generator->tree, context);
+    Value const *host_inline_args = context->inline_args;
+    context->inline_args = generator->inline_args;
+    context->generator = generator;
+    start_run(context);
+    if (!generator->started) {
+        generator->started = 1;
+        starting_generator = generator;
+    }
+    swapcontext(&generator->host, &generator->coroutine);
+
+    generator->tree = enter_tree(host_tree, context);
+    generator->inline_args = context->inline_args;
+    context->inline_args = host_inline_args;
+    context->generator = host_generator;
+
+    if (generator->finished) {
+        // unwind the frames of calls interrupted by an error
+        while (context->stack_frames.length > base) pop_stack_frame(context);
+        return context->error_code ? GENERATOR_FAILED : GENERATOR_DONE;
+    }
+
+    // suspended at a yield: the frames of the body leave the stack
+    frames = context->stack_frames.buffer;
+    for (size_t i = base; i < context->stack_frames.length; ++i) {
+        if (!stack_push(&generator->frames, frames+i)) {
+            // left where they are and unwound by ending the body
+            generator->frames.length = 0;
+            generator->closing = 1;
+            resume_generator(generator, value);
+            clear_evaluation_error(context);
+            context->error_code = INTERNAL;
+            context->error_message = stats_strdup(EVALUATOR_ALLOC, "Internal Error: Could not allocate memory for stack frames");
+            return GENERATOR_FAILED;
+        }
+    }
+    while (context->stack_frames.length > base) stack_pop(&context->stack_frames);
+    invalidate_call_caches(context);
+    *value = generator->value;
+    return GENERATOR_YIELDED;
+}
+
+enum GeneratorState generator_next(Generator *generator, Value *value) {
+    enum GeneratorState state = resume_generator(generator, value);
+    if (state == GENERATOR_FAILED) report_error(generator->context);
+    return state;
+}
+
+void delete_generator(Generator *generator) {
+    if (generator->started && !generator->finished) {
+        Value value;
+        generator->closing = 1;
+        resume_generator(generator, &value);
+        clear_evaluation_error(generator->context);
+    }
+    generator->context->generators -= 1;
+    delete_stack(&generator->frames);
+    munmap(generator->stack, generator->stack_bytes);
+    stats_free(EVALUATOR_ALLOC, generator->args);
+    stats_free(EVALUATOR_ALLOC, generator);
+}
+
 
 /*
 TODO 
-- string type support (currently only supports ints). Also maybe floats in future etc...
+- float type support
 - synthetic stress test
 */
\ No newline at end of file
@@ -0,0 +1,277 @@
+#include "flat_tree.h"
+
+#include <string.h>
+#include "hash_table.h"
+#include "stats.h"
+
+
+////////////////
+/// Counting ///
+////////////////
+
+// Entries a tree needs in each of its tables. names is an upper bound, as
+// repeated names share an entry
+typedef struct {
+    size_t nodes;
+    size_t names;
+    size_t strings;
+    size_t functions;
+    size_t call_sites;
+    size_t args;
+} FlatCounts;
+
+static char has_parsed_body(ASTNode const *function_node) {
+    return function_node->children_length == 1 && function_node->children[0].node_type != INVALID;
+}
+
+static void count_flat(ASTNode const *node, FlatCounts *counts) {
+    counts->nodes += 1;
+    switch (node->node_type) {
+        case FUNCTION:
+            counts->functions += 1;
+            counts->names += 1 + node->args_length;
+            counts->args += node->args_length;
+            if (has_parsed_body(node)) count_flat(node->children+0, counts);
+            return;
+        case DECLARATION:
+        case ASSIGNMENT:
+            counts->names += 1;
+            count_flat(node->children+1, counts);
+            return;
+        case FUNCTION_CALL:
+            counts->call_sites += 1;
+            counts->names += 1;
+            break;
+        case STRING:
+            counts->strings += 1;
+            break;
+        case VARIABLE:
+        case INDEX:
+        case INDEX_ASSIGNMENT:
+        case IMPORT_STMT:
+        case PMAP_CALL:
+            counts->names += 1;
+            break;
+        default:
+            break;
+    }
+    for (size_t i = 0; i < node->children_length; ++i) count_flat(node->children+i, counts);
+}
+
+
+////////////////
+/// Lowering ///
+////////////////
+
+typedef struct {
+    FlatTree *tree;
+    HashTable name_indices; // name -> uint32_t index into tree->names
+    size_t args_length;     // entries of tree->args in use
+    char error;
+} Flattener;
+
+static uint32_t name_index(Flattener *flattener, char const *name) {
+    uint32_t const *known = hash_table_get(&flattener->name_indices, name);
+    if (known != NULL) return *known;
+
+    FlatTree *tree = flattener->tree;
+    uint32_t index = tree->names_length;
+    tree->names[index] = (FlatName){.name = stats_strdup(PARSER_ALLOC, name), .hash = hash_key(name)};
+    tree->names_length += 1;
+    if (tree->names[index].name == NULL || hash_table_set(&flattener->name_indices, name, &index)) {
+        flattener->error = 1;
+    }
+    return index;
+}
+
+static void flatten_node(Flattener *flattener, ASTNode const *node, size_t index);
+
+static uint32_t add_function(Flattener *flattener, ASTNode const *node) {
+    FlatTree *tree = flattener->tree;
+    uint32_t index = tree->functions_length++;
+    FlatFunction *function = tree->functions + index;
+    *function = (FlatFunction){
+        .name = tree->names[name_index(flattener, node->value)].name,
+        .name_hash = node->value_hash,
+        .args = tree->args + flattener->args_length,
+        .args_length = node->args_length,
+        .args_hash_bits = node->args_hash_bits,
+        .body_tokens = node->body_tokens,
+        .body_tokens_length = node->body_tokens_length
+    };
+    for (size_t i = 0; i < node->args_length; ++i) {
+        tree->args[flattener->args_length++] = tree->names[name_index(flattener, node->args[i])].name;
+    }
+
+    if (has_parsed_body(node)) {
+        function->body_tree = tree;
+        function->body = tree->nodes_length++;
+        flatten_node(flattener, node->children+0, function->body);
+    }
+    else if (node->children_length == 1) {
+        function->error_message = stats_strdup(PARSER_ALLOC, node->children[0].error_message);
+        flattener->error |= function->error_message == NULL;
+    }
+    return index;
+}
+
+// Fills nodes[index] and places the children of node, one after the other,
+// at the end of the nodes in use
+static void flatten_node(Flattener *flattener, ASTNode const *node, size_t index) {
+    FlatTree *tree = flattener->tree;
+    FlatNode *flat = tree->nodes + index;
+    *flat = (FlatNode){
+        .node_type = node->node_type,
+        .negated = node->prefix_operator != NULL && *node->prefix_operator == SUB_OP
+    };
+
+    ASTNode const *children = node->children;
+    size_t children_length = node->children_length;
+    switch (node->node_type) {
+        case NUMBER:
+            flat->payload = (uint32_t)value_as_int(node->literal);
+            break;
+        case STRING:
+            tree->strings[tree->strings_length] = node->literal;
+            flat->payload = tree->strings_length++;
+            break;
+        case PARAMETER:
+            flat->payload = node->slot;
+            break;
+        case COMPARISON:
+        case LOGICAL:
+            flat->operator = node->operators[0];
+            break;
+        case VARIABLE:
+        case INDEX:
+        case INDEX_ASSIGNMENT:
+        case IMPORT_STMT:
+        case PMAP_CALL:
+            flat->payload = name_index(flattener, node->value);
+            break;
+        case DECLARATION:
+        case ASSIGNMENT:
+            flat->payload = name_index(flattener, children[0].value);
+            children += 1;
+            children_length -= 1;
+            break;
+        case FUNCTION_CALL:
+            tree->call_sites[tree->call_sites_length] = (FlatCallSite){
+                .name = name_index(flattener, node->value),
+                .cache.epoch = node->call_cache.epoch
+            };
+            flat->payload = tree->call_sites_length++;
+            break;
+        case FUNCTION:
+            flat->payload = add_function(flattener, node);
+            children_length = 0;
+            break;
+        default:
+            break;
+    }
+
+    size_t first_child = tree->nodes_length;
+    tree->nodes_length += children_length;
+    flat->first_child = first_child - index;
+    flat->children_length = children_length;
+    for (size_t i = 0; i < children_length; ++i) {
+        flatten_node(flattener, children+i, first_child+i);
+        if (node->node_type == ARITHMETIC && i > 0) tree->nodes[first_child+i].joining_operator = node->operators[i-1];
+    }
+}
+
+static void *allocate_table(size_t count, size_t size, char *error) {
+    if (count == 0) return NULL;
+    void *table = stats_malloc(PARSER_ALLOC, count * size);
+    *error |= table == NULL;
+    return table;
+}
+
+FlatTree *flatten_tree(ASTNode const *root) {
+    FlatCounts counts = {0};
+    count_flat(root, &counts);
+
+    FlatTree *tree = stats_calloc(PARSER_ALLOC, 1, sizeof(FlatTree));
+    if (tree == NULL) return NULL;
+    Flattener flattener = {
+        .tree = tree,
+        .name_indices = init_hash_table(_INITIAL_NAME_INDICES_CAPACITY, sizeof(uint32_t))
+    };
+    char error = flattener.name_indices.rows == NULL;
+    tree->nodes = allocate_table(counts.nodes, sizeof(FlatNode), &error);
+    tree->names = allocate_table(counts.names, sizeof(FlatName), &error);
+    tree->strings = allocate_table(counts.strings, sizeof(Value), &error);
+    tree->functions = allocate_table(counts.functions, sizeof(FlatFunction), &error);
+    tree->call_sites = allocate_table(counts.call_sites, sizeof(FlatCallSite), &error);
+    tree->args = allocate_table(counts.args, sizeof(char *), &error);
+
+    if (!error) {
+        tree->nodes_length = 1;
+        tree->shared = root->call_cache.epoch == _UNCACHED_CALL_SITE;
+        flatten_node(&flattener, root, 0);
+        error = flattener.error;
+    }
+    if (flattener.name_indices.rows != NULL) clean_hash_table(&flattener.name_indices);
+
+    // names shared by several nodes leave the end of the table unused
+    if (!error && tree->names_length < counts.names) {
+        tree->names = stats_realloc(PARSER_ALLOC, tree->names, tree->names_length * sizeof(FlatName));
+    }
+    if (error) {
+        delete_flat_tree(tree);
+        return NULL;
+    }
+    return tree;
+}
+
+void delete_flat_tree(FlatTree *tree) {
+    if (tree == NULL) return;
+    for (size_t i = 0; i < tree->functions_length; ++i) {
+        FlatFunction *function = tree->functions + i;
+        if (function->owns_body_tree) delete_flat_tree(function->body_tree);
+        stats_free(PARSER_ALLOC, function->error_message);
+        stats_free(PARSER_ALLOC, function->tiered_body);
+    }
+    for (size_t i = 0; i < tree->names_length; ++i) stats_free(PARSER_ALLOC, tree->names[i].name);
+    stats_free(PARSER_ALLOC, tree->nodes);
+    stats_free(PARSER_ALLOC, tree->names);
+    stats_free(PARSER_ALLOC, tree->strings);
+    stats_free(PARSER_ALLOC, tree->functions);
+    stats_free(PARSER_ALLOC, tree->call_sites);
+    stats_free(PARSER_ALLOC, tree->args);
+    stats_free(PARSER_ALLOC, tree);
+}
+
+char flat_tree_spawns(FlatTree const *tree) {
+    for (size_t i = 0; i < tree->nodes_length; ++i) {
+        if (tree->nodes[i].node_type == SPAWN_CALL || tree->nodes[i].node_type == PMAP_CALL) return 1;
+    }
+    return 0;
+}
+
+FlatNode const *flat_function_body(FlatFunction *function) {
+    if (function->body_tree == NULL && function->error_message == NULL) {
+        ASTNode body = parse_function_body(function->body_tokens, function->body_tokens_length);
+        if (body.node_type == INVALID) {
+            function->error_message = (char *)body.error_message;
+            return NULL;
+        }
+        function->body_tree = flatten_tree(&body);
+        function->owns_body_tree = function->body_tree != NULL;
+        function->body = 0;
+        delete_node(&body);
+    }
+    return function->body_tree ? function->body_tree->nodes + function->body : NULL;
+}
+
+char share_flat_tree(FlatTree *tree) {
+    if (tree->shared) return 0;
+    for (size_t i = 0; i < tree->functions_length; ++i) {
+        FlatFunction *function = tree->functions + i;
+        if (flat_function_body(function) == NULL && function->error_message == NULL) return 1;
+        if (function->owns_body_tree && share_flat_tree(function->body_tree)) return 1;
+    }
+    for (size_t i = 0; i < tree->call_sites_length; ++i) tree->call_sites[i].cache.epoch = _UNCACHED_CALL_SITE;
+    tree->shared = 1;
+    return 0;
+}
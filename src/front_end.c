@@ -0,0 +1,236 @@
+#include "front_end.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "stats.h"
+
+
+/////////////////
+/// Splitting ///
+/////////////////
+
+static char is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t';
+}
+
+static char is_word_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Whether the next token after code is the bummer keyword
+static char followed_by_else(char const *code) {
+    while (is_space(*code)) ++code;
+    return strncmp(code, "bummer", 6) == 0 && !is_word_char(code[6]);
+}
+
+size_t split_source(char const *code, size_t max_chunks, size_t min_chunk_bytes, SourceChunk *chunks) {
+    size_t length = strlen(code);
+    size_t num_chunks = max_chunks;
+    if (min_chunk_bytes > 0 && length / min_chunk_bytes < num_chunks) num_chunks = length / min_chunk_bytes;
+    if (num_chunks > _MAX_FRONT_END_CHUNKS) num_chunks = _MAX_FRONT_END_CHUNKS;
+    if (num_chunks < 1) num_chunks = 1;
+
+    size_t count = 0;
+    size_t start = 0;
+    size_t target = length / num_chunks;
+    size_t depth = 0;
+    for (size_t i = 0; i < length && count + 1 < num_chunks; ++i) {
+        char c = code[i];
+        if (c == '"') {
+            // skipped exactly as the tokenizer reads it. An unterminated
+            // literal keeps the rest of the source in the last chunk
+            for (++i; i < length && code[i] != '"'; ++i) {
+                if (code[i] == '\\' && ++i == length) break;
+            }
+            if (i >= length) break;
+            continue;
+        }
+        if (c == '{') depth += 1;
+        else if (c == '}') {
+            if (depth == 0) break;
+            depth -= 1;
+        }
+        else if (c != ';') continue;
+
+        if (depth > 0 || i + 1 < target) continue;
+        if (c == '}' && followed_by_else(code + i + 1)) continue;
+        chunks[count++] = (SourceChunk){.start = start, .end = i + 1};
+        start = i + 1;
+        target = start + (length - start) / (num_chunks - count);
+    }
+    chunks[count++] = (SourceChunk){.start = start, .end = length};
+    return count;
+}
+
+size_t default_front_end_threads(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) return 1;
+    return cores > _MAX_FRONT_END_CHUNKS ? _MAX_FRONT_END_CHUNKS : (size_t)cores;
+}
+
+
+///////////////
+/// Workers ///
+///////////////
+
+typedef struct {
+    void *(*job)(void *);
+    void *argument;
+    AllocCounter allocations[_ALLOC_SUBSYSTEMS_COUNT];
+} Worker;
+
+static void *run_worker(void *argument) {
+    Worker *worker = argument;
+    worker->job(worker->argument);
+    read_alloc_counters(worker->allocations);
+    return NULL;
+}
+
+// Runs job(arguments + i * size) for every i, all but the first on threads
+// of their own. Allocation counters of the workers are added to this thread
+static void run_jobs(void *(*job)(void *), void *arguments, size_t size, size_t count) {
+    Worker workers[_MAX_FRONT_END_CHUNKS];
+    pthread_t threads[_MAX_FRONT_END_CHUNKS];
+    char started[_MAX_FRONT_END_CHUNKS] = {0};
+    for (size_t i = 1; i < count; ++i) {
+        workers[i] = (Worker){.job = job, .argument = (char *)arguments + i * size};
+        started[i] = pthread_create(threads+i, NULL, run_worker, workers+i) == 0;
+    }
+    job(arguments);
+    for (size_t i = 1; i < count; ++i) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+            add_alloc_counters(workers[i].allocations);
+        }
+        else job((char *)arguments + i * size);
+    }
+}
+
+
+////////////////
+/// Tokenize ///
+////////////////
+
+typedef struct {
+    char const *code;
+    SourceChunk chunk;
+    TokenizerState state;
+    char error;
+} TokenizeJob;
+
+static void *tokenize_job(void *argument) {
+    TokenizeJob *job = argument;
+    job->state = init_tokenizer_range(job->code, job->chunk.start, job->chunk.end);
+    job->error = tokenize(&job->state);
+    return NULL;
+}
+
+static void delete_tokens(TokenizerState *state) {
+    for (size_t i = 0; i < state->parsed_tokens_length; ++i) delete_token(state->parsed_tokens+i);
+    stats_free(TOKENIZER_ALLOC, state->parsed_tokens);
+}
+
+char tokenize_chunks(
+    char const *code,
+    SourceChunk const *chunks,
+    size_t num_chunks,
+    Token **tokens,
+    size_t *num_tokens,
+    size_t *chunk_token_starts,
+    char **error_message
+) {
+    TokenizeJob jobs[_MAX_FRONT_END_CHUNKS];
+    for (size_t i = 0; i < num_chunks; ++i) jobs[i] = (TokenizeJob){.code = code, .chunk = chunks[i]};
+    run_jobs(tokenize_job, jobs, sizeof(TokenizeJob), num_chunks);
+
+    // the first error in source order is the one the serial path stops at
+    char error = 0;
+    size_t total = 0;
+    for (size_t i = 0; i < num_chunks; ++i) {
+        if (jobs[i].error && !error) {
+            error = jobs[i].error;
+            *error_message = strdup(jobs[i].state.error_message);
+        }
+        if (jobs[i].error) stats_free(TOKENIZER_ALLOC, jobs[i].state.error_message);
+        total += jobs[i].state.parsed_tokens_length;
+    }
+    Token *joined = error ? NULL : stats_malloc(TOKENIZER_ALLOC, (total ? total : 1) * sizeof(Token));
+    if (!error && joined == NULL) {
+        *error_message = strdup("Internal Error: Could not allocate memory for tokens");
+        error = 1;
+    }
+    if (error) {
+        for (size_t i = 0; i < num_chunks; ++i) delete_tokens(&jobs[i].state);
+        return error;
+    }
+
+    size_t length = 0;
+    for (size_t i = 0; i < num_chunks; ++i) {
+        chunk_token_starts[i] = length;
+        memcpy(joined + length, jobs[i].state.parsed_tokens, jobs[i].state.parsed_tokens_length * sizeof(Token));
+        length += jobs[i].state.parsed_tokens_length;
+        stats_free(TOKENIZER_ALLOC, jobs[i].state.parsed_tokens);
+    }
+    *tokens = joined;
+    *num_tokens = total;
+    return 0;
+}
+
+
+/////////////
+/// Parse ///
+/////////////
+
+typedef struct {
+    Token const *tokens;
+    size_t num_tokens;
+    ASTNode root;
+} ParseJob;
+
+// Bodies of the top-level functions are parsed here too, as the optimizer
+// would otherwise parse most of them on a single thread. A syntax error in
+// one is still only reported once the function is called
+static void *parse_job(void *argument) {
+    ParseJob *job = argument;
+    job->root = parse_ast(job->tokens, job->num_tokens);
+    for (size_t i = 0; job->root.node_type != INVALID && i < job->root.children_length; ++i) {
+        if (job->root.children[i].node_type == FUNCTION) function_body(job->root.children+i);
+    }
+    return NULL;
+}
+
+ASTNode parse_chunks(Token const *tokens, size_t num_tokens, size_t const *chunk_token_starts, size_t num_chunks) {
+    ParseJob jobs[_MAX_FRONT_END_CHUNKS];
+    for (size_t i = 0; i < num_chunks; ++i) {
+        size_t end = i + 1 < num_chunks ? chunk_token_starts[i+1] : num_tokens;
+        jobs[i] = (ParseJob){.tokens = tokens + chunk_token_starts[i], .num_tokens = end - chunk_token_starts[i]};
+    }
+    run_jobs(parse_job, jobs, sizeof(ParseJob), num_chunks);
+
+    size_t invalid = num_chunks;
+    size_t total = 0;
+    for (size_t i = 0; i < num_chunks; ++i) {
+        if (jobs[i].root.node_type == INVALID && invalid == num_chunks) invalid = i;
+        total += jobs[i].root.children_length;
+    }
+    ASTNode *children = invalid == num_chunks ? stats_malloc(PARSER_ALLOC, (total ? total : 1) * sizeof(ASTNode)) : NULL;
+    if (invalid == num_chunks && children == NULL) {
+        for (size_t i = 0; i < num_chunks; ++i) delete_node(&jobs[i].root);
+        char *error_message = stats_strdup(PARSER_ALLOC, "Internal Error: Could not allocate memory for statements");
+        return (ASTNode){.node_type = INVALID, .error_message = error_message};
+    }
+    if (invalid < num_chunks) {
+        for (size_t i = 0; i < num_chunks; ++i) if (i != invalid) delete_node(&jobs[i].root);
+        return jobs[invalid].root;
+    }
+
+    // the statements move over, only the arrays that held them go
+    size_t length = 0;
+    for (size_t i = 0; i < num_chunks; ++i) {
+        memcpy(children + length, jobs[i].root.children, jobs[i].root.children_length * sizeof(ASTNode));
+        length += jobs[i].root.children_length;
+        stats_free(PARSER_ALLOC, jobs[i].root.children);
+    }
+    return (ASTNode){.node_type = STMT_SEQUENCE, .children = children, .children_length = total};
+}
@@ -1,4 +1,5 @@
 #include "hash_table.h"
+#include "stats.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
@@ -9,7 +10,7 @@
 
 // Return 64-bit FNV-1a hash for key (NUL-terminated). See description:
 // https://en.wikipedia.org/wiki/Fowler–Noll–Vo_hash_function
-static uint64_t hash_function(char const *key) {
+uint64_t hash_key(char const *key) {
     uint64_t hash = FNV_OFFSET;
     for (char const *p = key; *p; ++p) {
         hash ^= (uint64_t)(unsigned char)(*p);
@@ -19,7 +20,7 @@ static uint64_t hash_function(char const *key) {
 }
 
 HashTable init_hash_table(size_t capacity, size_t value_size) {
-    HashTableRow *rows = calloc(capacity, sizeof(HashTableRow));
+    HashTableRow *rows = stats_calloc(HASH_TABLE_ALLOC, capacity, sizeof(HashTableRow));
     HashTable table = {
         .rows = rows,
         .capacity = capacity,
@@ -31,46 +32,84 @@ HashTable init_hash_table(size_t capacity, size_t value_size) {
 
 void clean_hash_table(HashTable *ht) {
     for (size_t i = 0; i < ht->capacity; ++i) {
-        free(ht->rows[i].key);
-        free(ht->rows[i].value);
+        stats_free(HASH_TABLE_ALLOC, ht->rows[i].key);
+        stats_free(HASH_TABLE_ALLOC, ht->rows[i].value);
     }
-    free(ht->rows);
+    stats_free(HASH_TABLE_ALLOC, ht->rows);
+}
+
+void clear_hash_table(HashTable *ht) {
+    for (size_t i = 0; i < ht->capacity && ht->size > 0; ++i) {
+        if (ht->rows[i].key == NULL) continue;
+        stats_free(HASH_TABLE_ALLOC, ht->rows[i].key);
+        stats_free(HASH_TABLE_ALLOC, ht->rows[i].value);
+        ht->rows[i] = (HashTableRow){0};
+        ht->size -= 1;
+    }
+}
+
+// Doubles the capacity and re-inserts every row at its new position
+static char hash_table_grow(HashTable *ht) {
+    size_t new_capacity = ht->capacity * 2;
+    HashTableRow *new_rows = stats_calloc(HASH_TABLE_ALLOC, new_capacity, sizeof(HashTableRow));
+    if (new_rows == NULL) return 1;
+
+    for (size_t i = 0; i < ht->capacity; ++i) {
+        if (ht->rows[i].key == NULL) continue;
+        size_t row_index = ht->rows[i].hash & (new_capacity - 1);
+        while (new_rows[row_index].key != NULL) row_index = (row_index + 1) & (new_capacity - 1);
+        new_rows[row_index] = ht->rows[i];
+    }
+
+    stats_free(HASH_TABLE_ALLOC, ht->rows);
+    ht->rows = new_rows;
+    ht->capacity = new_capacity;
+    return 0;
 }
 
 char hash_table_set(HashTable *ht, char const *key, void const *value) {
-    if (ht->capacity == ht->size) {
-        HashTableRow *new_rows = calloc(ht->capacity * 2, sizeof(HashTableRow));
-        if (new_rows == NULL) return 1;
-        memcpy(new_rows, ht->rows, ht->capacity * sizeof(HashTableRow));
-        ht->capacity *= 2;
+    // keep the load factor under 3/4 so probing stays short and always ends
+    if ((ht->size + 1) * 4 > ht->capacity * 3) {
+        if (hash_table_grow(ht)) return 1;
     }
 
-    size_t row_index = hash_function(key) & (ht->capacity - 1);
+    uint64_t hash = hash_key(key);
+    size_t row_index = hash & (ht->capacity - 1);
 
     while(ht->rows[row_index].key != NULL) {
-        if (strcmp(ht->rows[row_index].key, key) == 0) {
-            free(ht->rows[row_index].value);
-            ht->rows[row_index].value = malloc(ht->value_size);
+        if (ht->rows[row_index].hash == hash && strcmp(ht->rows[row_index].key, key) == 0) {
             memcpy(ht->rows[row_index].value, value, ht->value_size);
+            return 0;
         }
-        row_index = (row_index + 1) % ht->capacity;
+        row_index = (row_index + 1) & (ht->capacity - 1);
     }
 
-    ht->rows[row_index].key = strdup(key);
-    if (ht->rows[row_index].key == NULL) return 0;
-    ht->rows[row_index].value = malloc(ht->value_size);
-    if (ht->rows[row_index].value == NULL) return 0;
-    memcpy(ht->rows[row_index].value, value, ht->value_size);
+    char *new_key = stats_strdup(HASH_TABLE_ALLOC, key);
+    void *new_value = stats_malloc(HASH_TABLE_ALLOC, ht->value_size);
+    if (new_key == NULL || new_value == NULL) {
+        stats_free(HASH_TABLE_ALLOC, new_key);
+        stats_free(HASH_TABLE_ALLOC, new_value);
+        return 1;
+    }
+    memcpy(new_value, value, ht->value_size);
+    ht->rows[row_index].key = new_key;
+    ht->rows[row_index].hash = hash;
+    ht->rows[row_index].value = new_value;
+    ht->size += 1;
     return 0;
 }
 
 void const * hash_table_get(HashTable const *ht, char const *key) {
-    size_t row_index = hash_function(key) & (ht->capacity - 1);
+    return hash_table_get_hashed(ht, key, hash_key(key));
+}
+
+void const * hash_table_get_hashed(HashTable const *ht, char const *key, uint64_t hash) {
+    size_t row_index = hash & (ht->capacity - 1);
     while(ht->rows[row_index].key != NULL) {
-        if (strcmp(ht->rows[row_index].key, key) == 0) {
+        if (ht->rows[row_index].hash == hash && strcmp(ht->rows[row_index].key, key) == 0) {
             return ht->rows[row_index].value;
         }
-        row_index = (row_index + 1) % ht->capacity;
+        row_index = (row_index + 1) & (ht->capacity - 1);
     }
     return NULL;
 }
\ No newline at end of file
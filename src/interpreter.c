@@ -3,50 +3,437 @@
 #include "tokenizer.h"
 #include "parser.h"
 #include "evaluator.h"
+#include "interpreter.h"
+#include "optimizer.h"
+#include "front_end.h"
+#include "flat_tree.h"
+#include "snapshot.h"
+#include "hash_table.h"
+#include "stats.h"
+#include "hooks.h"
 
 
-char interpret(char const *code, char **error_message, EvaluatorContext *context, char dry_run) {
+const char *InterpreterPhaseNames[] = {
+    "tokenize",
+    "parse",
+    "optimize",
+    "evaluate",
+    "snapshot"
+};
+
+static void start_phase(enum InterpreterPhase phase, EvaluatorContext const *context) {
+    _PROBE1(phase__start, InterpreterPhaseNames[phase]);
+    _HOOK(context, phase_start, phase);
+}
+
+static void end_phase(enum InterpreterPhase phase, EvaluatorContext const *context) {
+    _PROBE1(phase__end, InterpreterPhaseNames[phase]);
+    _HOOK(context, phase_end, phase);
+}
+
+// Hands an error that stops a run outside of the evaluator to the probes and
+// hooks, see report_error() in the evaluator for the others
+static void report_run_error(enum ErrorCode error_code, char const *message, EvaluatorContext const *context) {
+    _PROBE2(error, error_code, message);
+    _HOOK(context, error, error_code, message);
+}
+
+// Nodes of the tree without function bodies, which the serial parser leaves
+// for later while the parallel one already parses them
+static size_t count_statement_nodes(ASTNode const *node) {
+    if (node->node_type == FUNCTION) return 1;
+    size_t result = 1;
+    for (size_t i = 0; i < node->children_length; ++i) {
+        result += count_statement_nodes(node->children+i);
+    }
+    return result;
+}
+
+// Tokenizes, parses and optimizes code. On error the tokens are freed and
+// *error_message set; otherwise the caller owns the tokens and the tree
+static char front_end(
+    char const *code, 
+    char **error_message, 
+    EvaluatorContext const *context, 
+    InterpreterStats *stats,
+    Token **tokens_out,
+    size_t *num_tokens_out,
+    ASTNode *root_out
+) {
+    PhaseTiming timer;
+
+    // Large sources are tokenized and parsed in chunks, one thread each
+    SourceChunk chunks[_MAX_FRONT_END_CHUNKS];
+    size_t threads = context->front_end_threads ? context->front_end_threads : default_front_end_threads();
+    size_t num_chunks = split_source(code, threads, _MIN_FRONT_END_CHUNK_BYTES, chunks);
+    if (stats) stats->front_end_chunks = num_chunks;
+
     // Tokenize 
-    TokenizerState tokenizer_state = init_tokenizer_state(code);
-    char error = tokenize(&tokenizer_state);
-    if (error) {
-        *error_message = strdup(tokenizer_state.error_message);
-        for (size_t i = 0; i < tokenizer_state.parsed_tokens_length; ++i) {
-            delete_token(tokenizer_state.parsed_tokens+i);
+    Token *tokens;
+    size_t num_tokens;
+    size_t chunk_token_starts[_MAX_FRONT_END_CHUNKS];
+    start_phase(TOKENIZE_PHASE, context);
+    if (stats) timer = start_phase_timer();
+    if (num_chunks > 1) {
+        if (tokenize_chunks(code, chunks, num_chunks, &tokens, &num_tokens, chunk_token_starts, error_message)) {
+            if (stats) stats->tokenize = stop_phase_timer(&timer);
+            end_phase(TOKENIZE_PHASE, context);
+            report_run_error(SYNTAX_ERROR, *error_message, context);
+            return 1;
         }
-        free(tokenizer_state.parsed_tokens);
-        return error;
     }
-    Token *tokens = tokenizer_state.parsed_tokens; // ownership transfer 
-    size_t num_tokens = tokenizer_state.parsed_tokens_length;
+    else {
+        TokenizerState tokenizer_state = init_tokenizer_state(code);
+        char error = tokenize(&tokenizer_state);
+        if (error) {
+            if (stats) stats->tokenize = stop_phase_timer(&timer);
+            end_phase(TOKENIZE_PHASE, context);
+            report_run_error(SYNTAX_ERROR, tokenizer_state.error_message, context);
+            *error_message = strdup(tokenizer_state.error_message);
+            for (size_t i = 0; i < tokenizer_state.parsed_tokens_length; ++i) {
+                delete_token(tokenizer_state.parsed_tokens+i);
+            }
+            stats_free(TOKENIZER_ALLOC, tokenizer_state.parsed_tokens);
+            return error;
+        }
+        tokens = tokenizer_state.parsed_tokens; // ownership transfer 
+        num_tokens = tokenizer_state.parsed_tokens_length;
+    }
+    if (stats) {
+        stats->tokenize = stop_phase_timer(&timer);
+        stats->tokens = num_tokens;
+    }
+    end_phase(TOKENIZE_PHASE, context);
 
     // Parse
-    ASTNode root = parse_ast(tokens, num_tokens);
+    start_phase(PARSE_PHASE, context);
+    if (stats) timer = start_phase_timer();
+    ASTNode root = num_chunks > 1 ? parse_chunks(tokens, num_tokens, chunk_token_starts, num_chunks) : parse_ast(tokens, num_tokens);
+    if (stats) {
+        stats->parse = stop_phase_timer(&timer);
+        stats->ast_nodes = count_statement_nodes(&root);
+    }
+    end_phase(PARSE_PHASE, context);
     if (root.node_type == INVALID) {
+        report_run_error(SYNTAX_ERROR, root.error_message, context);
         *error_message = strdup(root.error_message);
 
         // free mempory
         for (size_t i = 0; i < num_tokens; ++i) {
             delete_token(tokens + i);
         }
-        free(tokens);
+        stats_free(TOKENIZER_ALLOC, tokens);
         delete_node(&root);
 
         return 1;
     }
 
-    // Evaluate 
-    *context = evaluate(&root, dry_run);
-    if (context->error_code) {
-        *error_message = strdup(context->error_message);
+    // Optimize. Dead code goes first so that unused helpers are not parsed
+    // for the inliner, and again after it takes the last calls of a helper.
+    // Imported modules may call or redefine any function, so a program
+    // importing one keeps its functions and is not inlined
+    start_phase(OPTIMIZE_PHASE, context);
+    if (stats) timer = start_phase_timer();
+    size_t removed = 0;
+    size_t inlined = 0;
+    char imports = contains_node_type(&root, IMPORT_STMT);
+    char keep_functions = imports || context->keep_functions;
+    if (context->eliminate_dead_code) removed += eliminate_dead_code(&root, keep_functions);
+    if (context->inline_threshold && !imports) inlined = inline_calls(&root, context->inline_threshold);
+    if (context->eliminate_dead_code && inlined) removed += eliminate_dead_code(&root, keep_functions);
+    if (stats) {
+        stats->optimize = stop_phase_timer(&timer);
+        stats->dead_nodes_removed = removed;
+        stats->inlined_calls = inlined;
     }
+    end_phase(OPTIMIZE_PHASE, context);
+
+    *tokens_out = tokens;
+    *num_tokens_out = num_tokens;
+    *root_out = root;
+    return 0;
+}
 
-    // free memory 
+// Whether a program spawns tasks, also from bodies not parsed yet
+static char spawns_tasks(Token const *tokens, size_t num_tokens) {
+    for (size_t i = 0; i < num_tokens; ++i) {
+        if (tokens[i].token_type == SPAWN || tokens[i].token_type == PMAP) return 1;
+    }
+    return 0;
+}
+
+// For a run spawning tasks, which may call functions of the programs the
+// context kept from earlier runs: shares those programs, and every later
+// run of the context through share_trees. Returns 1 and sets error_message
+// when out of memory
+static char share_for_tasks(char **error_message, EvaluatorContext *context) {
+    for (size_t i = 0; i < context->programs.length; ++i) {
+        RetainedProgram const *program = stack_at(&context->programs, i);
+        if (share_flat_tree(program->tree)) {
+            *error_message = strdup("Internal Error: Could not allocate memory for the flat tree");
+            report_run_error(INTERNAL, *error_message, context);
+            return 1;
+        }
+    }
+    context->share_trees = 1;
+    return 0;
+}
+
+static void delete_tokens(Token *tokens, size_t num_tokens) {
     for (size_t i = 0; i < num_tokens; ++i) {
         delete_token(tokens + i);
     }
-    free(tokens);
-    delete_node(&root);
-    
+    stats_free(TOKENIZER_ALLOC, tokens);
+}
+
+static void add_phase_timing(PhaseTiming *total, PhaseTiming part) {
+    total->wall_ms += part.wall_ms;
+    total->cpu_ms += part.cpu_ms;
+}
+
+// Lowers the optimized tree to the flat tree the evaluator runs on and
+// deletes it. Counted as part of the optimize phase
+static FlatTree *lower(ASTNode *root, char **error_message, EvaluatorContext const *context, InterpreterStats *stats) {
+    PhaseTiming timer;
+    start_phase(OPTIMIZE_PHASE, context);
+    if (stats) timer = start_phase_timer();
+    long live_bytes = read_live_bytes(PARSER_ALLOC);
+    FlatTree *tree = flatten_tree(root);
+    long flat_live_bytes = read_live_bytes(PARSER_ALLOC);
+    delete_node(root);
+    if (stats) {
+        add_phase_timing(&stats->optimize, stop_phase_timer(&timer));
+        stats->ast_bytes = flat_live_bytes - read_live_bytes(PARSER_ALLOC);
+        stats->flat_ast_bytes = flat_live_bytes - live_bytes;
+    }
+    end_phase(OPTIMIZE_PHASE, context);
+    if (tree == NULL) {
+        *error_message = strdup("Internal Error: Could not allocate memory for the flat tree");
+        report_run_error(INTERNAL, *error_message, context);
+    }
+    return tree;
+}
+
+// Runs the top-level statements [first, last) of a prepared tree in the context
+static void evaluate_phase(
+    FlatTree const *tree, 
+    size_t first, 
+    size_t last, 
+    char **error_message, 
+    EvaluatorContext *context, 
+    InterpreterStats *stats
+) {
+    PhaseTiming timer;
+    start_phase(EVALUATE_PHASE, context);
+    if (stats) timer = start_phase_timer();
+    evaluate_statements(tree, first, last, context);
+    end_phase(EVALUATE_PHASE, context);
+    if (stats) {
+        add_phase_timing(&stats->evaluate, stop_phase_timer(&timer));
+        stats->function_calls = context->function_calls;
+        stats->frames_allocated = context->frames_allocated;
+        stats->tier_ups = context->tier_ups;
+        read_alloc_counters(stats->allocations);
+        stats->peak_rss_kb = read_peak_rss_kb();
+    }
+    if (context->error_code) {
+        *error_message = strdup(context->error_message ? context->error_message : "Internal Error");
+    }
+}
+
+char interpret(
+    char const *code, 
+    char **error_message, 
+    EvaluatorContext *context, 
+    InterpreterStats *stats
+) {
+    if (stats) {
+        memset(stats, 0, sizeof(InterpreterStats));
+        reset_alloc_counters();
+    }
+
+    Token *tokens;
+    size_t num_tokens;
+    ASTNode root;
+    if (front_end(code, error_message, context, stats, &tokens, &num_tokens, &root)) return 1;
+    // tasks evaluate the tree on other threads. A body that does not parse
+    // keeps its error for its first call
+    if (!context->share_trees && spawns_tasks(tokens, num_tokens) && share_for_tasks(error_message, context)) {
+        delete_node(&root);
+        delete_tokens(tokens, num_tokens);
+        return 1;
+    }
+    if (context->share_trees) share_tree(&root);
+    FlatTree *tree = lower(&root, error_message, context, stats);
+    if (tree == NULL) {
+        delete_tokens(tokens, num_tokens);
+        return 1;
+    }
+
+    evaluate_phase(tree, 0, tree->nodes[0].children_length, error_message, context, stats);
+
+    // function values point into the tree and unparsed function bodies into
+    // the tokens, so a program that defined any keeps both alive with the
+    // context (functions survive across REPL inputs). Should retaining fail
+    // they leak rather than dangle
+    if (tree->functions_length > 0) {
+        retain_program(context, tree, tokens, num_tokens);
+        return context->error_code;
+    }
+
+    delete_tokens(tokens, num_tokens);
+    delete_flat_tree(tree);
+    return context->error_code;
+}
+
+char compile_program(
+    char const *code, 
+    char **error_message, 
+    EvaluatorContext const *context, 
+    Program *program
+) {
+    Token *tokens;
+    size_t num_tokens;
+    ASTNode root;
+    if (front_end(code, error_message, context, NULL, &tokens, &num_tokens, &root)) return 1;
+
+    ASTNode const *invalid = share_tree(&root);
+    if (invalid != NULL) {
+        report_run_error(SYNTAX_ERROR, invalid->error_message, context);
+        *error_message = strdup(invalid->error_message);
+        delete_node(&root);
+        program->tree = NULL;
+    }
+    else program->tree = lower(&root, error_message, context, NULL);
+
+    delete_tokens(tokens, num_tokens);
+    return program->tree == NULL;
+}
+
+char run_program(
+    Program const *program, 
+    char **error_message, 
+    EvaluatorContext *context, 
+    InterpreterStats *stats
+) {
+    if (stats) {
+        memset(stats, 0, sizeof(InterpreterStats));
+        reset_alloc_counters();
+    }
+    // compiled trees are shared already, the programs of the context may not be
+    char shares = !context->share_trees && context->programs.length > 0 && flat_tree_spawns(program->tree);
+    if (shares && share_for_tasks(error_message, context)) return 1;
+    evaluate_phase(program->tree, 0, program->tree->nodes[0].children_length, error_message, context, stats);
+    return context->error_code;
+}
+
+void delete_program(Program *program) {
+    delete_flat_tree(program->tree);
+    program->tree = NULL;
+}
+
+char interpret_and_snapshot(
+    char const *code, 
+    char const *snapshot_path, 
+    char **error_message, 
+    EvaluatorContext *context, 
+    InterpreterStats *stats
+) {
+    if (stats) {
+        memset(stats, 0, sizeof(InterpreterStats));
+        reset_alloc_counters();
+    }
+
+    // a snapshot holds no tokens, so every body is parsed now. One that does
+    // not parse keeps its error for its first call, as under interpret()
+    Token *tokens;
+    size_t num_tokens;
+    ASTNode root;
+    if (front_end(code, error_message, context, stats, &tokens, &num_tokens, &root)) return 1;
+    share_tree(&root);
+    FlatTree *tree = lower(&root, error_message, context, stats);
+    delete_tokens(tokens, num_tokens);
+    if (tree == NULL) return 1;
+    // the tree belongs to this run alone, so its call sites may cache and its
+    // functions tier up again unless tasks evaluate it too
+    if (!context->share_trees && flat_tree_spawns(tree) && share_for_tasks(error_message, context)) {
+        delete_flat_tree(tree);
+        return 1;
+    }
+    if (!context->share_trees) {
+        for (size_t i = 0; i < tree->call_sites_length; ++i) tree->call_sites[i].cache.epoch = 0;
+        tree->shared = 0;
+    }
+
+    size_t prelude = prelude_length(tree);
+    evaluate_phase(tree, 0, prelude, error_message, context, stats);
+    if (!context->error_code) {
+        PhaseTiming timer;
+        start_phase(SNAPSHOT_PHASE, context);
+        if (stats) timer = start_phase_timer();
+        // the warm start would not print them again
+        if (context->side_effects.length > 0) {
+            context->error_code = SNAPSHOT_ERROR;
+            context->error_message = stats_strdup(EVALUATOR_ALLOC, "Snapshot of a prelude that printed");
+        }
+        else if (write_snapshot(snapshot_path, tree, hash_key(code), prelude, context, &context->error_message)) {
+            context->error_code = SNAPSHOT_ERROR;
+        }
+        if (stats) stats->snapshot = stop_phase_timer(&timer);
+        end_phase(SNAPSHOT_PHASE, context);
+        if (context->error_code) {
+            report_run_error(context->error_code, context->error_message, context);
+            *error_message = strdup(context->error_message ? context->error_message : "Internal Error");
+        }
+    }
+    if (!context->error_code) evaluate_phase(tree, prelude, tree->nodes[0].children_length, error_message, context, stats);
+
+    if (tree->functions_length > 0) {
+        retain_program(context, tree, NULL, 0);
+        return context->error_code;
+    }
+    delete_flat_tree(tree);
+    return context->error_code;
+}
+
+char resume_snapshot(
+    char const *snapshot_path, 
+    char const *code, 
+    Snapshot *snapshot, 
+    char **error_message, 
+    EvaluatorContext *context, 
+    InterpreterStats *stats
+) {
+    if (stats) {
+        memset(stats, 0, sizeof(InterpreterStats));
+        reset_alloc_counters();
+    }
+
+    PhaseTiming timer;
+    start_phase(SNAPSHOT_PHASE, context);
+    if (stats) timer = start_phase_timer();
+    char *message = NULL;
+    char error = load_snapshot(snapshot_path, snapshot, &message);
+    if (!error && code != NULL && snapshot->source_hash != hash_key(code)) {
+        delete_snapshot(snapshot);
+        message = stats_strdup(EVALUATOR_ALLOC, "Snapshot was taken of a different source");
+        error = 1;
+    }
+    if (!error && restore_globals(snapshot, context)) {
+        message = stats_strdup(EVALUATOR_ALLOC, "Internal Error: Could not allocate memory for the snapshot");
+        error = 1;
+    }
+    if (stats) stats->snapshot = stop_phase_timer(&timer);
+    end_phase(SNAPSHOT_PHASE, context);
+    if (error) {
+        report_run_error(SNAPSHOT_ERROR, message, context);
+        *error_message = strdup(message ? message : "Internal Error");
+        stats_free(EVALUATOR_ALLOC, message);
+        return 1;
+    }
+
+    if (!context->share_trees && snapshot->tree->shared && share_for_tasks(error_message, context)) return 1;
+    if (context->module_dir == NULL) context->module_dir = snapshot->module_dir;
+    evaluate_phase(snapshot->tree, snapshot->resume_statement, snapshot->tree->nodes[0].children_length, error_message, context, stats);
     return context->error_code;
-}
\ No newline at end of file
+}
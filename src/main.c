@@ -2,24 +2,23 @@
 #include <string.h>
 #include <assert.h>
 #include <stdint.h>
+#include <libgen.h>
 #include "tokenizer.h"
 #include "parser.h"
 #include "hash_table.h"
 #include "stack.h"
 #include "evaluator.h"
 #include "interpreter.h"
+#include "stats.h"
+#include "repl.h"
 
-int main(int argc, char **argv) {
-    if (argc < 2) {
-        printf("File path required\n");
-        return 1;
-    }
-
-    char *file_path = argv[1];
+// Returns the content of the script, NULL (with the reason printed) when it
+// cannot be read
+static char *read_script(char const *file_path) {
     FILE *file = fopen(file_path, "r");
     if (file == NULL) {
         printf("Failed to open file: %s\n", file_path);
-        return 1;
+        return NULL;
     }
 
     fseek(file, 0, SEEK_END);
@@ -30,20 +29,83 @@ int main(int argc, char **argv) {
     if (code == NULL) {
         printf("Failed to allocate memory for file content\n");
         fclose(file);
-        return 1;
+        return NULL;
     }
 
     fread(code, 1, length, file);
     code[length] = '\0';
     fclose(file);
+    return code;
+}
+
+int main(int argc, char **argv) {
+    char *file_path = NULL;
+    char *snapshot_path = NULL;
+    char restore_snapshot = 0;
+    char print_stats = 0;
+    char repl = 0;
+    EvaluatorContext context = init_evaluator_context(0);
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--stats") == 0) print_stats = 1;
+        else if (strcmp(argv[i], "--repl") == 0) repl = 1;
+        else if (strcmp(argv[i], "--no-dce") == 0) context.eliminate_dead_code = 0;
+        else if (strcmp(argv[i], "--inline-threshold") == 0 && i+1 < argc) context.inline_threshold = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--tier-up-threshold") == 0 && i+1 < argc) context.tier_up_threshold = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--log-tier-ups") == 0) context.tier_log = stderr;
+        else if (strcmp(argv[i], "--front-end-threads") == 0 && i+1 < argc) context.front_end_threads = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--max-steps") == 0 && i+1 < argc) context.limits.max_steps = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--timeout-ms") == 0 && i+1 < argc) context.limits.timeout_ms = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--max-call-depth") == 0 && i+1 < argc) context.limits.max_call_depth = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--max-heap-bytes") == 0 && i+1 < argc) context.limits.max_heap_bytes = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--snapshot-after-prelude") == 0 && i+1 < argc) snapshot_path = argv[++i];
+        else if (strcmp(argv[i], "--restore-snapshot") == 0 && i+1 < argc) {
+            snapshot_path = argv[++i];
+            restore_snapshot = 1;
+        }
+        else file_path = argv[i];
+    }
+
+    if (repl) {
+        run_repl(stdin, stdout, &context);
+        delete_evaluator_context(&context);
+        return 0;
+    }
+
+    // a snapshot holds the whole program, the script only guards against a
+    // stale one
+    if (file_path == NULL && !restore_snapshot) {
+        printf("File path required\n");
+        return 1;
+    }
+
+    char *code = NULL;
+    char *script_path = NULL;
+    if (file_path != NULL) {
+        code = read_script(file_path);
+        if (code == NULL) return 1;
+
+        // scripts import relative to their own directory
+        script_path = strdup(file_path);
+        context.module_dir = dirname(script_path);
+    }
 
     char *error_message;
-    EvaluatorContext context;
-    char exit_code = interpret(code, &error_message, &context, 0);
+    InterpreterStats stats;
+    Snapshot snapshot = {0};
+    char exit_code;
+    if (restore_snapshot) exit_code = resume_snapshot(snapshot_path, code, &snapshot, &error_message, &context, print_stats ? &stats : NULL);
+    else if (snapshot_path != NULL) exit_code = interpret_and_snapshot(code, snapshot_path, &error_message, &context, print_stats ? &stats : NULL);
+    else exit_code = interpret(code, &error_message, &context, print_stats ? &stats : NULL);
     if (exit_code) {
         printf("error message: %s\n", error_message);
     }
+    if (print_stats) {
+        print_interpreter_stats(&stats, stderr);
+    }
 
+    delete_evaluator_context(&context);
+    delete_snapshot(&snapshot);
     free(code);
+    free(script_path);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,162 @@
+#include "module.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash_table.h"
+#include "optimizer.h"
+#include "flat_tree.h"
+#include "stats.h"
+#include "tokenizer.h"
+
+// content hash and canonical path (see version_key()) -> Module *, every
+// version of every loaded module. Modules are never freed: function values
+// of any context that imported one point into its tree
+static HashTable module_cache;
+static pthread_mutex_t module_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+//////////////
+/// Errors ///
+//////////////
+
+static char *module_error(char const *format, char const *path, char const *detail) {
+    size_t num_bytes = strlen(format) + strlen(path) + (detail ? strlen(detail) : 0) + 1;
+    char *error_message = stats_malloc(EVALUATOR_ALLOC, num_bytes);
+    if (error_message != NULL) snprintf(error_message, num_bytes, format, path, detail);
+    return error_message;
+}
+
+
+///////////////
+/// Loading ///
+///////////////
+
+// Returns the file's content, NULL when it cannot be read
+static char *read_source(char const *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    char *source = NULL;
+    long length = -1;
+    if (fseek(file, 0, SEEK_END) == 0) length = ftell(file);
+    if (length >= 0 && fseek(file, 0, SEEK_SET) == 0) source = malloc(length + 1);
+    if (source != NULL && fread(source, 1, length, file) != (size_t)length) {
+        free(source);
+        source = NULL;
+    }
+    if (source != NULL) source[length] = '\0';
+    fclose(file);
+    return source;
+}
+
+// Tokenizes, parses and optimizes source into module. Returns 1 with
+// *error_message set on a syntax error, including one in a function body
+static char parse_module(Module *module, char const *source, char **error_message) {
+    TokenizerState tokenizer_state = init_tokenizer_state(source);
+    char error = tokenize(&tokenizer_state);
+    Token *tokens = tokenizer_state.parsed_tokens;
+    size_t num_tokens = tokenizer_state.parsed_tokens_length;
+    if (error) {
+        *error_message = module_error("Syntax error in module %s: %s", module->path, tokenizer_state.error_message);
+        stats_free(TOKENIZER_ALLOC, tokenizer_state.error_message);
+    }
+    else {
+        ASTNode root = parse_ast(tokens, num_tokens);
+        ASTNode const *invalid = root.node_type == INVALID ? &root : NULL;
+        if (invalid == NULL) {
+            eliminate_dead_code(&root, 1);
+            invalid = share_tree(&root);
+        }
+        if (invalid != NULL) {
+            *error_message = module_error("Syntax error in module %s: %s", module->path, invalid->error_message);
+            error = 1;
+        }
+        else {
+            module->tree = flatten_tree(&root);
+            if (module->tree == NULL) {
+                *error_message = stats_strdup(EVALUATOR_ALLOC, "Internal Error: Could not allocate memory for module");
+                error = 1;
+            }
+        }
+        delete_node(&root);
+    }
+
+    for (size_t i = 0; i < num_tokens; ++i) delete_token(tokens + i);
+    stats_free(TOKENIZER_ALLOC, tokens);
+    return error;
+}
+
+// Joins a relative path to directory and resolves it. Returns NULL when the
+// file does not exist
+static char *canonical_path(char const *directory, char const *path) {
+    char joined[PATH_MAX];
+    if (directory == NULL || path[0] == '/') snprintf(joined, sizeof(joined), "%s", path);
+    else snprintf(joined, sizeof(joined), "%s/%s", directory, path);
+    return realpath(joined, NULL);
+}
+
+// Key of the module cache: the content hash in hex, then the path
+static void version_key(char const *path, uint64_t content_hash, char *key, size_t key_size) {
+    snprintf(key, key_size, "%016llx%s", (unsigned long long)content_hash, path);
+}
+
+char load_module(char const *directory, char const *path, Module const **module, char **error_message) {
+    char *resolved = canonical_path(directory, path);
+    char *source = resolved ? read_source(resolved) : NULL;
+    if (source == NULL) {
+        *error_message = module_error("Could not open module: %s", path, NULL);
+        free(resolved);
+        return 1;
+    }
+    uint64_t content_hash = hash_key(source);
+    char key[PATH_MAX + 17];
+    version_key(resolved, content_hash, key, sizeof(key));
+
+    // loads are serialized, so each version is parsed by one thread only
+    pthread_mutex_lock(&module_cache_lock);
+    char error = 0;
+    if (module_cache.rows == NULL) module_cache = init_hash_table(16, sizeof(Module *));
+    Module * const *cached = module_cache.rows ? hash_table_get(&module_cache, key) : NULL;
+    if (cached != NULL) {
+        *module = *cached;
+    }
+    else {
+        Module *loaded = stats_malloc(PARSER_ALLOC, sizeof(Module));
+        char *slash = strrchr(resolved, '/');
+        if (loaded != NULL) {
+            *loaded = (Module){
+                .path = stats_strdup(PARSER_ALLOC, resolved),
+                .directory = stats_strdup(PARSER_ALLOC, resolved),
+                .content_hash = content_hash
+            };
+        }
+        if (loaded == NULL || loaded->path == NULL || loaded->directory == NULL || module_cache.rows == NULL) {
+            *error_message = stats_strdup(EVALUATOR_ALLOC, "Internal Error: Could not allocate memory for module");
+            error = 1;
+        }
+        else {
+            // resolved is absolute, so the directory keeps at least the root
+            loaded->directory[slash == resolved ? 1 : slash - resolved] = '\0';
+            error = parse_module(loaded, source, error_message);
+            if (!error && hash_table_set(&module_cache, key, &loaded)) {
+                *error_message = stats_strdup(EVALUATOR_ALLOC, "Internal Error: Could not allocate memory for module");
+                error = 1;
+            }
+        }
+        if (error && loaded != NULL) {
+            delete_flat_tree(loaded->tree);
+            stats_free(PARSER_ALLOC, loaded->path);
+            stats_free(PARSER_ALLOC, loaded->directory);
+            stats_free(PARSER_ALLOC, loaded);
+        }
+        if (!error) *module = loaded;
+    }
+    pthread_mutex_unlock(&module_cache_lock);
+
+    free(source);
+    free(resolved);
+    return error;
+}
@@ -0,0 +1,469 @@
+#include "optimizer.h"
+
+#include <string.h>
+#include "hash_table.h"
+#include "stack.h"
+#include "stats.h"
+#include "string_value.h"
+
+// FUNCTION node found by the analysis. Definitions sharing a name are
+// chained through next, the index + 1 of the one found before (0 ends)
+typedef struct {
+    ASTNode *node;
+    size_t next;
+    char scanned;
+} Definition;
+
+typedef struct {
+    Stack definitions;          // Definition
+    HashTable last_definition;  // name -> index + 1 into definitions
+    HashTable reachable;        // name -> char
+    Stack pending;              // char const *, reached names whose definitions are not scanned yet
+    char keep_functions;        // every definition counts as reachable
+    // set when memory runs out; the analysis is then incomplete and nothing is removed
+    char failed;
+} CallGraph;
+
+// Names declared in the frame of a program or function body, counted lazily.
+// A definition whose name is declared twice raises VARIABLE_EXISTS, so it
+// is kept even when unreachable
+typedef struct {
+    ASTNode const *sequence;
+    char **args;
+    size_t args_length;
+    HashTable counts; // name -> size_t
+    char built;
+} FrameNames;
+
+
+//////////////////
+/// Call graph ///
+//////////////////
+
+static void reach(CallGraph *graph, char const *name) {
+    if (hash_table_get(&graph->reachable, name) != NULL) return;
+    char reached = 1;
+    if (hash_table_set(&graph->reachable, name, &reached) || !stack_push(&graph->pending, &name)) {
+        graph->failed = 1;
+    }
+}
+
+static void add_definition(CallGraph *graph, ASTNode *node) {
+    size_t const *last = hash_table_get(&graph->last_definition, node->value);
+    Definition definition = {.node = node, .next = last ? *last : 0};
+    size_t index = graph->definitions.length + 1;
+    if (!stack_push(&graph->definitions, &definition) || hash_table_set(&graph->last_definition, node->value, &index)) {
+        graph->failed = 1;
+        return;
+    }
+
+    // the name may have been reached before this definition turned up
+    char const *name = node->value;
+    if (hash_table_get(&graph->reachable, name) != NULL && !stack_push(&graph->pending, &name)) {
+        graph->failed = 1;
+    }
+}
+
+// Records the definitions made by node and every name it mentions. The
+// bodies of the definitions are left to scan_reachable_definitions()
+static void scan_node(CallGraph *graph, ASTNode *node) {
+    if (node->node_type == FUNCTION) {
+        add_definition(graph, node);
+        return;
+    }
+    // an inlined call names a function it no longer needs
+    char names_identifier = node->node_type != NUMBER && node->node_type != STRING && node->node_type != INLINE_CALL;
+    if (node->value != NULL && names_identifier) {
+        reach(graph, node->value);
+    }
+    for (size_t i = 0; i < node->children_length; ++i) scan_node(graph, node->children+i);
+}
+
+static void scan_reachable_definitions(CallGraph *graph) {
+    while (graph->pending.length > 0 && !graph->failed) {
+        char const *name = *(char const **)stack_top(&graph->pending);
+        stack_pop(&graph->pending);
+
+        size_t const *last = hash_table_get(&graph->last_definition, name);
+        size_t index = last ? *last : 0;
+        while (index > 0) {
+            // scanning pushes definitions, so the entry is not held across it
+            Definition *definition = (Definition *)graph->definitions.buffer + index - 1;
+            index = definition->next;
+            if (definition->scanned) continue;
+            definition->scanned = 1;
+
+            ASTNode *body = (ASTNode *)function_body(definition->node);
+            if (body->node_type != INVALID) scan_node(graph, body);
+        }
+    }
+}
+
+static char is_reachable(CallGraph const *graph, char const *name) {
+    return graph->keep_functions || hash_table_get(&graph->reachable, name) != NULL;
+}
+
+
+///////////////
+/// Removal ///
+///////////////
+
+static void count_name(HashTable *counts, char const *name) {
+    size_t const *count = hash_table_get(counts, name);
+    size_t new_count = (count ? *count : 0) + 1;
+    hash_table_set(counts, name, &new_count);
+}
+
+static void count_declared(HashTable *counts, ASTNode const *sequence) {
+    for (size_t i = 0; i < sequence->children_length; ++i) {
+        ASTNode const *statement = sequence->children+i;
+        char const *name = NULL;
+        if (statement->node_type == DECLARATION) name = statement->children[0].value;
+        else if (statement->node_type == FUNCTION) name = statement->value;
+        // branches and loop bodies declare into the same frame
+        else if (statement->node_type == IF_ELSE_STMT || statement->node_type == WHILE_STMT) {
+            for (size_t j = 1; j < statement->children_length; ++j) count_declared(counts, statement->children+j);
+        }
+        if (name != NULL) count_name(counts, name);
+    }
+}
+
+static char declared_once(FrameNames *frame, char const *name) {
+    if (!frame->built) {
+        frame->counts = init_hash_table(16, sizeof(size_t));
+        if (frame->counts.rows == NULL) return 0;
+        frame->built = 1;
+        for (size_t i = 0; i < frame->args_length; ++i) count_name(&frame->counts, frame->args[i]);
+        count_declared(&frame->counts, frame->sequence);
+    }
+    size_t const *count = hash_table_get(&frame->counts, name);
+    return count != NULL && *count == 1;
+}
+
+// Truth value of a condition that does not depend on the program state
+static char constant_condition(ASTNode const *node, char *truth) {
+    // a minus prefix keeps a number's zeroness, and a comparison's
+    if (node->node_type == NUMBER) {
+        *truth = value_as_int(node->literal) != 0;
+        return 1;
+    }
+    if (node->node_type == STRING && node->prefix_operator == NULL) {
+        *truth = string_length(node->literal) != 0;
+        return 1;
+    }
+    if (node->node_type != COMPARISON) return 0;
+
+    int64_t operands[2];
+    for (size_t i = 0; i < 2; ++i) {
+        ASTNode const *child = node->children+i;
+        if (child->node_type != NUMBER) return 0;
+        operands[i] = value_as_int(child->literal);
+        if (child->prefix_operator && *child->prefix_operator == SUB_OP) operands[i] = (int32_t)-(uint32_t)operands[i];
+    }
+    switch (node->operators[0]) {
+        case EQ_OP: *truth = operands[0] == operands[1]; return 1;
+        case NE_OP: *truth = operands[0] != operands[1]; return 1;
+        case LT_OP: *truth = operands[0] < operands[1]; return 1;
+        case LE_OP: *truth = operands[0] <= operands[1]; return 1;
+        case GT_OP: *truth = operands[0] > operands[1]; return 1;
+        case GE_OP: *truth = operands[0] >= operands[1]; return 1;
+        default: return 0;
+    }
+}
+
+enum StatementFate { KEEP, DROP, SPLICE };
+
+static size_t prune_frame(CallGraph const *graph, ASTNode *sequence, char **args, size_t args_length, char keep_last);
+
+// Removes dead statements from a sequence and the sequences nested in it.
+// The value of a call without a return is whatever its last statement left
+// in the result, so with keep_last the last statement always stays
+static size_t prune_sequence(CallGraph const *graph, ASTNode *sequence, FrameNames *frame, char keep_last) {
+    size_t removed = 0;
+    size_t length = sequence->children_length;
+    if (length == 0) return 0;
+
+    char *fates = stats_malloc(PARSER_ALLOC, length);
+    if (fates == NULL) return 0;
+
+    size_t new_length = 0;
+    char after_return = 0;
+    for (size_t i = 0; i < length; ++i) {
+        ASTNode *statement = sequence->children+i;
+        char must_stay = keep_last && i == length - 1;
+        char truth;
+        fates[i] = KEEP;
+
+        if (after_return) fates[i] = DROP;
+        else if (statement->node_type == RETURN_STMT) after_return = 1;
+        else if (statement->node_type == FUNCTION) {
+            if (!must_stay && !is_reachable(graph, statement->value) && declared_once(frame, statement->value)) {
+                fates[i] = DROP;
+            }
+            else if (statement->children_length > 0 && statement->children[0].node_type != INVALID) {
+                removed += prune_frame(graph, statement->children+0, statement->args, statement->args_length, 1);
+            }
+        }
+        else if (statement->node_type == WHILE_STMT) {
+            if (!must_stay && constant_condition(statement->children+0, &truth) && !truth) fates[i] = DROP;
+            else removed += prune_sequence(graph, statement->children+1, frame, 0);
+        }
+        else if (statement->node_type == IF_ELSE_STMT) {
+            if (constant_condition(statement->children+0, &truth)) {
+                ASTNode *taken = truth ? statement->children+1 : statement->children_length == 3 ? statement->children+2 : NULL;
+                if (taken) removed += prune_sequence(graph, taken, frame, must_stay);
+                if (taken && taken->children_length > 0) {
+                    fates[i] = SPLICE;
+                    new_length += taken->children_length;
+                    after_return = taken->children[taken->children_length-1].node_type == RETURN_STMT;
+                    continue;
+                }
+                if (!must_stay) fates[i] = DROP;
+            }
+            else {
+                for (size_t j = 1; j < statement->children_length; ++j) {
+                    removed += prune_sequence(graph, statement->children+j, frame, must_stay);
+                }
+            }
+        }
+        if (fates[i] == KEEP) new_length += 1;
+    }
+
+    if (new_length == length && memchr(fates, SPLICE, length) == NULL) {
+        stats_free(PARSER_ALLOC, fates);
+        return removed;
+    }
+
+    ASTNode *children = stats_malloc(PARSER_ALLOC, (new_length ? new_length : 1) * sizeof(ASTNode));
+    if (children == NULL) {
+        stats_free(PARSER_ALLOC, fates);
+        return removed;
+    }
+
+    size_t position = 0;
+    for (size_t i = 0; i < length; ++i) {
+        ASTNode *statement = sequence->children+i;
+        if (fates[i] == KEEP) {
+            children[position++] = *statement;
+            continue;
+        }
+
+        removed += count_nodes(statement);
+        if (fates[i] == SPLICE) {
+            char truth;
+            constant_condition(statement->children+0, &truth);
+            ASTNode *taken = statement->children + (truth ? 1 : 2);
+            for (size_t j = 0; j < taken->children_length; ++j) {
+                removed -= count_nodes(taken->children+j);
+                children[position++] = taken->children[j];
+            }
+            taken->children_length = 0;
+        }
+        delete_node(statement);
+    }
+
+    stats_free(PARSER_ALLOC, fates);
+    stats_free(PARSER_ALLOC, sequence->children);
+    sequence->children = children;
+    sequence->children_length = new_length;
+    return removed;
+}
+
+static size_t prune_frame(CallGraph const *graph, ASTNode *sequence, char **args, size_t args_length, char keep_last) {
+    FrameNames frame = {.sequence = sequence, .args = args, .args_length = args_length};
+    size_t removed = prune_sequence(graph, sequence, &frame, keep_last);
+    if (frame.built) clean_hash_table(&frame.counts);
+    return removed;
+}
+
+
+size_t eliminate_dead_code(ASTNode *root, char keep_functions) {
+    if (root->node_type != STMT_SEQUENCE) return 0;
+
+    CallGraph graph = {
+        .definitions = init_stack(64, sizeof(Definition)),
+        .last_definition = init_hash_table(64, sizeof(size_t)),
+        .reachable = init_hash_table(64, sizeof(char)),
+        .pending = init_stack(64, sizeof(char const *)),
+        .keep_functions = keep_functions
+    };
+    graph.failed = graph.definitions.buffer == NULL || graph.last_definition.rows == NULL
+        || graph.reachable.rows == NULL || graph.pending.buffer == NULL;
+
+    if (!graph.failed) {
+        scan_node(&graph, root);
+        scan_reachable_definitions(&graph);
+    }
+
+    // the result of a program is not observable, its last statement can go
+    size_t removed = graph.failed ? 0 : prune_frame(&graph, root, NULL, 0, 0);
+
+    delete_stack(&graph.definitions);
+    delete_stack(&graph.pending);
+    if (graph.last_definition.rows) clean_hash_table(&graph.last_definition);
+    if (graph.reachable.rows) clean_hash_table(&graph.reachable);
+    return removed;
+}
+
+
+////////////////
+/// Inlining ///
+////////////////
+
+// Facts about the whole program that decide which functions can be inlined
+typedef struct {
+    HashTable definitions;  // name -> size_t, FUNCTION nodes with that name
+    HashTable bound;        // name -> char, declared, assigned or argument names
+    HashTable templates;    // name -> InlineTemplate
+    char failed;
+} InlineAnalysis;
+
+// Body expression of an inlinable function with its arguments replaced by
+// PARAMETER nodes, copied to every call site
+typedef struct {
+    ASTNode expression;
+    size_t args_length;
+} InlineTemplate;
+
+static void mark_bound(InlineAnalysis *analysis, char const *name) {
+    char bound = 1;
+    if (hash_table_set(&analysis->bound, name, &bound)) analysis->failed = 1;
+}
+
+// Gathers definitions and bound names of node and everything nested in it,
+// parsing function bodies on the way
+static void analyze_node(InlineAnalysis *analysis, ASTNode *node) {
+    if (node->node_type == FUNCTION) {
+        size_t const *count = hash_table_get(&analysis->definitions, node->value);
+        size_t new_count = (count ? *count : 0) + 1;
+        if (hash_table_set(&analysis->definitions, node->value, &new_count)) analysis->failed = 1;
+        for (size_t i = 0; i < node->args_length; ++i) mark_bound(analysis, node->args[i]);
+
+        ASTNode *body = (ASTNode *)function_body(node);
+        if (body->node_type != INVALID) analyze_node(analysis, body);
+        return;
+    }
+    if (node->node_type == DECLARATION || node->node_type == ASSIGNMENT) {
+        mark_bound(analysis, node->children[0].value);
+    }
+    for (size_t i = 0; i < node->children_length; ++i) analyze_node(analysis, node->children+i);
+}
+
+// Slot of an argument name, the last one wins like in a frame
+static char argument_slot(ASTNode const *function, char const *name, size_t *slot) {
+    for (size_t i = function->args_length; i > 0; --i) {
+        if (strcmp(function->args[i-1], name) == 0) {
+            *slot = i - 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static char inlinable_expression(InlineAnalysis const *analysis, ASTNode const *function, ASTNode const *node) {
+    size_t slot;
+    if (node->node_type == FUNCTION_CALL || node->node_type == PMAP_CALL) {
+        if (hash_table_get(&analysis->definitions, node->value) != NULL) return 0;
+        if (argument_slot(function, node->value, &slot)) return 0;
+    }
+    if (node->node_type == INDEX && argument_slot(function, node->value, &slot)) return 0;
+    for (size_t i = 0; i < node->children_length; ++i) {
+        if (!inlinable_expression(analysis, function, node->children+i)) return 0;
+    }
+    return 1;
+}
+
+// Turns the argument variables of a copied body into PARAMETER nodes
+static void bind_parameters(ASTNode const *function, ASTNode *node) {
+    if (node->node_type == VARIABLE && argument_slot(function, node->value, &node->slot)) {
+        node->node_type = PARAMETER;
+        return;
+    }
+    for (size_t i = 0; i < node->children_length; ++i) bind_parameters(function, node->children+i);
+}
+
+static void add_template(InlineAnalysis *analysis, ASTNode *function, size_t threshold) {
+    size_t const *count = hash_table_get(&analysis->definitions, function->value);
+    if (count == NULL || *count != 1) return;
+    if (hash_table_get(&analysis->bound, function->value) != NULL) return;
+    if (function->args_length > _MAX_INLINED_ARGS) return;
+
+    ASTNode const *body = function_body(function);
+    if (body->node_type != STMT_SEQUENCE || body->children_length != 1) return;
+    if (body->children[0].node_type != RETURN_STMT) return;
+
+    ASTNode const *expression = body->children[0].children+0;
+    if (count_nodes(expression) > threshold) return;
+    if (!inlinable_expression(analysis, function, expression)) return;
+
+    InlineTemplate template = {.expression = copy_node(expression), .args_length = function->args_length};
+    bind_parameters(function, &template.expression);
+    if (hash_table_set(&analysis->templates, function->value, &template)) {
+        delete_node(&template.expression);
+        analysis->failed = 1;
+    }
+}
+
+// Replaces the calls in node (and nested in it) that have a template
+static size_t substitute_calls(InlineAnalysis const *analysis, ASTNode *node) {
+    size_t inlined = 0;
+    if (node->node_type == FUNCTION) {
+        if (node->children_length > 0) inlined += substitute_calls(analysis, node->children+0);
+        return inlined;
+    }
+    // a spawned call needs a function to run on its own, only its arguments are inlined into
+    if (node->node_type == SPAWN_CALL) {
+        ASTNode *call = node->children+0;
+        for (size_t i = 0; i < call->children_length; ++i) inlined += substitute_calls(analysis, call->children+i);
+        return inlined;
+    }
+    for (size_t i = 0; i < node->children_length; ++i) inlined += substitute_calls(analysis, node->children+i);
+    if (node->node_type != FUNCTION_CALL) return inlined;
+
+    InlineTemplate const *template = hash_table_get(&analysis->templates, node->value);
+    if (template == NULL || template->args_length != node->children_length) return inlined;
+
+    ASTNode *children = stats_realloc(PARSER_ALLOC, node->children, (node->children_length + 1) * sizeof(ASTNode));
+    if (children == NULL) return inlined;
+    children[node->children_length] = copy_node(&template->expression);
+    node->children = children;
+    node->children_length += 1;
+    node->node_type = INLINE_CALL;
+    return inlined + 1;
+}
+
+static void delete_templates(HashTable *templates) {
+    for (size_t i = 0; i < templates->capacity; ++i) {
+        if (templates->rows[i].key) delete_node(&((InlineTemplate *)templates->rows[i].value)->expression);
+    }
+    clean_hash_table(templates);
+}
+
+size_t inline_calls(ASTNode *root, size_t threshold) {
+    if (root->node_type != STMT_SEQUENCE || threshold == 0) return 0;
+
+    InlineAnalysis analysis = {
+        .definitions = init_hash_table(64, sizeof(size_t)),
+        .bound = init_hash_table(64, sizeof(char)),
+        .templates = init_hash_table(16, sizeof(InlineTemplate))
+    };
+    if (analysis.definitions.rows == NULL || analysis.bound.rows == NULL || analysis.templates.rows == NULL) {
+        analysis.failed = 1;
+    }
+    else analyze_node(&analysis, root);
+
+    // calls can only run once the first statement that is not a definition
+    // does, every definition before it is registered by then
+    for (size_t i = 0; i < root->children_length && !analysis.failed; ++i) {
+        if (root->children[i].node_type != FUNCTION) break;
+        add_template(&analysis, root->children+i, threshold);
+    }
+
+    size_t inlined = 0;
+    if (!analysis.failed && analysis.templates.size > 0) inlined = substitute_calls(&analysis, root);
+
+    if (analysis.definitions.rows) clean_hash_table(&analysis.definitions);
+    if (analysis.bound.rows) clean_hash_table(&analysis.bound);
+    if (analysis.templates.rows) delete_templates(&analysis.templates);
+    return inlined;
+}
@@ -5,6 +5,9 @@
 #include <stdint.h>
 #include "parser.h"
 #include "tokenizer.h"
+#include "stats.h"
+#include "string_value.h"
+#include "hash_table.h"
 
 
 // Used for logging
@@ -13,13 +16,26 @@ const char *ASTNodeTypeNames[] = {
     "VARIABLE",
     "ARITHMETIC",
     "FUNCTION_CALL",
+    "STRING",
+    "ARRAY",
+    "INDEX",
+    "COMPARISON",
+    "LOGICAL",
+    "INLINE_CALL",
+    "PARAMETER",
+    "SPAWN_CALL",
+    "PMAP_CALL",
     "INVALID",
     "IF_ELSE_STMT",
+    "WHILE_STMT",
     "FUNCTION",
     "DECLARATION",
     "ASSIGNMENT",
+    "INDEX_ASSIGNMENT",
     "RETURN_STMT",
     "PRINT_STMT",
+    "IMPORT_STMT",
+    "YIELD_STMT",
     "STMT_SEQUENCE",
 }; 
 
@@ -34,7 +50,7 @@ ASTNode get_invalid_node(const enum TokenType expected_type, const ParserContext
 
         if (context->tokens[context->token_pos].token_value) {
             num_bytes += strlen(context->tokens[context->token_pos].token_value) + 2;
-            error_message = malloc(num_bytes);
+            error_message = stats_malloc(PARSER_ALLOC, num_bytes);
             sprintf(
                 error_message, 
                 "Syntex error: Expected %s. Instead got: %s[%s]", 
@@ -44,7 +60,7 @@ ASTNode get_invalid_node(const enum TokenType expected_type, const ParserContext
             );
         }
         else {
-            error_message = malloc(num_bytes);
+            error_message = stats_malloc(PARSER_ALLOC, num_bytes);
             sprintf(
                 error_message, 
                 "Syntex error: Expected %s. Instead got: %s", 
@@ -54,7 +70,7 @@ ASTNode get_invalid_node(const enum TokenType expected_type, const ParserContext
         }   
     }
     else {
-        error_message = malloc(50 + strlen(TokeTypeNames[expected_type]) + 1);
+        error_message = stats_malloc(PARSER_ALLOC, 50 + strlen(TokeTypeNames[expected_type]) + 1);
 
         sprintf(
             error_message, 
@@ -67,18 +83,19 @@ ASTNode get_invalid_node(const enum TokenType expected_type, const ParserContext
 }
 
 void delete_node(ASTNode *node) {
-    free(node->prefix_operator);
+    stats_free(PARSER_ALLOC, node->prefix_operator);
 
-    free(node->value);
+    stats_free(PARSER_ALLOC, node->value);
 
-    for(size_t i=0; i < node->args_length; ++i) free(node->args[i]);
-    free(node->args);
+    for(size_t i=0; i < node->args_length; ++i) stats_free(PARSER_ALLOC, node->args[i]);
+    stats_free(PARSER_ALLOC, node->args);
 
-    free(node->operators);
+    stats_free(PARSER_ALLOC, node->operators);
     
     for(size_t i=0; i < node->children_length; ++i) {
         delete_node(node->children+i);
     }
+    stats_free(PARSER_ALLOC, node->children);
 }
 
 
@@ -131,20 +148,20 @@ void print_node(ASTNode *node, size_t indent_count) {
 }
 
 void cleanup_node(ASTNode *node) {
-    free(node->value);
-    free(node->args);
-    free(node->operators);
+    stats_free(PARSER_ALLOC, node->value);
     for(size_t i = 0; i < node->args_length; ++i) {
-        free(node->args[i]);
+        stats_free(PARSER_ALLOC, node->args[i]);
     }
+    stats_free(PARSER_ALLOC, node->args);
+    stats_free(PARSER_ALLOC, node->operators);
     for(size_t i = 0; i < node->children_length; ++i) {
         cleanup_node(node->children+i);
     }
 }
 
 void cleanup_double_array(char **args, size_t args_length) {
-    for (size_t i = 0; i < args_length; ++i) free(args[i]);
-    free(args);
+    for (size_t i = 0; i < args_length; ++i) stats_free(PARSER_ALLOC, args[i]);
+    stats_free(PARSER_ALLOC, args);
 }
 
 // Expression Parsers 
@@ -162,6 +179,15 @@ char step(ParserContext *context, enum TokenType token_type) {
     return 0;
 }
 
+// Decimal literal to int32_t. Literals beyond its range wrap around
+static int32_t char_to_int(char const *num) {
+    uint32_t result = 0;
+    for(char const *p=num; *p; ++p) {
+        result = result * 10 + (*p) - '0';
+    }
+    return result;
+}
+
 ASTNode parse_number_or_variable(ParserContext *context) {
     ASTNode node = { .node_type = 0 };
     if (!peek(context, NUMERIC_LITERAL) && !peek(context, IDENTIFIER)) {
@@ -170,7 +196,9 @@ ASTNode parse_number_or_variable(ParserContext *context) {
     if (peek(context, NUMERIC_LITERAL)) node.node_type = NUMBER;
     if (peek(context, IDENTIFIER)) node.node_type = VARIABLE;
 
-    node.value = strdup(context->tokens[context->token_pos].token_value);
+    node.value = stats_strdup(PARSER_ALLOC, context->tokens[context->token_pos].token_value);
+    if (node.node_type == NUMBER) node.literal = int_value(char_to_int(node.value));
+    else node.value_hash = hash_key(node.value);
 
     context->token_pos += 1;
     return node;
@@ -181,17 +209,17 @@ ASTNode parse_function_call(ParserContext *context) {
 
     // IDENTIFIER
     if (!peek(context, IDENTIFIER)) return get_invalid_node(IDENTIFIER, context);
-    char *value = strdup(context->tokens[context->token_pos].token_value);
+    char *value = stats_strdup(PARSER_ALLOC, context->tokens[context->token_pos].token_value);
     context->token_pos += 1;
 
     // IDENTIFIER ROUND_OPEN
     if (!step(context, ROUND_OPEN)) {
-        free(value);
+        stats_free(PARSER_ALLOC, value);
         return get_invalid_node(ROUND_OPEN, context);
     }
 
     // IDENTIFIER ROUND_OPEN <comma separated expressions>
-    ASTNode *children = malloc(10 * sizeof(ASTNode));
+    ASTNode *children = stats_malloc(PARSER_ALLOC, 10 * sizeof(ASTNode));
     size_t children_length = 0;
     size_t children_capacity = 10;
     while(1) {
@@ -199,22 +227,22 @@ ASTNode parse_function_call(ParserContext *context) {
         ASTNode next_node = parse_expression(context);
         if (next_node.node_type == INVALID) {
             for (size_t i = 0; i < children_length; ++i) cleanup_node(children+i);
-            free(children);
-            free(value);
+            stats_free(PARSER_ALLOC, children);
+            stats_free(PARSER_ALLOC, value);
             return next_node;
         }
 
         if (children_length == children_capacity) {
             children_capacity *= 2;
-            children = realloc(children, children_capacity * sizeof(ASTNode));
+            children = stats_realloc(PARSER_ALLOC, children, children_capacity * sizeof(ASTNode));
         }
         children[children_length++] = next_node; 
         
         if (peek(context, ROUND_CLOSE)) break;
         if (!step(context, COMMA)) {
             for (size_t i = 0; i < children_length; ++i) cleanup_node(children+i);
-            free(children);
-            free(value);
+            stats_free(PARSER_ALLOC, children);
+            stats_free(PARSER_ALLOC, value);
             return get_invalid_node(ROUND_CLOSE, context);
         }
     }
@@ -222,21 +250,126 @@ ASTNode parse_function_call(ParserContext *context) {
     // IDENTIFIER ROUND_OPEN <comma separated expressions> ROUND_CLOSE
     if (!step(context, ROUND_CLOSE)) {
         for (size_t i = 0; i < children_length; ++i) cleanup_node(children+i);
-        free(children);
-        free(value);
+        stats_free(PARSER_ALLOC, children);
+        stats_free(PARSER_ALLOC, value);
         return get_invalid_node(ROUND_CLOSE, context);
     }
 
     ASTNode node = {
         .node_type = FUNCTION_CALL,
         .value = value,
+        .value_hash = hash_key(value),
         .children_length = children_length,
-        .children = realloc(children, children_length * sizeof(ASTNode))
+        .children = stats_realloc(PARSER_ALLOC, children, children_length * sizeof(ASTNode))
     };
 
     return node;
 }
 
+ASTNode parse_string(ParserContext *context) {
+    if (!peek(context, STRING_LITERAL)) return get_invalid_node(STRING_LITERAL, context);
+    char const *contents = context->tokens[context->token_pos].token_value;
+    ASTNode node = {
+        .node_type = STRING,
+        .value = stats_strdup(PARSER_ALLOC, contents),
+        .literal = intern_string(contents)
+    };
+    context->token_pos += 1;
+    return node;
+}
+
+ASTNode parse_array(ParserContext *context) {
+    // SQUARE_OPEN <comma separated expressions> SQUARE_CLOSE
+
+    // SQUARE_OPEN
+    if (!step(context, SQUARE_OPEN)) return get_invalid_node(SQUARE_OPEN, context);
+
+    // SQUARE_OPEN <comma separated expressions>
+    ASTNode *children = stats_malloc(PARSER_ALLOC, 10 * sizeof(ASTNode));
+    size_t children_length = 0;
+    size_t children_capacity = 10;
+    while(1) {
+        if (peek(context, SQUARE_CLOSE)) break;
+        ASTNode next_node = parse_expression(context);
+        if (next_node.node_type == INVALID) {
+            for (size_t i = 0; i < children_length; ++i) cleanup_node(children+i);
+            stats_free(PARSER_ALLOC, children);
+            return next_node;
+        }
+
+        if (children_length == children_capacity) {
+            children_capacity *= 2;
+            children = stats_realloc(PARSER_ALLOC, children, children_capacity * sizeof(ASTNode));
+        }
+        children[children_length++] = next_node;
+
+        if (peek(context, SQUARE_CLOSE)) break;
+        if (!step(context, COMMA)) {
+            for (size_t i = 0; i < children_length; ++i) cleanup_node(children+i);
+            stats_free(PARSER_ALLOC, children);
+            return get_invalid_node(SQUARE_CLOSE, context);
+        }
+    }
+
+    // SQUARE_OPEN <comma separated expressions> SQUARE_CLOSE
+    if (!step(context, SQUARE_CLOSE)) {
+        for (size_t i = 0; i < children_length; ++i) cleanup_node(children+i);
+        stats_free(PARSER_ALLOC, children);
+        return get_invalid_node(SQUARE_CLOSE, context);
+    }
+
+    ASTNode node = {
+        .node_type = ARRAY,
+        .children_length = children_length,
+        .children = stats_realloc(PARSER_ALLOC, children, children_length * sizeof(ASTNode))
+    };
+    return node;
+}
+
+// IDENTIFIER SQUARE_OPEN <expression> SQUARE_CLOSE, shared by indexing and
+// index assignment
+static ASTNode parse_indexed_identifier(ParserContext *context, enum ASTNodeType node_type) {
+    // IDENTIFIER
+    if (!peek(context, IDENTIFIER)) return get_invalid_node(IDENTIFIER, context);
+    char *value = stats_strdup(PARSER_ALLOC, context->tokens[context->token_pos].token_value);
+    context->token_pos += 1;
+
+    // IDENTIFIER SQUARE_OPEN
+    if (!step(context, SQUARE_OPEN)) {
+        stats_free(PARSER_ALLOC, value);
+        return get_invalid_node(SQUARE_OPEN, context);
+    }
+
+    // IDENTIFIER SQUARE_OPEN <expression>
+    ASTNode index = parse_expression(context);
+    if (index.node_type == INVALID) {
+        stats_free(PARSER_ALLOC, value);
+        return index;
+    }
+
+    // IDENTIFIER SQUARE_OPEN <expression> SQUARE_CLOSE
+    if (!step(context, SQUARE_CLOSE)) {
+        cleanup_node(&index);
+        stats_free(PARSER_ALLOC, value);
+        return get_invalid_node(SQUARE_CLOSE, context);
+    }
+
+    ASTNode *children = stats_malloc(PARSER_ALLOC, 2 * sizeof(ASTNode));
+    children[0] = index;
+    ASTNode node = {
+        .node_type = node_type,
+        .value = value,
+        .value_hash = hash_key(value),
+        .children_length = 1,
+        .children = children
+    };
+    return node;
+}
+
+ASTNode parse_index(ParserContext *context) {
+    return parse_indexed_identifier(context, INDEX);
+}
+
 ASTNode parse_bracket_expression(ParserContext *context) {
     if (!step(context, ROUND_OPEN)) return get_invalid_node(ROUND_OPEN, context);
     ASTNode child_node = parse_expression(context);
@@ -244,48 +377,133 @@ ASTNode parse_bracket_expression(ParserContext *context) {
     return child_node;
 }
 
-ASTNode parse_expression(ParserContext *context) {
-    ASTNode *children_buffer = malloc(10 * sizeof(ASTNode));
+ASTNode parse_spawn(ParserContext *context) {
+    // SPAWN IDENTIFIER ROUND_OPEN <comma separated expressions> ROUND_CLOSE
+
+    // SPAWN
+    if (!step(context, SPAWN)) return get_invalid_node(SPAWN, context);
+
+    // SPAWN IDENTIFIER ROUND_OPEN <comma separated expressions> ROUND_CLOSE
+    ASTNode call = parse_function_call(context);
+    if (call.node_type == INVALID) return call;
+
+    ASTNode *children = stats_malloc(PARSER_ALLOC, sizeof(ASTNode));
+    children[0] = call;
+    ASTNode node = {
+        .node_type = SPAWN_CALL,
+        .children_length = 1,
+        .children = children
+    };
+    return node;
+}
+
+ASTNode parse_pmap(ParserContext *context) {
+    // PMAP ROUND_OPEN IDENTIFIER COMMA <expression> ROUND_CLOSE
+
+    // PMAP ROUND_OPEN
+    if (!step(context, PMAP)) return get_invalid_node(PMAP, context);
+    if (!step(context, ROUND_OPEN)) return get_invalid_node(ROUND_OPEN, context);
+
+    // PMAP ROUND_OPEN IDENTIFIER COMMA
+    if (!peek(context, IDENTIFIER)) return get_invalid_node(IDENTIFIER, context);
+    char *value = stats_strdup(PARSER_ALLOC, context->tokens[context->token_pos].token_value);
+    context->token_pos += 1;
+    if (!step(context, COMMA)) {
+        stats_free(PARSER_ALLOC, value);
+        return get_invalid_node(COMMA, context);
+    }
+
+    // PMAP ROUND_OPEN IDENTIFIER COMMA <expression>
+    ASTNode count = parse_expression(context);
+    if (count.node_type == INVALID) {
+        stats_free(PARSER_ALLOC, value);
+        return count;
+    }
+
+    // PMAP ROUND_OPEN IDENTIFIER COMMA <expression> ROUND_CLOSE
+    if (!step(context, ROUND_CLOSE)) {
+        cleanup_node(&count);
+        stats_free(PARSER_ALLOC, value);
+        return get_invalid_node(ROUND_CLOSE, context);
+    }
+
+    ASTNode *children = stats_malloc(PARSER_ALLOC, sizeof(ASTNode));
+    children[0] = count;
+    ASTNode node = {
+        .node_type = PMAP_CALL,
+        .value = value,
+        .value_hash = hash_key(value),
+        .children_length = 1,
+        .children = children
+    };
+    return node;
+}
+
+// Operand of an arithmetic expression, an INVALID node expecting an
+// IDENTIFIER when none starts at the current token
+static ASTNode parse_operand(ParserContext *context) {
+    if (peek(context, ROUND_OPEN)) return parse_bracket_expression(context);
+    if (peek(context, NUMERIC_LITERAL)) return parse_number_or_variable(context);
+    if (peek(context, STRING_LITERAL)) return parse_string(context);
+    if (peek(context, SQUARE_OPEN)) return parse_array(context);
+    if (peek(context, SPAWN)) return parse_spawn(context);
+    if (peek(context, PMAP)) return parse_pmap(context);
+    if (!peek(context, IDENTIFIER)) return get_invalid_node(IDENTIFIER, context);
+
+    context->token_pos += 1;
+    char call = peek(context, ROUND_OPEN);
+    char index = peek(context, SQUARE_OPEN);
+    context->token_pos -= 1;
+    if (call) return parse_function_call(context);
+    if (index) return parse_index(context);
+    return parse_number_or_variable(context);
+}
+
+static char peek_arithmetic_operator(ParserContext *context, char additive, enum OperatorType *operator) {
+    if (additive && peek(context, PLUS)) *operator = ADD_OP;
+    else if (additive && peek(context, MINUS)) *operator = SUB_OP;
+    else if (!additive && peek(context, MULT)) *operator = MULT_OP;
+    else if (!additive && peek(context, DIV)) *operator = DIV_OP;
+    else return 0;
+    return 1;
+}
+
+// Gives node the minus prefix_operator. A node negated already, an operand
+// in brackets, loses its prefix instead
+static void negate_node(ASTNode *node, enum OperatorType *prefix_operator) {
+    if (node->prefix_operator == NULL) {
+        node->prefix_operator = prefix_operator;
+        return;
+    }
+    stats_free(PARSER_ALLOC, node->prefix_operator);
+    stats_free(PARSER_ALLOC, prefix_operator);
+    node->prefix_operator = NULL;
+}
+
+// Operands joined by the operators of one precedence level, applied left to
+// right: terms joined by + and - when additive, else the operands of a term
+// joined by * and /. A chain of one operand is that operand. prefix_operator
+// (NULL when there is none) goes to the first term, negating its value
+static ASTNode parse_operator_chain(ParserContext *context, char additive, enum OperatorType *prefix_operator) {
+    ASTNode *children_buffer = stats_malloc(PARSER_ALLOC, 10 * sizeof(ASTNode));
     size_t children_length = 0;
     size_t children_capacity = 10;
 
-    enum OperatorType *operators_buffer = malloc(10 * sizeof(enum OperatorType));
+    enum OperatorType *operators_buffer = stats_malloc(PARSER_ALLOC, 10 * sizeof(enum OperatorType));
     size_t operators_length = 0;
     size_t operators_capacity = 10;
-    enum OperatorType *prefix_operator = NULL;
-    if (peek(context, MINUS)) {
-        prefix_operator = malloc(sizeof(enum OperatorType));
-        *prefix_operator = SUB_OP;
-        context->token_pos += 1;
-    }
 
     while(1) {
-        // Find operands (and operators) until hitting a wall
-        
-        if (context->token_pos >= context->num_tokens) break;
-        
-        // Parse the next operand
+        // Parse the next operand, the first term owning the prefix
         ASTNode next_node;
-        if (peek(context, ROUND_OPEN)) next_node = parse_bracket_expression(context);
-        else if (peek(context, NUMERIC_LITERAL)) next_node = parse_number_or_variable(context);
-        else if (peek(context, IDENTIFIER)) {
-            context->token_pos+=1;
-            if(peek(context, ROUND_OPEN)) {
-                context->token_pos-=1;
-                next_node = parse_function_call(context);
-            }
-            else {
-                context->token_pos-=1;
-                next_node = parse_number_or_variable(context);
-            }
-        }
-        else break;
+        if (additive) next_node = parse_operator_chain(context, 0, children_length == 0 ? prefix_operator : NULL);
+        else next_node = parse_operand(context);
 
         if (next_node.node_type == INVALID) {
             for (size_t i = 0; i < children_length; ++i) cleanup_node(children_buffer+i);
-            free(children_buffer);
-            free(operators_buffer);
-            if (prefix_operator != NULL) free(prefix_operator); 
+            stats_free(PARSER_ALLOC, children_buffer);
+            stats_free(PARSER_ALLOC, operators_buffer);
+            if (!additive && prefix_operator != NULL) stats_free(PARSER_ALLOC, prefix_operator); 
             return next_node;
         }
         
@@ -293,51 +511,135 @@ ASTNode parse_expression(ParserContext *context) {
         {
             if (children_length == children_capacity) {
                 children_capacity *= 2;
-                children_buffer = realloc(children_buffer, children_capacity * sizeof(ASTNode));
+                children_buffer = stats_realloc(PARSER_ALLOC, children_buffer, children_capacity * sizeof(ASTNode));
             }
             children_buffer[children_length++] = next_node;
         } 
 
-
-        // Parse the next operator and add it to the operator buffer
-        if (peek(context, PLUS) || peek(context, MINUS) || peek(context, MULT) || peek(context, DIV)) {
-            if (operators_capacity == operators_length) {
-                operators_capacity *= 2;
-                operators_buffer = realloc(operators_buffer, operators_capacity * sizeof(enum OperatorType));
-            }
-            if (peek(context, PLUS)) operators_buffer[operators_length++] = ADD_OP;
-            else if (peek(context, MINUS)) operators_buffer[operators_length++] = SUB_OP;
-            else if (peek(context, MULT)) operators_buffer[operators_length++] = MULT_OP;
-            else operators_buffer[operators_length++] = DIV_OP;
-            context->token_pos += 1;
+        // Parse the next operator of this level and add it to the operator buffer
+        enum OperatorType operator;
+        if (!peek_arithmetic_operator(context, additive, &operator)) break;
+        if (operators_capacity == operators_length) {
+            operators_capacity *= 2;
+            operators_buffer = stats_realloc(PARSER_ALLOC, operators_buffer, operators_capacity * sizeof(enum OperatorType));
         }
-        else break;
+        operators_buffer[operators_length++] = operator;
+        context->token_pos += 1;
     }
 
-    if (children_length == 0) {
-        for (size_t i = 0; i < children_length; ++i) cleanup_node(children_buffer+i);
-        free(children_buffer);
-        free(operators_buffer);
-        if (prefix_operator != NULL) free(prefix_operator);
-        return get_invalid_node(IDENTIFIER, context); // >:)
-    }
-    else if (children_length == 1) {
-        ASTNode result = children_buffer[0];
-        result.prefix_operator = prefix_operator;
-        free(children_buffer);
-        free(operators_buffer);
-        return result;
+    ASTNode result;
+    if (children_length == 1) {
+        result = children_buffer[0];
+        stats_free(PARSER_ALLOC, children_buffer);
+        stats_free(PARSER_ALLOC, operators_buffer);
     }
     else {
-        ASTNode result = {
+        result = (ASTNode){
             .node_type = ARITHMETIC,
-            .operators = realloc(operators_buffer, operators_length * sizeof(enum OperatorType)),
-            .prefix_operator = prefix_operator,
-            .children = realloc(children_buffer, children_length * sizeof(ASTNode)),
+            .operators = stats_realloc(PARSER_ALLOC, operators_buffer, operators_length * sizeof(enum OperatorType)),
+            .children = stats_realloc(PARSER_ALLOC, children_buffer, children_length * sizeof(ASTNode)),
             .children_length = children_length
         };
-        return result;
     }
+    if (!additive && prefix_operator != NULL) negate_node(&result, prefix_operator);
+    return result;
+}
+
+ASTNode parse_arithmetic(ParserContext *context) {
+    // [MINUS] <term> ((PLUS | MINUS) <term>)*
+    // <term>: <operand> ((MULT | DIV) <operand>)*
+    // * and / bind tighter than + and -, operators of one level apply left
+    // to right. The minus prefix negates the first term
+
+    enum OperatorType *prefix_operator = NULL;
+    if (peek(context, MINUS)) {
+        prefix_operator = stats_malloc(PARSER_ALLOC, sizeof(enum OperatorType));
+        *prefix_operator = SUB_OP;
+        context->token_pos += 1;
+    }
+    return parse_operator_chain(context, 1, prefix_operator);
+}
+
+// Node of a binary operator (comparison or logical) owning both operands
+static ASTNode binary_node(enum ASTNodeType node_type, enum OperatorType operator, ASTNode left, ASTNode right) {
+    ASTNode *children = stats_malloc(PARSER_ALLOC, 2 * sizeof(ASTNode));
+    enum OperatorType *operators = stats_malloc(PARSER_ALLOC, sizeof(enum OperatorType));
+    children[0] = left;
+    children[1] = right;
+    *operators = operator;
+
+    ASTNode node = {
+        .node_type = node_type,
+        .operators = operators,
+        .children = children,
+        .children_length = 2
+    };
+    return node;
+}
+
+static char peek_comparison_operator(ParserContext *context, enum OperatorType *operator) {
+    if (peek(context, DOUBLE_EQUAL)) *operator = EQ_OP;
+    else if (peek(context, NOT_EQUAL)) *operator = NE_OP;
+    else if (peek(context, LESS)) *operator = LT_OP;
+    else if (peek(context, LESS_EQUAL)) *operator = LE_OP;
+    else if (peek(context, GREATER)) *operator = GT_OP;
+    else if (peek(context, GREATER_EQUAL)) *operator = GE_OP;
+    else return 0;
+    return 1;
+}
+
+ASTNode parse_comparison(ParserContext *context) {
+    // <arithmetic> (<comparison operator> <arithmetic>)*
+
+    ASTNode left = parse_arithmetic(context);
+    if (left.node_type == INVALID) return left;
+
+    enum OperatorType operator;
+    while (peek_comparison_operator(context, &operator)) {
+        context->token_pos += 1;
+        ASTNode right = parse_arithmetic(context);
+        if (right.node_type == INVALID) {
+            cleanup_node(&left);
+            return right;
+        }
+        left = binary_node(COMPARISON, operator, left, right);
+    }
+    return left;
+}
+
+ASTNode parse_logical_and(ParserContext *context) {
+    // <comparison> (AND <comparison>)*
+
+    ASTNode left = parse_comparison(context);
+    if (left.node_type == INVALID) return left;
+
+    while (step(context, AND)) {
+        ASTNode right = parse_comparison(context);
+        if (right.node_type == INVALID) {
+            cleanup_node(&left);
+            return right;
+        }
+        left = binary_node(LOGICAL, AND_OP, left, right);
+    }
+    return left;
+}
+
+ASTNode parse_expression(ParserContext *context) {
+    // <logical and> (OR <logical and>)*
+    // || binds weaker than &&, which binds weaker than comparisons
+
+    ASTNode left = parse_logical_and(context);
+    if (left.node_type == INVALID) return left;
+
+    while (step(context, OR)) {
+        ASTNode right = parse_logical_and(context);
+        if (right.node_type == INVALID) {
+            cleanup_node(&left);
+            return right;
+        }
+        left = binary_node(LOGICAL, OR_OP, left, right);
+    }
+    return left;
 }
 
 // Statement Parsers
@@ -362,7 +664,7 @@ ASTNode parse_declaration(ParserContext *context) {
     // LET IDENTIFIER EQUAL <expression> SEMICOLON
     if (!step(context, SEMICOLON)) return get_invalid_node(SEMICOLON, context);
     
-    ASTNode *children = malloc(2 * sizeof(ASTNode));
+    ASTNode *children = stats_malloc(PARSER_ALLOC, 2 * sizeof(ASTNode));
     children[0] = first_child;
     children[1] = second_child;
     ASTNode node = {
@@ -392,7 +694,7 @@ ASTNode parse_assignment(ParserContext *context) {
     // IDENTIFIER EQUAL <expression> SEMICOLON
     if (!step(context, SEMICOLON)) return get_invalid_node(SEMICOLON, context);
 
-    ASTNode *children = malloc(2 * sizeof(ASTNode));
+    ASTNode *children = stats_malloc(PARSER_ALLOC, 2 * sizeof(ASTNode));
     children[0] = first_child;
     children[1] = second_child;
     ASTNode node = {
@@ -404,6 +706,38 @@ ASTNode parse_assignment(ParserContext *context) {
 }
 
 
+ASTNode parse_index_assignment(ParserContext *context) {
+    // IDENTIFIER SQUARE_OPEN <expression> SQUARE_CLOSE EQUAL <expression> SEMICOLON
+
+    // IDENTIFIER SQUARE_OPEN <expression> SQUARE_CLOSE
+    ASTNode node = parse_indexed_identifier(context, INDEX_ASSIGNMENT);
+    if (node.node_type == INVALID) return node;
+
+    // IDENTIFIER SQUARE_OPEN <expression> SQUARE_CLOSE EQUAL
+    if (!step(context, EQUAL)) {
+        cleanup_node(&node);
+        return get_invalid_node(EQUAL, context);
+    }
+
+    // IDENTIFIER SQUARE_OPEN <expression> SQUARE_CLOSE EQUAL <expression>
+    ASTNode value = parse_expression(context);
+    if (value.node_type == INVALID) {
+        cleanup_node(&node);
+        return value;
+    }
+
+    // IDENTIFIER SQUARE_OPEN <expression> SQUARE_CLOSE EQUAL <expression> SEMICOLON
+    if (!step(context, SEMICOLON)) {
+        cleanup_node(&node);
+        cleanup_node(&value);
+        return get_invalid_node(SEMICOLON, context);
+    }
+
+    node.children[node.children_length++] = value;
+    return node;
+}
+
+
 ASTNode parse_return_stmt(ParserContext *context) {
     // RETURN <expression> SEMICOLON
 
@@ -417,7 +751,7 @@ ASTNode parse_return_stmt(ParserContext *context) {
     // RETURN <expression> SEMICOlON
     if (!step(context, SEMICOLON)) return get_invalid_node(SEMICOLON, context);
 
-    ASTNode *children = malloc(sizeof(ASTNode));
+    ASTNode *children = stats_malloc(PARSER_ALLOC, sizeof(ASTNode));
     children[0] = child;
     ASTNode node = {
         .node_type = RETURN_STMT,
@@ -441,7 +775,7 @@ ASTNode parse_print_stmt(ParserContext *context) {
     // PRINT <expression> SEMICOlON
     if (!step(context, SEMICOLON)) return get_invalid_node(SEMICOLON, context);
 
-    ASTNode *children = malloc(sizeof(ASTNode));
+    ASTNode *children = stats_malloc(PARSER_ALLOC, sizeof(ASTNode));
     children[0] = child;
     ASTNode node = {
         .node_type = PRINT_STMT,
@@ -451,6 +785,53 @@ ASTNode parse_print_stmt(ParserContext *context) {
     return node;
 }
 
+ASTNode parse_yield_stmt(ParserContext *context) {
+    // YIELD <expression> SEMICOLON
+
+    // YIELD
+    if (!step(context, YIELD)) return get_invalid_node(YIELD, context);
+
+    // YIELD <expression>
+    ASTNode child = parse_expression(context);
+    if (child.node_type == INVALID) return child;
+
+    // YIELD <expression> SEMICOlON
+    if (!step(context, SEMICOLON)) return get_invalid_node(SEMICOLON, context);
+
+    ASTNode *children = stats_malloc(PARSER_ALLOC, sizeof(ASTNode));
+    children[0] = child;
+    ASTNode node = {
+        .node_type = YIELD_STMT,
+        .children_length = 1,
+        .children = children
+    };
+    return node;
+}
+
+ASTNode parse_import_stmt(ParserContext *context) {
+    // IMPORT STRING_LITERAL SEMICOLON
+
+    // IMPORT
+    if (!step(context, IMPORT)) return get_invalid_node(IMPORT, context);
+
+    // IMPORT STRING_LITERAL
+    if (!peek(context, STRING_LITERAL)) return get_invalid_node(STRING_LITERAL, context);
+    char *value = stats_strdup(PARSER_ALLOC, context->tokens[context->token_pos].token_value);
+    context->token_pos += 1;
+
+    // IMPORT STRING_LITERAL SEMICOLON
+    if (!step(context, SEMICOLON)) {
+        stats_free(PARSER_ALLOC, value);
+        return get_invalid_node(SEMICOLON, context);
+    }
+
+    ASTNode node = {
+        .node_type = IMPORT_STMT,
+        .value = value
+    };
+    return node;
+}
+
 
 ASTNode parse_if_else_stmt(ParserContext *context) {
     // IF <expression> CURLY_OPEN <stmt_sequence> CURLY_CLOSE
@@ -488,7 +869,7 @@ ASTNode parse_if_else_stmt(ParserContext *context) {
         // ELSE CURLY_OPEN <stmt_sequence> CURLY_CLOSE
         if (!step(context, CURLY_CLOSE)) return get_invalid_node(CURLY_CLOSE, context);
 
-        ASTNode *children = malloc(3 * sizeof(ASTNode));
+        ASTNode *children = stats_malloc(PARSER_ALLOC, 3 * sizeof(ASTNode));
         children[0] = first_child;
         children[1] = second_child;
         children[2] = third_child;
@@ -502,7 +883,7 @@ ASTNode parse_if_else_stmt(ParserContext *context) {
         return node;
     }
     else {
-        ASTNode *children = malloc(2 * sizeof(ASTNode));
+        ASTNode *children = stats_malloc(PARSER_ALLOC, 2 * sizeof(ASTNode));
         children[0] = first_child;
         children[1] = second_child;
 
@@ -517,6 +898,39 @@ ASTNode parse_if_else_stmt(ParserContext *context) {
 }
 
 
+ASTNode parse_while_stmt(ParserContext *context) {
+    // WHILE <expression> CURLY_OPEN <stmt_sequence> CURLY_CLOSE
+
+    // WHILE
+    if (!step(context, WHILE)) return get_invalid_node(WHILE, context);
+
+    // WHILE <expression>
+    ASTNode first_child = parse_expression(context);
+    if (first_child.node_type == INVALID) return first_child;
+
+    // WHILE <expression> CURLY_OPEN
+    if (!step(context, CURLY_OPEN)) return get_invalid_node(CURLY_OPEN, context);
+
+    // WHILE <expression> CURLY_OPEN <stmt_sequence>
+    ASTNode second_child = parse_stmt_sequence(context);
+    if (second_child.node_type == INVALID) return second_child;
+
+    // WHILE <expression> CURLY_OPEN <stmt_sequence> CURLY_CLOSE
+    if (!step(context, CURLY_CLOSE)) return get_invalid_node(CURLY_CLOSE, context);
+
+    ASTNode *children = stats_malloc(PARSER_ALLOC, 2 * sizeof(ASTNode));
+    children[0] = first_child;
+    children[1] = second_child;
+
+    ASTNode node = {
+        .node_type = WHILE_STMT,
+        .children_length = 2,
+        .children = children
+    };
+    return node;
+}
+
+
 ASTNode parse_function(ParserContext *context) {
     // FN IDENTIFIER ROUND_OPEN <comma _separated identifiers> ROUND_CLOSE
     // CURLY_OPEN <stmt_sequence> CURLY_CLOSE 
@@ -528,7 +942,7 @@ ASTNode parse_function(ParserContext *context) {
     if (!step(context, IDENTIFIER)) return get_invalid_node(IDENTIFIER, context);
     if (!step(context, ROUND_OPEN)) return get_invalid_node(ROUND_OPEN, context);
 
-    char **args = malloc(10 * sizeof(void*));
+    char **args = stats_malloc(PARSER_ALLOC, 10 * sizeof(void*));
     int args_length = 0;
     int args_capacity = 10;
     if (!step(context, ROUND_CLOSE)) {
@@ -542,7 +956,7 @@ ASTNode parse_function(ParserContext *context) {
             
             if (args_length == args_capacity) {
                 args_capacity *= 2;
-                args = realloc(args, args_capacity * sizeof(void*));
+                args = stats_realloc(PARSER_ALLOC, args, args_capacity * sizeof(void*));
             }
             args[args_length++] = next_node.value; // ownership transfer
             
@@ -559,38 +973,41 @@ ASTNode parse_function(ParserContext *context) {
     // CURLY_OPEN
     if (!step(context, CURLY_OPEN)) return get_invalid_node(CURLY_OPEN, context);
 
-    // CURLY_OPEN <stmt_sequence>
-    ASTNode child_node = parse_stmt_sequence(context);
-    if (child_node.node_type == INVALID) {
-        cleanup_double_array(args, args_length);
-        return child_node;
-    }
-
-    // CURLY_OPEN <stmt_sequence> CURLY_CLOSE
-    if(!step(context, CURLY_CLOSE)) {
-        cleanup_double_array(args, args_length);
-        return get_invalid_node(CURLY_CLOSE, context);
+    // CURLY_OPEN <tokens> CURLY_CLOSE
+    // The body is only scanned for its matching CURLY_CLOSE here. The first
+    // call parses it through flat_function_body() and parse_function_body(),
+    // unless share_tree() or the optimizer does first with function_body()
+    int body_start = context->token_pos;
+    for (int depth = 1; depth > 0; ) {
+        if (context->token_pos >= context->num_tokens) {
+            cleanup_double_array(args, args_length);
+            return get_invalid_node(CURLY_CLOSE, context);
+        }
+        if (peek(context, CURLY_OPEN)) depth += 1;
+        else if (peek(context, CURLY_CLOSE)) depth -= 1;
+        context->token_pos += 1;
     }
-
-    ASTNode *children = malloc(sizeof(ASTNode));
-    children[0] = child_node; 
     
-    char *value = strdup(context->tokens[function_name_token_pos].token_value);
+    char *value = stats_strdup(PARSER_ALLOC, context->tokens[function_name_token_pos].token_value);
+    uint64_t args_hash_bits = 0;
+    for (int i = 0; i < args_length; ++i) args_hash_bits |= hash_bit(hash_key(args[i]));
 
     ASTNode node = {
         .node_type = FUNCTION,
         .value = value,
-        .args = realloc(args, args_length * sizeof(void*)),
+        .value_hash = hash_key(value),
+        .args = stats_realloc(PARSER_ALLOC, args, args_length * sizeof(void*)),
         .args_length = args_length,
-        .children = children, 
-        .children_length = 1 
+        .args_hash_bits = args_hash_bits,
+        .body_tokens = context->tokens + body_start,
+        .body_tokens_length = context->token_pos - 1 - body_start
     };
     return node;
 }
 
 
 ASTNode parse_stmt_sequence(ParserContext *context) {
-    ASTNode *children = malloc(10 * sizeof(ASTNode));
+    ASTNode *children = stats_malloc(PARSER_ALLOC, 10 * sizeof(ASTNode));
     size_t children_length = 0;
     size_t children_capacity = 10;
 
@@ -598,10 +1015,19 @@ ASTNode parse_stmt_sequence(ParserContext *context) {
         ASTNode next_node;
 
         if (peek(context, LET)) next_node = parse_declaration(context);
-        else if (peek(context, IDENTIFIER)) next_node = parse_assignment(context);
+        else if (peek(context, IDENTIFIER)) {
+            context->token_pos += 1;
+            char is_index_assignment = peek(context, SQUARE_OPEN);
+            context->token_pos -= 1;
+            if (is_index_assignment) next_node = parse_index_assignment(context);
+            else next_node = parse_assignment(context);
+        }
         else if (peek(context, RETURN)) next_node = parse_return_stmt(context);
         else if (peek(context, PRINT)) next_node = parse_print_stmt(context);
+        else if (peek(context, YIELD)) next_node = parse_yield_stmt(context);
+        else if (peek(context, IMPORT)) next_node = parse_import_stmt(context);
         else if (peek(context, IF)) next_node = parse_if_else_stmt(context);
+        else if (peek(context, WHILE)) next_node = parse_while_stmt(context);
         else if (peek(context, FN)) next_node = parse_function(context);
         else break; 
         
@@ -609,7 +1035,7 @@ ASTNode parse_stmt_sequence(ParserContext *context) {
 
         if (children_length == children_capacity) {
             children_capacity *= 2;
-            children = realloc(children, children_capacity * sizeof(ASTNode));
+            children = stats_realloc(PARSER_ALLOC, children, children_capacity * sizeof(ASTNode));
         }
         children[children_length++] = next_node;
     }
@@ -617,7 +1043,7 @@ ASTNode parse_stmt_sequence(ParserContext *context) {
     ASTNode node = {
         .node_type = STMT_SEQUENCE,
         .children_length = children_length, 
-        .children = realloc(children, children_length * sizeof(ASTNode))
+        .children = stats_realloc(PARSER_ALLOC, children, children_length * sizeof(ASTNode))
     };
 
     return node;
@@ -643,12 +1069,73 @@ ASTNode parse_ast(Token const *tokens, int num_tokens) {
     return result;
 }
 
+ASTNode parse_function_body(Token const *tokens, int num_tokens) {
+    ParserContext context = {
+        .tokens = tokens,
+        .num_tokens = num_tokens,
+        .token_pos = 0
+    };
+    ASTNode body = parse_stmt_sequence(&context);
+    if (body.node_type != INVALID && context.token_pos != context.num_tokens) {
+        cleanup_node(&body);
+        body = get_invalid_node(CURLY_CLOSE, &context);
+    }
+    return body;
+}
+
+ASTNode const *function_body(ASTNode *function_node) {
+    if (function_node->children_length == 0) {
+        ASTNode body = parse_function_body(function_node->body_tokens, function_node->body_tokens_length);
+        function_node->children = stats_malloc(PARSER_ALLOC, sizeof(ASTNode));
+        function_node->children[0] = body;
+        function_node->children_length = 1;
+    }
+    return function_node->children+0;
+}
+
+ASTNode const *share_tree(ASTNode *root) {
+    ASTNode const *invalid = NULL;
+    if (root->node_type == FUNCTION) {
+        ASTNode const *body = function_body(root);
+        if (body->node_type == INVALID) invalid = body;
+        root->body_tokens = NULL;
+        root->body_tokens_length = 0;
+    }
+    // the mark on the root flags the lowered tree as shared, see flatten_tree()
+    root->call_cache.epoch = _UNCACHED_CALL_SITE;
+    for (size_t i = 0; i < root->children_length; ++i) {
+        ASTNode const *invalid_child = share_tree(root->children+i);
+        if (invalid == NULL) invalid = invalid_child;
+    }
+    return invalid;
+}
+
 int safe_streq(const char *left, const char *right) {
     if (left == NULL) return right == NULL;
     if (right == NULL) return 0;
     return strcmp(left, right) == 0;
 }
 
+ASTNode copy_node(ASTNode const *node) {
+    ASTNode copy = *node;
+    copy.call_cache = (CallSiteCache){0};
+    if (node->value) copy.value = stats_strdup(PARSER_ALLOC, node->value);
+    if (node->prefix_operator) {
+        copy.prefix_operator = stats_malloc(PARSER_ALLOC, sizeof(enum OperatorType));
+        *copy.prefix_operator = *node->prefix_operator;
+    }
+    if (node->operators) {
+        size_t size = (node->children_length - 1) * sizeof(enum OperatorType);
+        copy.operators = stats_malloc(PARSER_ALLOC, size);
+        memcpy(copy.operators, node->operators, size);
+    }
+    if (node->children) {
+        copy.children = stats_malloc(PARSER_ALLOC, node->children_length * sizeof(ASTNode));
+        for (size_t i = 0; i < node->children_length; ++i) copy.children[i] = copy_node(node->children+i);
+    }
+    return copy;
+}
+
 char ast_equal(ASTNode *left, ASTNode *right) {
     if (left->node_type != right -> node_type) return 0;
     
@@ -666,3 +1153,20 @@ char ast_equal(ASTNode *left, ASTNode *right) {
     
     return 1;
 }
+
+
+size_t count_nodes(ASTNode const *node) {
+    size_t result = 1;
+    for (size_t i = 0; i < node->children_length; ++i) {
+        result += count_nodes(node->children+i);
+    }
+    return result;
+}
+
+char contains_node_type(ASTNode const *node, enum ASTNodeType node_type) {
+    if (node->node_type == node_type) return 1;
+    for (size_t i = 0; i < node->children_length; ++i) {
+        if (contains_node_type(node->children+i, node_type)) return 1;
+    }
+    return 0;
+}
\ No newline at end of file
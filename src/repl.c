@@ -0,0 +1,78 @@
+#include "repl.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "interpreter.h"
+
+// Change of the curly bracket depth over a line. String literals are
+// skipped; in_string carries an unterminated one over to the next line
+static long bracket_depth_change(char const *line, char *in_string) {
+    long change = 0;
+    for (char const *p = line; *p; ++p) {
+        if (*in_string) {
+            if (*p == '\\' && p[1] != '\0') ++p;
+            else if (*p == '"') *in_string = 0;
+        }
+        else if (*p == '"') *in_string = 1;
+        else if (*p == '{') ++change;
+        else if (*p == '}') --change;
+    }
+    return change;
+}
+
+static void run_input(char const *input, FILE *out, EvaluatorContext *context) {
+    char *error_message;
+    if (interpret(input, &error_message, context, NULL)) {
+        fprintf(out, "error message: %s\n", error_message);
+        free(error_message);
+        clear_evaluation_error(context);
+    }
+    // the values an input printed were written already, a session keeps
+    // none of them
+    context->side_effects.length = 0;
+}
+
+void run_repl(FILE *in, FILE *out, EvaluatorContext *context) {
+    char interactive = isatty(fileno(in));
+    // a function defined by one input may be called, or its name bound, by
+    // any later one, also from a task
+    context->eliminate_dead_code = 0;
+    context->inline_threshold = 0;
+    context->share_trees = 1;
+    char *line = NULL;
+    size_t line_capacity = 0;
+
+    char *input = NULL;
+    size_t input_length = 0;
+    long depth = 0;
+    char in_string = 0;
+
+    while (1) {
+        if (interactive) {
+            fputs(input_length == 0 ? "> " : "... ", out);
+            fflush(out);
+        }
+
+        ssize_t line_length = getline(&line, &line_capacity, in);
+        if (line_length < 0) break;
+
+        char *grown = realloc(input, input_length + line_length + 1);
+        if (grown == NULL) break;
+        input = grown;
+        memcpy(input + input_length, line, line_length + 1);
+        input_length += line_length;
+
+        depth += bracket_depth_change(line, &in_string);
+        if (depth > 0 || in_string) continue;
+
+        run_input(input, out, context);
+        input_length = 0;
+        depth = 0;
+    }
+
+    // whatever is left of an unfinished input still runs
+    if (input_length > 0) run_input(input, out, context);
+    free(input);
+    free(line);
+}
@@ -0,0 +1,728 @@
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "array_value.h"
+#include "string_value.h"
+#include "hash_table.h"
+#include "optimizer.h"
+#include "stats.h"
+
+#define _SNAPSHOT_BYTE_ORDER 0x01020304
+
+
+////////////
+/// File ///
+////////////
+
+// Tables of a snapshot file, in file order after the header
+enum SnapshotSection {
+    NODES_SECTION,      // FlatNode, as the tree holds them
+    NAMES_SECTION,      // SnapshotName
+    STRINGS_SECTION,    // SnapshotValue of every string literal
+    FUNCTIONS_SECTION,  // SnapshotFunction
+    ARGS_SECTION,       // uint64_t offset into chars of an argument name
+    CALL_SITES_SECTION, // uint32_t index into names
+    GLOBALS_SECTION,    // SnapshotGlobal
+    ARRAYS_SECTION,     // SnapshotArray
+    ITEMS_SECTION,      // int32_t elements of the arrays
+    CHARS_SECTION,      // NUL terminated strings the others point to
+    _SNAPSHOT_SECTIONS_COUNT
+};
+
+typedef struct {
+    uint64_t offset;    // from the start of the file, 8 byte aligned
+    uint64_t length;    // entries
+} SnapshotExtent;
+
+// Snapshots hold native integers and FlatNode as is, so a file is only read
+// back by a build with the same byte order and node layout
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t node_size;
+    uint32_t resume_statement;
+    uint64_t source_hash;
+    uint64_t module_dir;    // offset into chars
+    SnapshotExtent sections[_SNAPSHOT_SECTIONS_COUNT];
+} SnapshotHeader;
+
+typedef struct {
+    uint64_t chars;
+    uint64_t hash;
+} SnapshotName;
+
+// INT_TAG and SMALL_STRING_TAG: the Value itself, STRING_TAG: offset into
+// chars, ARRAY_TAG: index into arrays, FUNCTION_TAG: index into functions
+typedef struct {
+    uint64_t tag;
+    uint64_t payload;
+} SnapshotValue;
+
+typedef struct {
+    uint64_t name;  // offset into chars
+    SnapshotValue value;
+} SnapshotGlobal;
+
+typedef struct {
+    uint64_t name;  // offset into chars
+    uint64_t name_hash;
+    uint64_t first_arg;
+    uint64_t args_length;
+    uint64_t args_hash_bits;
+    uint64_t body;
+    uint64_t error_message; // offset into chars, _SNAPSHOT_NONE for a parsed body
+} SnapshotFunction;
+
+typedef struct {
+    uint64_t first_item;
+    uint64_t length;
+} SnapshotArray;
+
+static size_t const SECTION_ENTRY_SIZES[_SNAPSHOT_SECTIONS_COUNT] = {
+    sizeof(FlatNode),
+    sizeof(SnapshotName),
+    sizeof(SnapshotValue),
+    sizeof(SnapshotFunction),
+    sizeof(uint64_t),
+    sizeof(uint32_t),
+    sizeof(SnapshotGlobal),
+    sizeof(SnapshotArray),
+    sizeof(int32_t),
+    sizeof(char)
+};
+
+static char *snapshot_error(char const *format, char const *detail) {
+    size_t num_bytes = strlen(format) + strlen(detail) + 1;
+    char *error_message = stats_malloc(EVALUATOR_ALLOC, num_bytes);
+    if (error_message != NULL) snprintf(error_message, num_bytes, format, detail);
+    return error_message;
+}
+
+size_t prelude_length(FlatTree const *tree) {
+    FlatNode const *statements = flat_child(tree->nodes, 0);
+    size_t length = 0;
+    while (length < tree->nodes[0].children_length) {
+        uint8_t node_type = statements[length].node_type;
+        if (node_type != FUNCTION && node_type != DECLARATION) break;
+        length += 1;
+    }
+    return length;
+}
+
+
+///////////////
+/// Writing ///
+///////////////
+
+typedef struct {
+    char *bytes;
+    size_t length;
+    size_t capacity;
+} ByteBuffer;
+
+typedef struct {
+    FlatTree const *tree;
+    ByteBuffer sections[_SNAPSHOT_SECTIONS_COUNT];
+    Stack arrays;   // Array const * saved so far, in the order of the arrays section
+    char error;     // out of memory
+    char *error_message;
+} SnapshotWriter;
+
+// Makes room for size more bytes at the end of a section and returns their
+// offset into it
+static uint64_t reserve_bytes(SnapshotWriter *writer, enum SnapshotSection section, size_t size) {
+    ByteBuffer *buffer = writer->sections + section;
+    if (buffer->length + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 256;
+        while (capacity < buffer->length + size) capacity *= 2;
+        char *bytes = stats_realloc(EVALUATOR_ALLOC, buffer->bytes, capacity);
+        if (bytes == NULL) {
+            writer->error = 1;
+            return 0;
+        }
+        buffer->bytes = bytes;
+        buffer->capacity = capacity;
+    }
+    uint64_t offset = buffer->length;
+    buffer->length += size;
+    return offset;
+}
+
+// Appends an entry to a section and returns its index
+static uint64_t add_entry(SnapshotWriter *writer, enum SnapshotSection section, void const *entry) {
+    size_t size = SECTION_ENTRY_SIZES[section];
+    uint64_t offset = reserve_bytes(writer, section, size);
+    if (writer->error) return 0;
+    memcpy(writer->sections[section].bytes + offset, entry, size);
+    return offset / size;
+}
+
+static uint64_t add_chars(SnapshotWriter *writer, char const *chars) {
+    size_t length = strlen(chars) + 1;
+    uint64_t offset = reserve_bytes(writer, CHARS_SECTION, length);
+    if (!writer->error) memcpy(writer->sections[CHARS_SECTION].bytes + offset, chars, length);
+    return offset;
+}
+
+// Index of an array in the arrays section, saving its elements the first
+// time it is seen
+static uint64_t add_array(SnapshotWriter *writer, Array const *array) {
+    Array const **saved = writer->arrays.buffer;
+    for (size_t i = 0; i < writer->arrays.length; ++i) {
+        if (saved[i] == array) return i;
+    }
+    if (!stack_push(&writer->arrays, &array)) {
+        writer->error = 1;
+        return 0;
+    }
+
+    size_t items_size = array->length * sizeof(int32_t);
+    uint64_t offset = reserve_bytes(writer, ITEMS_SECTION, items_size);
+    if (writer->error) return 0;
+    if (items_size) memcpy(writer->sections[ITEMS_SECTION].bytes + offset, array->items, items_size);
+    SnapshotArray entry = {.first_item = offset / sizeof(int32_t), .length = array->length};
+    return add_entry(writer, ARRAYS_SECTION, &entry);
+}
+
+static SnapshotValue save_value(SnapshotWriter *writer, Value value) {
+    SnapshotValue saved = {.tag = value_tag(value), .payload = value};
+    switch (value_tag(value)) {
+        case STRING_TAG: {
+            size_t length = string_length(value);
+            saved.payload = reserve_bytes(writer, CHARS_SECTION, length + 1);
+            if (writer->error) break;
+            char *chars = writer->sections[CHARS_SECTION].bytes + saved.payload;
+            copy_string_chars(value, chars);
+            chars[length] = '\0';
+            break;
+        }
+        case ARRAY_TAG:
+            saved.payload = add_array(writer, value_as_array(value));
+            break;
+        case FUNCTION_TAG: {
+            FlatFunction const *function = value_as_pointer(value);
+            FlatTree const *tree = writer->tree;
+            if (function < tree->functions || function >= tree->functions + tree->functions_length) {
+                if (writer->error_message == NULL) writer->error_message = snapshot_error("Snapshot cannot hold function: %s", function->name);
+                break;
+            }
+            saved.payload = function - tree->functions;
+            break;
+        }
+        case TASK_TAG:
+            // the task itself is joined and gone by the time the prelude ends
+            if (writer->error_message == NULL) writer->error_message = snapshot_error("Snapshot cannot hold %s", "a task");
+            break;
+        default:
+            break;
+    }
+    return saved;
+}
+
+static void save_tree(SnapshotWriter *writer) {
+    FlatTree const *tree = writer->tree;
+    uint64_t offset = reserve_bytes(writer, NODES_SECTION, tree->nodes_length * sizeof(FlatNode));
+    if (!writer->error) memcpy(writer->sections[NODES_SECTION].bytes + offset, tree->nodes, tree->nodes_length * sizeof(FlatNode));
+
+    for (size_t i = 0; i < tree->names_length; ++i) {
+        SnapshotName name = {.chars = add_chars(writer, tree->names[i].name), .hash = tree->names[i].hash};
+        add_entry(writer, NAMES_SECTION, &name);
+    }
+    for (size_t i = 0; i < tree->strings_length; ++i) {
+        SnapshotValue literal = save_value(writer, tree->strings[i]);
+        add_entry(writer, STRINGS_SECTION, &literal);
+    }
+    for (size_t i = 0; i < tree->call_sites_length; ++i) {
+        add_entry(writer, CALL_SITES_SECTION, &tree->call_sites[i].name);
+    }
+
+    for (size_t i = 0; i < tree->functions_length; ++i) {
+        FlatFunction const *function = tree->functions + i;
+        if (function->body_tree != tree && function->error_message == NULL) {
+            if (writer->error_message == NULL) writer->error_message = snapshot_error("Snapshot needs every function body parsed: %s", function->name);
+            return;
+        }
+        SnapshotFunction saved = {
+            .name = add_chars(writer, function->name),
+            .name_hash = function->name_hash,
+            .first_arg = writer->sections[ARGS_SECTION].length / sizeof(uint64_t),
+            .args_length = function->args_length,
+            .args_hash_bits = function->args_hash_bits,
+            .body = function->body,
+            .error_message = function->error_message ? add_chars(writer, function->error_message) : _SNAPSHOT_NONE
+        };
+        for (size_t j = 0; j < function->args_length; ++j) {
+            uint64_t arg = add_chars(writer, function->args[j]);
+            add_entry(writer, ARGS_SECTION, &arg);
+        }
+        add_entry(writer, FUNCTIONS_SECTION, &saved);
+    }
+}
+
+static void save_globals(SnapshotWriter *writer, EvaluatorContext const *context) {
+    HashTable const *main_frame = context->stack_frames.buffer;
+    for (size_t i = 0; i < main_frame->capacity; ++i) {
+        HashTableRow const *row = main_frame->rows + i;
+        if (row->key == NULL) continue;
+        SnapshotGlobal global = {.name = add_chars(writer, row->key), .value = save_value(writer, *(Value const *)row->value)};
+        add_entry(writer, GLOBALS_SECTION, &global);
+    }
+}
+
+// Writes the header and the sections, each 8 byte aligned
+static char write_sections(FILE *file, SnapshotHeader *header, SnapshotWriter const *writer) {
+    static char const padding[8] = {0};
+    uint64_t offset = sizeof(SnapshotHeader);
+    for (size_t i = 0; i < _SNAPSHOT_SECTIONS_COUNT; ++i) {
+        offset = (offset + 7) & ~(uint64_t)7;
+        header->sections[i] = (SnapshotExtent){.offset = offset, .length = writer->sections[i].length / SECTION_ENTRY_SIZES[i]};
+        offset += writer->sections[i].length;
+    }
+
+    if (fwrite(header, sizeof(SnapshotHeader), 1, file) != 1) return 1;
+    uint64_t written = sizeof(SnapshotHeader);
+    for (size_t i = 0; i < _SNAPSHOT_SECTIONS_COUNT; ++i) {
+        size_t pad = header->sections[i].offset - written;
+        if (pad && fwrite(padding, 1, pad, file) != pad) return 1;
+        size_t length = writer->sections[i].length;
+        if (length && fwrite(writer->sections[i].bytes, 1, length, file) != length) return 1;
+        written = header->sections[i].offset + length;
+    }
+    return 0;
+}
+
+char write_snapshot(
+    char const *path,
+    FlatTree const *tree,
+    uint64_t source_hash,
+    uint32_t resume_statement,
+    EvaluatorContext const *context,
+    char **error_message
+) {
+    SnapshotWriter writer = {.tree = tree, .arrays = init_stack(16, sizeof(Array const *))};
+    writer.error = writer.arrays.buffer == NULL;
+    SnapshotHeader header = {
+        .version = _SNAPSHOT_VERSION,
+        .byte_order = _SNAPSHOT_BYTE_ORDER,
+        .node_size = sizeof(FlatNode),
+        .resume_statement = resume_statement,
+        .source_hash = source_hash,
+        .module_dir = _SNAPSHOT_NONE
+    };
+    memcpy(header.magic, _SNAPSHOT_MAGIC, sizeof(header.magic));
+
+    // imports after the prelude resolve against the script's directory
+    // wherever the snapshot is restored from
+    char *module_dir = context->module_dir ? realpath(context->module_dir, NULL) : NULL;
+    if (module_dir != NULL) header.module_dir = add_chars(&writer, module_dir);
+    free(module_dir);
+    save_tree(&writer);
+    save_globals(&writer, context);
+
+    char error = writer.error || writer.error_message != NULL;
+    if (!error) {
+        // written next to the target and renamed over it, so that a
+        // snapshot is never seen half written
+        size_t path_length = strlen(path);
+        char *temporary_path = stats_malloc(EVALUATOR_ALLOC, path_length + 8);
+        int fd = -1;
+        if (temporary_path != NULL) {
+            memcpy(temporary_path, path, path_length);
+            memcpy(temporary_path + path_length, ".XXXXXX", 8);
+            fd = mkstemp(temporary_path);
+            if (fd >= 0) fchmod(fd, 0644);
+        }
+        FILE *file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+        if (file == NULL && fd >= 0) close(fd);
+        error = file == NULL || write_sections(file, &header, &writer);
+        if (file != NULL) error |= fclose(file) != 0;
+        if (!error) error = rename(temporary_path, path) != 0;
+        if (error && fd >= 0) unlink(temporary_path);
+        stats_free(EVALUATOR_ALLOC, temporary_path);
+        if (error) writer.error_message = snapshot_error("Could not write snapshot: %s", path);
+    }
+    else if (writer.error_message == NULL) {
+        writer.error_message = stats_strdup(EVALUATOR_ALLOC, "Internal Error: Could not allocate memory for the snapshot");
+    }
+
+    for (size_t i = 0; i < _SNAPSHOT_SECTIONS_COUNT; ++i) stats_free(EVALUATOR_ALLOC, writer.sections[i].bytes);
+    delete_stack(&writer.arrays);
+    if (error) *error_message = writer.error_message;
+    return error;
+}
+
+
+///////////////
+/// Reading ///
+///////////////
+
+static SnapshotHeader const *snapshot_header(Snapshot const *snapshot) {
+    return snapshot->mapping;
+}
+
+static void const *section_entries(Snapshot const *snapshot, enum SnapshotSection section) {
+    return (char const *)snapshot->mapping + snapshot_header(snapshot)->sections[section].offset;
+}
+
+static uint64_t section_length(Snapshot const *snapshot, enum SnapshotSection section) {
+    return snapshot_header(snapshot)->sections[section].length;
+}
+
+// String at an offset into chars, which ends in a NUL. Sets *error when the
+// offset lies outside of it
+static char *chars_at(Snapshot const *snapshot, uint64_t offset, char *error) {
+    if (offset >= section_length(snapshot, CHARS_SECTION)) {
+        *error = 1;
+        return NULL;
+    }
+    return (char *)section_entries(snapshot, CHARS_SECTION) + offset;
+}
+
+static char sections_in_range(Snapshot const *snapshot) {
+    SnapshotHeader const *header = snapshot_header(snapshot);
+    for (size_t i = 0; i < _SNAPSHOT_SECTIONS_COUNT; ++i) {
+        SnapshotExtent extent = header->sections[i];
+        if (extent.offset % 8 || extent.offset > snapshot->mapping_length) return 0;
+        if (extent.length > (snapshot->mapping_length - extent.offset) / SECTION_ENTRY_SIZES[i]) return 0;
+    }
+    uint64_t chars_length = section_length(snapshot, CHARS_SECTION);
+    return chars_length == 0 || ((char const *)section_entries(snapshot, CHARS_SECTION))[chars_length - 1] == '\0';
+}
+
+// Whether a saved value refers to entries the snapshot holds
+static char value_in_range(Snapshot const *snapshot, SnapshotValue value) {
+    char error = 0;
+    switch (value.tag) {
+        case INT_TAG:
+        case SMALL_STRING_TAG:
+            return 1;
+        case STRING_TAG:
+            chars_at(snapshot, value.payload, &error);
+            return !error;
+        case ARRAY_TAG:
+            return value.payload < section_length(snapshot, ARRAYS_SECTION);
+        case FUNCTION_TAG:
+            return value.payload < section_length(snapshot, FUNCTIONS_SECTION);
+        default:
+            return 0;
+    }
+}
+
+static char globals_in_range(Snapshot const *snapshot) {
+    SnapshotArray const *arrays = section_entries(snapshot, ARRAYS_SECTION);
+    uint64_t items_length = section_length(snapshot, ITEMS_SECTION);
+    for (size_t i = 0; i < section_length(snapshot, ARRAYS_SECTION); ++i) {
+        if (arrays[i].first_item > items_length || arrays[i].length > items_length - arrays[i].first_item) return 0;
+    }
+    SnapshotGlobal const *globals = section_entries(snapshot, GLOBALS_SECTION);
+    char error = 0;
+    for (size_t i = 0; i < section_length(snapshot, GLOBALS_SECTION); ++i) {
+        chars_at(snapshot, globals[i].name, &error);
+        if (error || !value_in_range(snapshot, globals[i].value)) return 0;
+    }
+    return 1;
+}
+
+static void *allocate_table(size_t count, size_t size, char *error) {
+    if (count == 0) return NULL;
+    void *table = stats_malloc(PARSER_ALLOC, count * size);
+    *error |= table == NULL;
+    return table;
+}
+
+// Fewest children the evaluator reads of a node of type node_type
+static size_t least_children(enum ASTNodeType node_type) {
+    switch (node_type) {
+        case COMPARISON:
+        case LOGICAL:
+        case INDEX_ASSIGNMENT:
+        case IF_ELSE_STMT:
+        case WHILE_STMT:
+            return 2;
+        case ARITHMETIC:
+        case INDEX:
+        case INLINE_CALL:
+        case SPAWN_CALL:
+        case PMAP_CALL:
+        case DECLARATION:
+        case ASSIGNMENT:
+        case RETURN_STMT:
+        case PRINT_STMT:
+        case YIELD_STMT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Whether the payload of a node indexes inside the table of tree its type
+// refers to. PARAMETER slots index the inline_args arguments of the
+// innermost INLINE_CALL around the node
+static char payload_in_range(FlatTree const *tree, FlatNode const *node, size_t inline_args) {
+    switch (node->node_type) {
+        case STRING:
+            return node->payload < tree->strings_length;
+        case PARAMETER:
+            return node->payload < inline_args;
+        case FUNCTION:
+            return node->payload < tree->functions_length;
+        case FUNCTION_CALL:
+            return node->payload < tree->call_sites_length;
+        case VARIABLE:
+        case INDEX:
+        case INDEX_ASSIGNMENT:
+        case DECLARATION:
+        case ASSIGNMENT:
+        case IMPORT_STMT:
+        case PMAP_CALL:
+            return node->payload < tree->names_length;
+        default:
+            return 1;
+    }
+}
+
+// A node whose subtree is yet to be checked, see subtree_in_range()
+typedef struct {
+    size_t index;
+    size_t inline_args;
+} PendingNode;
+
+// Whether the subtree of nodes[root] stays inside the tree: children after
+// their parent and within the nodes, payloads within their tables, and as
+// many children as the evaluator reads. visited flags the nodes reached so
+// far, reaching one twice means the nodes do not form a tree. Walks with
+// pending (room for every node) instead of recursing, as a corrupt chain
+// may be as deep as the file is long
+static char subtree_in_range(FlatTree const *tree, size_t root, char *visited, PendingNode *pending) {
+    if (visited[root]) return 0;
+    visited[root] = 1;
+    size_t pending_length = 0;
+    pending[pending_length++] = (PendingNode){.index = root};
+    while (pending_length > 0) {
+        PendingNode next = pending[--pending_length];
+        FlatNode const *node = tree->nodes + next.index;
+        if (node->node_type > STMT_SEQUENCE || node->node_type == INVALID) return 0;
+        if (node->operator > OR_OP || node->joining_operator > OR_OP) return 0;
+        if (!payload_in_range(tree, node, next.inline_args)) return 0;
+        if (node->children_length < least_children(node->node_type)) return 0;
+        if (node->children_length > 0 && node->first_child == 0) return 0;
+        if ((uint64_t)next.index + node->first_child + node->children_length > tree->nodes_length) return 0;
+        if (node->node_type == INLINE_CALL && node->children_length > _MAX_INLINED_ARGS + 1) return 0;
+        if (node->node_type == SPAWN_CALL && flat_child(node, 0)->node_type != FUNCTION_CALL) return 0;
+
+        for (size_t i = 0; i < node->children_length; ++i) {
+            size_t child = next.index + node->first_child + i;
+            if (visited[child]) return 0;
+            visited[child] = 1;
+            // the body of an inlined call reads the arguments before it
+            char body = node->node_type == INLINE_CALL && i + 1 == node->children_length;
+            pending[pending_length++] = (PendingNode){.index = child, .inline_args = body ? i : next.inline_args};
+        }
+    }
+    return 1;
+}
+
+// Checks the program and every parsed function body before the evaluator
+// trusts the mapped nodes. Returns 1 when out of memory
+static char nodes_in_range(FlatTree const *tree, char *corrupt) {
+    char *visited = stats_calloc(PARSER_ALLOC, tree->nodes_length, 1);
+    PendingNode *pending = stats_malloc(PARSER_ALLOC, tree->nodes_length * sizeof(PendingNode));
+    if (visited == NULL || pending == NULL) {
+        stats_free(PARSER_ALLOC, visited);
+        stats_free(PARSER_ALLOC, pending);
+        return 1;
+    }
+    *corrupt |= !subtree_in_range(tree, 0, visited, pending);
+    for (size_t i = 0; i < tree->functions_length && !*corrupt; ++i) {
+        FlatFunction const *function = tree->functions + i;
+        if (function->body_tree != NULL) *corrupt |= !subtree_in_range(tree, function->body, visited, pending);
+    }
+    stats_free(PARSER_ALLOC, visited);
+    stats_free(PARSER_ALLOC, pending);
+    return 0;
+}
+
+// Builds the tree around the mapped nodes. Returns 1 when out of memory and
+// sets *corrupt when an entry refers outside of the snapshot
+static char rebuild_tree(Snapshot *snapshot, char *corrupt) {
+    FlatTree *tree = stats_calloc(PARSER_ALLOC, 1, sizeof(FlatTree));
+    if (tree == NULL) return 1;
+    snapshot->tree = tree;
+
+    // the evaluator never writes to nodes
+    tree->nodes = (FlatNode *)section_entries(snapshot, NODES_SECTION);
+    tree->nodes_length = section_length(snapshot, NODES_SECTION);
+    char error = 0;
+    tree->names_length = section_length(snapshot, NAMES_SECTION);
+    tree->names = allocate_table(tree->names_length, sizeof(FlatName), &error);
+    tree->strings_length = section_length(snapshot, STRINGS_SECTION);
+    tree->strings = allocate_table(tree->strings_length, sizeof(Value), &error);
+    tree->functions_length = section_length(snapshot, FUNCTIONS_SECTION);
+    tree->functions = allocate_table(tree->functions_length, sizeof(FlatFunction), &error);
+    tree->call_sites_length = section_length(snapshot, CALL_SITES_SECTION);
+    tree->call_sites = allocate_table(tree->call_sites_length, sizeof(FlatCallSite), &error);
+    size_t args_length = section_length(snapshot, ARGS_SECTION);
+    tree->args = allocate_table(args_length, sizeof(char *), &error);
+    if (error) return 1;
+
+    SnapshotName const *names = section_entries(snapshot, NAMES_SECTION);
+    for (size_t i = 0; i < tree->names_length; ++i) {
+        tree->names[i] = (FlatName){.name = chars_at(snapshot, names[i].chars, corrupt), .hash = names[i].hash};
+    }
+
+    // long literals are interned again, as the parser would
+    SnapshotValue const *strings = section_entries(snapshot, STRINGS_SECTION);
+    for (size_t i = 0; i < tree->strings_length && !*corrupt; ++i) {
+        *corrupt |= strings[i].tag != SMALL_STRING_TAG && strings[i].tag != STRING_TAG;
+        *corrupt |= !value_in_range(snapshot, strings[i]);
+        if (*corrupt) break;
+        if (strings[i].tag == STRING_TAG) tree->strings[i] = intern_string(chars_at(snapshot, strings[i].payload, corrupt));
+        else tree->strings[i] = strings[i].payload;
+    }
+
+    uint64_t const *args = section_entries(snapshot, ARGS_SECTION);
+    for (size_t i = 0; i < args_length; ++i) tree->args[i] = chars_at(snapshot, args[i], corrupt);
+
+    SnapshotFunction const *functions = section_entries(snapshot, FUNCTIONS_SECTION);
+    for (size_t i = 0; i < tree->functions_length; ++i) {
+        SnapshotFunction const *saved = functions + i;
+        char parsed = saved->error_message == _SNAPSHOT_NONE;
+        *corrupt |= saved->first_arg > args_length || saved->args_length > args_length - saved->first_arg;
+        *corrupt |= parsed && saved->body >= tree->nodes_length;
+        if (*corrupt) {
+            // delete_snapshot() frees the tiered bodies of the functions filled in
+            tree->functions_length = i;
+            break;
+        }
+        tree->functions[i] = (FlatFunction){
+            .name = chars_at(snapshot, saved->name, corrupt),
+            .name_hash = saved->name_hash,
+            .args = tree->args + saved->first_arg,
+            .args_length = saved->args_length,
+            .args_hash_bits = saved->args_hash_bits,
+            .body_tree = parsed ? tree : NULL,
+            .body = parsed ? saved->body : 0,
+            .error_message = parsed ? NULL : chars_at(snapshot, saved->error_message, corrupt)
+        };
+    }
+
+    *corrupt |= tree->nodes_length == 0 || tree->nodes[0].node_type != STMT_SEQUENCE;
+    if (!*corrupt && nodes_in_range(tree, corrupt)) return 1;
+    if (*corrupt) return 0;
+
+    uint32_t const *call_sites = section_entries(snapshot, CALL_SITES_SECTION);
+    tree->shared = flat_tree_spawns(tree);
+    uint64_t epoch = tree->shared ? _UNCACHED_CALL_SITE : 0;
+    for (size_t i = 0; i < tree->call_sites_length; ++i) {
+        *corrupt |= call_sites[i] >= tree->names_length;
+        tree->call_sites[i] = (FlatCallSite){.name = call_sites[i], .cache.epoch = epoch};
+    }
+
+    *corrupt |= snapshot_header(snapshot)->resume_statement > tree->nodes[0].children_length;
+    return 0;
+}
+
+char load_snapshot(char const *path, Snapshot *snapshot, char **error_message) {
+    *snapshot = (Snapshot){0};
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        *error_message = snapshot_error("Could not open snapshot: %s", path);
+        return 1;
+    }
+    struct stat file_stat;
+    char error = fstat(fd, &file_stat) != 0;
+    if (!error && (size_t)file_stat.st_size >= sizeof(SnapshotHeader)) {
+        void *mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            snapshot->mapping = mapping;
+            snapshot->mapping_length = file_stat.st_size;
+        }
+        else error = 1;
+    }
+    close(fd);
+    if (error) {
+        *error_message = snapshot_error("Could not read snapshot: %s", path);
+        return 1;
+    }
+
+    SnapshotHeader const *header = snapshot->mapping;
+    if (header == NULL || memcmp(header->magic, _SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+        delete_snapshot(snapshot);
+        *error_message = snapshot_error("Not a snapshot: %s", path);
+        return 1;
+    }
+    if (header->version != _SNAPSHOT_VERSION || header->byte_order != _SNAPSHOT_BYTE_ORDER || header->node_size != sizeof(FlatNode)) {
+        delete_snapshot(snapshot);
+        *error_message = snapshot_error("Snapshot written by a different build: %s", path);
+        return 1;
+    }
+
+    char corrupt = !sections_in_range(snapshot) || !globals_in_range(snapshot);
+    if (!corrupt && rebuild_tree(snapshot, &corrupt)) {
+        delete_snapshot(snapshot);
+        *error_message = stats_strdup(EVALUATOR_ALLOC, "Internal Error: Could not allocate memory for the snapshot");
+        return 1;
+    }
+    if (corrupt) {
+        delete_snapshot(snapshot);
+        *error_message = snapshot_error("Corrupt snapshot: %s", path);
+        return 1;
+    }
+
+    snapshot->source_hash = header->source_hash;
+    snapshot->resume_statement = header->resume_statement;
+    if (header->module_dir != _SNAPSHOT_NONE) snapshot->module_dir = chars_at(snapshot, header->module_dir, &corrupt);
+    return 0;
+}
+
+char restore_globals(Snapshot const *snapshot, EvaluatorContext *context) {
+    // arrays first, so that names sharing one get the same copy
+    size_t arrays_length = section_length(snapshot, ARRAYS_SECTION);
+    SnapshotArray const *arrays = section_entries(snapshot, ARRAYS_SECTION);
+    int32_t const *items = section_entries(snapshot, ITEMS_SECTION);
+    char error = 0;
+    Value *array_values = allocate_table(arrays_length, sizeof(Value), &error);
+    for (size_t i = 0; i < arrays_length && !error; ++i) {
+        error = new_array(arrays[i].length, &context->objects, array_values+i);
+        if (!error && arrays[i].length) {
+            memcpy(value_as_array(array_values[i])->items, items + arrays[i].first_item, arrays[i].length * sizeof(int32_t));
+        }
+    }
+
+    HashTable *main_frame = context->stack_frames.buffer;
+    SnapshotGlobal const *globals = section_entries(snapshot, GLOBALS_SECTION);
+    for (size_t i = 0; i < section_length(snapshot, GLOBALS_SECTION) && !error; ++i) {
+        SnapshotValue saved = globals[i].value;
+        Value value = saved.payload;
+        if (saved.tag == STRING_TAG) {
+            char const *chars = chars_at(snapshot, saved.payload, &error);
+            error = new_string(chars, strlen(chars), &context->objects, &value);
+        }
+        else if (saved.tag == ARRAY_TAG) value = array_values[saved.payload];
+        else if (saved.tag == FUNCTION_TAG) value = pointer_value(snapshot->tree->functions + saved.payload, FUNCTION_TAG);
+        if (!error) error = hash_table_set(main_frame, chars_at(snapshot, globals[i].name, &error), &value);
+    }
+    stats_free(PARSER_ALLOC, array_values);
+    return error;
+}
+
+void delete_snapshot(Snapshot *snapshot) {
+    FlatTree *tree = snapshot->tree;
+    if (tree != NULL) {
+        for (size_t i = 0; i < tree->functions_length; ++i) stats_free(PARSER_ALLOC, tree->functions[i].tiered_body);
+        stats_free(PARSER_ALLOC, tree->names);
+        stats_free(PARSER_ALLOC, tree->strings);
+        stats_free(PARSER_ALLOC, tree->functions);
+        stats_free(PARSER_ALLOC, tree->call_sites);
+        stats_free(PARSER_ALLOC, tree->args);
+        stats_free(PARSER_ALLOC, tree);
+    }
+    if (snapshot->mapping != NULL) munmap(snapshot->mapping, snapshot->mapping_length);
+    *snapshot = (Snapshot){0};
+}
@@ -2,11 +2,12 @@
 #include <stdint.h>
 #include <string.h>
 #include "stack.h"
+#include "stats.h"
 
 
 Stack init_stack(size_t capacity, size_t element_size) {
     Stack st = {
-        .buffer = malloc(capacity * element_size),
+        .buffer = stats_malloc(STACK_ALLOC, capacity * element_size),
         .capacity = capacity,
         .element_size = element_size,
         .length = 0
@@ -15,14 +16,14 @@ Stack init_stack(size_t capacity, size_t element_size) {
 }
 
 void delete_stack(Stack *st) {
-    free(st->buffer);
+    stats_free(STACK_ALLOC, st->buffer);
     st->buffer = NULL;
 }
 
 char stack_push(Stack *st, void *value) {
     if (st->length == st->capacity) {
         st->capacity *= 2;
-        void *new_buffer = realloc(st->buffer, st->capacity * st->element_size);
+        void *new_buffer = stats_realloc(STACK_ALLOC, st->buffer, st->capacity * st->element_size);
         if (new_buffer == NULL) { 
             st->capacity >>= 1;
             return 0;
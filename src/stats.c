@@ -0,0 +1,144 @@
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Used for logging
+const char *AllocSubsystemNames[] = {
+    "tokenizer",
+    "parser",
+    "evaluator",
+    "hash_table",
+    "stack",
+};
+
+static _Thread_local AllocCounter alloc_counters[_ALLOC_SUBSYSTEMS_COUNT];
+
+// Size of a live block. Falls back to 0 (live bytes are then not tracked)
+// when the allocator cannot report it
+static size_t block_size(void *ptr) {
+#ifdef __GLIBC__
+    return ptr ? malloc_usable_size(ptr) : 0;
+#else
+    (void)ptr;
+    return 0;
+#endif
+}
+
+static void *count_allocation(enum AllocSubsystem subsystem, size_t size, void *ptr) {
+    alloc_counters[subsystem].calls += 1;
+    alloc_counters[subsystem].bytes += size;
+    alloc_counters[subsystem].live_bytes += block_size(ptr);
+    return ptr;
+}
+
+void *stats_malloc(enum AllocSubsystem subsystem, size_t size) {
+    return count_allocation(subsystem, size, malloc(size));
+}
+
+void *stats_calloc(enum AllocSubsystem subsystem, size_t count, size_t size) {
+    return count_allocation(subsystem, count * size, calloc(count, size));
+}
+
+void *stats_realloc(enum AllocSubsystem subsystem, void *ptr, size_t size) {
+    size_t old_size = block_size(ptr);
+    void *new_ptr = realloc(ptr, size);
+    if (new_ptr != NULL || size == 0) alloc_counters[subsystem].live_bytes -= old_size;
+    return count_allocation(subsystem, size, new_ptr);
+}
+
+char *stats_strdup(enum AllocSubsystem subsystem, char const *str) {
+    return count_allocation(subsystem, strlen(str) + 1, strdup(str));
+}
+
+void stats_free(enum AllocSubsystem subsystem, void *ptr) {
+    alloc_counters[subsystem].live_bytes -= block_size(ptr);
+    free(ptr);
+}
+
+void reset_alloc_counters(void) {
+    memset(alloc_counters, 0, sizeof(alloc_counters));
+}
+
+void read_alloc_counters(AllocCounter *counters) {
+    memcpy(counters, alloc_counters, sizeof(alloc_counters));
+}
+
+void add_alloc_counters(AllocCounter const *counters) {
+    for (size_t i = 0; i < _ALLOC_SUBSYSTEMS_COUNT; ++i) {
+        alloc_counters[i].calls += counters[i].calls;
+        alloc_counters[i].bytes += counters[i].bytes;
+        alloc_counters[i].live_bytes += counters[i].live_bytes;
+    }
+}
+
+long read_live_bytes(enum AllocSubsystem subsystem) {
+    return alloc_counters[subsystem].live_bytes;
+}
+
+static double timespec_ms(struct timespec const *ts) {
+    return ts->tv_sec * 1e3 + ts->tv_nsec / 1e6;
+}
+
+PhaseTiming start_phase_timer(void) {
+    struct timespec wall, cpu;
+    clock_gettime(CLOCK_MONOTONIC, &wall);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+    PhaseTiming start = {.wall_ms = timespec_ms(&wall), .cpu_ms = timespec_ms(&cpu)};
+    return start;
+}
+
+PhaseTiming stop_phase_timer(PhaseTiming const *start) {
+    PhaseTiming now = start_phase_timer();
+    PhaseTiming timing = {
+        .wall_ms = now.wall_ms - start->wall_ms,
+        .cpu_ms = now.cpu_ms - start->cpu_ms
+    };
+    return timing;
+}
+
+long read_peak_rss_kb(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+    return usage.ru_maxrss; // kilobytes on Linux
+}
+
+void print_interpreter_stats(InterpreterStats const *stats, FILE *out) {
+    fprintf(out, "--- mshon stats ---\n");
+    fprintf(out, "%-12s %12s %12s\n", "phase", "wall ms", "cpu ms");
+    fprintf(out, "%-12s %12.3f %12.3f\n", "tokenize", stats->tokenize.wall_ms, stats->tokenize.cpu_ms);
+    fprintf(out, "%-12s %12.3f %12.3f\n", "parse", stats->parse.wall_ms, stats->parse.cpu_ms);
+    fprintf(out, "%-12s %12.3f %12.3f\n", "optimize", stats->optimize.wall_ms, stats->optimize.cpu_ms);
+    fprintf(out, "%-12s %12.3f %12.3f\n", "evaluate", stats->evaluate.wall_ms, stats->evaluate.cpu_ms);
+    fprintf(out, "%-12s %12.3f %12.3f\n", "snapshot", stats->snapshot.wall_ms, stats->snapshot.cpu_ms);
+
+    fprintf(out, "tokens: %zu\n", stats->tokens);
+    fprintf(out, "ast nodes: %zu\n", stats->ast_nodes);
+    fprintf(out, "ast bytes: %zu\n", stats->ast_bytes);
+    fprintf(out, "flat ast bytes: %zu\n", stats->flat_ast_bytes);
+    fprintf(out, "front end chunks: %zu\n", stats->front_end_chunks);
+    fprintf(out, "dead nodes removed: %zu\n", stats->dead_nodes_removed);
+    fprintf(out, "inlined calls: %zu\n", stats->inlined_calls);
+    fprintf(out, "function calls: %zu\n", stats->function_calls);
+    fprintf(out, "frames allocated: %zu\n", stats->frames_allocated);
+    fprintf(out, "tier ups: %zu\n", stats->tier_ups);
+
+    fprintf(out, "%-12s %12s %12s %12s\n", "allocations", "calls", "bytes", "live bytes");
+    for (size_t i = 0; i < _ALLOC_SUBSYSTEMS_COUNT; ++i) {
+        fprintf(
+            out, "%-12s %12zu %12zu %12ld\n",
+            AllocSubsystemNames[i],
+            stats->allocations[i].calls,
+            stats->allocations[i].bytes,
+            stats->allocations[i].live_bytes
+        );
+    }
+
+    fprintf(out, "peak rss: %ld kB\n", stats->peak_rss_kb);
+}
@@ -0,0 +1,235 @@
+#include "string_value.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "hash_table.h"
+#include "stack.h"
+#include "stats.h"
+
+static size_t small_string_length(Value value) {
+    return (value >> _VALUE_TAG_BITS) & 0x1f;
+}
+
+static char small_string_char(Value value, size_t index) {
+    return (char)((value >> (8 * (index + 1))) & 0xff);
+}
+
+static Value small_string_value(char const *chars, size_t length) {
+    Value value = SMALL_STRING_TAG | ((uint64_t)length << _VALUE_TAG_BITS);
+    for (size_t i = 0; i < length; ++i) {
+        value |= (uint64_t)(unsigned char)chars[i] << (8 * (i + 1));
+    }
+    return value;
+}
+
+size_t string_length(Value value) {
+    if (value_tag(value) == SMALL_STRING_TAG) return small_string_length(value);
+    return ((String const *)value_as_pointer(value))->length;
+}
+
+// Process wide table of interned literals: chars -> String *
+static HashTable intern_table;
+static pthread_mutex_t intern_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+Value intern_string(char const *chars) {
+    size_t length = strlen(chars);
+    if (length <= _SMALL_STRING_CAPACITY) return small_string_value(chars, length);
+
+    pthread_mutex_lock(&intern_table_lock);
+    if (intern_table.rows == NULL) {
+        intern_table = init_hash_table(64, sizeof(String *));
+    }
+
+    String * const *interned = hash_table_get(&intern_table, chars);
+    String *string = interned ? *interned : NULL;
+    if (string == NULL) {
+        string = stats_malloc(PARSER_ALLOC, sizeof(String) + length + 1);
+        if (string != NULL) {
+            char *string_chars = (char *)(string + 1);
+            memcpy(string_chars, chars, length + 1);
+            *string = (String){.length = length, .chars = string_chars};
+            if (hash_table_set(&intern_table, chars, &string)) {
+                stats_free(PARSER_ALLOC, string);
+                string = NULL;
+            }
+        }
+    }
+    pthread_mutex_unlock(&intern_table_lock);
+
+    // an empty small string stands in when memory runs out
+    if (string == NULL) return small_string_value("", 0);
+    return pointer_value(string, STRING_TAG);
+}
+
+char new_string(char const *chars, size_t length, ObjectArena *arena, Value *result) {
+    if (length <= _SMALL_STRING_CAPACITY) {
+        *result = small_string_value(chars, length);
+        return 0;
+    }
+
+    String *string = arena_alloc(arena, sizeof(String) + length + 1);
+    if (string == NULL) return 1;
+    char *string_chars = (char *)(string + 1);
+    memcpy(string_chars, chars, length);
+    string_chars[length] = '\0';
+    *string = (String){.length = length, .chars = string_chars};
+    *result = pointer_value(string, STRING_TAG);
+    return 0;
+}
+
+char concat_strings(Value left, Value right, ObjectArena *arena, Value *result) {
+    size_t left_length = string_length(left);
+    size_t right_length = string_length(right);
+    size_t length = left_length + right_length;
+
+    if (length <= _FLAT_CONCAT_THRESHOLD) {
+        char buffer[_FLAT_CONCAT_THRESHOLD];
+        copy_string_chars(left, buffer);
+        copy_string_chars(right, buffer + left_length);
+        return new_string(buffer, length, arena, result);
+    }
+
+    if (left_length == 0) {
+        *result = right;
+        return 0;
+    }
+    if (right_length == 0) {
+        *result = left;
+        return 0;
+    }
+
+    String *rope = arena_alloc(arena, sizeof(String));
+    if (rope == NULL) return 1;
+    *rope = (String){.length = length, .left = left, .right = right};
+    *result = pointer_value(rope, STRING_TAG);
+    return 0;
+}
+
+char int_to_string(int32_t number, ObjectArena *arena, Value *result) {
+    char buffer[16];
+    int length = snprintf(buffer, sizeof(buffer), "%d", number);
+    return new_string(buffer, length, arena, result);
+}
+
+// Visits the flat pieces of a string from left to right. Ropes built by
+// appending in a loop are deep, so the walk keeps its own stack instead of
+// recursing
+static void for_each_piece(Value value, void (*visit)(char const *, size_t, void *), void *data) {
+    if (value_tag(value) == SMALL_STRING_TAG) {
+        char buffer[_SMALL_STRING_CAPACITY];
+        size_t length = small_string_length(value);
+        for (size_t i = 0; i < length; ++i) buffer[i] = small_string_char(value, i);
+        visit(buffer, length, data);
+        return;
+    }
+
+    String const *string = value_as_pointer(value);
+    if (string->chars) {
+        visit(string->chars, string->length, data);
+        return;
+    }
+
+    Stack pending = init_stack(32, sizeof(Value));
+    stack_push(&pending, &value);
+    while (pending.length > 0) {
+        Value piece = *(Value *)stack_top(&pending);
+        stack_pop(&pending);
+
+        String const *piece_string = value_tag(piece) == STRING_TAG ? value_as_pointer(piece) : NULL;
+        if (piece_string == NULL || piece_string->chars) {
+            for_each_piece(piece, visit, data);
+            continue;
+        }
+        stack_push(&pending, (void *)&piece_string->right);
+        stack_push(&pending, (void *)&piece_string->left);
+    }
+    delete_stack(&pending);
+}
+
+static void copy_piece(char const *chars, size_t length, void *data) {
+    char **cursor = data;
+    memcpy(*cursor, chars, length);
+    *cursor += length;
+}
+
+void copy_string_chars(Value value, char *buffer) {
+    for_each_piece(value, copy_piece, &buffer);
+}
+
+// Walks the flat pieces of a string from left to right, one step at a time,
+// so that two strings can be compared side by side. The right halves of the
+// ropes above the current piece wait in pending, allocated by the first rope
+typedef struct {
+    Stack pending;  // Value
+    char small[_SMALL_STRING_CAPACITY];
+    char const *chars;  // rest of the current piece
+    size_t remaining;
+    char failed;        // out of memory
+} PieceCursor;
+
+static void enter_piece(PieceCursor *cursor, Value value) {
+    while (value_tag(value) == STRING_TAG && ((String const *)value_as_pointer(value))->chars == NULL) {
+        String const *rope = value_as_pointer(value);
+        if (cursor->pending.buffer == NULL) cursor->pending = init_stack(32, sizeof(Value));
+        if (cursor->pending.buffer == NULL || !stack_push(&cursor->pending, (void *)&rope->right)) {
+            cursor->failed = 1;
+            return;
+        }
+        value = rope->left;
+    }
+    if (value_tag(value) == SMALL_STRING_TAG) {
+        cursor->remaining = small_string_length(value);
+        for (size_t i = 0; i < cursor->remaining; ++i) cursor->small[i] = small_string_char(value, i);
+        cursor->chars = cursor->small;
+        return;
+    }
+    cursor->chars = ((String const *)value_as_pointer(value))->chars;
+    cursor->remaining = ((String const *)value_as_pointer(value))->length;
+}
+
+// Moves past length bytes of the current piece, on to the next non-empty one
+static void advance_piece(PieceCursor *cursor, size_t length) {
+    cursor->chars += length;
+    cursor->remaining -= length;
+    while (cursor->remaining == 0 && cursor->pending.length > 0 && !cursor->failed) {
+        Value next = *(Value *)stack_top(&cursor->pending);
+        stack_pop(&cursor->pending);
+        enter_piece(cursor, next);
+    }
+}
+
+char strings_equal(Value left, Value right) {
+    if (left == right) return 1;
+    size_t length = string_length(left);
+    if (length != string_length(right)) return 0;
+    // distinct small strings always differ, their length and bytes are the word
+    if (value_tag(left) == SMALL_STRING_TAG && value_tag(right) == SMALL_STRING_TAG) return 0;
+
+    PieceCursor cursors[2] = {0};
+    enter_piece(cursors, left);
+    enter_piece(cursors + 1, right);
+    advance_piece(cursors, 0);
+    advance_piece(cursors + 1, 0);
+    char equal = 1;
+    while (length > 0 && equal && !cursors[0].failed && !cursors[1].failed) {
+        size_t step = cursors[0].remaining < cursors[1].remaining ? cursors[0].remaining : cursors[1].remaining;
+        equal = memcmp(cursors[0].chars, cursors[1].chars, step) == 0;
+        advance_piece(cursors, step);
+        advance_piece(cursors + 1, step);
+        length -= step;
+    }
+    if (cursors[0].failed || cursors[1].failed) equal = 0;
+    delete_stack(&cursors[0].pending);
+    delete_stack(&cursors[1].pending);
+    return equal;
+}
+
+static void write_piece(char const *chars, size_t length, void *data) {
+    fwrite(chars, 1, length, data);
+}
+
+void write_string(Value value, FILE *out) {
+    for_each_piece(value, write_piece, out);
+}
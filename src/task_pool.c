@@ -0,0 +1,194 @@
+#include "task_pool.h"
+
+#include <pthread.h>
+#include <string.h>
+#include "stats.h"
+
+// Jobs [head, tail) of a deque are queued, the oldest at head
+typedef struct {
+    pthread_mutex_t lock;
+    PoolJob **jobs;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} JobDeque;
+
+typedef struct {
+    struct TaskPool_s *pool;
+    size_t index;   // of its deque
+    pthread_t thread;
+} Worker;
+
+struct TaskPool_s {
+    Worker *workers;
+    size_t workers_length;
+    // the one of the threads outside of the pool, then one per worker
+    JobDeque *deques;
+    size_t deques_capacity;
+    // jobs in the deques. Checked before searching them, so idle threads
+    // leave the deque locks alone
+    _Atomic size_t queued;
+
+    // sleeping threads wait on wake for a queued job, a finished job or the
+    // end of the pool. Both are signalled with lock held, and sleepers check
+    // their condition with it held, so no wake up is lost
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    char stopping;
+};
+
+// Worker the current thread is, for it to find its own deque
+static _Thread_local Worker const *current_worker;
+
+static size_t own_deque(TaskPool const *pool) {
+    if (current_worker != NULL && current_worker->pool == pool) return current_worker->index;
+    return 0;
+}
+
+static void wake_all(TaskPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// The newest job of the own deque, else the oldest one of another deque
+static PoolJob *take_job(TaskPool *pool) {
+    if (atomic_load(&pool->queued) == 0) return NULL;
+
+    size_t own = own_deque(pool);
+    size_t deques_length = pool->workers_length + 1;
+    PoolJob *job = NULL;
+    for (size_t i = 0; i < deques_length && job == NULL; ++i) {
+        JobDeque *deque = pool->deques + (own + i) % deques_length;
+        pthread_mutex_lock(&deque->lock);
+        if (deque->head < deque->tail) job = i == 0 ? deque->jobs[--deque->tail] : deque->jobs[deque->head++];
+        pthread_mutex_unlock(&deque->lock);
+    }
+    if (job != NULL) atomic_fetch_sub(&pool->queued, 1);
+    return job;
+}
+
+static void run_job(TaskPool *pool, PoolJob *job) {
+    job->run(job);
+    // the waiter may free the job as soon as it is done
+    atomic_store(&job->done, 1);
+    wake_all(pool);
+}
+
+static void *run_worker(void *argument) {
+    Worker const *worker = argument;
+    TaskPool *pool = worker->pool;
+    current_worker = worker;
+    while (1) {
+        PoolJob *job = take_job(pool);
+        if (job != NULL) {
+            run_job(pool, job);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (atomic_load(&pool->queued) == 0 && !pool->stopping) pthread_cond_wait(&pool->wake, &pool->lock);
+        char stop = pool->stopping && atomic_load(&pool->queued) == 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop) return NULL;
+    }
+}
+
+TaskPool *start_task_pool(size_t threads) {
+    TaskPool *pool = stats_calloc(EVALUATOR_ALLOC, 1, sizeof(TaskPool));
+    if (pool == NULL) return NULL;
+    pool->workers = stats_calloc(EVALUATOR_ALLOC, threads, sizeof(Worker));
+    pool->deques_capacity = threads + 1;
+    pool->deques = stats_calloc(EVALUATOR_ALLOC, pool->deques_capacity, sizeof(JobDeque));
+    if (pool->workers == NULL || pool->deques == NULL) {
+        stats_free(EVALUATOR_ALLOC, pool->workers);
+        stats_free(EVALUATOR_ALLOC, pool->deques);
+        stats_free(EVALUATOR_ALLOC, pool);
+        return NULL;
+    }
+    for (size_t i = 0; i < pool->deques_capacity; ++i) pthread_mutex_init(&pool->deques[i].lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+
+    // fewer workers than asked for still run every job
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, _TASK_STACK_BYTES);
+    for (size_t i = 0; i < threads; ++i) {
+        Worker *worker = pool->workers + pool->workers_length;
+        *worker = (Worker){.pool = pool, .index = pool->workers_length + 1};
+        if (pthread_create(&worker->thread, &attributes, run_worker, worker) != 0) break;
+        pool->workers_length += 1;
+    }
+    pthread_attr_destroy(&attributes);
+
+    if (pool->workers_length == 0) {
+        stop_task_pool(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+size_t task_pool_threads(TaskPool const *pool) {
+    return pool->workers_length;
+}
+
+char submit_job(TaskPool *pool, PoolJob *job) {
+    atomic_store(&job->done, 0);
+    JobDeque *deque = pool->deques + own_deque(pool);
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail == deque->capacity && deque->head > 0) {
+        memmove(deque->jobs, deque->jobs + deque->head, (deque->tail - deque->head) * sizeof(PoolJob *));
+        deque->tail -= deque->head;
+        deque->head = 0;
+    }
+    if (deque->tail == deque->capacity) {
+        size_t capacity = deque->capacity ? 2 * deque->capacity : _INITIAL_JOB_DEQUE_CAPACITY;
+        PoolJob **jobs = stats_realloc(EVALUATOR_ALLOC, deque->jobs, capacity * sizeof(PoolJob *));
+        if (jobs == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            return 1;
+        }
+        deque->jobs = jobs;
+        deque->capacity = capacity;
+    }
+    deque->jobs[deque->tail++] = job;
+    pthread_mutex_unlock(&deque->lock);
+
+    atomic_fetch_add(&pool->queued, 1);
+    wake_all(pool);
+    return 0;
+}
+
+void wait_job(TaskPool *pool, PoolJob *job) {
+    while (!atomic_load(&job->done)) {
+        PoolJob *other = take_job(pool);
+        if (other != NULL) {
+            run_job(pool, other);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (!atomic_load(&job->done) && atomic_load(&pool->queued) == 0) pthread_cond_wait(&pool->wake, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+void stop_task_pool(TaskPool *pool) {
+    if (pool == NULL) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < pool->workers_length; ++i) pthread_join(pool->workers[i].thread, NULL);
+
+    for (size_t i = 0; i < pool->deques_capacity; ++i) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        stats_free(EVALUATOR_ALLOC, pool->deques[i].jobs);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    stats_free(EVALUATOR_ALLOC, pool->workers);
+    stats_free(EVALUATOR_ALLOC, pool->deques);
+    stats_free(EVALUATOR_ALLOC, pool);
+}
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "tokenizer.h"
+#include "stats.h"
 
 // Used for logging
 const char *TokeTypeNames[] = {
@@ -20,19 +21,31 @@ const char *TokeTypeNames[] = {
     "COMMA",
     "EQUAL",
     "DOUBLE_EQUAL",
-    //"DOUBLE_QUOTES", TODO: adding string support
+    "NOT_EQUAL",
+    "LESS",
+    "LESS_EQUAL",
+    "GREATER",
+    "GREATER_EQUAL",
+    "AND",
+    "OR",
     "IF",
     "ELSE",
     "FN",
     "LET",
     "RETURN",
     "PRINT",
+    "WHILE",
+    "IMPORT",
+    "YIELD",
+    "SPAWN",
+    "PMAP",
     "NUMERIC_LITERAL",
+    "STRING_LITERAL",
     "IDENTIFIER",
 };
 
 void delete_token(Token *token) {
-    free(token->token_value);
+    stats_free(TOKENIZER_ALLOC, token->token_value);
 }
 
 size_t num_digits(size_t x) {
@@ -46,16 +59,23 @@ size_t num_digits(size_t x) {
 }
 
 char *invalid_character_error_message(size_t pos, char c) {
-    char *error_message = malloc(33 + num_digits(pos));
+    char *error_message = stats_malloc(TOKENIZER_ALLOC, 34 + num_digits(pos));
     if (error_message != NULL)
         sprintf(error_message, "Invalid character at position %ld: %c", pos, c);
     return error_message;
 }
 
+char *unterminated_string_error_message(size_t pos) {
+    char *error_message = stats_malloc(TOKENIZER_ALLOC, 44 + num_digits(pos));
+    if (error_message != NULL)
+        sprintf(error_message, "Unterminated string literal at position %ld", pos);
+    return error_message;
+}
+
 TokenizerState init_tokenizer_state(char const *code) {
     int parsed_tokens_capacity = 10;
     TokenizerState tokenizer_state = {
-        .parsed_tokens = malloc(parsed_tokens_capacity * sizeof(Token)),
+        .parsed_tokens = stats_malloc(TOKENIZER_ALLOC, parsed_tokens_capacity * sizeof(Token)),
         .parsed_tokens_capacity = parsed_tokens_capacity,
         .parsed_tokens_length = 0,
         .code = code,
@@ -64,10 +84,17 @@ TokenizerState init_tokenizer_state(char const *code) {
     return tokenizer_state;
 }
 
+TokenizerState init_tokenizer_range(char const *code, size_t start, size_t end) {
+    TokenizerState tokenizer_state = init_tokenizer_state(code);
+    tokenizer_state.code = code + start;
+    tokenizer_state.code_end = code + end;
+    return tokenizer_state;
+}
+
 void tokenizer_state_adjust_capacity(TokenizerState *tokenizer_state) {
      if (tokenizer_state->parsed_tokens_capacity == tokenizer_state->parsed_tokens_length) {
         tokenizer_state->parsed_tokens_capacity *= 2;
-        tokenizer_state->parsed_tokens = realloc(
+        tokenizer_state->parsed_tokens = stats_realloc(TOKENIZER_ALLOC, 
             tokenizer_state->parsed_tokens, 
             tokenizer_state->parsed_tokens_capacity * sizeof(Token)
         );
@@ -90,6 +117,41 @@ char is_alphanumeric(char c) {
     return is_alphabetical(c) || is_numeric(c);
 }
 
+// Reads a double quoted literal. Supports the \n, \t, \" and \\ escapes
+char parse_string_literal(TokenizerState *tokenizer_state, Token *token) {
+    char const *literal_start = tokenizer_state->code;
+    char const *code = literal_start + 1;
+
+    size_t length = 0;
+    for (char const *p = code; *p != '"'; ++p, ++length) {
+        if (*p == '\0' || (*p == '\\' && p[1] == '\0')) {
+            tokenizer_state->error_code = TOKENIZER_UNTERMINATED_STRING;
+            tokenizer_state->error_message = unterminated_string_error_message(
+                literal_start - tokenizer_state->code_start
+            );
+            return 1;
+        }
+        if (*p == '\\') ++p;
+    }
+
+    token->token_type = STRING_LITERAL;
+    token->token_value = stats_malloc(TOKENIZER_ALLOC, length + 1);
+    char *out = token->token_value;
+    while (*code != '"') {
+        if (*code == '\\') {
+            ++code;
+            if (*code == 'n') *out++ = '\n';
+            else if (*code == 't') *out++ = '\t';
+            else *out++ = *code;
+        }
+        else *out++ = *code;
+        ++code;
+    }
+    *out = '\0';
+    tokenizer_state->code = code + 1;
+    return 0;
+}
+
 void parse_next_token(TokenizerState *tokenizer_state) {
     while(is_whitespace(tokenizer_state->code[0])) {
         ++tokenizer_state->code;
@@ -100,6 +162,13 @@ void parse_next_token(TokenizerState *tokenizer_state) {
 
     Token next_token = {.token_type = IDENTIFIER, .token_value = NULL};
 
+    if (tokenizer_state->code[0] == '"') {
+        if (parse_string_literal(tokenizer_state, &next_token)) return;
+        tokenizer_state_adjust_capacity(tokenizer_state);
+        tokenizer_state->parsed_tokens[tokenizer_state->parsed_tokens_length++] = next_token;
+        return;
+    }
+
     if (tokenizer_state->code[0] == '+') next_token.token_type = PLUS;
     else if (tokenizer_state->code[0] == '-') next_token.token_type = MINUS;
     else if (tokenizer_state->code[0] == '*') next_token.token_type = MULT;
@@ -121,6 +190,36 @@ void parse_next_token(TokenizerState *tokenizer_state) {
             next_token.token_type = EQUAL;
         }
     }
+    else if (tokenizer_state->code[0] == '!' && tokenizer_state->code[1] == '=') {
+        next_token.token_type = NOT_EQUAL;
+        ++tokenizer_state->code;
+    }
+    else if (tokenizer_state->code[0] == '<') {
+        if(tokenizer_state->code[1] == '=') {
+            next_token.token_type = LESS_EQUAL;
+            ++tokenizer_state->code;
+        }
+        else {
+            next_token.token_type = LESS;
+        }
+    }
+    else if (tokenizer_state->code[0] == '>') {
+        if(tokenizer_state->code[1] == '=') {
+            next_token.token_type = GREATER_EQUAL;
+            ++tokenizer_state->code;
+        }
+        else {
+            next_token.token_type = GREATER;
+        }
+    }
+    else if (tokenizer_state->code[0] == '&' && tokenizer_state->code[1] == '&') {
+        next_token.token_type = AND;
+        ++tokenizer_state->code;
+    }
+    else if (tokenizer_state->code[0] == '|' && tokenizer_state->code[1] == '|') {
+        next_token.token_type = OR;
+        ++tokenizer_state->code;
+    }
 
     // The next token has more than a single char in its value
     if (next_token.token_type == IDENTIFIER) {
@@ -139,7 +238,7 @@ void parse_next_token(TokenizerState *tokenizer_state) {
             return;
         }
         
-        next_token.token_value = malloc(tokenizer_state->code - code_start + 1);
+        next_token.token_value = stats_malloc(TOKENIZER_ALLOC, tokenizer_state->code - code_start + 1);
         strncpy(next_token.token_value, code_start, tokenizer_state->code - code_start);
         next_token.token_value[tokenizer_state->code - code_start] = '\0';
 
@@ -150,10 +249,15 @@ void parse_next_token(TokenizerState *tokenizer_state) {
         else if (strcmp(next_token.token_value, "suppose") == 0) next_token.token_type = LET;
         else if (strcmp(next_token.token_value, "checkit") == 0) next_token.token_type = RETURN;
         else if (strcmp(next_token.token_value, "vomit") == 0) next_token.token_type = PRINT;
+        else if (strcmp(next_token.token_value, "while") == 0) next_token.token_type = WHILE;
+        else if (strcmp(next_token.token_value, "import") == 0) next_token.token_type = IMPORT;
+        else if (strcmp(next_token.token_value, "yield") == 0) next_token.token_type = YIELD;
+        else if (strcmp(next_token.token_value, "spawn") == 0) next_token.token_type = SPAWN;
+        else if (strcmp(next_token.token_value, "pmap") == 0) next_token.token_type = PMAP;
 
         //no need to save the token value for keywords 
         if (next_token.token_type != IDENTIFIER && next_token.token_type != NUMERIC_LITERAL) {
-            free(next_token.token_value);
+            stats_free(TOKENIZER_ALLOC, next_token.token_value);
             next_token.token_value = NULL;
         }
     }
@@ -167,7 +271,7 @@ void parse_next_token(TokenizerState *tokenizer_state) {
 }
 
 char tokenize(TokenizerState *tokenizer_state) {
-    while(tokenizer_state->code[0] != '\0') {
+    while(tokenizer_state->code[0] != '\0' && tokenizer_state->code != tokenizer_state->code_end) {
         parse_next_token(tokenizer_state);
         if (tokenizer_state->error_code) {
             return tokenizer_state->error_code;
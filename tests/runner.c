@@ -2,12 +2,23 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <dirent.h>
 #include <libgen.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "interpreter.h"
 #include "evaluator.h"
+#include "stats.h"
+#include "array_value.h"
+#include "string_value.h"
+#include "repl.h"
+#include "module.h"
+#include "flat_tree.h"
+#include "snapshot.h"
+#include "hooks.h"
 
 #define MAX_FILE_SIZE 1048576
 
@@ -32,21 +43,125 @@ char *get_test_path(const char *test_name) {
     return full_path;
 }
 
+// Directory the test scripts import their modules from
+char *get_test_cases_directory() {
+    char *test_path = get_test_path("test0");
+    char *directory = get_directory(test_path);
+    free(test_path);
+    return directory;
+}
+
 typedef struct {
     size_t test_index;
     const char *test_name;
     int32_t *side_effects; 
+    enum ErrorCode error_code;
+    const char *output; // expected printed text, checked instead of side_effects when set
 } TestCase;
 
-TestCase TEST_CASES[5] = {
+#define NUM_TEST_CASES 19
+
+TestCase TEST_CASES[NUM_TEST_CASES] = {
     {.test_index=0, .test_name="test0", .side_effects=(int32_t[]){1} },
     {.test_index=1, .test_name="test1", .side_effects=(int32_t[]){-5499} },
     {.test_index=2, .test_name="test2", .side_effects=(int32_t[]){2} },
     {.test_index=3, .test_name="test3", .side_effects=(int32_t[]){8} },
-    {.test_index=4, .test_name="test4", .side_effects=(int32_t[]){8, -34} }
+    {.test_index=4, .test_name="test4", .side_effects=(int32_t[]){8, -34} },
+    {.test_index=5, .test_name="test5", .side_effects=(int32_t[]){}, .error_code=CALL_DEPTH_EXCEEDED },
+    {.test_index=6, .test_name="test6", .side_effects=(int32_t[]){3, 13} },
+    {.test_index=7, .test_name="test7", .side_effects=(int32_t[]){-2147483648, -3}, .error_code=DIVISION_BY_ZERO },
+    {.test_index=8, .test_name="test8", .output=(
+        "hello, mshon interpreter!\n"
+        "answer: 42\n"
+        "abababababababababababababababababababab\n"
+        "quote \" and tab\t\n"
+    )},
+    {.test_index=9, .test_name="test9", .error_code=INDEX_OUT_OF_RANGE, .output=(
+        "31\n"
+        "[0, 1, 4, 9, 16, 25, 36, 49, 64, 81]\n"
+        "285\n"
+        "5951\n"
+        "[3, 5, 9, 13, 21, 25, 33, 37, 45, 57]\n"
+        "-52\n"
+        "705082704\n"
+    )},
+    {.test_index=10, .test_name="test10", .error_code=VARIABLE_EXISTS, .output=(
+        "705082704\n"
+        "60\n"
+        "***\n"
+        "**\n"
+        "*\n"
+    )},
+    {.test_index=11, .test_name="test11", .error_code=UNEXPECTED_TYPE, .output=(
+        "1\n"
+        "0\n"
+        "1\n"
+        "0\n"
+        "1\n"
+        "1\n"
+        "0\n"
+        "guarded\n"
+        "expensive\n"
+        "evaluated\n"
+        "5\n"
+    )},
+    // function bodies are parsed on first call, so the broken one only fails when called
+    {.test_index=12, .test_name="test12", .error_code=SYNTAX_ERROR, .output="11\n13\n"},
+    // the duplicate definition is unreachable but still raises its error
+    {.test_index=13, .test_name="test13", .error_code=VARIABLE_EXISTS, .output="3\n7\n3\n"},
+    {.test_index=14, .test_name="test14", .error_code=UNDECLARED_IDENTIFIER, .output=(
+        "3\n"
+        "-10\n"
+        "40\n"
+        "6\n"
+        "6\n"
+        "2\n"
+        "201\n"
+        "101\n"
+        "a1\n"
+    )},
+    // cached callees give way to shadowing definitions and assignments
+    {.test_index=15, .test_name="test15", .error_code=NOT_CALLABLE, .output=(
+        "2\n"
+        "100\n"
+        "2\n"
+        "1\n"
+        "102\n"
+        "203\n"
+    )},
+    // modules run once per context, also through a cycle, and only at the top level
+    {.test_index=16, .test_name="test16", .error_code=IMPORT_ERROR, .output=(
+        "mathlib loaded\n"
+        "16\n"
+        "27\n"
+        "12\n"
+        "18\n"
+    )},
+    // also run from many threads at once by run_shared_program_test()
+    {.test_index=17, .test_name="test17", .error_code=UNDECLARED_IDENTIFIER, .output=(
+        "fib: 6765\n"
+        "sum: 15150\n"
+        "[0, 1, 2, 610, 4, 5, 6, 7, 8, 9]\n"
+        "3912\n"
+    )},
+    // * and / bind tighter than + and -, a minus prefix negates the first term
+    {.test_index=18, .test_name="test18", .error_code=DIVISION_BY_ZERO, .output=(
+        "14\n"
+        "-5\n"
+        "-9\n"
+        "4\n"
+        "2\n"
+        "5\n"
+        "11\n"
+        "1\n"
+        "n = 42\n"
+    )}
 };
 
+size_t failed_tests = 0;
+
 void print_test_verdict(TestCase *test_case, char passed) {
+    if (!passed) failed_tests += 1;
     printf(">>> Test id: %ld - Test name: %s -------- ", test_case->test_index, test_case->test_name);
     if (passed) {
         printf("\033[32mPASSED\033[0m\n");
@@ -69,33 +184,1212 @@ char *get_code_from_test_case(TestCase *test_case) {
     return code;
 }
 
-void run_test_case(TestCase *test_case) {
+char output_matches(EvaluatorContext *context, const char *expected) {
+    char *output;
+    size_t output_length;
+    FILE *stream = open_memstream(&output, &output_length);
+    for (size_t i = 0; i < context->side_effects.length; ++i) {
+        write_value(*(Value*)stack_at(&context->side_effects, context->side_effects.length-i-1), stream);
+        fputc('\n', stream);
+    }
+    fclose(stream);
+
+    char matches = strcmp(output, expected) == 0;
+    free(output);
+    return matches;
+}
+
+// Runs a test case with the given tier up threshold. Returns whether it
+// passed, with *unexpected_error set (to be freed) when it failed with an
+// error other than the expected one
+char test_case_passes(TestCase *test_case, size_t tier_up_threshold, char **unexpected_error) {
     char *code = get_code_from_test_case(test_case);
     char *error_message;
-    EvaluatorContext context;
+    EvaluatorContext context = init_evaluator_context(1);
+    char *module_dir = get_test_cases_directory();
+    context.module_dir = module_dir;
+    context.tier_up_threshold = tier_up_threshold;
 
-    char exit_code = interpret(code, &error_message, &context, 1);
+    char exit_code = interpret(code, &error_message, &context, NULL);
+    free(code);
+    free(module_dir);
+    *unexpected_error = NULL;
 
-    if (exit_code) {
-        print_test_verdict(test_case, 0);
-        printf("error message: %s\n", error_message);
-        return;
+    if (exit_code && context.error_code != test_case->error_code) {
+        *unexpected_error = error_message;
+        delete_evaluator_context(&context);
+        return 0;
     }
 
     char passed = 1;
-    for (size_t i=0;i<context.side_effects.length; ++i) {
-        int32_t output_number = *(int32_t*)stack_at(&context.side_effects, context.side_effects.length-i-1);
+    if (test_case->output != NULL) {
+        passed = output_matches(&context, test_case->output);
+    }
+    else for (size_t i=0;i<context.side_effects.length; ++i) {
+        int32_t output_number = value_as_int(*(Value*)stack_at(&context.side_effects, context.side_effects.length-i-1));
         if (output_number != test_case->side_effects[i]) {
             passed = 0;
             break;
         }
     }
+    if (context.error_code != test_case->error_code) passed = 0;
+    delete_evaluator_context(&context);
+    return passed;
+}
+
+void run_test_case(TestCase *test_case) {
+    char *unexpected_error;
+    char passed = test_case_passes(test_case, _DEFAULT_TIER_UP_THRESHOLD, &unexpected_error);
     print_test_verdict(test_case, passed);
+    if (unexpected_error != NULL) {
+        printf("error message: %s\n", unexpected_error);
+        free(unexpected_error);
+    }
+}
+
+void run_stats_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES, .test_name="stats"};
+    char *code = get_code_from_test_case(TEST_CASES+3);
+    char *error_message;
+    EvaluatorContext context = init_evaluator_context(1);
+    InterpreterStats stats;
+
+    char exit_code = interpret(code, &error_message, &context, &stats);
+    free(code);
+
+    // fib(5) makes 15 calls, each in its own frame, plus the main frame.
+    // Expressions and arguments are evaluated without the heap
+    char passed = (
+        exit_code == 0 &&
+        stats.tokens == 52 &&
+        stats.function_calls == 15 &&
+        stats.frames_allocated == 16 &&
+        stats.allocations[TOKENIZER_ALLOC].calls > 0 &&
+        stats.allocations[PARSER_ALLOC].calls > 0 &&
+        stats.allocations[EVALUATOR_ALLOC].calls == 0 &&
+        stats.peak_rss_kb > 0
+    );
+    print_test_verdict(&test_case, passed);
+    delete_evaluator_context(&context);
+}
+
+void *watchdog(void *context) {
+    usleep(10000);
+    cancel_evaluation(context);
+    return NULL;
+}
+
+void run_limits_test(
+    size_t test_index, 
+    const char *test_name, 
+    TestCase *script, 
+    EvaluatorLimits limits, 
+    char cancel_from_watchdog,
+    enum ErrorCode expected
+) {
+    TestCase test_case = {.test_index=test_index, .test_name=test_name};
+    char *code = get_code_from_test_case(script);
+    char *error_message;
+    EvaluatorContext context = init_evaluator_context(1);
+    context.limits = limits;
+
+    pthread_t watchdog_thread;
+    if (cancel_from_watchdog) pthread_create(&watchdog_thread, NULL, watchdog, &context);
+    interpret(code, &error_message, &context, NULL);
+    if (cancel_from_watchdog) pthread_join(watchdog_thread, NULL);
+    free(code);
+
+    print_test_verdict(&test_case, context.error_code == expected);
+    delete_evaluator_context(&context);
+}
+
+void run_limits_tests() {
+    // test6 computes fib(25) after its quick outputs, long enough to be interrupted
+    size_t index = NUM_TEST_CASES + 1;
+    run_limits_test(index++, "max_steps", TEST_CASES+3, (EvaluatorLimits){.max_steps=10}, 0, STEP_LIMIT_EXCEEDED);
+    run_limits_test(index++, "max_call_depth", TEST_CASES+3, (EvaluatorLimits){.max_call_depth=3}, 0, CALL_DEPTH_EXCEEDED);
+    run_limits_test(index++, "max_heap_bytes", TEST_CASES+5, (EvaluatorLimits){.max_heap_bytes=1<<16}, 0, HEAP_LIMIT_EXCEEDED);
+    run_limits_test(index++, "timeout_ms", TEST_CASES+6, (EvaluatorLimits){.timeout_ms=10}, 0, DEADLINE_EXCEEDED);
+    run_limits_test(index++, "watchdog", TEST_CASES+6, (EvaluatorLimits){}, 1, CANCELLED);
+    // loop iterations are steps too, test10 starts with a 100000 iteration loop
+    run_limits_test(index++, "loop_steps", TEST_CASES+10, (EvaluatorLimits){.max_steps=1000}, 0, STEP_LIMIT_EXCEEDED);
+}
+
+
+// Every SIMD level must agree with the scalar kernels, including on the
+// tails left over after the last whole vector
+void run_simd_kernels_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 7, .test_name="simd_kernels"};
+    int32_t left[67], right[67], expected[67], actual[67];
+    for (size_t i = 0; i < 67; ++i) {
+        left[i] = (int32_t)(i * 2654435761u);
+        right[i] = (int32_t)(i * 40503u) - 1000000;
+    }
+
+    char passed = 1;
+    for (enum SimdLevel level = SIMD_SSE41; level <= detect_simd_level(); ++level) {
+        for (size_t length = 1; length <= 67; ++length) {
+            set_simd_level(SIMD_SCALAR);
+            int32_t sums[4] = {
+                sum_int32(left, length), min_int32(left, length),
+                max_int32(left, length), dot_int32(left, right, length)
+            };
+            mul_int32(expected, left, right, 0, length);
+            add_int32(expected, expected, NULL, 7, length);
+
+            set_simd_level(level);
+            passed &= sums[0] == sum_int32(left, length);
+            passed &= sums[1] == min_int32(left, length);
+            passed &= sums[2] == max_int32(left, length);
+            passed &= sums[3] == dot_int32(left, right, length);
+            mul_int32(actual, left, right, 0, length);
+            add_int32(actual, actual, NULL, 7, length);
+            passed &= memcmp(expected, actual, length * sizeof(int32_t)) == 0;
+        }
+    }
+    set_simd_level(detect_simd_level());
+    print_test_verdict(&test_case, passed);
+}
+
+// Definitions of earlier inputs stay visible and errors do not end the session
+void run_repl_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 8, .test_name="repl"};
+    char const *session = (
+        "fn sq(x) {\n"
+        "    checkit x * x;\n"
+        "}\n"
+        "suppose y = sq(4);\n"
+        "vomit missing;\n"
+        "vomit y + sq(2);\n"
+    );
+    FILE *in = fmemopen((void *)session, strlen(session), "r");
+    char *output;
+    size_t output_length;
+    FILE *out = open_memstream(&output, &output_length);
+    EvaluatorContext context = init_evaluator_context(0);
+    context.output = out;
+
+    run_repl(in, out, &context);
+    fclose(in);
+    fclose(out);
+
+    char passed = (
+        context.error_code == PASS &&
+        context.side_effects.length == 0 &&
+        strcmp(output, "error message: Undeclared Identifier: missing\n20\n") == 0
+    );
+    print_test_verdict(&test_case, passed);
+    free(output);
+    delete_evaluator_context(&context);
+}
+
+// Dead code elimination removes unreachable functions, constant branches and
+// statements after a return without changing what the program prints
+void run_dead_code_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 9, .test_name="dead_code"};
+    char *code = get_code_from_test_case(TEST_CASES+13);
+    char passed = 1;
+
+    for (char eliminate = 0; eliminate <= 1; ++eliminate) {
+        char *error_message;
+        EvaluatorContext context = init_evaluator_context(1);
+        context.eliminate_dead_code = eliminate;
+        context.inline_threshold = 0;
+        InterpreterStats stats;
+
+        if (interpret(code, &error_message, &context, &stats)) free(error_message);
+        passed &= context.error_code == VARIABLE_EXISTS;
+        passed &= output_matches(&context, "3\n7\n3\n");
+        passed &= stats.dead_nodes_removed == (eliminate ? 20 : 0);
+        delete_evaluator_context(&context);
+    }
+    free(code);
+    print_test_verdict(&test_case, passed);
+}
+
+// Inlined helpers print the same as called ones, including free names that
+// resolve through the caller's frames, and save their calls
+void run_inline_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 10, .test_name="inline"};
+    char *code = get_code_from_test_case(TEST_CASES+14);
+    char passed = 1;
+
+    size_t thresholds[2] = {0, _DEFAULT_INLINE_THRESHOLD};
+    size_t expected_inlined[2] = {0, 9};
+    size_t expected_calls[2] = {14, 5};
+    for (size_t i = 0; i < 2; ++i) {
+        char *error_message;
+        EvaluatorContext context = init_evaluator_context(1);
+        context.inline_threshold = thresholds[i];
+        InterpreterStats stats;
+
+        if (interpret(code, &error_message, &context, &stats)) free(error_message);
+        passed &= context.error_code == UNDECLARED_IDENTIFIER;
+        passed &= output_matches(&context, TEST_CASES[14].output);
+        passed &= stats.inlined_calls == expected_inlined[i];
+        passed &= stats.function_calls == expected_calls[i];
+        delete_evaluator_context(&context);
+    }
+    free(code);
+    print_test_verdict(&test_case, passed);
 }
 
+typedef struct {
+    char const *code;
+    char const *module_dir;
+    char passed;
+} ImportRun;
+
+void *run_import(void *argument) {
+    ImportRun *run = argument;
+    char *error_message;
+    EvaluatorContext context = init_evaluator_context(1);
+    context.module_dir = run->module_dir;
+    if (interpret(run->code, &error_message, &context, NULL)) free(error_message);
+    run->passed = context.error_code == IMPORT_ERROR && output_matches(&context, TEST_CASES[16].output);
+    delete_evaluator_context(&context);
+    return NULL;
+}
+
+// A module is parsed once per process and content, and shared by every
+// context and thread importing it
+void run_module_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 11, .test_name="modules"};
+    char *code = get_code_from_test_case(TEST_CASES+16);
+    char *module_dir = get_test_cases_directory();
+    char passed = 1;
+
+    ImportRun runs[4];
+    pthread_t threads[4];
+    for (size_t i = 0; i < 4; ++i) {
+        runs[i] = (ImportRun){.code = code, .module_dir = module_dir};
+        pthread_create(threads+i, NULL, run_import, runs+i);
+    }
+    for (size_t i = 0; i < 4; ++i) {
+        pthread_join(threads[i], NULL);
+        passed &= runs[i].passed;
+    }
+
+    char *error_message;
+    Module const *first, *second;
+    passed &= !load_module(module_dir, "mathlib.shr", &first, &error_message);
+    passed &= !load_module(module_dir, "mathlib.shr", &second, &error_message);
+    passed &= first == second;
+
+    char path[] = "/tmp/mshon_moduleXXXXXX";
+    int fd = mkstemp(path);
+    passed &= fd >= 0 && write(fd, "suppose a = 1;", 14) == 14;
+    passed &= !load_module(NULL, path, &first, &error_message);
+    passed &= fd >= 0 && write(fd, "suppose b = 2;", 14) == 14;
+    passed &= !load_module(NULL, path, &second, &error_message);
+    passed &= first != second;
+    // back to the first content, the first version is found again
+    Module const *third;
+    passed &= fd >= 0 && ftruncate(fd, 14) == 0;
+    passed &= !load_module(NULL, path, &third, &error_message);
+    passed &= third == first;
+    passed &= fd >= 0 && lseek(fd, 0, SEEK_END) == 14 && write(fd, "suppose", 7) == 7;
+    if (load_module(NULL, path, &second, &error_message)) stats_free(EVALUATOR_ALLOC, error_message);
+    else passed = 0;
+    if (fd >= 0) close(fd);
+    unlink(path);
+
+    free(code);
+    free(module_dir);
+    print_test_verdict(&test_case, passed);
+}
+
+// Functions of a loaded program are called from C with integer arguments,
+// also ones the program itself never calls
+void run_host_call_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 12, .test_name="host_call"};
+    char const *code = (
+        "fn score(a, b) {\n"
+        "    suppose s = a * 10;\n"
+        "    imagine b > 0 { checkit s + b; }\n"
+        "    checkit s - b;\n"
+        "}\n"
+        "fn label(a) { checkit \"a\" + a; }\n"
+        "fn forever(n) { checkit forever(n); }\n"
+        "vomit 1;\n"
+    );
+    char *error_message;
+    EvaluatorContext context = init_evaluator_context(1);
+    context.keep_functions = 1;
+    context.limits.max_call_depth = 100;
+    char passed = !interpret(code, &error_message, &context, NULL);
+
+    FlatFunction const *score = find_function(&context, "score");
+    passed &= score != NULL && find_function(&context, "missing") == NULL;
+    for (int32_t i = -500; passed && i < 500; ++i) {
+        int32_t result;
+        passed &= !call_function(&context, score, (int32_t[]){i, i % 7}, 2, &result);
+        passed &= result == i * 10 + (i % 7 > 0 ? i % 7 : -(i % 7));
+    }
+
+    int32_t result;
+    passed &= call_function(&context, score, (int32_t[]){1}, 1, &result) && context.error_code == UNEXPECTED_ARGUMENTS;
+    passed &= call_function(&context, find_function(&context, "label"), (int32_t[]){1}, 1, &result);
+    passed &= context.error_code == UNEXPECTED_TYPE;
+    passed &= call_function(&context, find_function(&context, "forever"), (int32_t[]){1}, 1, &result);
+    passed &= context.error_code == CALL_DEPTH_EXCEEDED && context.stack_frames.length == 1;
+    passed &= !call_function(&context, score, (int32_t[]){2, 3}, 2, &result) && result == 23;
+
+    print_test_verdict(&test_case, passed);
+    delete_evaluator_context(&context);
+}
+
+#define NUM_SHARED_PROGRAM_THREADS 8
+#define NUM_SHARED_PROGRAM_RUNS 25
+
+typedef struct {
+    Program const *program;
+    char passed;
+} SharedProgramRun;
+
+void *run_shared_program(void *argument) {
+    SharedProgramRun *run = argument;
+    run->passed = 1;
+    for (size_t i = 0; i < NUM_SHARED_PROGRAM_RUNS; ++i) {
+        char *error_message = NULL;
+        EvaluatorContext context = init_evaluator_context(1);
+        run_program(run->program, &error_message, &context, NULL);
+        run->passed &= context.error_code == TEST_CASES[17].error_code;
+        run->passed &= output_matches(&context, TEST_CASES[17].output);
+        free(error_message);
+        delete_evaluator_context(&context);
+    }
+    return NULL;
+}
+
+// One compiled program runs in many threads at once, each with its own
+// context. Built with -fsanitize=thread (make test_tsan) this doubles as a
+// check that evaluation never writes to the shared tree
+void run_shared_program_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 13, .test_name="shared_program"};
+    char *code = get_code_from_test_case(TEST_CASES+17);
+    char *error_message;
+    EvaluatorContext settings = init_evaluator_context(1);
+    Program program;
+    char passed = !compile_program(code, &error_message, &settings, &program);
+    delete_evaluator_context(&settings);
+    free(code);
+    if (!passed) {
+        print_test_verdict(&test_case, 0);
+        free(error_message);
+        return;
+    }
+
+    SharedProgramRun runs[NUM_SHARED_PROGRAM_THREADS];
+    pthread_t threads[NUM_SHARED_PROGRAM_THREADS];
+    for (size_t i = 0; i < NUM_SHARED_PROGRAM_THREADS; ++i) {
+        runs[i] = (SharedProgramRun){.program = &program};
+        pthread_create(threads+i, NULL, run_shared_program, runs+i);
+    }
+    for (size_t i = 0; i < NUM_SHARED_PROGRAM_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+        passed &= runs[i].passed;
+    }
+
+    // a syntax error in a body that is never called still fails the compilation
+    EvaluatorContext lazy = init_evaluator_context(1);
+    Program invalid;
+    char const *invalid_code = "fn f() { suppose; } suppose x = 0; imagine x { vomit f(); }";
+    if (compile_program(invalid_code, &error_message, &lazy, &invalid)) free(error_message);
+    else passed = 0;
+    delete_evaluator_context(&lazy);
+
+    delete_program(&program);
+    print_test_verdict(&test_case, passed);
+}
+
+#define NUM_FRONT_END_BLOCKS 12000
+
+// Source of NUM_FRONT_END_BLOCKS blocks mixing what a split has to respect:
+// braces, bummer after a closing brace and string literals holding ; } and ".
+// extra[i], when set, goes in front of block i
+char *generate_front_end_source(char const **extra) {
+    char *code;
+    size_t size;
+    FILE *stream = open_memstream(&code, &size);
+    fprintf(stream, "suppose total = 0;\n");
+    for (size_t i = 0; i < NUM_FRONT_END_BLOCKS; ++i) {
+        if (extra[i]) fputs(extra[i], stream);
+        fprintf(stream, "fn f%zu(x) {\n    imagine x > %zu { checkit x - %zu; }\n    bummer { checkit x + 1; }\n}\n", i, i % 7, i % 7);
+        fprintf(stream, "imagine total < 0 { total = 0; }\nbummer\n{ total = total + f%zu(%zu); }\n", i, i);
+        fprintf(stream, "suppose s%zu = \"a;b}c\\\"{\" + %zu;\n", i, i);
+    }
+    fprintf(stream, "vomit total;\nvomit s%d;\n", NUM_FRONT_END_BLOCKS - 1);
+    fclose(stream);
+    return code;
+}
+
+// Runs code with a serial and a parallel front end, which must agree on the
+// output, the tree size and any error message. A source that cannot be
+// split all the way gives fewer chunks than threads
+char front_ends_agree(char const *code, size_t threads_used, char all_chunks) {
+    char *messages[2] = {NULL, NULL};
+    char *outputs[2] = {NULL, NULL};
+    InterpreterStats stats[2];
+    size_t threads[2] = {1, threads_used};
+    for (size_t i = 0; i < 2; ++i) {
+        EvaluatorContext context = init_evaluator_context(1);
+        context.front_end_threads = threads[i];
+        interpret(code, messages+i, &context, stats+i);
+
+        size_t length;
+        FILE *stream = open_memstream(outputs+i, &length);
+        for (size_t j = 0; j < context.side_effects.length; ++j) {
+            write_value(*(Value*)stack_at(&context.side_effects, context.side_effects.length-j-1), stream);
+        }
+        fclose(stream);
+        delete_evaluator_context(&context);
+    }
+
+    char agree = strcmp(outputs[0], outputs[1]) == 0;
+    agree &= (messages[0] == NULL) == (messages[1] == NULL);
+    agree &= messages[0] == NULL || strcmp(messages[0], messages[1]) == 0;
+    agree &= stats[0].tokens == stats[1].tokens && stats[0].ast_nodes == stats[1].ast_nodes;
+    agree &= stats[0].front_end_chunks == 1 && stats[1].front_end_chunks > 1;
+    agree &= !all_chunks || stats[1].front_end_chunks == threads_used;
+    for (size_t i = 0; i < 2; ++i) {
+        free(messages[i]);
+        free(outputs[i]);
+    }
+    return agree;
+}
+
+// A source split at top-level statements, tokenized and parsed on several
+// threads, gives the same program and the same errors as the serial path
+void run_front_end_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 14, .test_name="parallel_front_end"};
+    char const **extra = calloc(NUM_FRONT_END_BLOCKS, sizeof(char const *));
+    char passed = 1;
+
+    char *code = generate_front_end_source(extra);
+    passed &= front_ends_agree(code, 8, 1);
+    free(code);
+
+    // first errors of each kind, past the first chunk
+    char const *errors[][2] = {
+        {"suppose q = 1 $ 2;\n", "suppose r = 2 @ 1;\n"},
+        {"suppose 34 = 4;\n", "vomit ;\n"},
+        {"vomit \"open;\n", NULL},
+        {"}\n", "suppose 1;\n"},
+    };
+    for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); ++i) {
+        extra[5000] = errors[i][0];
+        extra[9000] = errors[i][1];
+        code = generate_front_end_source(extra);
+        passed &= front_ends_agree(code, 8, 0);
+        free(code);
+    }
+    extra[5000] = extra[9000] = NULL;
+
+    free(extra);
+    print_test_verdict(&test_case, passed);
+}
+
+// Every child range lies inside the node array and past its parent
+char flat_children_in_range(FlatTree const *tree) {
+    for (size_t i = 0; i < tree->nodes_length; ++i) {
+        FlatNode const *node = tree->nodes + i;
+        if (node->children_length && (node->first_child == 0 || i + node->first_child + node->children_length > tree->nodes_length)) return 0;
+    }
+    return 1;
+}
+
+// The flat tree packs a node in 16 bytes, keeps every name once and parses a
+// body left unparsed by the front end on demand. On a large script it takes
+// a fraction of the memory of the tree it is lowered from
+void run_flat_tree_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 15, .test_name="flat_tree"};
+    char passed = sizeof(FlatNode) == 16;
+
+    char const *code = "fn twice(a) { checkit a + a; } suppose a = 1; a = twice(a) - 3 * 2; vomit a < 0 && a != 5;";
+    TokenizerState tokenizer_state = init_tokenizer_state(code);
+    passed &= tokenize(&tokenizer_state) == 0;
+    ASTNode root = parse_ast(tokenizer_state.parsed_tokens, tokenizer_state.parsed_tokens_length);
+    FlatTree *tree = flatten_tree(&root);
+    delete_node(&root);
+
+    FlatNode const *statements = flat_child(tree->nodes, 0);
+    FlatNode const *difference = flat_child(statements+2, 0);
+    passed &= tree->nodes[0].node_type == STMT_SEQUENCE && tree->nodes[0].children_length == 4;
+    passed &= tree->names_length == 2 && tree->functions_length == 1 && tree->call_sites_length == 1;
+    passed &= statements[2].node_type == ASSIGNMENT && strcmp(tree->names[statements[2].payload].name, "a") == 0;
+    FlatNode const *product = flat_child(difference, 1);
+    passed &= difference->node_type == ARITHMETIC && difference->children_length == 2;
+    passed &= product->node_type == ARITHMETIC && product->joining_operator == SUB_OP && flat_child(product, 1)->joining_operator == MULT_OP;
+    passed &= flat_child(statements+3, 0)->node_type == LOGICAL && flat_child(statements+3, 0)->operator == AND_OP;
+    passed &= flat_children_in_range(tree);
+
+    FlatFunction *twice = tree->functions;
+    passed &= twice->body_tree == NULL && twice->args_length == 1 && strcmp(twice->args[0], "a") == 0;
+    FlatNode const *body = flat_function_body(twice);
+    passed &= body != NULL && body->node_type == STMT_SEQUENCE && twice->owns_body_tree;
+    passed &= flat_children_in_range(twice->body_tree);
+    delete_flat_tree(tree);
+    for (size_t i = 0; i < tokenizer_state.parsed_tokens_length; ++i) delete_token(tokenizer_state.parsed_tokens+i);
+    stats_free(TOKENIZER_ALLOC, tokenizer_state.parsed_tokens);
+
+    char const **extra = calloc(NUM_FRONT_END_BLOCKS, sizeof(char const *));
+    char *large_code = generate_front_end_source(extra);
+    char *error_message = NULL;
+    EvaluatorContext context = init_evaluator_context(1);
+    InterpreterStats stats;
+    passed &= interpret(large_code, &error_message, &context, &stats) == 0;
+    passed &= stats.flat_ast_bytes > 0 && stats.ast_bytes >= 3 * stats.flat_ast_bytes;
+    delete_evaluator_context(&context);
+    free(large_code);
+    free(extra);
+    free(error_message);
+
+    print_test_verdict(&test_case, passed);
+}
+
+// A snapshot taken after the prelude restores the functions and globals,
+// arrays still shared, and the warm start prints what the cold run printed
+// after the prelude
+void run_snapshot_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 16, .test_name="snapshot"};
+    char const *code = (
+        "fn fib(i) { imagine i < 2 { checkit i; } checkit fib(i-1) + fib(i-2); }\n"
+        "suppose table = range(4);\n"
+        "suppose alias = table;\n"
+        "suppose title = \"a title longer than a small string\";\n"
+        "suppose base = fib(15);\n"
+        "table[0] = base;\n"
+        "vomit alias[0];\n"
+        "vomit title + \" \" + fib(10);\n"
+    );
+    char const *expected = "610\na title longer than a small string 55\n";
+    char path[] = "/tmp/mshon_snapshotXXXXXX";
+    int fd = mkstemp(path);
+    char passed = fd >= 0;
+    if (fd >= 0) close(fd);
+
+    char *error_message = NULL;
+    EvaluatorContext cold = init_evaluator_context(1);
+    passed &= interpret_and_snapshot(code, path, &error_message, &cold, NULL) == 0;
+    passed &= output_matches(&cold, expected);
+    delete_evaluator_context(&cold);
+
+    Snapshot snapshot;
+    EvaluatorContext warm = init_evaluator_context(1);
+    passed &= resume_snapshot(path, code, &snapshot, &error_message, &warm, NULL) == 0;
+    passed &= output_matches(&warm, expected) && snapshot.resume_statement == 5;
+    int32_t result = 0;
+    FlatFunction const *fib = find_function(&warm, "fib");
+    passed &= fib != NULL && call_function(&warm, fib, (int32_t[]){12}, 1, &result) == 0 && result == 144;
+    size_t nodes_offset = (char *)snapshot.tree->nodes - (char *)snapshot.mapping;
+    delete_evaluator_context(&warm);
+    delete_snapshot(&snapshot);
+
+    // a node pointing outside of the nodes is caught before it is run
+    FILE *file = fopen(path, "r+b");
+    uint32_t far_child = 0x7fffffff;
+    passed &= file != NULL && fseek(file, nodes_offset + offsetof(FlatNode, first_child), SEEK_SET) == 0;
+    passed &= file != NULL && fwrite(&far_child, sizeof(far_child), 1, file) == 1;
+    if (file != NULL) fclose(file);
+    EvaluatorContext corrupt = init_evaluator_context(1);
+    if (resume_snapshot(path, code, &snapshot, &error_message, &corrupt, NULL)) {
+        passed &= strncmp(error_message, "Corrupt snapshot: ", 18) == 0;
+        free(error_message);
+    }
+    else passed = 0;
+    passed &= corrupt.side_effects.length == 0 && snapshot.tree == NULL;
+    delete_evaluator_context(&corrupt);
+
+    // a snapshot is only restored for the source it was taken of
+    EvaluatorContext stale = init_evaluator_context(1);
+    if (resume_snapshot(path, "vomit 1;", &snapshot, &error_message, &stale, NULL)) free(error_message);
+    else passed = 0;
+    passed &= stale.side_effects.length == 0 && snapshot.tree == NULL;
+    delete_evaluator_context(&stale);
+
+    // the warm start could not print what the prelude printed
+    EvaluatorContext printing = init_evaluator_context(1);
+    if (interpret_and_snapshot("fn f() { vomit 1; checkit 2; } suppose x = f(); vomit x;", path, &error_message, &printing, NULL)) free(error_message);
+    passed &= printing.error_code == SNAPSHOT_ERROR;
+    delete_evaluator_context(&printing);
+
+    unlink(path);
+    print_test_verdict(&test_case, passed);
+}
+
+// A generator hands its values to the host one at a time, also from helpers
+// its body calls, and takes the same memory however many it yields. The host
+// may call functions between two values and delete a generator midway
+void run_generator_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 17, .test_name="generators"};
+    char const *code = (
+        "fn emit(x) { yield x * x; checkit 0; }\n"
+        "fn squares(n) { suppose i = 0; suppose r = 0; while i < n { r = emit(i); i = i + 1; } checkit r; }\n"
+        "fn words() { yield \"first\"; yield \"second\"; checkit 0; }\n"
+        "fn count() { suppose i = 0; while 1 { yield i; i = i + 1; } }\n"
+        "fn broken(n) { yield n; checkit n / 0; }\n"
+        "fn twice(a) { checkit a + a; }\n"
+    );
+    char *error_message = NULL;
+    EvaluatorContext context = init_evaluator_context(1);
+    context.keep_functions = 1;
+    char passed = interpret(code, &error_message, &context, NULL) == 0;
+
+    Value value;
+    int32_t result;
+    Generator *squares = start_generator(&context, find_function(&context, "squares"), (int32_t[]){4}, 1);
+    for (int32_t i = 0; i < 4; ++i) {
+        passed &= generator_next(squares, &value) == GENERATOR_YIELDED && value == int_value(i * i);
+        passed &= call_function(&context, find_function(&context, "twice"), (int32_t[]){i}, 1, &result) == 0 && result == 2 * i;
+    }
+    passed &= generator_next(squares, &value) == GENERATOR_DONE && generator_next(squares, &value) == GENERATOR_DONE;
+    delete_generator(squares);
+
+    Generator *words = start_generator(&context, find_function(&context, "words"), NULL, 0);
+    passed &= generator_next(words, &value) == GENERATOR_YIELDED && strings_equal(value, intern_string("first"));
+    passed &= generator_next(words, &value) == GENERATOR_YIELDED && strings_equal(value, intern_string("second"));
+    delete_generator(words);
+
+    // frames and buffers do not grow with the number of values
+    Generator *count = start_generator(&context, find_function(&context, "count"), NULL, 0);
+    for (int32_t i = 0; i < 1000; ++i) passed &= generator_next(count, &value) == GENERATOR_YIELDED && value == int_value(i);
+    long live_bytes = read_live_bytes(EVALUATOR_ALLOC) + read_live_bytes(HASH_TABLE_ALLOC) + read_live_bytes(STACK_ALLOC);
+    for (int32_t i = 1000; i < 100000; ++i) passed &= generator_next(count, &value) == GENERATOR_YIELDED && value == int_value(i);
+    passed &= read_live_bytes(EVALUATOR_ALLOC) + read_live_bytes(HASH_TABLE_ALLOC) + read_live_bytes(STACK_ALLOC) == live_bytes;
+    passed &= context.side_effects.length == 0 && context.stack_frames.length == 1;
+    delete_generator(count);
+    passed &= context.stack_frames.length == 1 && context.error_code == PASS;
+
+    Generator *broken = start_generator(&context, find_function(&context, "broken"), (int32_t[]){7}, 1);
+    passed &= generator_next(broken, &value) == GENERATOR_YIELDED && value == int_value(7);
+    passed &= generator_next(broken, &value) == GENERATOR_FAILED && context.error_code == DIVISION_BY_ZERO;
+    passed &= generator_next(broken, &value) == GENERATOR_DONE;
+    delete_generator(broken);
+    passed &= start_generator(&context, find_function(&context, "broken"), NULL, 0) == NULL && context.error_code == UNEXPECTED_ARGUMENTS;
+    delete_evaluator_context(&context);
+
+    EvaluatorContext outside = init_evaluator_context(1);
+    if (interpret("yield 1;", &error_message, &outside, NULL)) free(error_message);
+    passed &= outside.error_code == YIELD_OUTSIDE_GENERATOR;
+    delete_evaluator_context(&outside);
+
+    print_test_verdict(&test_case, passed);
+}
+
+// Natives registered by the host and the integer builtins are called without
+// a frame, their call sites cache them until a script binding shadows them
+typedef struct {
+    size_t calls;
+} NativeHook;
+
+void native_clamp(Native const *native, Value const *args, EvaluatorContext *context) {
+    ((NativeHook *)native->data)->calls += 1;
+    int32_t x = value_as_int(args[0]), low = value_as_int(args[1]), high = value_as_int(args[2]);
+    context->result = int_value(x < low ? low : x > high ? high : x);
+}
+
+void native_len(Native const *native, Value const *args, EvaluatorContext *context) {
+    (void)native;
+    (void)args;
+    context->result = int_value(-1);
+}
+
+void run_natives_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 18, .test_name="natives"};
+    char const *code = (
+        "fn total(n) { suppose i = 0; suppose s = 0; while i < n { s = s + clamp(i, 10, 20); i = i + 1; } checkit s; }\n"
+        "vomit abs(-7) + abs(7);\n"
+        "vomit pow(3, 4) + pow(2, 31) + pow(0, 0);\n"
+        "vomit mod(-7, 3) * 100 + mod(7, -3);\n"
+        "vomit min(4, -2) + max(4, -2) + min([5, 3, 9]) + max([5, 3, 9]);\n"
+        "vomit total(100);\n"
+        "vomit len([1, 2]);\n"
+        "fn abs(x) { checkit 42; }\n"
+        "vomit abs(-1);\n"
+    );
+    NativeHook hook = {0};
+    Native const natives[] = {
+        {"clamp", 3, native_clamp, &hook},
+        {"len", 1, native_len, NULL},
+    };
+
+    char *error_message;
+    EvaluatorContext context = init_evaluator_context(1);
+    context.eliminate_dead_code = 0;
+    char passed = !register_natives(&context, natives, 2);
+    passed &= !interpret(code, &error_message, &context, NULL);
+    int32_t const expected[] = {14, 81 + INT32_MIN + 1, 200 - 2, 2 + 3 + 9, 10 * 10 + 165 + 20 * 79, -1, 42};
+    passed &= context.side_effects.length == sizeof(expected) / sizeof(expected[0]);
+    for (size_t i = 0; passed && i < context.side_effects.length; ++i) {
+        passed &= value_as_int(((Value *)context.side_effects.buffer)[i]) == expected[i];
+    }
+    passed &= hook.calls == 100;
+    delete_evaluator_context(&context);
+
+    char const *failing[] = {"vomit mod(1, 0);", "vomit pow(2, -1);", "vomit abs(1, 2);", "vomit min(\"a\", 1);"};
+    enum ErrorCode const codes[] = {DIVISION_BY_ZERO, UNEXPECTED_ARGUMENTS, UNEXPECTED_ARGUMENTS, UNEXPECTED_TYPE};
+    for (size_t i = 0; i < 4; ++i) {
+        context = init_evaluator_context(1);
+        char failed = interpret(failing[i], &error_message, &context, NULL);
+        passed &= failed && context.error_code == codes[i];
+        if (failed) free(error_message);
+        delete_evaluator_context(&context);
+    }
+
+    Native const too_many = {"wide", _MAX_NATIVE_ARGS + 1, native_len, NULL};
+    context = init_evaluator_context(1);
+    passed &= register_natives(&context, &too_many, 1);
+    delete_evaluator_context(&context);
+    print_test_verdict(&test_case, passed);
+}
+
+// Batches give the results of calling the function row by row, whether the
+// body runs column-at-a-time (at every SIMD level) or falls back to rows
+#define NUM_BATCH_ROWS 1500
+
+void run_batch_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 19, .test_name="batch"};
+    char const *code = (
+        "fn half(x) { checkit x / 2; }\n"
+        "fn score(a, b) {\n"
+        "    imagine b != 0 && a / b > 3 || -a >= 100 { checkit -(a < b) + half(a) * 3 - b; }\n"
+        "    imagine a - b { imagine a > 500 { checkit 1 - a; } }\n"
+        "    bummer { checkit -7; }\n"
+        "    checkit a * b - (b <= 0) + 2147483647;\n"
+        "}\n"
+        "fn ratio(a, b) { checkit a / b; }\n"
+        "fn local(a, b) { suppose c = a + b; checkit c * c; }\n"
+    );
+    char *error_message;
+    EvaluatorContext context = init_evaluator_context(1);
+    context.keep_functions = 1;
+    char passed = !interpret(code, &error_message, &context, NULL);
+
+    int32_t *a = malloc(NUM_BATCH_ROWS * sizeof(int32_t)), *b = malloc(NUM_BATCH_ROWS * sizeof(int32_t));
+    int32_t *results = malloc(NUM_BATCH_ROWS * sizeof(int32_t));
+    for (int32_t i = 0; i < NUM_BATCH_ROWS; ++i) {
+        a[i] = (i * 7919) % 1201 - 600;
+        b[i] = i % 13 - 6;
+    }
+    a[3] = INT32_MIN;
+    b[3] = -1;
+    int32_t const *columns[] = {a, b};
+
+    char const *names[] = {"score", "local"};
+    for (size_t level = SIMD_SCALAR; passed && level <= SIMD_AVX2; ++level) {
+        set_simd_level(level);
+        for (size_t f = 0; f < 2; ++f) {
+            FlatFunction const *function = find_function(&context, names[f]);
+            passed &= !call_function_batch(&context, function, columns, 2, NUM_BATCH_ROWS, results);
+            for (size_t i = 0; passed && i < NUM_BATCH_ROWS; ++i) {
+                int32_t expected;
+                passed &= !call_function(&context, function, (int32_t[]){a[i], b[i]}, 2, &expected);
+                passed &= results[i] == expected;
+            }
+        }
+    }
+    set_simd_level(detect_simd_level());
+
+    // the first division by zero fails the batch at its row
+    b[1200] = 0;
+    for (size_t i = 0; i < 1200; ++i) b[i] |= 1;
+    results[1199] = 0;
+    passed &= call_function_batch(&context, find_function(&context, "ratio"), columns, 2, NUM_BATCH_ROWS, results);
+    passed &= context.error_code == DIVISION_BY_ZERO && results[1199] == a[1199] / b[1199];
+    context.limits.max_steps = 1000;
+    passed &= call_function_batch(&context, find_function(&context, "ratio"), columns, 2, 1100, results);
+    passed &= context.error_code == STEP_LIMIT_EXCEEDED;
+    passed &= call_function_batch(&context, find_function(&context, "ratio"), columns, 1, 10, results);
+    passed &= context.error_code == UNEXPECTED_ARGUMENTS;
+
+    free(a);
+    free(b);
+    free(results);
+    print_test_verdict(&test_case, passed);
+    delete_evaluator_context(&context);
+}
+
+// Tasks on several workers: output is merged at the joins in a fixed order,
+// and errors reach the context that joins
+void run_tasks_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 20, .test_name="tasks"};
+    char const *code = (
+        "fn fib(n) { imagine n < 2 { checkit n; } checkit fib(n - 1) + fib(n - 2); }\n"
+        "fn work(k) { vomit k; suppose inner = spawn fib(k); checkit join(inner) * 1000 + fib(k); }\n"
+        "fn square(i) { vomit i; checkit i * i; }\n"
+        "suppose a = spawn work(10);\n"
+        "suppose b = spawn work(15);\n"
+        "vomit 1;\n"
+        "vomit join(b) - join(a);\n"
+        "suppose squares = pmap(square, 40);\n"
+        "vomit sum(squares) + len(squares) + join(a) - join(a);\n"
+        "suppose c = spawn work(5);\n"
+        "vomit 2;\n"
+    );
+    char *error_message;
+    EvaluatorContext context = init_evaluator_context(1);
+    context.task_threads = 4;
+    char passed = !interpret(code, &error_message, &context, NULL);
+    int32_t expected[48] = {1, 15, 10, 610610 - 55055};
+    for (int32_t i = 0; i < 40; ++i) expected[4 + i] = i;
+    expected[44] = 20540 + 40;
+    expected[45] = 2;
+    expected[46] = 5;
+    passed &= context.side_effects.length == 47;
+    for (size_t i = 0; passed && i < context.side_effects.length; ++i) {
+        passed &= value_as_int(((Value *)context.side_effects.buffer)[i]) == expected[i];
+    }
+    delete_evaluator_context(&context);
+
+    // tasks calling a program the context ran before it first spawned, whose
+    // call sites cached and whose functions tiered up in the meantime
+    context = init_evaluator_context(1);
+    context.task_threads = 4;
+    context.inline_threshold = 0;
+    context.tier_up_threshold = 2;
+    char const *earlier = (
+        "fn g(x) { checkit x + 1; }\n"
+        "fn f(n) { suppose s = 0; suppose i = 0; while i < n { s = s + g(i); i = i + 1; } checkit s; }\n"
+        "vomit f(3);\n"
+    );
+    passed &= !interpret(earlier, &error_message, &context, NULL);
+    passed &= !interpret("suppose a = spawn f(5000); suppose b = spawn f(5000); vomit join(a) + join(b);", &error_message, &context, NULL);
+    passed &= context.side_effects.length == 2;
+    passed &= passed && value_as_int(((Value *)context.side_effects.buffer)[0]) == 6;
+    passed &= passed && value_as_int(((Value *)context.side_effects.buffer)[1]) == 25005000;
+    delete_evaluator_context(&context);
+
+    // a task writes copies of the arrays it sees, names sharing one in the
+    // owner sharing its copy
+    context = init_evaluator_context(1);
+    context.task_threads = 4;
+    char const *arrays = (
+        "suppose arr = [0, 0];\n"
+        "suppose alias = arr;\n"
+        "fn fill(n) { suppose i = 0; while i < n { arr[0] = i; i = i + 1; } alias[1] = 7; checkit arr[0] + arr[1]; }\n"
+        "suppose t = spawn fill(1000);\n"
+        "suppose i = 0;\n"
+        "while i < 1000 { arr[0] = 0 - i; i = i + 1; }\n"
+        "vomit join(t);\n"
+        "vomit arr[0] + alias[1];\n"
+    );
+    passed &= !interpret(arrays, &error_message, &context, NULL);
+    passed &= context.side_effects.length == 2;
+    passed &= passed && value_as_int(((Value *)context.side_effects.buffer)[0]) == 999 + 7;
+    passed &= passed && value_as_int(((Value *)context.side_effects.buffer)[1]) == -999;
+    delete_evaluator_context(&context);
+
+    // a task copies only what its call can reach, not a large unrelated global
+    size_t evaluator_bytes[2];
+    for (size_t spawning = 0; spawning < 2; ++spawning) {
+        char source[256];
+        snprintf(
+            source, sizeof(source), 
+            "suppose big = range(100000); suppose small = [1, 2]; fn f(i) { checkit small[1] + i; } %s", 
+            spawning ? "suppose a = spawn f(1); suppose b = spawn f(2); vomit join(a) + join(b);" : "vomit f(1) + f(2);"
+        );
+        InterpreterStats stats;
+        context = init_evaluator_context(1);
+        context.task_threads = 2;
+        passed &= !interpret(source, &error_message, &context, &stats);
+        passed &= context.side_effects.length == 1 && value_as_int(*(Value *)context.side_effects.buffer) == 7;
+        evaluator_bytes[spawning] = stats.allocations[EVALUATOR_ALLOC].bytes;
+        delete_evaluator_context(&context);
+    }
+    passed &= evaluator_bytes[1] - evaluator_bytes[0] < 100000 * sizeof(int32_t);
+
+    // the first failing call of a pmap fails it, after the output of the calls before it
+    char const *failing[] = {
+        "fn bad(i) { imagine i == 30 { checkit 1 / 0; } imagine i == 7 { checkit \"x\"; } vomit i; checkit i; } vomit pmap(bad, 50);",
+        "fn f(x) { checkit 1 / x; } suppose t = spawn f(0); vomit 0; vomit join(t);",
+        "vomit join(3);",
+        "fn g(a, b) { checkit a; } vomit pmap(g, 3);",
+        "suppose t = spawn len([1]);",
+        "fn one() { checkit 1; } fn h() { checkit spawn one(); } vomit join(spawn h());",
+        "fn one() { checkit 1; } suppose t = spawn one(); fn j() { checkit join(t); } vomit join(spawn j());",
+    };
+    enum ErrorCode const codes[] = {
+        UNEXPECTED_TYPE, DIVISION_BY_ZERO, UNEXPECTED_TYPE, UNEXPECTED_ARGUMENTS, NOT_CALLABLE, UNEXPECTED_TYPE, UNEXPECTED_ARGUMENTS
+    };
+    size_t const printed[] = {7, 1, 0, 0, 0, 0, 0};
+    for (size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); ++i) {
+        context = init_evaluator_context(1);
+        context.task_threads = 4;
+        char failed = interpret(failing[i], &error_message, &context, NULL);
+        passed &= failed && context.error_code == codes[i] && context.side_effects.length == printed[i];
+        for (size_t j = 0; passed && j < printed[i]; ++j) {
+            passed &= value_as_int(((Value *)context.side_effects.buffer)[j]) == (int32_t)j;
+        }
+        if (failed) free(error_message);
+        delete_evaluator_context(&context);
+    }
+    print_test_verdict(&test_case, passed);
+}
+
+// Every test case passes with functions tiering up on their first call, and
+// the tiered forms resolve only arguments the body never rebinds
+void run_tiers_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 21, .test_name="tiers"};
+    char passed = 1;
+    for (size_t i = 0; i < NUM_TEST_CASES; ++i) {
+        char *unexpected_error;
+        passed &= test_case_passes(TEST_CASES+i, 1, &unexpected_error);
+        free(unexpected_error);
+    }
+
+    char const *code = (
+        "fn add(a, b) { checkit a + b * (2 * 3 - 4) + (1 < 2) + (-1); }\n"
+        "fn bump(x) { x = x + 1; checkit x; }\n"
+        "vomit add(1, 2) + add(3, 4) + add(5, 6);\n"
+        "vomit bump(1) + bump(2) + bump(3);\n"
+    );
+    char *log;
+    size_t log_length;
+    char *error_message;
+    EvaluatorContext context = init_evaluator_context(1);
+    context.inline_threshold = 0;
+    context.tier_up_threshold = 2;
+    context.tier_log = open_memstream(&log, &log_length);
+    InterpreterStats stats;
+    passed &= !interpret(code, &error_message, &context, &stats);
+    fclose(context.tier_log);
+    passed &= output_matches(&context, "33\n9\n");
+    passed &= stats.tier_ups == 2;
+    passed &= strcmp(log, (
+        "tier up: add after 2 calls, 2 arguments resolved, 3 expressions folded\n"
+        "tier up: bump after 2 calls, 0 arguments resolved, 0 expressions folded\n"
+    )) == 0;
+    free(log);
+    delete_evaluator_context(&context);
+    print_test_verdict(&test_case, passed);
+}
+
+// Events seen by the hooks of run_hooks_test(), phases as their initials
+typedef struct {
+    size_t entries;
+    size_t exits;
+    size_t max_depth;
+    int32_t printed;
+    enum ErrorCode error_code;
+    size_t errors;
+    char phases[32];
+} HookEvents;
+
+void count_entry(void *data, char const *name, size_t depth) {
+    HookEvents *events = data;
+    events->entries += strcmp(name, "fib") == 0;
+    if (depth > events->max_depth) events->max_depth = depth;
+}
+
+void count_exit(void *data, char const *name, size_t depth) {
+    HookEvents *events = data;
+    events->exits += strcmp(name, "fib") == 0 && depth > 0;
+}
+
+void record_print(void *data, Value value) {
+    ((HookEvents *)data)->printed += value_as_int(value);
+}
+
+void record_error(void *data, enum ErrorCode error_code, char const *message) {
+    HookEvents *events = data;
+    events->error_code = error_code;
+    events->errors += message != NULL;
+}
+
+void record_phase_start(void *data, enum InterpreterPhase phase) {
+    HookEvents *events = data;
+    size_t length = strlen(events->phases);
+    if (length + 1 < sizeof(events->phases)) events->phases[length] = InterpreterPhaseNames[phase][0];
+}
+
+void record_phase_end(void *data, enum InterpreterPhase phase) {
+    HookEvents *events = data;
+    size_t length = strlen(events->phases);
+    if (length + 1 < sizeof(events->phases)) events->phases[length] = InterpreterPhaseNames[phase][0] - 'a' + 'A';
+}
+
+// Hooks see every frame of a recursion, the output, the phases of interpret()
+// and one error per failed run. Built with -D_DISABLE_HOOKS, the same runs
+// fire none of them
+void run_hooks_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 22, .test_name="hooks"};
+    HookEvents events = {0};
+    EvaluatorHooks hooks = {
+        count_entry, count_exit, record_print, record_error, record_phase_start, record_phase_end, &events
+    };
+    char *error_message;
+    EvaluatorContext context = init_evaluator_context(1);
+    context.hooks = &hooks;
+    char passed = !interpret(
+        "fn fib(n) { imagine n < 2 { checkit n; } checkit fib(n - 1) + fib(n - 2); } vomit fib(5); vomit 3;",
+        &error_message, &context, NULL
+    );
+#ifndef _DISABLE_HOOKS
+    // fib(5) makes 15 calls, 5 deep at most
+    passed &= events.entries == 15 && events.exits == 15 && events.max_depth == 5;
+    passed &= events.printed == 8 && events.errors == 0;
+    passed &= strcmp(events.phases, "tTpPoOoOeE") == 0;
+#endif
+
+    // an error of the evaluator, one of the front end and one of a host call
+    passed &= interpret("vomit 1 / 0;", &error_message, &context, NULL);
+    free(error_message);
+#ifndef _DISABLE_HOOKS
+    passed &= events.errors == 1 && events.error_code == DIVISION_BY_ZERO;
+#endif
+    clear_evaluation_error(&context);
+    passed &= interpret("vomit (;", &error_message, &context, NULL);
+    free(error_message);
+#ifndef _DISABLE_HOOKS
+    passed &= events.errors == 2 && events.error_code == SYNTAX_ERROR;
+#endif
+    int32_t result;
+    passed &= call_function(&context, find_function(&context, "fib"), NULL, 0, &result);
+#ifndef _DISABLE_HOOKS
+    passed &= events.errors == 3 && events.error_code == UNEXPECTED_ARGUMENTS;
+#else
+    passed &= events.entries == 0 && events.exits == 0 && events.printed == 0;
+    passed &= events.errors == 0 && events.error_code == PASS && events.phases[0] == '\0';
+#endif
+    delete_evaluator_context(&context);
+    print_test_verdict(&test_case, passed);
+}
+
+// Loops of arithmetic and calls allocate nothing per iteration: a run of
+// 1000 iterations makes as many allocations as one of 10. Calls that get a
+// frame still allocate its bindings, but nothing for their arguments
+void run_allocation_free_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 23, .test_name="allocation_free"};
+    char const *code = (
+        "fn mix(a, b, c) { checkit a * b + c / 3 - (a - b) * 2; }\n"
+        "suppose i = 0;\n"
+        "suppose total = 0;\n"
+        "while i < %d { total = total + mix(i, i * 2 + 1, -i) * 3 - i / 2; i = i + 1; }\n"
+        "vomit total;\n"
+    );
+    char passed = 1;
+    for (size_t inlined = 0; inlined < 2; ++inlined) {
+        size_t calls[2][_ALLOC_SUBSYSTEMS_COUNT];
+        int const iterations[2] = {10, 1000};
+        for (size_t i = 0; i < 2; ++i) {
+            char source[512];
+            snprintf(source, sizeof(source), code, iterations[i]);
+            char *error_message;
+            EvaluatorContext context = init_evaluator_context(1);
+            context.inline_threshold = inlined ? _DEFAULT_INLINE_THRESHOLD : 0;
+            context.tier_up_threshold = 0;
+            InterpreterStats stats;
+            passed &= !interpret(source, &error_message, &context, &stats);
+            passed &= stats.function_calls == (inlined ? 0 : (size_t)iterations[i]);
+            for (size_t j = 0; j < _ALLOC_SUBSYSTEMS_COUNT; ++j) calls[i][j] = stats.allocations[j].calls;
+            delete_evaluator_context(&context);
+        }
+        if (inlined) passed &= memcmp(calls[0], calls[1], sizeof(calls[0])) == 0;
+        else passed &= calls[0][EVALUATOR_ALLOC] == calls[1][EVALUATOR_ALLOC];
+    }
+    print_test_verdict(&test_case, passed);
+}
+
+// Integer loops run on registers must agree with the tree: same results,
+// one step per iteration, the same errors, and a fall back to the tree when
+// a variable is not an integer
+void run_loop_kernel_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 24, .test_name="loop_kernel"};
+    char const *sources[] = {
+        "suppose i = 0;\nsuppose n = 7;\nwhile i < 1000 && n != 0 { n = -i + n * 3 / 2 + 2 * i; i = i + 1; }\nvomit n;\nvomit i;\n",
+        "suppose i = 0;\nwhile i < 1000 { i = i + 1; }\n",
+        "suppose i = 3;\nsuppose x = 0;\nwhile 1 { x = x + 6 / i; i = i - 1; }\n",
+        "suppose s = \"a\";\nsuppose i = 3;\nwhile i { s = s + i; i = i - 1; }\nvomit s;\n",
+    };
+    int32_t n = 7, i = 0;
+    for (; i < 1000 && n != 0; ++i) n = (int32_t)((uint32_t)n * 3u) / 2 + i;
+    char expected[64];
+    snprintf(expected, sizeof(expected), "%d\n%d\n", n, i);
+
+    char passed = 1;
+    for (size_t k = 0; k < 5; ++k) {
+        char *error_message;
+        EvaluatorContext context = init_evaluator_context(1);
+        if (k == 2) context.limits.max_steps = 500;
+        char exit_code = interpret(sources[k < 2 ? k : k - 1], &error_message, &context, NULL);
+        switch (k) {
+            case 0: passed &= !exit_code && output_matches(&context, expected); break;
+            case 1: passed &= !exit_code && context.steps == 1000; break;
+            case 2: passed &= context.error_code == STEP_LIMIT_EXCEEDED && context.steps == 501; break;
+            case 3: {
+                Value const *x = hash_table_get(stack_top(&context.stack_frames), "x");
+                passed &= context.error_code == DIVISION_BY_ZERO && x != NULL && value_as_int(*x) == 2 + 3 + 6;
+                break;
+            }
+            case 4: passed &= !exit_code && output_matches(&context, "a321\n"); break;
+        }
+        if (exit_code) free(error_message);
+        delete_evaluator_context(&context);
+    }
+    print_test_verdict(&test_case, passed);
+}
+
+// Arrays nothing refers to any more are freed while the program runs, the
+// ones still bound or printed survive the sweeps
+void run_array_sweep_test() {
+    TestCase test_case = {.test_index=NUM_TEST_CASES + 25, .test_name="array_sweep"};
+    char source[4096] = (
+        "suppose keep = range(5);\n"
+        "keep[0] = 7;\n"
+        "vomit keep;\n"
+        "suppose a = 0;\n"
+        "suppose i = 0;\n"
+        "while i < 2000 { a = range(10000); a[1] = i; i = i + 1; }\n"
+    );
+    // and as many arrays from one statement each
+    for (size_t i = 0; i < 40; ++i) strcat(source, "a = range(100000);\n");
+    strcat(source, "vomit keep[0] + a[1] + len(a);\n");
+
+    char *error_message;
+    EvaluatorContext context = init_evaluator_context(1);
+    char passed = !interpret(source, &error_message, &context, NULL);
+    passed &= output_matches(&context, "[7, 1, 2, 3, 4]\n100008\n");
+    // 2000 arrays of 40 kB and 40 of 400 kB were allocated
+    passed &= read_live_bytes(EVALUATOR_ALLOC) < 8 << 20;
+    delete_evaluator_context(&context);
+    print_test_verdict(&test_case, passed);
+}
+
+int main(int argc, char **argv) {
+    // bin/test threads: only the tests running threads, for sanitizer builds
+    // that cannot afford the deep recursion of the others
+    if (argc > 1 && strcmp(argv[1], "threads") == 0) {
+        run_module_test();
+        run_shared_program_test();
+        run_front_end_test();
+        run_tasks_test();
+        return failed_tests != 0;
+    }
 
-int main() {
-    for (char i=0; i < 4; ++i) {
+    for (char i=0; i < NUM_TEST_CASES; ++i) {
         run_test_case(TEST_CASES+i);
     }
+    run_stats_test();
+    run_limits_tests();
+    run_simd_kernels_test();
+    run_repl_test();
+    run_dead_code_test();
+    run_inline_test();
+    run_module_test();
+    run_host_call_test();
+    run_shared_program_test();
+    run_front_end_test();
+    run_flat_tree_test();
+    run_snapshot_test();
+    run_generator_test();
+    run_natives_test();
+    run_batch_test();
+    run_tasks_test();
+    run_tiers_test();
+    run_hooks_test();
+    run_allocation_free_test();
+    run_loop_kernel_test();
+    run_array_sweep_test();
+    return failed_tests != 0;
 }